@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+
+// Interface between rvemu and code translated ahead of time by rvaot.
+// This is the only header the generated C++ includes, so it stays plain
+// C-compatible data and function pointers.
+
+#define RVEMU_AOT_VERSION 1
+
+struct RvAotContext
+{
+    uint32_t *x;      // Register file; generated code never writes x[0]
+    uint64_t *cycles; // Cycle counter, charged as the interpreter would
+    uint32_t simple;  // Non-zero for SIMPLE timing, else FUNCTIONAL costs
+    uint32_t next_pc; // Set by a block on return: where execution continues
+    uint32_t stop;    // Set by a callback: end the block after this instruction
+    void *runtime;
+
+    // Memory goes through the emulator so MMIO, watchpoints, lazy pages
+    // and faults behave as in the interpreter. k is the index of the
+    // instruction in its block; funct3 is the access width and signedness.
+    uint32_t (*load)(RvAotContext *c, uint32_t k, uint32_t addr, uint32_t funct3);
+    void (*store)(RvAotContext *c, uint32_t k, uint32_t addr, uint32_t value, uint32_t funct3);
+    // Branch outcome, FUNCTIONAL timing only (keeps the predictor warm)
+    void (*branch)(RvAotContext *c, uint32_t pc, uint32_t next);
+};
+
+// One translated basic block; returns the number of instructions retired
+// (all of them unless a callback set stop) and sets next_pc
+typedef uint32_t (*RvAotBlockFn)(RvAotContext *c);
+
+struct RvAotBlock
+{
+    uint32_t pc;
+    uint32_t length; // Instructions
+    RvAotBlockFn fn;
+};
+
+// An instruction word the translation assumed
+struct RvAotWord
+{
+    uint32_t addr;
+    uint32_t instr;
+};
+
+struct RvAotImage
+{
+    uint32_t version; // RVEMU_AOT_VERSION
+    uint32_t block_count;
+    const RvAotBlock *blocks; // Sorted by pc
+    uint32_t word_count;
+    const RvAotWord *words; // Sorted by addr
+};
+
+// Exported by every translated image
+#define RVEMU_AOT_SYMBOL "rvemu_aot_image"
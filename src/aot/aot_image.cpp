@@ -0,0 +1,106 @@
+#include "aot_image.hpp"
+#include <stdexcept>
+#include "../cpu/riscv.hpp"
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#ifdef _WIN32
+
+AotImage::AotImage(const std::string &path) : path(path)
+{
+    throw std::runtime_error("Translated images are not supported on Windows");
+}
+
+AotImage::~AotImage() {}
+
+#else
+
+AotImage::AotImage(const std::string &path) : path(path)
+{
+    handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        throw std::runtime_error(std::string("Cannot load translated image: ") + dlerror());
+
+    image = (const RvAotImage *)dlsym(handle, RVEMU_AOT_SYMBOL);
+    if (!image || image->version != RVEMU_AOT_VERSION)
+    {
+        dlclose(handle);
+        throw std::runtime_error("'" + path + "' is not an rvaot image for this rvemu version");
+    }
+
+    if (image->block_count)
+    {
+        first_pc = image->blocks[0].pc;
+        uint32_t last_pc = image->blocks[image->block_count - 1].pc;
+        table.assign(((last_pc - first_pc) >> 2) + 1, nullptr);
+        for (uint32_t i = 0; i < image->block_count; i++)
+        {
+            table[(image->blocks[i].pc - first_pc) >> 2] = &image->blocks[i];
+            if (image->blocks[i].length > max_length)
+                max_length = image->blocks[i].length;
+        }
+    }
+}
+
+AotImage::~AotImage()
+{
+    dlclose(handle);
+}
+
+#endif
+
+bool AotImage::covers(uint32_t addr, uint32_t size) const
+{
+    // First word ending after addr
+    uint32_t lo = 0, hi = image->word_count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (image->words[mid].addr + 4 <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < image->word_count && image->words[lo].addr < addr + size;
+}
+
+void AotImage::blocks_covering(uint32_t addr, uint32_t size, std::unordered_set<uint32_t> &pcs) const
+{
+    // No block starts more than max_length words before a word it covers
+    uint32_t span = 4 * max_length;
+    uint32_t start = addr & ~3u;
+    uint64_t end = (uint64_t)addr + size;
+    for (uint64_t pc = start >= first_pc + span ? start - span : first_pc; pc < end; pc += 4)
+    {
+        const RvAotBlock *block = lookup((uint32_t)pc);
+        if (block && block->pc + 4 * (uint64_t)block->length > addr)
+            pcs.insert(block->pc);
+    }
+}
+
+bool AotImage::matches(RISCV &cpu, uint32_t &bad_addr) const
+{
+    for (uint32_t i = 0; i < image->word_count; i++)
+    {
+        const RvAotWord &word = image->words[i];
+        uint32_t value = 0;
+        for (uint32_t b = 0; b < 4; b++)
+        {
+            uint8_t byte;
+            if (!cpu.debug_read(word.addr + b, byte))
+            {
+                bad_addr = word.addr;
+                return false;
+            }
+            value |= (uint32_t)byte << (8 * b);
+        }
+        if (value != word.instr)
+        {
+            bad_addr = word.addr;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "aot_abi.hpp"
+
+class RISCV;
+
+// A program translated ahead of time by rvaot and compiled to a shared
+// object, loaded for RISCV::set_aot. Read-only once loaded, so several
+// cores (batch workers) can share one.
+class AotImage
+{
+public:
+    // Throws std::runtime_error if the object cannot be loaded or was
+    // built against another RVEMU_AOT_VERSION
+    explicit AotImage(const std::string &path);
+    ~AotImage();
+    AotImage(const AotImage &) = delete;
+    AotImage &operator=(const AotImage &) = delete;
+
+    // Translated block starting at pc, or nullptr
+    const RvAotBlock *lookup(uint32_t pc) const
+    {
+        uint32_t index = (pc - first_pc) >> 2;
+        if ((pc & 3) || index >= table.size())
+            return nullptr;
+        return table[index];
+    }
+
+    // True if [addr, addr + size) overlaps a translated instruction
+    bool covers(uint32_t addr, uint32_t size) const;
+
+    // Adds the pcs of the blocks that translate any of [addr, addr + size)
+    void blocks_covering(uint32_t addr, uint32_t size, std::unordered_set<uint32_t> &pcs) const;
+
+    // Checks every translated instruction against the loaded program;
+    // on a mismatch returns false with its address in bad_addr
+    bool matches(RISCV &cpu, uint32_t &bad_addr) const;
+
+    const RvAotImage &get_image() const { return *image; }
+    const std::string &get_path() const { return path; }
+
+private:
+    std::string path;
+    void *handle = nullptr;
+    const RvAotImage *image = nullptr;
+    uint32_t first_pc = 0;
+    uint32_t max_length = 0; // Of any block
+    std::vector<const RvAotBlock *> table; // Indexed by (pc - first_pc) / 4
+};
@@ -0,0 +1,498 @@
+#include "batch.hpp"
+#include "work_queue.hpp"
+#include "../environment/simple_env.hpp"
+#include "../replay/stimulus.hpp"
+#include "../cpu/lockstep.hpp"
+#include "../aot/aot_image.hpp"
+#include "../cpu/decode_cache.hpp"
+#include "../jit/trace_jit.hpp"
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+// Instructions between cycle-budget checks
+static const uint64_t BUDGET_CHECK_STEPS = 10000;
+
+const char *batch_status_name(BatchStatus status)
+{
+    switch (status)
+    {
+    case BatchStatus::PASS:
+        return "pass";
+    case BatchStatus::FAIL:
+        return "fail";
+    case BatchStatus::TIMEOUT:
+        return "timeout";
+    default:
+        return "error";
+    }
+}
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &data)
+{
+    std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+    std::streamsize size = in.tellg();
+    in.seekg(0, std::ios::beg);
+    data.resize((size_t)size);
+    return size == 0 || (bool)in.read((char *)data.data(), size);
+}
+
+std::vector<BatchJob> load_manifest(const std::string &path)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+        throw std::runtime_error("Cannot open manifest '" + path + "'");
+
+    std::vector<BatchJob> jobs;
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++)
+    {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+
+        std::istringstream fields(line);
+        std::string field;
+        if (!(fields >> field))
+            continue;
+
+        BatchJob job;
+        job.program = field;
+        size_t slash = job.program.find_last_of('/');
+        job.name = slash == std::string::npos ? job.program : job.program.substr(slash + 1);
+
+        while (fields >> field)
+        {
+            size_t eq = field.find('=');
+            std::string key = field.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : field.substr(eq + 1);
+            bool ok = !value.empty();
+            if (key == "stimulus")
+                job.stimulus = value;
+            else if (key == "expect")
+                job.expected = value;
+            else if (key == "name")
+                job.name = value;
+            else if (key == "cycles")
+            {
+                try
+                {
+                    job.max_cycles = std::stoull(value, nullptr, 0);
+                }
+                catch (const std::exception &)
+                {
+                    ok = false;
+                }
+            }
+            else
+                ok = false;
+
+            if (!ok)
+            {
+                std::ostringstream msg;
+                msg << path << ":" << number << ": bad field '" << field << "'";
+                throw std::runtime_error(msg.str());
+            }
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// RAM of a fresh machine: firmware and program over zeros, filled in page
+// by page as a job touches it
+class ProgramImage : public PageLoader
+{
+public:
+    struct Segment
+    {
+        const uint8_t *data;
+        uint32_t size;
+        uint32_t base;
+    };
+    std::vector<Segment> segments;
+
+    void load_page(RISCV &cpu, uint32_t page) override
+    {
+        uint64_t start = (uint64_t)page * RISCV::PAGE_SIZE;
+        uint64_t end = start + RISCV::PAGE_SIZE;
+        if (end > cpu.get_ram_size())
+            end = cpu.get_ram_size();
+        std::memset(cpu.get_ram() + start, 0, (size_t)(end - start));
+
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            const Segment &s = segments[i];
+            uint64_t from = s.base > start ? s.base : start;
+            uint64_t to = (uint64_t)s.base + s.size < end ? (uint64_t)s.base + s.size : end;
+            if (from < to)
+                std::memcpy(cpu.get_ram() + from, s.data + (from - s.base), (size_t)(to - from));
+        }
+    }
+};
+
+// What a worker keeps between jobs
+struct BatchMachine
+{
+    RISCV cpu;
+    Bus bus;
+    SimpleEnvironment env;
+    ProgramImage image;
+    std::vector<uint8_t> program;
+    std::vector<uint8_t> cpu_reset; // State right after construction
+    std::vector<uint8_t> bus_reset;
+    std::string aot_program; // Program last checked against config.aot
+    bool aot_match = false;
+    std::unique_ptr<TraceJit> jit; // Traces go when the job's reset state is loaded
+    std::map<std::string, std::unique_ptr<DecodeCache>> decoded; // By program path
+
+    explicit BatchMachine(const BatchConfig &config) : cpu(config.ram_size)
+    {
+        env.set_raw_terminal(false);
+        cpu.set_environment(&env);
+        cpu.set_bus(&bus);
+        cpu.get_pipeline().set_config(config.pipeline);
+        cpu.set_timing_mode(config.timing);
+        if (config.jit)
+        {
+            jit.reset(new TraceJit);
+            cpu.set_jit(jit.get());
+        }
+
+        StateWriter cw(cpu_reset);
+        cpu.save_state(cw);
+        StateWriter bw(bus_reset);
+        bus.save_state(bw);
+    }
+};
+
+// One job on a machine, between start_job and finish_job
+struct JobRun
+{
+    Stimulus stimulus;
+    std::ostringstream output;
+    uint64_t budget = 0;
+    bool out_of_budget = false;
+};
+
+// Resets the machine and loads the job; false (with result.message set)
+// if it cannot run
+static bool start_job(BatchMachine &m, const BatchJob &job, const BatchConfig &config,
+                      const std::vector<uint8_t> &firmware, JobRun &run, BatchResult &result)
+{
+    if (!read_file(job.program, m.program))
+    {
+        result.message = "Cannot open program '" + job.program + "'";
+        return false;
+    }
+    if (m.program.size() > config.ram_size - config.user_base)
+    {
+        result.message = "Program too large";
+        return false;
+    }
+
+    if (job.stimulus.empty())
+        run.stimulus.open_replay_empty();
+    else if (!run.stimulus.open_replay(job.stimulus))
+    {
+        result.message = "Cannot open recording '" + job.stimulus + "'";
+        return false;
+    }
+
+    StateReader cr(m.cpu_reset);
+    m.cpu.load_state(cr);
+    StateReader br(m.bus_reset);
+    m.bus.load_state(br);
+
+    m.image.segments.clear();
+    ProgramImage::Segment fw = {firmware.data(), (uint32_t)firmware.size(), config.firmware_base};
+    ProgramImage::Segment user = {m.program.data(), (uint32_t)m.program.size(), config.user_base};
+    m.image.segments.push_back(fw);
+    m.image.segments.push_back(user);
+    m.cpu.set_page_loader(&m.image);
+    m.cpu.set_pc(config.user_base);
+
+    // Translated code, if it was made from this program (checked once per
+    // program and machine)
+    m.cpu.set_aot(nullptr);
+    if (config.aot)
+    {
+        if (m.aot_program != job.program)
+        {
+            uint32_t bad_addr;
+            m.aot_program = job.program;
+            m.aot_match = config.aot->matches(m.cpu, bad_addr);
+        }
+        if (m.aot_match)
+            m.cpu.set_aot(config.aot);
+    }
+
+    // Pre-decoded once per program and machine, or mapped from the cache
+    // directory if an earlier run left it there
+    m.cpu.set_decode_cache(nullptr);
+    if (!config.decode_cache.empty())
+    {
+        std::unique_ptr<DecodeCache> &cache = m.decoded[job.program];
+        if (!cache)
+        {
+            cache.reset(new DecodeCache);
+            cache->open(config.decode_cache, m.program.data(), (uint32_t)m.program.size(), config.user_base);
+        }
+        m.cpu.set_decode_cache(cache.get());
+    }
+
+    m.env.set_output(run.output);
+    m.env.set_stimulus(&run.stimulus);
+    run.budget = job.max_cycles ? job.max_cycles : config.max_cycles;
+    return true;
+}
+
+// Collects the result of a job that ran; result.message holds the error
+// that ended it, if any
+static void finish_job(BatchMachine &m, const BatchJob &job, JobRun &run, BatchResult &result)
+{
+    m.env.set_stimulus(nullptr);
+
+    result.output = run.output.str();
+    result.cycles = m.cpu.get_cycles();
+    result.instructions = m.cpu.get_instret();
+    if (run.out_of_budget)
+    {
+        std::ostringstream msg;
+        msg << "Cycle budget of " << run.budget << " used up";
+        result.status = BatchStatus::TIMEOUT;
+        result.message = msg.str();
+        return;
+    }
+    if (!result.message.empty())
+        return;
+
+    if (!job.expected.empty())
+    {
+        std::vector<uint8_t> expected;
+        if (!read_file(job.expected, expected))
+        {
+            result.message = "Cannot open expected output '" + job.expected + "'";
+            return;
+        }
+        const std::string &out = result.output;
+        size_t i = 0;
+        while (i < out.size() && i < expected.size() && (uint8_t)out[i] == expected[i])
+            i++;
+        if (i != out.size() || i != expected.size())
+        {
+            std::ostringstream msg;
+            msg << "Output differs from '" << job.expected << "' at byte " << i;
+            result.status = BatchStatus::FAIL;
+            result.message = msg.str();
+            return;
+        }
+    }
+    result.status = BatchStatus::PASS;
+}
+
+static void run_job(BatchMachine &m, const BatchJob &job, const BatchConfig &config,
+                    const std::vector<uint8_t> &firmware, BatchResult &result)
+{
+    JobRun job_run;
+    if (!start_job(m, job, config, firmware, job_run, result))
+        return;
+
+    RISCV &cpu = m.cpu;
+    Stimulus::Runner run = [&](uint64_t n) -> uint64_t
+    {
+        if (cpu.get_cycles() >= job_run.budget)
+        {
+            job_run.out_of_budget = true;
+            cpu.stop();
+            return 0;
+        }
+        return cpu.run_for(n < BUDGET_CHECK_STEPS ? n : BUDGET_CHECK_STEPS);
+    };
+
+    try
+    {
+        job_run.stimulus.replay(cpu, m.bus, run);
+    }
+    catch (const std::exception &e)
+    {
+        // A replay cut short by the budget reports unapplied inputs
+        if (!job_run.out_of_budget)
+            result.message = e.what();
+    }
+    finish_job(m, job, job_run, result);
+}
+
+// The jobs of one lockstep group, one machine each. Every lane is driven
+// the way run_job drives a single machine: inputs are applied and the
+// budget checked at the same instret, so the results are the same.
+static void run_group(std::vector<std::unique_ptr<BatchMachine>> &machines, const std::vector<BatchJob> &jobs,
+                      const std::vector<size_t> &group, const BatchConfig &config,
+                      const std::vector<uint8_t> &firmware, std::vector<BatchResult> &results,
+                      uint64_t &lockstep_steps, uint64_t &total_steps)
+{
+    std::vector<JobRun> runs(group.size());
+    std::vector<size_t> lane_job; // Index into group of each lane
+    std::vector<RISCV *> cpus;
+    for (size_t k = 0; k < group.size(); k++)
+    {
+        BatchMachine &m = *machines[cpus.size()];
+        if (!start_job(m, jobs[group[k]], config, firmware, runs[k], results[group[k]]))
+            continue;
+        lane_job.push_back(k);
+        cpus.push_back(&m.cpu);
+    }
+
+    LockstepGroup lockstep(cpus);
+    std::vector<uint64_t> limits(cpus.size(), 0);
+    std::vector<bool> done(cpus.size(), false);
+    for (;;)
+    {
+        bool any = false;
+        for (size_t l = 0; l < cpus.size(); l++)
+        {
+            if (done[l])
+                continue;
+            BatchMachine &m = *machines[l];
+            JobRun &run = runs[lane_job[l]];
+            BatchResult &result = results[group[lane_job[l]]];
+            try
+            {
+                uint64_t until = UINT64_MAX;
+                if (!lockstep.get_error(l).empty())
+                    throw std::runtime_error(lockstep.get_error(l));
+                if (m.cpu.is_running())
+                    until = run.stimulus.replay_advance(m.cpu, m.bus);
+                if (m.cpu.is_running() && m.cpu.get_cycles() >= run.budget)
+                {
+                    run.out_of_budget = true;
+                    m.cpu.stop();
+                }
+                if (!m.cpu.is_running())
+                {
+                    if (!run.out_of_budget)
+                        run.stimulus.replay_finish(m.cpu);
+                    done[l] = true;
+                    finish_job(m, jobs[group[lane_job[l]]], run, result);
+                    continue;
+                }
+                uint64_t check = m.cpu.get_instret() + BUDGET_CHECK_STEPS;
+                limits[l] = until < check ? until : check;
+                any = true;
+            }
+            catch (const std::exception &e)
+            {
+                if (!run.out_of_budget)
+                    result.message = e.what();
+                m.cpu.stop();
+                done[l] = true;
+                finish_job(m, jobs[group[lane_job[l]]], run, result);
+            }
+        }
+        if (!any)
+            break;
+        lockstep.run_until(limits);
+    }
+
+    lockstep_steps += lockstep.get_vector_steps();
+    total_steps += lockstep.get_vector_steps() + lockstep.get_scalar_steps();
+}
+
+BatchRunner::BatchRunner(const BatchConfig &config) : config(config)
+{
+    if (this->config.threads == 0)
+        this->config.threads = std::thread::hardware_concurrency();
+    if (this->config.threads == 0)
+        this->config.threads = 1;
+
+    // Silently skipped if not found, like a single run does
+    if (!config.firmware_path.empty() && !read_file(config.firmware_path, firmware))
+        firmware.clear();
+}
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<BatchJob> &jobs)
+{
+    std::vector<BatchResult> results(jobs.size());
+    lockstep_steps = 0;
+    total_steps = 0;
+
+    // Lockstep groups: jobs of the same program, in manifest order
+    std::vector<std::vector<size_t>> groups;
+    if (config.lockstep)
+    {
+        std::map<std::string, size_t> open;
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            std::map<std::string, size_t>::iterator it = open.find(jobs[i].program);
+            if (it == open.end() || groups[it->second].size() == LockstepGroup::MAX_LANES)
+            {
+                open[jobs[i].program] = groups.size();
+                groups.push_back(std::vector<size_t>());
+            }
+            groups[open[jobs[i].program]].push_back(i);
+        }
+    }
+
+    size_t items = config.lockstep ? groups.size() : jobs.size();
+    size_t threads = config.threads < items ? config.threads : items;
+    WorkStealingQueue queue(threads, items);
+
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < threads; w++)
+    {
+        if (config.lockstep)
+            workers.push_back(std::thread(&BatchRunner::work_lockstep, this, w, std::cref(jobs), std::cref(groups),
+                                          std::ref(results), std::ref(queue)));
+        else
+            workers.push_back(
+                std::thread(&BatchRunner::work, this, w, std::cref(jobs), std::ref(results), std::ref(queue)));
+    }
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+    return results;
+}
+
+void BatchRunner::work(size_t worker, const std::vector<BatchJob> &jobs, std::vector<BatchResult> &results,
+                       WorkStealingQueue &queue)
+{
+    BatchMachine machine(config);
+    size_t index;
+    while (queue.take(worker, index))
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        run_job(machine, jobs[index], config, firmware, results[index]);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        results[index].seconds = elapsed.count();
+    }
+}
+
+void BatchRunner::work_lockstep(size_t worker, const std::vector<BatchJob> &jobs,
+                                const std::vector<std::vector<size_t>> &groups, std::vector<BatchResult> &results,
+                                WorkStealingQueue &queue)
+{
+    std::vector<std::unique_ptr<BatchMachine>> machines;
+    uint64_t lockstep = 0, total = 0;
+    size_t index;
+    while (queue.take(worker, index))
+    {
+        const std::vector<size_t> &group = groups[index];
+        while (machines.size() < group.size())
+            machines.push_back(std::unique_ptr<BatchMachine>(new BatchMachine(config)));
+
+        // The jobs run together, so each is charged the group's wall time
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        run_group(machines, jobs, group, config, firmware, results, lockstep, total);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        for (size_t k = 0; k < group.size(); k++)
+            results[group[k]].seconds = elapsed.count();
+    }
+    lockstep_steps += lockstep;
+    total_steps += total;
+}
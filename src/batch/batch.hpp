@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../cpu/riscv.hpp"
+
+class AotImage;
+class WorkStealingQueue;
+
+// One program run of a batch manifest
+struct BatchJob
+{
+    std::string name;       // Defaults to the program file name
+    std::string program;    // Raw binary, loaded at the user base
+    std::string stimulus;   // Recording to replay (--record); none: no input
+    std::string expected;   // File the program output must equal; none: not checked
+    uint64_t max_cycles = 0; // Cycle budget; 0 for the runner's default
+};
+
+enum class BatchStatus
+{
+    PASS,
+    FAIL,    // Output differs from the expected file
+    TIMEOUT, // Cycle budget used up
+    ERROR    // Missing file, diverged replay, emulator exception
+};
+
+struct BatchResult
+{
+    BatchStatus status = BatchStatus::ERROR;
+    std::string message;
+    std::string output; // Everything the program printed
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    double seconds = 0;
+};
+
+const char *batch_status_name(BatchStatus status);
+
+// Manifest: one job per line, the program followed by optional
+// key=value fields (stimulus, expect, cycles, name); # starts a comment.
+// Throws std::runtime_error naming the line on malformed input.
+std::vector<BatchJob> load_manifest(const std::string &path);
+
+struct BatchConfig
+{
+    unsigned threads = 0; // 0 for one per host core
+    uint32_t ram_size = 64 * 1024 * 1024;
+    std::string firmware_path; // Loaded under every program if present
+    uint32_t firmware_base = 0;
+    uint32_t user_base = 0x2000;
+    TimingMode timing = TimingMode::SIMPLE;
+    PipelineConfig pipeline;
+    uint64_t max_cycles = 1000000000; // Budget of jobs that set none
+    bool lockstep = false; // Run jobs of the same program side by side (LockstepGroup)
+    const AotImage *aot = nullptr; // Translated code for jobs whose program it matches; not owned
+    bool jit = false;              // A trace JIT per machine (TraceJit), flushed for every job
+    std::string decode_cache;      // Directory of pre-decoded programs (DecodeCache); empty: off
+};
+
+// Runs a manifest inside one process. Each worker thread builds one
+// machine (CPU, bus, RAM) and reuses it for every job it takes: the CPU
+// and bus are reset from a state saved when the machine was new, and RAM
+// pages are refilled with the program image as the job first touches them
+// (RISCV::set_page_loader), so a short program pays for the few pages it
+// uses instead of clearing the whole RAM. Jobs are spread over the
+// workers with work stealing (work_queue.hpp).
+//
+// With lockstep set, jobs of the same program are taken in groups of up
+// to LockstepGroup::MAX_LANES, and a worker runs the machines of a group
+// together so that the instructions they share are decoded once.
+class BatchRunner
+{
+public:
+    explicit BatchRunner(const BatchConfig &config);
+
+    // Results in manifest order
+    std::vector<BatchResult> run(const std::vector<BatchJob> &jobs);
+
+    unsigned get_threads() const { return config.threads; }
+
+    // Lockstep: instructions the last run retired in lockstep, and in all
+    uint64_t get_lockstep_steps() const { return lockstep_steps; }
+    uint64_t get_total_steps() const { return total_steps; }
+
+private:
+    void work(size_t worker, const std::vector<BatchJob> &jobs, std::vector<BatchResult> &results,
+              WorkStealingQueue &queue);
+    void work_lockstep(size_t worker, const std::vector<BatchJob> &jobs, const std::vector<std::vector<size_t>> &groups,
+                       std::vector<BatchResult> &results, WorkStealingQueue &queue);
+
+    BatchConfig config;
+    std::vector<uint8_t> firmware;
+    std::atomic<uint64_t> lockstep_steps{0};
+    std::atomic<uint64_t> total_steps{0};
+};
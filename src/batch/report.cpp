@@ -0,0 +1,114 @@
+#include "report.hpp"
+#include <cstdio>
+#include <string>
+
+static std::string xml_escape(const std::string &s)
+{
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '&')
+            out += "&amp;";
+        else if (c == '<')
+            out += "&lt;";
+        else if (c == '>')
+            out += "&gt;";
+        else if (c == '"')
+            out += "&quot;";
+        else if (c < 0x20 && c != '\n' && c != '\t' && c != '\r')
+            out += '?'; // Not allowed in XML 1.0
+        else
+            out += (char)c;
+    }
+    return out;
+}
+
+static std::string json_escape(const std::string &s)
+{
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += (char)c;
+        }
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '\t')
+            out += "\\t";
+        else if (c < 0x20 || c >= 0x80)
+        {
+            // Program output is bytes, not necessarily UTF-8
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else
+            out += (char)c;
+    }
+    return out;
+}
+
+static size_t count(const std::vector<BatchResult> &results, BatchStatus status)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results[i].status == status)
+            n++;
+    }
+    return n;
+}
+
+void write_junit(std::ostream &out, const std::vector<BatchJob> &jobs, const std::vector<BatchResult> &results,
+                 double seconds)
+{
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    out << "<testsuite name=\"rvemu\" tests=\"" << results.size() << "\" failures=\""
+        << count(results, BatchStatus::FAIL) + count(results, BatchStatus::TIMEOUT) << "\" errors=\""
+        << count(results, BatchStatus::ERROR) << "\" time=\"" << seconds << "\">\n";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BatchResult &r = results[i];
+        out << "  <testcase classname=\"rvemu\" name=\"" << xml_escape(jobs[i].name) << "\" time=\"" << r.seconds
+            << "\"";
+        if (r.status == BatchStatus::PASS)
+        {
+            out << "/>\n";
+            continue;
+        }
+        out << ">\n";
+        const char *element = r.status == BatchStatus::ERROR ? "error" : "failure";
+        out << "    <" << element << " type=\"" << batch_status_name(r.status) << "\" message=\""
+            << xml_escape(r.message) << "\"/>\n";
+        out << "    <system-out>" << xml_escape(r.output) << "</system-out>\n";
+        out << "  </testcase>\n";
+    }
+    out << "</testsuite>\n";
+}
+
+void write_json(std::ostream &out, const std::vector<BatchJob> &jobs, const std::vector<BatchResult> &results,
+                double seconds)
+{
+    out << "{\n  \"jobs\": " << results.size() << ",\n";
+    out << "  \"passed\": " << count(results, BatchStatus::PASS) << ",\n";
+    out << "  \"failed\": " << count(results, BatchStatus::FAIL) << ",\n";
+    out << "  \"timeouts\": " << count(results, BatchStatus::TIMEOUT) << ",\n";
+    out << "  \"errors\": " << count(results, BatchStatus::ERROR) << ",\n";
+    out << "  \"seconds\": " << seconds << ",\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BatchResult &r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << json_escape(jobs[i].name) << "\", \"program\": \""
+            << json_escape(jobs[i].program) << "\", \"status\": \"" << batch_status_name(r.status)
+            << "\", \"cycles\": " << r.cycles << ", \"instructions\": " << r.instructions
+            << ", \"seconds\": " << r.seconds << ", \"message\": \"" << json_escape(r.message)
+            << "\", \"output\": \"" << json_escape(r.output) << "\"}";
+    }
+    out << "\n  ]\n}\n";
+}
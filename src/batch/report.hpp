@@ -0,0 +1,13 @@
+#pragma once
+#include <ostream>
+#include <vector>
+#include "batch.hpp"
+
+// Batch results for CI systems. JUnit XML has one testcase per job with a
+// <failure> (wrong output, budget used up) or <error> element and the
+// program output of failed jobs; JSON has the counters and every field of
+// every result. `seconds` is the wall time of the whole batch.
+void write_junit(std::ostream &out, const std::vector<BatchJob> &jobs, const std::vector<BatchResult> &results,
+                 double seconds);
+void write_json(std::ostream &out, const std::vector<BatchJob> &jobs, const std::vector<BatchResult> &results,
+                double seconds);
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Work-stealing job distribution for a fixed set of jobs: every worker
+// owns a deque and takes from its front; a worker whose deque is empty
+// steals from the back of another's. Jobs are dealt out in contiguous
+// runs, so neighbours in the manifest tend to run on the same worker,
+// while stealing keeps every worker busy until the last job is taken.
+class WorkStealingQueue
+{
+public:
+    WorkStealingQueue(size_t workers, size_t jobs) : deques(workers)
+    {
+        for (size_t w = 0; w < workers; w++)
+        {
+            size_t begin = jobs * w / workers;
+            size_t end = jobs * (w + 1) / workers;
+            for (size_t j = begin; j < end; j++)
+                deques[w].jobs.push_back(j);
+        }
+    }
+
+    // Next job for `worker`; false once every deque is empty
+    bool take(size_t worker, size_t &job)
+    {
+        if (pop(deques[worker], true, job))
+            return true;
+        for (size_t i = 1; i < deques.size(); i++)
+        {
+            if (pop(deques[(worker + i) % deques.size()], false, job))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    struct Deque
+    {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    static bool pop(Deque &d, bool front, size_t &job)
+    {
+        std::lock_guard<std::mutex> guard(d.lock);
+        if (d.jobs.empty())
+            return false;
+        if (front)
+        {
+            job = d.jobs.front();
+            d.jobs.pop_front();
+        }
+        else
+        {
+            job = d.jobs.back();
+            d.jobs.pop_back();
+        }
+        return true;
+    }
+
+    std::vector<Deque> deques;
+};
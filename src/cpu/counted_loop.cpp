@@ -0,0 +1,379 @@
+#include "counted_loop.hpp"
+#include "decode_cache.hpp"
+#include "disasm.hpp"
+#include <cstring>
+
+// Register-immediate and register-register results, as RISCV::exec
+// computes them (the immediate is b)
+static uint32_t alu(uint8_t op, uint32_t a, uint32_t b)
+{
+    switch (op)
+    {
+    case INSN_ADDI:
+    case INSN_ADD:
+        return a + b;
+    case INSN_SUB:
+        return a - b;
+    case INSN_SLTI:
+    case INSN_SLT:
+        return (int32_t)a < (int32_t)b ? 1 : 0;
+    case INSN_SLTIU:
+    case INSN_SLTU:
+        return a < b ? 1 : 0;
+    case INSN_XORI:
+    case INSN_XOR:
+        return a ^ b;
+    case INSN_ORI:
+    case INSN_OR:
+        return a | b;
+    case INSN_ANDI:
+    case INSN_AND:
+        return a & b;
+    case INSN_SLLI:
+    case INSN_SLL:
+        return a << (b & 0x1F);
+    case INSN_SRLI:
+    case INSN_SRL:
+        return a >> (b & 0x1F);
+    case INSN_SRAI:
+    case INSN_SRA:
+        return (uint32_t)((int32_t)a >> (b & 0x1F));
+    case INSN_MUL:
+        return (uint32_t)((int64_t)(int32_t)a * (int64_t)(int32_t)b);
+    case INSN_MULH:
+        return (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+    case INSN_MULHSU:
+        return (uint32_t)(((int64_t)(int32_t)a * (int64_t)b) >> 32);
+    default: // INSN_MULHU
+        return (uint32_t)(((uint64_t)a * b) >> 32);
+    }
+}
+
+static bool branch_taken(uint8_t op, uint32_t a, uint32_t b)
+{
+    switch (op)
+    {
+    case INSN_BEQ:
+        return a == b;
+    case INSN_BNE:
+        return a != b;
+    case INSN_BLT:
+        return (int32_t)a < (int32_t)b;
+    case INSN_BGE:
+        return (int32_t)a >= (int32_t)b;
+    case INSN_BLTU:
+        return a < b;
+    default: // INSN_BGEU
+        return a >= b;
+    }
+}
+
+bool CountedLoop::analyse(const uint32_t *reg, uint32_t loop_head, uint32_t loop_tail, uint64_t steps,
+                          const ReadWord &read)
+{
+    head = loop_head;
+    tail = loop_tail;
+    trips = 0;
+
+    // Everything constant first, to find what the body writes
+    Pass scan;
+    bool none[32] = {};
+    if (!pass(scan, reg, none, std::vector<Slot>(), read) || scan.steps != steps)
+        return false;
+    std::memcpy(var_regs, scan.written, sizeof(var_regs));
+    var_slots.clear();
+    for (const Slot &s : scan.slots)
+        if (s.stored)
+            var_slots.push_back(s);
+
+    if (!pass(first, reg, var_regs, var_slots, read))
+        return false;
+
+    // A value carried into the next pass must be its own previous value
+    // plus a constant; values the body recomputes from those can be anything
+    for (int r = 1; r < 32; r++)
+        if (var_regs[r] && first.live[r] && first.sym[r].var != r)
+            return false;
+    for (size_t i = 0; i < var_slots.size(); i++)
+        if (first.slots[i].live && first.slots[i].sym.var != (int)(32 + i))
+            return false;
+    return count_trips(first);
+}
+
+// The first pass tests x against a constant, where x is a variable plus an
+// offset and the variable moves by step each pass: the test goes the other
+// way after a number of passes that follows from the bounds, as long as x
+// does not wrap around before
+bool CountedLoop::count_trips(const Pass &p)
+{
+    if (!p.has_test)
+        return false;
+    bool x_is_a;
+    if (p.test_a.var >= 0 && p.test_b.var == CONST)
+        x_is_a = true;
+    else if (p.test_b.var >= 0 && p.test_a.var == CONST)
+        x_is_a = false;
+    else
+        return false;
+    int var = x_is_a ? p.test_a.var : p.test_b.var;
+    const Value &end = var < 32 ? p.sym[var] : p.slots[var - 32].sym;
+    int64_t step = (int32_t)end.offset;
+    if (step == 0)
+        return false;
+    uint32_t x = x_is_a ? p.test_va : p.test_vb;
+    uint32_t k = x_is_a ? p.test_vb : p.test_va;
+
+    if (p.test_op == INSN_BEQ || p.test_op == INSN_BNE)
+    {
+        // Only "continue while x != k" runs more than once
+        if ((p.test_op == INSN_BNE) != p.test_taken)
+            return false;
+        uint32_t distance = step > 0 ? k - x : x - k;
+        uint32_t stride = (uint32_t)(step > 0 ? step : -step);
+        if (distance % stride)
+            return false; // Steps over k and wraps around
+        trips = distance / stride;
+        return trips > 0;
+    }
+
+    bool is_signed = p.test_op == INSN_BLT || p.test_op == INSN_BGE;
+    int64_t lo = is_signed ? INT32_MIN : 0;
+    int64_t hi = is_signed ? INT32_MAX : UINT32_MAX;
+    int64_t xv = is_signed ? (int64_t)(int32_t)x : (int64_t)x;
+    int64_t kv = is_signed ? (int64_t)(int32_t)k : (int64_t)k;
+
+    // Taken means x < limit or x >= limit; the pass continued
+    bool less = (p.test_op == INSN_BLT || p.test_op == INSN_BLTU) == x_is_a;
+    int64_t limit = x_is_a ? kv : kv + 1;
+    if (!p.test_taken)
+        less = !less;
+    int64_t n;
+    if (less)
+    {
+        if (step < 0)
+            return false;
+        n = (limit - xv + step - 1) / step;
+        if (xv + n * step > hi)
+            return false;
+    }
+    else
+    {
+        if (step > 0)
+            return false;
+        n = (xv - limit) / -step + 1;
+        if (xv + n * step < lo)
+            return false;
+    }
+    trips = (uint64_t)n;
+    return trips > 0;
+}
+
+// Passes n-1 of the carried variables in closed form, then evaluates the
+// last pass for the values recomputed from them
+bool CountedLoop::advance(uint64_t n, uint32_t *reg, std::vector<std::pair<uint32_t, uint32_t>> &stores,
+                          const ReadWord &read) const
+{
+    if (n == 0 || n > trips)
+        return false;
+    uint32_t start[32];
+    std::memcpy(start, reg, sizeof(start));
+    std::vector<Slot> slots = var_slots;
+    uint64_t before = n - 1;
+    for (int r = 1; r < 32; r++)
+        if (var_regs[r] && first.live[r])
+            start[r] += (uint32_t)(before * first.sym[r].offset);
+    for (size_t i = 0; i < slots.size(); i++)
+        if (first.slots[i].live)
+            slots[i].start += (uint32_t)(before * first.slots[i].sym.offset);
+
+    Pass last;
+    if (!pass(last, start, var_regs, slots, read) || last.steps != first.steps || last.test_taken != first.test_taken)
+        return false;
+    std::memcpy(reg, last.reg, sizeof(last.reg));
+    stores.clear();
+    for (const Slot &s : last.slots)
+        if (s.stored)
+            stores.push_back(std::make_pair(s.addr, s.value));
+    return true;
+}
+
+bool CountedLoop::pass(Pass &p, const uint32_t *reg, const bool *vars, const std::vector<Slot> &start,
+                       const ReadWord &read) const
+{
+    for (int r = 0; r < 32; r++)
+    {
+        p.reg[r] = reg[r];
+        p.sym[r] = r && vars[r] ? Value{r, 0} : Value{CONST, reg[r]};
+        p.written[r] = false;
+        p.live[r] = false;
+    }
+    p.slots = start;
+    for (size_t i = 0; i < p.slots.size(); i++)
+    {
+        Slot &s = p.slots[i];
+        s.value = s.start;
+        s.sym = Value{(int)(32 + i), 0};
+        s.stored = false;
+        s.live = false;
+    }
+    p.steps = 0;
+    p.has_test = false;
+
+    // Reads of a register or word before the body writes it make it live
+    auto get = [&p](uint32_t r, uint32_t &v) -> Value
+    {
+        if (!p.written[r])
+            p.live[r] = true;
+        v = p.reg[r];
+        return p.sym[r];
+    };
+    auto set = [&p](uint32_t r, uint32_t v, Value sym)
+    {
+        if (r == 0)
+            return;
+        p.reg[r] = v;
+        p.sym[r] = sym;
+        p.written[r] = true;
+    };
+    auto slot = [&](uint32_t addr) -> Slot *
+    {
+        if ((addr & 3) || (addr < tail + 4 && addr + 4 > head))
+            return nullptr; // The body's own code is fetched, not loaded
+        for (Slot &s : p.slots)
+            if (s.addr == addr)
+                return &s;
+        uint32_t v;
+        if (p.slots.size() >= MAX_SLOTS || !read(addr, v))
+            return nullptr;
+        p.slots.push_back(Slot{addr, v, v, Value{CONST, v}, false, false});
+        return &p.slots.back();
+    };
+
+    uint32_t pc = head;
+    for (;;)
+    {
+        uint32_t word;
+        if (pc < head || pc > tail || !read(pc, word))
+            return false;
+        p.steps++;
+        DecodedInsn d = decode_insn(word);
+        uint32_t next = pc + 4;
+        uint32_t va, vb, v;
+        Value a, b;
+        switch (d.op)
+        {
+        case INSN_LUI:
+            set(d.rd, d.imm, Value{CONST, (uint32_t)d.imm});
+            break;
+        case INSN_AUIPC:
+            set(d.rd, pc + d.imm, Value{CONST, pc + d.imm});
+            break;
+        case INSN_ADDI:
+            a = get(d.rs1, va);
+            set(d.rd, va + d.imm, a.var == UNKNOWN ? a : Value{a.var, a.offset + d.imm});
+            break;
+        case INSN_SLTI:
+        case INSN_SLTIU:
+        case INSN_XORI:
+        case INSN_ORI:
+        case INSN_ANDI:
+        case INSN_SLLI:
+        case INSN_SRLI:
+        case INSN_SRAI:
+            a = get(d.rs1, va);
+            v = alu(d.op, va, d.imm);
+            set(d.rd, v, a.var == CONST ? Value{CONST, v} : Value{UNKNOWN, 0});
+            break;
+        case INSN_ADD:
+            a = get(d.rs1, va);
+            b = get(d.rs2, vb);
+            if (a.var == CONST && b.var != UNKNOWN)
+                set(d.rd, va + vb, Value{b.var, b.offset + a.offset});
+            else if (b.var == CONST && a.var != UNKNOWN)
+                set(d.rd, va + vb, Value{a.var, a.offset + b.offset});
+            else
+                set(d.rd, va + vb, Value{UNKNOWN, 0});
+            break;
+        case INSN_SUB:
+            a = get(d.rs1, va);
+            b = get(d.rs2, vb);
+            if (b.var == CONST && a.var != UNKNOWN)
+                set(d.rd, va - vb, Value{a.var, a.offset - b.offset});
+            else if (a.var == b.var && a.var != UNKNOWN)
+                set(d.rd, va - vb, Value{CONST, a.offset - b.offset});
+            else
+                set(d.rd, va - vb, Value{UNKNOWN, 0});
+            break;
+        case INSN_SLL:
+        case INSN_SLT:
+        case INSN_SLTU:
+        case INSN_XOR:
+        case INSN_SRL:
+        case INSN_SRA:
+        case INSN_OR:
+        case INSN_AND:
+        case INSN_MUL:
+        case INSN_MULH:
+        case INSN_MULHSU:
+        case INSN_MULHU:
+            a = get(d.rs1, va);
+            b = get(d.rs2, vb);
+            v = alu(d.op, va, vb);
+            set(d.rd, v, a.var == CONST && b.var == CONST ? Value{CONST, v} : Value{UNKNOWN, 0});
+            break;
+        case INSN_LW:
+        {
+            a = get(d.rs1, va);
+            Slot *s = a.var == CONST ? slot(va + d.imm) : nullptr;
+            if (!s)
+                return false;
+            if (!s->stored && s->sym.var >= 0)
+                s->live = true;
+            set(d.rd, s->value, s->sym);
+            break;
+        }
+        case INSN_SW:
+        {
+            a = get(d.rs1, va);
+            b = get(d.rs2, vb);
+            Slot *s = a.var == CONST ? slot(va + d.imm) : nullptr;
+            if (!s)
+                return false;
+            s->value = vb;
+            s->sym = b;
+            s->stored = true;
+            break;
+        }
+        case INSN_BEQ:
+        case INSN_BNE:
+        case INSN_BLT:
+        case INSN_BGE:
+        case INSN_BLTU:
+        case INSN_BGEU:
+            if (p.has_test)
+                return false; // One test per pass
+            p.has_test = true;
+            p.test_op = d.op;
+            p.test_a = get(d.rs1, p.test_va);
+            p.test_b = get(d.rs2, p.test_vb);
+            p.test_taken = branch_taken(d.op, p.test_va, p.test_vb);
+            if (p.test_taken)
+                next = pc + d.imm;
+            break;
+        case INSN_JAL:
+            if (d.rd != 0)
+                return false; // A call
+            next = pc + d.imm;
+            break;
+        default: // Other loads and stores, JALR, system instructions
+            return false;
+        }
+
+        // Forward within the body, or from the tail back to the head
+        if (pc == tail)
+            return next == head;
+        if (next <= pc)
+            return false;
+        pc = next;
+    }
+}
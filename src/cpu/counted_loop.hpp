@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Closed form of a counted loop: a body that runs from its head to a
+// backward jump at its tail with one conditional branch (the loop test),
+// only ALU operations, word loads and stores at fixed addresses, and
+// forward jumps in between. Such delay loops
+//
+//     for (i = 0; i < 100000; i++);          // -O0: i lives on the stack
+//     1: addi t0, t0, -1; bnez t0, 1b
+//
+// change nothing but an induction variable (register or memory word) that
+// moves by a constant step each pass, plus values recomputed from it. The
+// pass evaluated at the head gives each variable as "value at the head +
+// constant", from which the number of passes left before the test fails
+// and the state after any number of them follow directly.
+class CountedLoop
+{
+public:
+    // Reads an aligned RAM word; false for anything else (MMIO, out of
+    // range), which rules the loop out
+    typedef std::function<bool(uint32_t addr, uint32_t &value)> ReadWord;
+
+    static const uint32_t MAX_SLOTS = 8; // Memory words a body may touch
+
+    // Evaluates the pass starting at head with these registers; steps is
+    // the instruction count of the passes the caller saw. False if the
+    // body does not have the shape above, its test does not count towards
+    // an exit, or this pass leaves the loop.
+    bool analyse(const uint32_t *reg, uint32_t head, uint32_t tail, uint64_t steps, const ReadWord &read);
+
+    // Passes from the head before the one that leaves (which is left to
+    // the interpreter, like the jump out)
+    uint64_t get_trips() const { return trips; }
+
+    // The state at the head after n passes, 1 <= n <= get_trips(): updates
+    // reg and returns the words the body stored, last values only
+    bool advance(uint64_t n, uint32_t *reg, std::vector<std::pair<uint32_t, uint32_t>> &stores,
+                 const ReadWord &read) const;
+
+private:
+    enum
+    {
+        CONST = -1,  // Just the offset
+        UNKNOWN = -2 // Not affine in one variable
+    };
+
+    // offset + the value variable var had at the head; variables are
+    // registers (1-31) and memory words (32 + slot index)
+    struct Value
+    {
+        int var;
+        uint32_t offset;
+    };
+
+    struct Slot
+    {
+        uint32_t addr;
+        uint32_t start; // At the head
+        uint32_t value;
+        Value sym;
+        bool stored;
+        bool live; // Read before the body stored it
+    };
+
+    // One evaluated pass. Variables not in var_regs/var_slots are taken as
+    // constants, which pass() later checks they are.
+    struct Pass
+    {
+        uint32_t reg[32];
+        Value sym[32];
+        bool written[32];
+        bool live[32];
+        std::vector<Slot> slots;
+        uint32_t steps;
+        bool has_test;
+        uint8_t test_op; // InsnClass of the branch
+        Value test_a, test_b;
+        uint32_t test_va, test_vb;
+        bool test_taken;
+    };
+
+    bool pass(Pass &p, const uint32_t *reg, const bool *var_regs, const std::vector<Slot> &start,
+              const ReadWord &read) const;
+    bool count_trips(const Pass &p);
+
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    bool var_regs[32];
+    std::vector<Slot> var_slots; // Slots with their values at the analysed head
+    Pass first;                  // The analysed pass
+    uint64_t trips = 0;
+};
@@ -0,0 +1,300 @@
+#include "decode_cache.hpp"
+#include "disasm.hpp"
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// File layout: this header, then count DecodedInsn
+struct DecodeCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t base;
+    uint32_t count;
+    uint64_t key;
+    uint64_t checksum; // Of the entries
+};
+
+static const char DECODE_CACHE_MAGIC[8] = {'R', 'V', 'D', 'C', 'A', 'C', 'H', 'E'};
+static const char DECODE_CACHE_SUFFIX[] = ".rvdc";
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t h = 1469598103934665603ull)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static int32_t sign_extend(uint32_t value, int bits)
+{
+    int shift = 32 - bits;
+    return (int32_t)(value << shift) >> shift;
+}
+
+static uint32_t word_at(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Immediates and costs as RISCV::exec() computes them
+DecodedInsn decode_insn(uint32_t word)
+{
+    DecodedInsn d;
+    std::memset(&d, 0, sizeof(d));
+    d.word = word;
+    d.rd = (word >> 7) & 0x1F;
+    d.rs1 = (word >> 15) & 0x1F;
+    d.rs2 = (word >> 20) & 0x1F;
+
+    InsnClass c = classify(word);
+    uint32_t funct7 = word >> 25;
+    switch (c)
+    {
+    case INSN_LUI:
+    case INSN_AUIPC:
+        d.imm = (int32_t)(word & 0xFFFFF000);
+        break;
+    case INSN_JAL:
+        d.imm = sign_extend(((word >> 21) & 0x3FF) << 1 | ((word >> 20) & 0x1) << 11 | ((word >> 12) & 0xFF) << 12 |
+                                ((word >> 31) & 0x1) << 20,
+                            21);
+        d.cost = 1;
+        break;
+    case INSN_JALR:
+        d.imm = sign_extend(word >> 20, 12);
+        d.cost = 1;
+        break;
+    case INSN_BEQ:
+    case INSN_BNE:
+    case INSN_BLT:
+    case INSN_BGE:
+    case INSN_BLTU:
+    case INSN_BGEU:
+        d.imm = sign_extend(((word >> 8) & 0xF) << 1 | ((word >> 25) & 0x3F) << 5 | ((word >> 7) & 0x1) << 11 |
+                                ((word >> 31) & 0x1) << 12,
+                            13);
+        break;
+    case INSN_LB:
+    case INSN_LH:
+    case INSN_LW:
+    case INSN_LBU:
+    case INSN_LHU:
+        d.imm = sign_extend(word >> 20, 12);
+        d.cost = 2;
+        break;
+    case INSN_SB:
+    case INSN_SH:
+    case INSN_SW:
+        d.imm = sign_extend(((word >> 7) & 0x1F) | ((word >> 25) << 5), 12);
+        d.cost = 2;
+        break;
+    case INSN_ADDI:
+    case INSN_SLTI:
+    case INSN_SLTIU:
+    case INSN_XORI:
+    case INSN_ORI:
+    case INSN_ANDI:
+        d.imm = sign_extend(word >> 20, 12);
+        break;
+    case INSN_SLLI:
+    case INSN_SRLI:
+    case INSN_SRAI:
+        d.imm = (word >> 20) & 0x1F;
+        break;
+    case INSN_ADD:
+    case INSN_SRL:
+        // classify() takes any other funct7 for these; exec() throws
+        if (funct7 != 0x00)
+            c = INSN_UNKNOWN;
+        break;
+    case INSN_SUB:
+    case INSN_SLL:
+    case INSN_SLT:
+    case INSN_SLTU:
+    case INSN_XOR:
+    case INSN_SRA:
+    case INSN_OR:
+    case INSN_AND:
+        break;
+    case INSN_MUL:
+    case INSN_MULH:
+    case INSN_MULHSU:
+    case INSN_MULHU:
+        d.cost = 2;
+        break;
+    case INSN_DIV:
+    case INSN_DIVU:
+    case INSN_REM:
+    case INSN_REMU:
+        d.cost = 4;
+        break;
+    case INSN_FENCE:
+        d.cost = 1;
+        break;
+    default:
+        c = INSN_UNKNOWN;
+        break;
+    }
+    d.op = (uint8_t)c;
+    return d;
+}
+
+DecodeCache::~DecodeCache()
+{
+#ifndef _WIN32
+    if (map)
+        munmap(map, map_size);
+#endif
+}
+
+void DecodeCache::open(const std::string &dir, const uint8_t *code, uint32_t size, uint32_t load_base)
+{
+    base = load_base;
+    count = size / 4;
+
+    uint32_t params[4] = {VERSION, (uint32_t)sizeof(DecodedInsn), base, size};
+    uint64_t key = fnv1a(code, size, fnv1a(params, sizeof(params)));
+    if (!dir.empty())
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)key, DECODE_CACHE_SUFFIX);
+        path = dir + "/" + name;
+        if (load(code, key))
+            return;
+    }
+
+    table.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+        table[i] = decode_insn(word_at(code + 4 * i));
+    insns = table.data();
+
+    if (!dir.empty())
+    {
+#ifndef _WIN32
+        mkdir(dir.c_str(), 0777);
+#endif
+        evict_stale(dir);
+        saved = save(key);
+    }
+}
+
+// Maps the file at path if it holds the table of this image, and removes
+// it if it does not
+bool DecodeCache::load(const uint8_t *code, uint64_t key)
+{
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    size_t expected = sizeof(DecodeCacheHeader) + (size_t)count * sizeof(DecodedInsn);
+    struct stat st;
+    void *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == expected)
+        m = mmap(nullptr, expected, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (m != MAP_FAILED)
+    {
+        const DecodeCacheHeader *h = (const DecodeCacheHeader *)m;
+        const DecodedInsn *entries = (const DecodedInsn *)((const uint8_t *)m + sizeof(DecodeCacheHeader));
+        bool valid = std::memcmp(h->magic, DECODE_CACHE_MAGIC, sizeof(h->magic)) == 0 && h->version == VERSION &&
+                     h->entry_size == sizeof(DecodedInsn) && h->base == base && h->count == count && h->key == key &&
+                     h->checksum == fnv1a(entries, (size_t)count * sizeof(DecodedInsn));
+        // The key is a hash: make sure the words are this program's
+        for (uint32_t i = 0; valid && i < count; i++)
+            valid = entries[i].word == word_at(code + 4 * i);
+        if (valid)
+        {
+            map = m;
+            map_size = expected;
+            insns = entries;
+            return true;
+        }
+        munmap(m, expected);
+    }
+    std::remove(path.c_str());
+#else
+    (void)code;
+    (void)key;
+#endif
+    return false;
+}
+
+// Written next to the final name and renamed, so concurrent runs never
+// map a partial file (batch workers in one process use different names)
+bool DecodeCache::save(uint64_t key) const
+{
+#ifndef _WIN32
+    DecodeCacheHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, DECODE_CACHE_MAGIC, sizeof(h.magic));
+    h.version = VERSION;
+    h.entry_size = sizeof(DecodedInsn);
+    h.base = base;
+    h.count = count;
+    h.key = key;
+    h.checksum = fnv1a(table.data(), table.size() * sizeof(DecodedInsn));
+
+    char suffix[48];
+    std::snprintf(suffix, sizeof(suffix), ".tmp%ld.%p", (long)getpid(), (const void *)this);
+    std::string tmp = path + suffix;
+    std::FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 &&
+              std::fwrite(table.data(), sizeof(DecodedInsn), table.size(), f) == table.size();
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+#else
+    (void)key;
+    return false;
+#endif
+}
+
+// Files of other emulator versions would never be looked up again
+void DecodeCache::evict_stale(const std::string &dir) const
+{
+#ifndef _WIN32
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+    size_t suffix = sizeof(DECODE_CACHE_SUFFIX) - 1;
+    while (struct dirent *e = readdir(d))
+    {
+        std::string name = e->d_name;
+        if (name.size() <= suffix || name.compare(name.size() - suffix, suffix, DECODE_CACHE_SUFFIX) != 0)
+            continue;
+        std::string file = dir + "/" + name;
+        DecodeCacheHeader h;
+        std::FILE *f = std::fopen(file.c_str(), "rb");
+        if (!f)
+            continue;
+        bool current = std::fread(&h, sizeof(h), 1, f) == 1 &&
+                       std::memcmp(h.magic, DECODE_CACHE_MAGIC, sizeof(h.magic)) == 0 && h.version == VERSION &&
+                       h.entry_size == sizeof(DecodedInsn);
+        std::fclose(f);
+        if (!current)
+            std::remove(file.c_str());
+    }
+    closedir(d);
+#else
+    (void)dir;
+#endif
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One instruction word, decoded. The core only uses an entry for a
+// fetched word equal to `word`, so a stale entry (self-modifying code, a
+// different program) is a miss, never a wrong result.
+struct DecodedInsn
+{
+    uint32_t word;
+    int32_t imm; // Sign-extended immediate; the shift amount for SLLI/SRLI/SRAI
+    uint8_t op;  // InsnClass (disasm.hpp); INSN_UNKNOWN leaves the word to exec()
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t cost; // SIMPLE cycles on top of fetch and base; a taken branch adds one
+    uint8_t reserved[3];
+};
+
+// Anything exec() runs differently from the plain class (system
+// instructions, encodings it rejects) gets op INSN_UNKNOWN
+DecodedInsn decode_insn(uint32_t word);
+
+// Pre-decoded form of a program image, one DecodedInsn per word from its
+// load address (--decode-cache). The table is kept in
+// <dir>/<key>.rvdc, where the key hashes the image, the load address and
+// VERSION; later runs of the same program map that file instead of
+// decoding again. A file that fails its checks (another VERSION, wrong
+// size, checksum or contents) is deleted and written again, and writing a
+// new file also deletes those of other versions. Read-only once opened,
+// so batch workers share one.
+class DecodeCache
+{
+public:
+    static const uint32_t VERSION = 3; // Bump whenever decode_insn or DecodedInsn changes
+
+    DecodeCache() = default;
+    ~DecodeCache();
+    DecodeCache(const DecodeCache &) = delete;
+    DecodeCache &operator=(const DecodeCache &) = delete;
+
+    // Maps the cached table for this image, or decodes it and tries to
+    // save it (an empty dir keeps it in memory only). Never fails: a
+    // directory that cannot be written only costs the decoding next time.
+    void open(const std::string &dir, const uint8_t *code, uint32_t size, uint32_t base);
+
+    const DecodedInsn *get_insns() const { return insns; }
+    uint32_t get_base() const { return base; }
+    uint32_t get_count() const { return count; }
+
+    // For --stats: the file, and whether it was mapped or just written
+    const std::string &get_path() const { return path; }
+    bool is_mapped() const { return map != nullptr; }
+    bool is_saved() const { return saved; }
+
+private:
+    bool load(const uint8_t *code, uint64_t key);
+    bool save(uint64_t key) const;
+    void evict_stale(const std::string &dir) const;
+
+    const DecodedInsn *insns = nullptr;
+    uint32_t base = 0;
+    uint32_t count = 0;
+    std::string path;
+    void *map = nullptr; // The mapped file, or nullptr if decoded here
+    size_t map_size = 0;
+    std::vector<DecodedInsn> table;
+    bool saved = false;
+};
@@ -0,0 +1,217 @@
+#include "disasm.hpp"
+#include <cstdio>
+
+static const char *const NAMES[INSN_CLASS_COUNT] = {
+    "lui", "auipc", "jal", "jalr",
+    "beq", "bne", "blt", "bge", "bltu", "bgeu",
+    "lb", "lh", "lw", "lbu", "lhu",
+    "sb", "sh", "sw",
+    "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai",
+    "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and",
+    "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu",
+    "fence", "fence.i", "ecall", "ebreak", "mret", "sret", "sfence.vma", "wfi",
+    "csrrw", "csrrs", "csrrc", "csrrwi", "csrrsi", "csrrci",
+    "unknown"};
+
+const char *insn_name(InsnClass c)
+{
+    return c < INSN_CLASS_COUNT ? NAMES[c] : "unknown";
+}
+
+// Mirrors the decoding in RISCV::exec()
+InsnClass classify(uint32_t instr)
+{
+    uint32_t opcode = instr & 0x7F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t funct7 = instr >> 25;
+
+    switch (opcode)
+    {
+    case 0x37:
+        return INSN_LUI;
+    case 0x17:
+        return INSN_AUIPC;
+    case 0x6F:
+        return INSN_JAL;
+    case 0x67:
+        return INSN_JALR;
+
+    case 0x63:
+    {
+        static const InsnClass branches[8] = {INSN_BEQ, INSN_BNE, INSN_UNKNOWN, INSN_UNKNOWN,
+                                              INSN_BLT, INSN_BGE, INSN_BLTU, INSN_BGEU};
+        return branches[funct3];
+    }
+
+    case 0x03:
+    {
+        static const InsnClass loads[8] = {INSN_LB, INSN_LH, INSN_LW, INSN_UNKNOWN,
+                                           INSN_LBU, INSN_LHU, INSN_UNKNOWN, INSN_UNKNOWN};
+        return loads[funct3];
+    }
+
+    case 0x23:
+    {
+        static const InsnClass stores[8] = {INSN_SB, INSN_SH, INSN_SW, INSN_UNKNOWN,
+                                            INSN_UNKNOWN, INSN_UNKNOWN, INSN_UNKNOWN, INSN_UNKNOWN};
+        return stores[funct3];
+    }
+
+    case 0x13:
+    {
+        static const InsnClass op_imm[8] = {INSN_ADDI, INSN_SLLI, INSN_SLTI, INSN_SLTIU,
+                                            INSN_XORI, INSN_SRLI, INSN_ORI, INSN_ANDI};
+        if (funct3 == 0x5 && funct7 != 0x00)
+            return INSN_SRAI;
+        return op_imm[funct3];
+    }
+
+    case 0x33:
+    {
+        if ((funct7 & 0x1) == 0x1)
+        {
+            static const InsnClass muldiv[8] = {INSN_MUL, INSN_MULH, INSN_MULHSU, INSN_MULHU,
+                                                INSN_DIV, INSN_DIVU, INSN_REM, INSN_REMU};
+            return muldiv[funct3];
+        }
+        static const InsnClass op[8] = {INSN_ADD, INSN_SLL, INSN_SLT, INSN_SLTU,
+                                        INSN_XOR, INSN_SRL, INSN_OR, INSN_AND};
+        if (funct3 == 0x0 && funct7 == 0x20)
+            return INSN_SUB;
+        if (funct3 == 0x5 && funct7 == 0x20)
+            return INSN_SRA;
+        return op[funct3];
+    }
+
+    case 0x0F:
+        return funct3 == 0x1 ? INSN_FENCE_I : INSN_FENCE;
+
+    case 0x73:
+    {
+        if (funct3 == 0)
+        {
+            switch (instr >> 20)
+            {
+            case 0x000:
+                return INSN_ECALL;
+            case 0x001:
+                return INSN_EBREAK;
+            case 0x302:
+                return INSN_MRET;
+            case 0x102:
+                return INSN_SRET;
+            case 0x105:
+                return INSN_WFI;
+            default:
+                return (instr >> 25) == 0x09 ? INSN_SFENCE_VMA : INSN_UNKNOWN;
+            }
+        }
+        static const InsnClass csr[8] = {INSN_UNKNOWN, INSN_CSRRW, INSN_CSRRS, INSN_CSRRC,
+                                         INSN_UNKNOWN, INSN_CSRRWI, INSN_CSRRSI, INSN_CSRRCI};
+        return csr[funct3];
+    }
+
+    default:
+        return INSN_UNKNOWN;
+    }
+}
+
+static const char *const REG_NAMES[32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+const char *reg_name(uint32_t index)
+{
+    return REG_NAMES[index & 0x1F];
+}
+
+static int32_t sign_extend(uint32_t value, int bits)
+{
+    int shift = 32 - bits;
+    return (int32_t)(value << shift) >> shift;
+}
+
+std::string disassemble(uint32_t instr, uint32_t pc)
+{
+    InsnClass c = classify(instr);
+    const char *name = insn_name(c);
+    const char *rd = reg_name((instr >> 7) & 0x1F);
+    const char *rs1 = reg_name((instr >> 15) & 0x1F);
+    const char *rs2 = reg_name((instr >> 20) & 0x1F);
+    int32_t imm_i = sign_extend(instr >> 20, 12);
+    char buf[64];
+
+    switch (instr & 0x7F)
+    {
+    case 0x37:
+    case 0x17:
+        snprintf(buf, sizeof(buf), "%s %s, 0x%x", name, rd, instr >> 12);
+        break;
+
+    case 0x6F:
+    {
+        uint32_t imm = ((instr >> 31) << 20) | (((instr >> 12) & 0xFF) << 12) |
+                       (((instr >> 20) & 0x1) << 11) | (((instr >> 21) & 0x3FF) << 1);
+        snprintf(buf, sizeof(buf), "%s %s, 0x%x", name, rd, pc + sign_extend(imm, 21));
+        break;
+    }
+
+    case 0x67:
+    case 0x03:
+        snprintf(buf, sizeof(buf), "%s %s, %d(%s)", name, rd, imm_i, rs1);
+        break;
+
+    case 0x63:
+    {
+        uint32_t imm = ((instr >> 31) << 12) | (((instr >> 7) & 0x1) << 11) |
+                       (((instr >> 25) & 0x3F) << 5) | (((instr >> 8) & 0xF) << 1);
+        snprintf(buf, sizeof(buf), "%s %s, %s, 0x%x", name, rs1, rs2, pc + sign_extend(imm, 13));
+        break;
+    }
+
+    case 0x23:
+    {
+        uint32_t imm = ((instr >> 7) & 0x1F) | ((instr >> 25) << 5);
+        snprintf(buf, sizeof(buf), "%s %s, %d(%s)", name, rs2, sign_extend(imm, 12), rs1);
+        break;
+    }
+
+    case 0x13:
+        if (c == INSN_SLLI || c == INSN_SRLI || c == INSN_SRAI)
+            snprintf(buf, sizeof(buf), "%s %s, %s, %u", name, rd, rs1, (instr >> 20) & 0x1F);
+        else
+            snprintf(buf, sizeof(buf), "%s %s, %s, %d", name, rd, rs1, imm_i);
+        break;
+
+    case 0x33:
+        snprintf(buf, sizeof(buf), "%s %s, %s, %s", name, rd, rs1, rs2);
+        break;
+
+    case 0x73:
+        if (c >= INSN_CSRRWI && c <= INSN_CSRRCI)
+            snprintf(buf, sizeof(buf), "%s %s, 0x%x, %u", name, rd, instr >> 20, (instr >> 15) & 0x1F);
+        else if (c >= INSN_CSRRW && c <= INSN_CSRRC)
+            snprintf(buf, sizeof(buf), "%s %s, 0x%x, %s", name, rd, instr >> 20, rs1);
+        else if (c == INSN_SFENCE_VMA)
+            snprintf(buf, sizeof(buf), "%s %s, %s", name, rs1, rs2);
+        else if (c == INSN_UNKNOWN)
+            snprintf(buf, sizeof(buf), ".word 0x%08x", instr);
+        else
+            snprintf(buf, sizeof(buf), "%s", name);
+        break;
+
+    case 0x0F:
+        snprintf(buf, sizeof(buf), "%s", name);
+        break;
+
+    default:
+        snprintf(buf, sizeof(buf), ".word 0x%08x", instr);
+        break;
+    }
+
+    if (c == INSN_UNKNOWN)
+        snprintf(buf, sizeof(buf), ".word 0x%08x", instr);
+    return buf;
+}
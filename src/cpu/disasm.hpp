@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Instruction classes at mnemonic granularity (RV32IM + Zicsr + Zifencei + system)
+enum InsnClass
+{
+    INSN_LUI,
+    INSN_AUIPC,
+    INSN_JAL,
+    INSN_JALR,
+    INSN_BEQ,
+    INSN_BNE,
+    INSN_BLT,
+    INSN_BGE,
+    INSN_BLTU,
+    INSN_BGEU,
+    INSN_LB,
+    INSN_LH,
+    INSN_LW,
+    INSN_LBU,
+    INSN_LHU,
+    INSN_SB,
+    INSN_SH,
+    INSN_SW,
+    INSN_ADDI,
+    INSN_SLTI,
+    INSN_SLTIU,
+    INSN_XORI,
+    INSN_ORI,
+    INSN_ANDI,
+    INSN_SLLI,
+    INSN_SRLI,
+    INSN_SRAI,
+    INSN_ADD,
+    INSN_SUB,
+    INSN_SLL,
+    INSN_SLT,
+    INSN_SLTU,
+    INSN_XOR,
+    INSN_SRL,
+    INSN_SRA,
+    INSN_OR,
+    INSN_AND,
+    INSN_MUL,
+    INSN_MULH,
+    INSN_MULHSU,
+    INSN_MULHU,
+    INSN_DIV,
+    INSN_DIVU,
+    INSN_REM,
+    INSN_REMU,
+    INSN_FENCE,
+    INSN_FENCE_I,
+    INSN_ECALL,
+    INSN_EBREAK,
+    INSN_MRET,
+    INSN_SRET,
+    INSN_SFENCE_VMA,
+    INSN_WFI,
+    INSN_CSRRW,
+    INSN_CSRRS,
+    INSN_CSRRC,
+    INSN_CSRRWI,
+    INSN_CSRRSI,
+    INSN_CSRRCI,
+    INSN_UNKNOWN,
+    INSN_CLASS_COUNT
+};
+
+InsnClass classify(uint32_t instr);
+const char *insn_name(InsnClass c);
+
+// Assembly text of one instruction ("addi a0, a0, 1"); branch and jump
+// targets are shown as absolute addresses computed from pc
+std::string disassemble(uint32_t instr, uint32_t pc);
+
+// ABI name of an integer register ("a0")
+const char *reg_name(uint32_t index);
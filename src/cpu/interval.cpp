@@ -0,0 +1,236 @@
+#include "interval.hpp"
+#include "../environment/simple_env.hpp"
+#include "../snapshot/checkpoint.hpp"
+#include <sstream>
+
+// Checkpoints waiting for a worker, per thread; the functional pass waits
+// beyond that so a slow detailed run cannot pile up images in memory
+static const size_t QUEUED_PER_THREAD = 2;
+
+static void add_stats(PipelineStats &to, const PipelineStats &from)
+{
+    to.instructions += from.instructions;
+    to.load_use_stalls += from.load_use_stalls;
+    to.data_stalls += from.data_stalls;
+    to.structural_stalls += from.structural_stalls;
+    to.branch_mispredicts += from.branch_mispredicts;
+    to.jumps += from.jumps;
+    to.flushes += from.flushes;
+}
+
+static PipelineStats stats_since(const PipelineStats &now, const PipelineStats &then)
+{
+    PipelineStats d;
+    d.instructions = now.instructions - then.instructions;
+    d.load_use_stalls = now.load_use_stalls - then.load_use_stalls;
+    d.data_stalls = now.data_stalls - then.data_stalls;
+    d.structural_stalls = now.structural_stalls - then.structural_stalls;
+    d.branch_mispredicts = now.branch_mispredicts - then.branch_mispredicts;
+    d.jumps = now.jumps - then.jumps;
+    d.flushes = now.flushes - then.flushes;
+    return d;
+}
+
+IntervalSimulator::IntervalSimulator(RISCV &cpu, Bus &bus, Stimulus &stimulus, const IntervalConfig &config)
+    : cpu(cpu), bus(bus), stimulus(stimulus), config(config), base_cycles(cpu.get_cycles())
+{
+    if (this->config.length <= this->config.warmup)
+        this->config.length = this->config.warmup + 1;
+    if (this->config.threads == 0)
+        this->config.threads = std::thread::hardware_concurrency();
+    if (this->config.threads == 0)
+        this->config.threads = 1;
+
+    cpu.set_timing_mode(TimingMode::FUNCTIONAL);
+
+    // The first interval starts cold, like a plain run would
+    uint64_t now = cpu.get_instret();
+    current.reset(capture(now));
+    next_boundary = now + this->config.length;
+    next_capture = next_boundary - this->config.warmup;
+
+    for (unsigned i = 0; i < this->config.threads; i++)
+        workers.push_back(std::thread(&IntervalSimulator::work, this));
+}
+
+IntervalSimulator::~IntervalSimulator()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.clear();
+        closing = true;
+    }
+    work_ready.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+IntervalSimulator::Job *IntervalSimulator::capture(uint64_t start)
+{
+    Job *job = new Job();
+    job->index = 0;
+    job->from = cpu.get_instret();
+    job->start = start;
+    job->end = start;
+    CheckpointInfo info;
+    encode_checkpoint(cpu, bus, job->image, info);
+    return job;
+}
+
+uint64_t IntervalSimulator::run_for(uint64_t max_steps)
+{
+    uint64_t done = 0;
+
+    while (cpu.is_running() && done < max_steps)
+    {
+        uint64_t now = cpu.get_instret();
+        if (now == next_capture)
+        {
+            upcoming.reset(capture(next_boundary));
+            next_capture += config.length;
+            continue;
+        }
+        if (now == next_boundary)
+        {
+            submit(now);
+            current = std::move(upcoming);
+            next_boundary += config.length;
+            continue;
+        }
+
+        uint64_t target = next_capture < next_boundary ? next_capture : next_boundary;
+        uint64_t chunk = max_steps - done;
+        if (chunk > target - now)
+            chunk = target - now;
+
+        uint64_t ran = cpu.run_for(chunk);
+        done += ran;
+        if (ran == 0)
+            break; // Debug halt
+    }
+    return done;
+}
+
+// Hands the current interval to the pool once its inputs are all known
+void IntervalSimulator::submit(uint64_t end)
+{
+    std::unique_ptr<Job> job = std::move(current);
+    if (!job || end <= job->start)
+        return;
+
+    job->end = end;
+    job->index = submitted++;
+    job->inputs.rerun_inputs(stimulus, job->from, end);
+
+    std::unique_lock<std::mutex> guard(lock);
+    queue_space.wait(guard, [this] { return queue.size() < workers.size() * QUEUED_PER_THREAD; });
+    results.resize(submitted);
+    queue.push_back(std::move(job));
+    guard.unlock();
+    work_ready.notify_one();
+}
+
+void IntervalSimulator::finish()
+{
+    if (current)
+        submit(cpu.get_instret());
+    upcoming.reset();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    work_ready.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+}
+
+// Each worker keeps one machine and reuses it for every interval it
+// takes; the image stays alive as the machine's page loader until the next
+// restore replaces it
+void IntervalSimulator::work()
+{
+    RISCV detail(cpu.get_ram_size());
+    Bus detail_bus;
+    CheckpointImage image;
+
+    // Output was shown by the functional pass; stdin data comes from it too
+    SimpleEnvironment env;
+    env.set_raw_terminal(false);
+    detail.set_environment(&env);
+    detail.set_bus(&detail_bus);
+
+    for (;;)
+    {
+        std::unique_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            work_ready.wait(guard, [this] { return closing || !queue.empty(); });
+            if (queue.empty())
+                return;
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        queue_space.notify_one();
+
+        IntervalResult result;
+        try
+        {
+            env.set_stimulus(&job->inputs);
+            result = simulate(*job, image, detail, detail_bus);
+        }
+        catch (const std::exception &e)
+        {
+            result.start = job->start;
+            result.error = e.what();
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        results[job->index] = result;
+    }
+}
+
+IntervalResult IntervalSimulator::simulate(Job &job, CheckpointImage &image, RISCV &detail, Bus &detail_bus)
+{
+    image.open_buffer(std::move(job.image));
+    image.restore(detail, detail_bus);
+    detail.set_timing_mode(config.detailed);
+
+    while (detail.is_running() && detail.get_instret() < job.start)
+        detail.run_for(job.start - detail.get_instret());
+    uint64_t start_cycles = detail.get_cycles();
+    PipelineStats start_stats = detail.get_pipeline().get_stats();
+
+    while (detail.is_running() && detail.get_instret() < job.end)
+        detail.run_for(job.end - detail.get_instret());
+    if (detail.get_instret() != job.end)
+    {
+        std::ostringstream msg;
+        msg << "stopped at instret " << detail.get_instret() << " instead of " << job.end;
+        throw std::runtime_error(msg.str());
+    }
+
+    IntervalResult result;
+    result.start = job.start;
+    result.instructions = job.end - job.start;
+    result.cycles = detail.get_cycles() - start_cycles;
+    result.pipeline = stats_since(detail.get_pipeline().get_stats(), start_stats);
+    return result;
+}
+
+IntervalResult IntervalSimulator::total() const
+{
+    IntervalResult sum;
+    sum.cycles = base_cycles;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const IntervalResult &r = results[i];
+        if (i == 0)
+            sum.start = r.start;
+        sum.instructions += r.instructions;
+        sum.cycles += r.cycles;
+        add_stats(sum.pipeline, r.pipeline);
+    }
+    return sum;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "riscv.hpp"
+#include "../replay/stimulus.hpp"
+
+class CheckpointImage;
+
+// Parallel interval simulation: the program runs once in FUNCTIONAL mode
+// and is cut into intervals of `length` instructions. A checkpoint taken
+// `warmup` instructions before each interval starts it again on a worker
+// thread with detailed timing; the warm-up refills the pipeline, then the
+// interval is measured up to the next boundary. Workers take intervals
+// from a shared queue whenever they finish one, so long and short
+// intervals even out, and start while the functional pass still runs.
+struct IntervalConfig
+{
+    uint64_t length = 10000000; // Instructions per interval
+    uint64_t warmup = 10000;    // Detailed instructions run and discarded before each interval
+    unsigned threads = 0;       // Worker threads; 0 for one per host core
+    TimingMode detailed = TimingMode::PIPELINE;
+};
+
+// Measured part of one interval
+struct IntervalResult
+{
+    uint64_t start = 0; // instret at the first measured instruction
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    PipelineStats pipeline;
+    std::string error; // Why the interval could not be simulated, if it failed
+};
+
+class IntervalSimulator
+{
+public:
+    IntervalSimulator(RISCV &cpu, Bus &bus, Stimulus &stimulus, const IntervalConfig &config = IntervalConfig());
+    ~IntervalSimulator();
+
+    // Drop-in replacement for RISCV::run_for (the functional pass)
+    uint64_t run_for(uint64_t max_steps);
+
+    // Queues the last interval and waits for all of them; call once the
+    // program has stopped
+    void finish();
+
+    // Per-interval results in program order, and their sum on top of the
+    // cycles already spent when the simulator was created
+    const std::vector<IntervalResult> &get_results() const { return results; }
+    IntervalResult total() const;
+    unsigned get_threads() const { return (unsigned)workers.size(); }
+    const IntervalConfig &get_config() const { return config; }
+
+private:
+    struct Job
+    {
+        size_t index;
+        uint64_t from;  // instret of the checkpoint
+        uint64_t start; // First measured instruction
+        uint64_t end;   // instret the interval ends at
+        std::vector<uint8_t> image;
+        Stimulus inputs; // Stdin data taken between from and end
+    };
+
+    Job *capture(uint64_t start);
+    void submit(uint64_t end);
+    void work();
+    IntervalResult simulate(Job &job, CheckpointImage &image, RISCV &detail, Bus &detail_bus);
+
+    RISCV &cpu;
+    Bus &bus;
+    Stimulus &stimulus;
+    IntervalConfig config;
+    uint64_t base_cycles;
+
+    // Functional pass
+    std::unique_ptr<Job> current;  // Interval being run functionally
+    std::unique_ptr<Job> upcoming; // Captured for the next boundary
+    uint64_t next_capture;
+    uint64_t next_boundary;
+    size_t submitted = 0;
+
+    // Worker pool; results is indexed by Job::index
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::condition_variable queue_space;
+    std::deque<std::unique_ptr<Job>> queue;
+    bool closing = false;
+    std::vector<IntervalResult> results;
+};
@@ -0,0 +1,561 @@
+#include "lockstep.hpp"
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LOCKSTEP_AVX2 1
+#endif
+
+// Longest lockstep stretch before the lanes are brought up to date
+static const uint64_t VECTOR_CHUNK = 65536;
+
+// Register-register and register-immediate operations, in the order of
+// funct3 (then the M extension's funct3)
+enum AluOp
+{
+    OP_ADD,
+    OP_SLL,
+    OP_SLT,
+    OP_SLTU,
+    OP_XOR,
+    OP_SRL,
+    OP_OR,
+    OP_AND,
+    OP_MUL,
+    OP_MULH,
+    OP_MULHSU,
+    OP_MULHU,
+    OP_DIV,
+    OP_DIVU,
+    OP_REM,
+    OP_REMU,
+    OP_SUB,
+    OP_SRA
+};
+
+static inline int32_t sign_extend(uint32_t value, int bits)
+{
+    uint32_t m = 1u << (bits - 1);
+    value &= (1u << bits) - 1;
+    return (int32_t)((value ^ m) - m);
+}
+
+// One lane, with the same results as RISCV::exec
+static inline uint32_t alu(int op, uint32_t a, uint32_t b)
+{
+    switch (op)
+    {
+    case OP_ADD:
+        return a + b;
+    case OP_SUB:
+        return a - b;
+    case OP_SLL:
+        return a << (b & 0x1F);
+    case OP_SLT:
+        return (int32_t)a < (int32_t)b ? 1 : 0;
+    case OP_SLTU:
+        return a < b ? 1 : 0;
+    case OP_XOR:
+        return a ^ b;
+    case OP_SRL:
+        return a >> (b & 0x1F);
+    case OP_SRA:
+        return (uint32_t)((int32_t)a >> (b & 0x1F));
+    case OP_OR:
+        return a | b;
+    case OP_AND:
+        return a & b;
+    case OP_MUL:
+        return (uint32_t)((int64_t)(int32_t)a * (int64_t)(int32_t)b);
+    case OP_MULH:
+        return (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+    case OP_MULHSU:
+        return (uint32_t)(((int64_t)(int32_t)a * (int64_t)b) >> 32);
+    case OP_MULHU:
+        return (uint32_t)(((uint64_t)a * b) >> 32);
+    case OP_DIV:
+        if (b == 0)
+            return UINT32_MAX;
+        if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+            return a;
+        return (uint32_t)((int32_t)a / (int32_t)b);
+    case OP_DIVU:
+        return b == 0 ? UINT32_MAX : a / b;
+    case OP_REM:
+        if (b == 0)
+            return a;
+        if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+            return 0;
+        return (uint32_t)((int32_t)a % (int32_t)b);
+    default: // OP_REMU
+        return b == 0 ? a : a % b;
+    }
+}
+
+static void alu_lanes(int op, uint32_t *d, const uint32_t *a, const uint32_t *b)
+{
+    for (size_t i = 0; i < LockstepGroup::MAX_LANES; i++)
+        d[i] = alu(op, a[i], b[i]);
+}
+
+#ifdef LOCKSTEP_AVX2
+// All eight lanes in one 256-bit register; there is no vector divide, so
+// division and MULHSU stay per lane
+__attribute__((target("avx2"))) static void alu_lanes_avx2(int op, uint32_t *d, const uint32_t *a, const uint32_t *b)
+{
+    __m256i va = _mm256_load_si256((const __m256i *)a);
+    __m256i vb = _mm256_load_si256((const __m256i *)b);
+    __m256i shift = _mm256_and_si256(vb, _mm256_set1_epi32(0x1F));
+    __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    __m256i r;
+
+    switch (op)
+    {
+    case OP_ADD:
+        r = _mm256_add_epi32(va, vb);
+        break;
+    case OP_SUB:
+        r = _mm256_sub_epi32(va, vb);
+        break;
+    case OP_SLL:
+        r = _mm256_sllv_epi32(va, shift);
+        break;
+    case OP_SLT:
+        r = _mm256_srli_epi32(_mm256_cmpgt_epi32(vb, va), 31);
+        break;
+    case OP_SLTU:
+        r = _mm256_srli_epi32(_mm256_cmpgt_epi32(_mm256_xor_si256(vb, bias), _mm256_xor_si256(va, bias)), 31);
+        break;
+    case OP_XOR:
+        r = _mm256_xor_si256(va, vb);
+        break;
+    case OP_SRL:
+        r = _mm256_srlv_epi32(va, shift);
+        break;
+    case OP_SRA:
+        r = _mm256_srav_epi32(va, shift);
+        break;
+    case OP_OR:
+        r = _mm256_or_si256(va, vb);
+        break;
+    case OP_AND:
+        r = _mm256_and_si256(va, vb);
+        break;
+    case OP_MUL:
+        r = _mm256_mullo_epi32(va, vb);
+        break;
+    case OP_MULH:
+    case OP_MULHU:
+    {
+        // 64-bit products of the even lanes, then of the odd ones; the
+        // high halves are blended back into lane order
+        __m256i odd_a = _mm256_srli_epi64(va, 32);
+        __m256i odd_b = _mm256_srli_epi64(vb, 32);
+        __m256i even, odd;
+        if (op == OP_MULH)
+        {
+            even = _mm256_mul_epi32(va, vb);
+            odd = _mm256_mul_epi32(odd_a, odd_b);
+        }
+        else
+        {
+            even = _mm256_mul_epu32(va, vb);
+            odd = _mm256_mul_epu32(odd_a, odd_b);
+        }
+        r = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+        break;
+    }
+    default:
+        alu_lanes(op, d, a, b);
+        return;
+    }
+    _mm256_store_si256((__m256i *)d, r);
+}
+#endif
+
+typedef void (*AluKernel)(int op, uint32_t *d, const uint32_t *a, const uint32_t *b);
+
+static AluKernel alu_kernel()
+{
+#ifdef LOCKSTEP_AVX2
+    static const AluKernel kernel = __builtin_cpu_supports("avx2") ? alu_lanes_avx2 : alu_lanes;
+#else
+    static const AluKernel kernel = alu_lanes;
+#endif
+    return kernel;
+}
+
+bool LockstepGroup::has_avx2()
+{
+    return alu_kernel() != alu_lanes;
+}
+
+static inline void fill(uint32_t *d, uint32_t value)
+{
+    for (size_t i = 0; i < LockstepGroup::MAX_LANES; i++)
+        d[i] = value;
+}
+
+LockstepGroup::LockstepGroup(const std::vector<RISCV *> &lanes) : lanes(lanes), errors(lanes.size())
+{
+    if (lanes.size() > MAX_LANES)
+        throw std::invalid_argument("Too many lockstep lanes");
+    std::memset(x, 0, sizeof(x));
+}
+
+void LockstepGroup::run_until(const std::vector<uint64_t> &limits)
+{
+    std::vector<size_t> active;
+    for (;;)
+    {
+        active.clear();
+        for (size_t l = 0; l < lanes.size(); l++)
+        {
+            if (lanes[l]->is_running() && lanes[l]->get_instret() < limits[l])
+                active.push_back(l);
+        }
+        if (active.empty())
+            return;
+
+        // A lane on its own runs at full speed
+        if (active.size() == 1)
+        {
+            run_lane(active[0], limits[active[0]] - lanes[active[0]]->instret);
+            continue;
+        }
+
+        uint32_t low = lanes[active[0]]->pc;
+        bool same = true;
+        uint64_t room = VECTOR_CHUNK;
+        for (size_t i = 0; i < active.size(); i++)
+        {
+            RISCV &cpu = *lanes[active[i]];
+            same = same && cpu.pc == low;
+            if (cpu.pc < low)
+                low = cpu.pc;
+            if (limits[active[i]] - cpu.instret < room)
+                room = limits[active[i]] - cpu.instret;
+        }
+
+        if (same)
+        {
+            if (vector_ready(active) && run_vector(active, room) > 0)
+                continue;
+            // Not even one instruction in lockstep: each lane takes it
+            // alone. Pipeline timing never runs in lockstep, so those
+            // lanes go on by themselves for a while.
+            for (size_t i = 0; i < active.size(); i++)
+                run_lane(active[i], lanes[active[i]]->timing_mode == TimingMode::PIPELINE ? room : 1);
+            continue;
+        }
+
+        // Diverged: the lanes furthest behind catch up with the others
+        for (size_t i = 0; i < active.size(); i++)
+        {
+            if (lanes[active[i]]->pc == low)
+                run_lane(active[i], lanes[active[i]]->timing_mode == TimingMode::PIPELINE ? room : 1);
+        }
+    }
+}
+
+void LockstepGroup::run_lane(size_t lane, uint64_t max_steps)
+{
+    try
+    {
+        scalar_steps += lanes[lane]->run_for(max_steps);
+    }
+    catch (const std::exception &e)
+    {
+        errors[lane] = e.what();
+        lanes[lane]->stop();
+    }
+}
+
+bool LockstepGroup::vector_ready(const std::vector<size_t> &active) const
+{
+    TimingMode first = lanes[active[0]]->timing_mode;
+    if (first == TimingMode::PIPELINE)
+        return false;
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        const RISCV &cpu = *lanes[active[i]];
+        if (cpu.timing_mode != first || !cpu.bare || !cpu.observers.empty() || cpu.coverage_map)
+            return false;
+        // An interrupt would be taken before the next instruction: the
+        // core looks at the lowest pending vector only (check_interrupts)
+        if ((cpu.mstatus & (1 << 3)) && cpu.bus)
+        {
+            uint32_t pending = cpu.bus->get_interrupt_status() & cpu.bus->get_interrupt_enable();
+            if (cpu.mie & pending & (0u - pending))
+                return false;
+        }
+    }
+    return true;
+}
+
+uint64_t LockstepGroup::run_vector(const std::vector<size_t> &active, uint64_t max_steps)
+{
+    count = active.size();
+    for (size_t i = 0; i < count; i++)
+        order[i] = active[i];
+    mode = lanes[order[0]]->timing_mode;
+    pc = lanes[order[0]]->pc;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const RISCV &cpu = *lanes[order[i]];
+        for (uint32_t r = 1; r < 32; r++)
+            x[r][i] = cpu.reg[r];
+        extra_cycles[i] = 0;
+    }
+    steps = 0;
+    cycles = 0;
+    diverged = false;
+
+    const RISCV &lead = *lanes[order[0]];
+    while (steps < max_steps && !diverged)
+    {
+        // Fetched once; the other lanes must hold the same instruction
+        if ((uint64_t)pc + 3 >= lead.mem.size())
+            break;
+        uint32_t instr;
+        std::memcpy(&instr, &lead.mem[pc], 4);
+        bool same = true;
+        for (size_t i = 0; i < count && same; i++)
+        {
+            const RISCV &cpu = *lanes[order[i]];
+            same = !(cpu.page_flags[pc >> RISCV::PAGE_SHIFT] & (RISCV::PAGE_BREAKPOINT | RISCV::PAGE_LAZY)) &&
+                   (uint64_t)pc + 3 < cpu.mem.size() && std::memcmp(&cpu.mem[pc], &instr, 4) == 0;
+        }
+        if (!same || !exec(instr))
+            break;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        RISCV &cpu = *lanes[order[i]];
+        for (uint32_t r = 1; r < 32; r++)
+            cpu.reg[r] = x[r][i];
+        cpu.pc = diverged ? lane_pc[i] : pc;
+        cpu.instret += steps;
+        cpu.cycles += cycles + extra_cycles[i];
+        // Nothing in lockstep touches a peripheral, so the per-instruction
+        // bus ticks can all be delivered now
+        if (cpu.bus && steps)
+            cpu.bus->tick((uint32_t)steps);
+    }
+    vector_steps += steps * count;
+    return steps;
+}
+
+// Effective addresses of a load or store for every lane; false unless all
+// of them are plain RAM the core would access without a slow path
+bool LockstepGroup::mem_ok(uint32_t size, uint8_t flags, int32_t imm, uint32_t rs1, uint32_t *addr) const
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const RISCV &cpu = *lanes[order[i]];
+        uint32_t a = x[rs1][i] + imm;
+        if ((cpu.page_flags[a >> RISCV::PAGE_SHIFT] & flags) || (a >= 0x1000 && a <= 0x1FFF) ||
+            (uint64_t)a + size > cpu.mem.size())
+            return false;
+        addr[i] = a;
+    }
+    return true;
+}
+
+// simple_cost is what SIMPLE timing charges: base, fetch, data accesses
+// and the instruction's extra cycles
+void LockstepGroup::retire(uint32_t simple_cost)
+{
+    cycles += mode == TimingMode::SIMPLE ? simple_cost : 1;
+    steps++;
+    fill(x[0], 0);
+}
+
+// Executes one instruction for every lane, or returns false without
+// changing anything if it has to run on the lanes one by one
+bool LockstepGroup::exec(uint32_t instr)
+{
+    uint32_t opcode = instr & 0x7F;
+    uint32_t rd = (instr >> 7) & 0x1F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+    uint32_t funct7 = instr >> 25;
+    alignas(32) uint32_t operand[MAX_LANES];
+
+    switch (opcode)
+    {
+    case 0x37: // LUI
+        fill(x[rd], instr & 0xFFFFF000);
+        pc += 4;
+        retire(2);
+        return true;
+
+    case 0x17: // AUIPC
+        fill(x[rd], pc + (instr & 0xFFFFF000));
+        pc += 4;
+        retire(2);
+        return true;
+
+    case 0x13: // OP-IMM
+    {
+        int op = (int)funct3;
+        if (funct3 == 0x5 && funct7 != 0)
+            op = OP_SRA;
+        fill(operand, (uint32_t)sign_extend(instr >> 20, 12));
+        alu_kernel()(op, x[rd], x[rs1], operand);
+        pc += 4;
+        retire(2);
+        return true;
+    }
+
+    case 0x33: // OP
+    {
+        int op = (int)funct3;
+        uint32_t cost = 2;
+        if (funct7 & 0x1)
+        {
+            op = OP_MUL + (int)funct3;
+            cost = funct3 >= 0x4 ? 6 : 4;
+        }
+        else if (funct3 == 0x0 || funct3 == 0x5)
+        {
+            if (funct7 == 0x20)
+                op = funct3 == 0x0 ? OP_SUB : OP_SRA;
+            else if (funct7 != 0x00)
+                return false;
+        }
+        alu_kernel()(op, x[rd], x[rs1], x[rs2]);
+        pc += 4;
+        retire(cost);
+        return true;
+    }
+
+    case 0x6F: // JAL
+    {
+        uint32_t imm = ((instr >> 21) & 0x3FF) << 1 | ((instr >> 20) & 0x1) << 11 |
+                       ((instr >> 12) & 0xFF) << 12 | ((instr >> 31) & 0x1) << 20;
+        fill(x[rd], pc + 4);
+        pc += sign_extend(imm, 21);
+        retire(3);
+        return true;
+    }
+
+    case 0x67: // JALR
+    {
+        int32_t imm = sign_extend(instr >> 20, 12);
+        for (size_t i = 0; i < count; i++)
+            lane_pc[i] = (x[rs1][i] + imm) & ~1u;
+        fill(x[rd], pc + 4);
+        break;
+    }
+
+    case 0x63: // BRANCH
+    {
+        if (funct3 == 0x2 || funct3 == 0x3)
+            return false;
+        uint32_t imm = ((instr >> 8) & 0xF) << 1 | ((instr >> 25) & 0x3F) << 5 | ((instr >> 7) & 0x1) << 11 |
+                       ((instr >> 31) & 0x1) << 12;
+        uint32_t target = pc + sign_extend(imm, 13);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t a = x[rs1][i], b = x[rs2][i];
+            bool taken;
+            switch (funct3)
+            {
+            case 0x0:
+                taken = a == b;
+                break;
+            case 0x1:
+                taken = a != b;
+                break;
+            case 0x4:
+                taken = (int32_t)a < (int32_t)b;
+                break;
+            case 0x5:
+                taken = (int32_t)a >= (int32_t)b;
+                break;
+            case 0x6:
+                taken = a < b;
+                break;
+            default:
+                taken = a >= b;
+                break;
+            }
+            lane_pc[i] = taken ? target : pc + 4;
+            if (mode == TimingMode::SIMPLE)
+                extra_cycles[i] += taken;
+            else
+                lanes[order[i]]->pipeline.warm(pc, lane_pc[i]);
+        }
+        retire(2);
+        break;
+    }
+
+    case 0x03: // LOAD
+    {
+        static const uint32_t sizes[8] = {1, 2, 4, 0, 1, 2, 0, 0};
+        uint32_t size = sizes[funct3];
+        uint32_t addr[MAX_LANES];
+        if (!size || !mem_ok(size, RISCV::PAGE_WATCH_READ | RISCV::PAGE_LAZY, sign_extend(instr >> 20, 12), rs1, addr))
+            return false;
+        for (size_t i = 0; i < count; i++)
+        {
+            RISCV &cpu = *lanes[order[i]];
+            const uint8_t *p = &cpu.mem[addr[i]];
+            uint32_t value = p[0];
+            if (size >= 2)
+                value |= p[1] << 8;
+            if (size == 4)
+                value |= (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+            if (funct3 == 0x0)
+                value = (uint32_t)sign_extend(value, 8);
+            else if (funct3 == 0x1)
+                value = (uint32_t)sign_extend(value, 16);
+            x[rd][i] = value;
+            cpu.last_mem_addr = addr[i];
+        }
+        pc += 4;
+        retire(5);
+        return true;
+    }
+
+    case 0x23: // STORE
+    {
+        uint32_t size = funct3 == 0x0 ? 1 : funct3 == 0x1 ? 2 : funct3 == 0x2 ? 4 : 0;
+        uint32_t imm = ((instr >> 7) & 0x1F) | ((instr >> 25) << 5);
+        uint32_t addr[MAX_LANES];
+        if (!size || !mem_ok(size, RISCV::PAGE_WATCH_WRITE | RISCV::PAGE_TRACK_WRITE | RISCV::PAGE_LAZY | RISCV::PAGE_CODE,
+                             sign_extend(imm, 12), rs1, addr))
+            return false;
+        for (size_t i = 0; i < count; i++)
+        {
+            RISCV &cpu = *lanes[order[i]];
+            uint32_t value = x[rs2][i];
+            for (uint32_t b = 0; b < size; b++)
+                cpu.mem[addr[i] + b] = (uint8_t)(value >> (8 * b));
+            cpu.last_mem_addr = addr[i];
+        }
+        pc += 4;
+        retire(5);
+        return true;
+    }
+
+    default: // SYSTEM, FENCE, illegal: one lane at a time
+        return false;
+    }
+
+    // JALR and branches: the lanes may part here
+    if (opcode == 0x67)
+        retire(3);
+    diverged = false;
+    for (size_t i = 1; i < count; i++)
+        diverged = diverged || lane_pc[i] != lane_pc[0];
+    pc = lane_pc[0];
+    return true;
+}
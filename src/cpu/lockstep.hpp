@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "riscv.hpp"
+
+// Lockstep execution of several instances of one program, for sweeps that
+// run the same code over many inputs.
+//
+// While every lane is at the same pc, the group fetches and decodes each
+// instruction once and executes it for all lanes at once from a
+// structure-of-arrays register file (x[reg][lane]): ALU and M-extension
+// operations use AVX2 when the host has it (checked at run time), and
+// loads, stores and branches loop over the lanes. Only the common subset
+// runs this way: plain RAM accesses in M mode without translation, SIMPLE
+// or FUNCTIONAL timing, no pending interrupt, observers or coverage.
+// Anything else (MMIO, system instructions, flagged pages) is one ordinary
+// RISCV::step per lane.
+// Lanes whose pcs diverge after a branch also step on their own, the ones
+// furthest behind first, until the pcs agree again.
+//
+// Every lane ends up in exactly the state a run on its own would have
+// reached, cycles and instret included.
+class LockstepGroup
+{
+public:
+    static const size_t MAX_LANES = 8;
+
+    // Each lane is a complete machine (own bus, environment and RAM) that
+    // runs the same code; at most MAX_LANES
+    explicit LockstepGroup(const std::vector<RISCV *> &lanes);
+
+    // Runs every lane until it stops or its instret reaches limits[lane].
+    // An emulator exception stops only the lane that raised it; the
+    // message is kept in get_error.
+    void run_until(const std::vector<uint64_t> &limits);
+
+    size_t size() const { return lanes.size(); }
+    const std::string &get_error(size_t lane) const { return errors[lane]; }
+
+    // Instructions retired in lockstep and one lane at a time, all lanes
+    // counted
+    uint64_t get_vector_steps() const { return vector_steps; }
+    uint64_t get_scalar_steps() const { return scalar_steps; }
+
+    static bool has_avx2();
+
+private:
+    uint64_t run_vector(const std::vector<size_t> &active, uint64_t max_steps);
+    bool vector_ready(const std::vector<size_t> &active) const;
+    bool exec(uint32_t instr);
+    bool mem_ok(uint32_t size, uint8_t flags, int32_t imm, uint32_t rs1, uint32_t *addr) const;
+    void retire(uint32_t simple_cost);
+    void run_lane(size_t lane, uint64_t max_steps);
+
+    std::vector<RISCV *> lanes;
+    std::vector<std::string> errors;
+
+    // Lockstep state, copied back to the lanes when lockstep ends
+    alignas(32) uint32_t x[32][MAX_LANES];
+    uint32_t lane_pc[MAX_LANES];
+    uint64_t extra_cycles[MAX_LANES]; // Taken-branch penalties (SIMPLE)
+    uint32_t pc = 0;
+    uint64_t steps = 0;        // Instructions since lockstep started
+    uint64_t cycles = 0;       // Cycles common to all lanes in that time
+    size_t count = 0;          // Lanes taking part
+    size_t order[MAX_LANES];   // Their indexes
+    bool diverged = false;     // Last instruction left the lanes at different pcs
+    TimingMode mode = TimingMode::FUNCTIONAL;
+
+    uint64_t vector_steps = 0;
+    uint64_t scalar_steps = 0;
+};
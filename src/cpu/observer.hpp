@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include "watch.hpp"
+
+class RISCV;
+
+// Instrumentation hook attached with RISCV::add_observer(). Observers see
+// every retired instruction after it has executed, so they can read the
+// resulting architectural state but never change the functional result.
+class ExecObserver
+{
+public:
+    virtual ~ExecObserver() = default;
+
+    // pc/instr of the retired instruction, cost = cycles it added
+    virtual void on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost) = 0;
+
+    // Trap or interrupt taken; the CPU pc already points at the handler
+    virtual void on_trap(RISCV &cpu, uint32_t cause, bool is_interrupt)
+    {
+        (void)cpu;
+        (void)cause;
+        (void)is_interrupt;
+    }
+};
+
+// Watchpoint hook attached with RISCV::add_watch_observer(). It sees no
+// instructions, so unlike an ExecObserver it keeps fusion, AOT code and
+// the JIT on.
+class WatchObserver
+{
+public:
+    virtual ~WatchObserver() = default;
+
+    // A load/store touched a watchpoint; called after the access completed
+    virtual void on_watch(RISCV &cpu, const WatchHit &hit) = 0;
+};
+
+// Copy-on-write hook for snapshots (RISCV::track_page_writes). Called
+// once before the first store to a tracked RAM page, while the page still
+// holds its old contents.
+class PageWriteObserver
+{
+public:
+    virtual ~PageWriteObserver() = default;
+
+    virtual void before_page_write(RISCV &cpu, uint32_t page) = 0;
+};
+
+// Supplies RAM contents on demand (RISCV::set_page_loader), e.g. from a
+// checkpoint file. Called once per page, before its first access.
+class PageLoader
+{
+public:
+    virtual ~PageLoader() = default;
+
+    // Fill cpu.get_ram() + page * RISCV::PAGE_SIZE
+    virtual void load_page(RISCV &cpu, uint32_t page) = 0;
+};
@@ -0,0 +1,190 @@
+#include "pipeline.hpp"
+#include <cstring>
+
+PipelineModel::PipelineModel(const PipelineConfig &config) : config(config)
+{
+    std::memset(bht, 1, sizeof(bht)); // Weakly not-taken
+    reset();
+}
+
+void PipelineModel::reset()
+{
+    primed = false;
+    last_ex = 0;
+    fetch_ready = 0;
+    ex_free = 0;
+    expected_pc = 0;
+    std::memset(ready, 0, sizeof(ready));
+    std::memset(from_load, 0, sizeof(from_load));
+}
+
+void PipelineModel::train(uint32_t pc, bool taken)
+{
+    uint8_t &counter = bht[(pc >> 2) & (BHT_ENTRIES - 1)];
+    if (taken && counter < 3)
+        counter++;
+    else if (!taken && counter > 0)
+        counter--;
+}
+
+uint32_t PipelineModel::retire(uint32_t instr, uint32_t fetch_pc, uint32_t next_pc)
+{
+    uint32_t opcode = instr & 0x7F;
+    uint32_t rd = (instr >> 7) & 0x1F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+
+    // Register usage per format
+    bool uses_rs1 = false;
+    bool uses_rs2 = false;
+    bool writes_rd = false;
+
+    switch (opcode)
+    {
+    case 0x37: // LUI
+    case 0x17: // AUIPC
+    case 0x6F: // JAL
+        writes_rd = true;
+        break;
+    case 0x67: // JALR
+    case 0x03: // LOAD
+    case 0x13: // OP-IMM
+        uses_rs1 = writes_rd = true;
+        break;
+    case 0x63: // BRANCH
+    case 0x23: // STORE
+        uses_rs1 = uses_rs2 = true;
+        break;
+    case 0x33: // OP
+        uses_rs1 = uses_rs2 = writes_rd = true;
+        break;
+    case 0x73: // SYSTEM (CSR forms; the immediate forms do not read rs1)
+        if (funct3 != 0)
+        {
+            writes_rd = true;
+            uses_rs1 = funct3 < 4;
+        }
+        break;
+    }
+
+    bool is_load = opcode == 0x03;
+    bool is_mem = is_load || opcode == 0x23;
+    bool is_muldiv = opcode == 0x33 && (instr >> 25) == 0x01;
+
+    // Cycle this instruction could enter EX without data hazards
+    uint64_t issue;
+    if (!primed)
+    {
+        issue = last_ex + FILL_CYCLES;
+        primed = true;
+    }
+    else
+    {
+        issue = last_ex + 1;
+
+        // Fetched from somewhere the previous instruction did not lead to:
+        // an interrupt was taken in between
+        if (fetch_pc != expected_pc)
+        {
+            stats.flushes++;
+            issue = last_ex + 1 + config.trap_penalty;
+        }
+        if (fetch_ready > issue)
+            issue = fetch_ready;
+    }
+
+    // RAW hazards on source operands
+    uint64_t operands = issue;
+    bool waits_on_load = false;
+    if (uses_rs1 && rs1 != 0 && ready[rs1] > operands)
+    {
+        operands = ready[rs1];
+        waits_on_load = from_load[rs1];
+    }
+    if (uses_rs2 && rs2 != 0 && ready[rs2] > operands)
+    {
+        operands = ready[rs2];
+        waits_on_load = from_load[rs2];
+    }
+    if (operands > issue)
+    {
+        if (waits_on_load)
+            stats.load_use_stalls += operands - issue;
+        else
+            stats.data_stalls += operands - issue;
+        issue = operands;
+    }
+
+    // Structural hazard: EX still busy with a MUL/DIV or MEM with a slow access
+    if (ex_free > issue)
+    {
+        stats.structural_stalls += ex_free - issue;
+        issue = ex_free;
+    }
+
+    uint32_t ex_cycles = 1;
+    if (is_muldiv)
+        ex_cycles = funct3 >= 4 ? config.div_latency : config.mul_latency;
+    uint32_t mem_cycles = is_mem ? config.mem_latency : 1;
+
+    ex_free = issue + ex_cycles;
+    if (is_mem && issue + mem_cycles > ex_free)
+        ex_free = issue + mem_cycles;
+
+    if (writes_rd && rd != 0)
+    {
+        if (config.forwarding)
+            ready[rd] = issue + ex_cycles + (is_load ? mem_cycles : 0);
+        else
+            ready[rd] = issue + ex_cycles + mem_cycles + 1; // Read in ID after WB
+        from_load[rd] = is_load;
+    }
+
+    // Control hazards
+    bool redirected = next_pc != fetch_pc + 4;
+    switch (opcode)
+    {
+    case 0x63: // BRANCH
+    {
+        bool predicted = config.branch_predictor && predict(fetch_pc);
+        if (config.branch_predictor)
+            train(fetch_pc, redirected);
+        if (predicted != redirected)
+        {
+            stats.branch_mispredicts++;
+            fetch_ready = issue + 1 + config.branch_penalty;
+        }
+        break;
+    }
+    case 0x6F: // JAL
+        stats.jumps++;
+        fetch_ready = issue + 1 + config.jump_penalty;
+        break;
+    case 0x67: // JALR
+        stats.jumps++;
+        fetch_ready = issue + 1 + config.branch_penalty;
+        break;
+    case 0x0F: // FENCE.I: the instructions fetched behind it are fetched again
+        if (funct3 == 0x1)
+        {
+            stats.flushes++;
+            fetch_ready = issue + 1 + config.branch_penalty;
+        }
+        break;
+    default: // Trap, MRET, WFI
+        if (redirected)
+        {
+            stats.flushes++;
+            fetch_ready = issue + 1 + config.trap_penalty;
+        }
+        break;
+    }
+
+    expected_pc = next_pc;
+    stats.instructions++;
+
+    uint32_t delta = (uint32_t)(issue - last_ex);
+    last_ex = issue;
+    return delta;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+
+// Timing parameters of the modelled in-order core
+struct PipelineConfig
+{
+    bool forwarding = true;       // EX/MEM and MEM/WB bypass paths
+    bool branch_predictor = true; // 2-bit bimodal predictor (else predict not-taken)
+    uint32_t mul_latency = 3;     // Cycles MUL* occupies EX
+    uint32_t div_latency = 34;    // Cycles DIV*/REM* occupies EX (iterative divider)
+    uint32_t mem_latency = 1;     // Cycles a load/store spends in MEM
+    uint32_t jump_penalty = 1;    // JAL resolved in ID
+    uint32_t branch_penalty = 2;  // Mispredicted branch / JALR resolved in EX
+    uint32_t trap_penalty = 3;    // Flush on trap, interrupt, MRET
+};
+
+// Hazard counters collected while the model is active
+struct PipelineStats
+{
+    uint64_t instructions = 0;
+    uint64_t load_use_stalls = 0; // Cycles lost waiting for a load result
+    uint64_t data_stalls = 0;     // Cycles lost waiting for other results (no forwarding, MUL/DIV results)
+    uint64_t structural_stalls = 0; // Cycles lost because EX (MUL/DIV) or MEM was occupied
+    uint64_t branch_mispredicts = 0;
+    uint64_t jumps = 0;
+    uint64_t flushes = 0;         // Traps, interrupts, MRET
+};
+
+// Classic IF/ID/EX/MEM/WB in-order pipeline timing model.
+//
+// The model never touches architectural state: the functional core executes
+// the instruction first and then reports it here with the PC it was fetched
+// from and the PC execution continues at. The model tracks when each
+// register value becomes available and when EX is free again, and returns
+// how many cycles later than its predecessor the instruction enters EX.
+class PipelineModel
+{
+public:
+    explicit PipelineModel(const PipelineConfig &config = PipelineConfig());
+
+    // Drop all in-flight state (next retire pays the pipeline fill).
+    // The branch predictor and the statistics are kept.
+    void reset();
+
+    // Account one executed instruction; returns the cycles it adds
+    uint32_t retire(uint32_t instr, uint32_t fetch_pc, uint32_t next_pc);
+
+    // Train the branch predictor with a branch executed outside the model
+    // (functional fast-forward), so detailed windows start warm
+    void warm(uint32_t fetch_pc, uint32_t next_pc)
+    {
+        if (config.branch_predictor)
+            train(fetch_pc, next_pc != fetch_pc + 4);
+    }
+
+    const PipelineConfig &get_config() const { return config; }
+    void set_config(const PipelineConfig &c) { config = c; }
+    const PipelineStats &get_stats() const { return stats; }
+
+private:
+    static constexpr uint32_t FILL_CYCLES = 5;   // First instruction after a reset goes through all stages
+    static constexpr uint32_t BHT_ENTRIES = 512; // Branch history table size (power of two)
+
+    bool predict(uint32_t pc) const { return bht[(pc >> 2) & (BHT_ENTRIES - 1)] >= 2; }
+    void train(uint32_t pc, bool taken);
+
+    PipelineConfig config;
+    PipelineStats stats;
+
+    bool primed = false;
+    uint64_t last_ex = 0;      // Cycle the previous instruction entered EX
+    uint64_t fetch_ready = 0;  // Earliest EX cycle after a redirect
+    uint64_t ex_free = 0;      // Cycle EX is free again (MUL/DIV occupancy)
+    uint32_t expected_pc = 0;  // Where the previous instruction continued
+    uint64_t ready[32]{};      // Cycle each register can be consumed in EX
+    bool from_load[32]{};      // Whether the pending value of a register comes from a load
+    uint8_t bht[BHT_ENTRIES];
+};
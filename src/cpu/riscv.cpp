@@ -1,4 +1,9 @@
 #include "riscv.hpp"
+#include "../aot/aot_image.hpp"
+#include "decode_cache.hpp"
+#include "disasm.hpp"
+#include "../jit/trace_jit.hpp"
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
 #include <bitset>
@@ -20,15 +25,23 @@ static inline uint32_t zext(uint32_t value, int bits)
     return value & ((1u << bits) - 1);
 }
 
-RISCV::RISCV() : mem(RAM_SIZE), cycles(0) { reset(); }
-RISCV::RISCV(uint32_t ram_size) : mem(ram_size), cycles(0) { reset(); }
+RISCV::RISCV() : mem(RAM_SIZE), cycles(0), page_flags(1u << (32 - PAGE_SHIFT)) { reset(); }
+RISCV::RISCV(uint32_t ram_size) : mem(ram_size), cycles(0), page_flags(1u << (32 - PAGE_SHIFT)) { reset(); }
 
 void RISCV::reset()
 {
     pc = 0x00000000;
     running = true;
     cycles = 0;
+    instret = 0;
+    pipeline.reset();
     std::memset(reg, 0, sizeof(reg));
+    priv = PRIV_M;
+    satp = 0;
+    std::memset(pmpcfg, 0, sizeof(pmpcfg)); // Unlocks every entry
+    pmp_locked = false;
+    std::fill(pmp_pages.begin(), pmp_pages.end(), 0);
+    flush_tlb();
 
     // CSR defaults (important!)
     write_csr(0x300, 0x00000000); // mstatus
@@ -42,100 +55,1548 @@ void RISCV::run()
 
 void RISCV::step()
 {
+    switch (timing_mode)
+    {
+    case TimingMode::FUNCTIONAL:
+        step_impl<TimingMode::FUNCTIONAL>();
+        break;
+    case TimingMode::PIPELINE:
+        step_impl<TimingMode::PIPELINE>();
+        break;
+    default:
+        step_impl<TimingMode::SIMPLE>();
+        break;
+    }
+}
+
+uint64_t RISCV::run_for(uint64_t max_steps)
+{
+    uint64_t done = 0;
+    idle_watching = false; // The host may have changed pins or memory
+
+    // The timing mode is dispatched once per batch, not per instruction;
+    // a mode switch from inside the guest ends the inner loop
+    while (running && done < max_steps)
+    {
+        // Translated code stands in for the interpreter whenever nothing
+        // needs to see individual instructions
+        if ((aot || jit) && bare && timing_mode != TimingMode::PIPELINE && observers.empty() && !coverage_map)
+        {
+            bool simple = timing_mode == TimingMode::SIMPLE;
+            if (aot)
+                done += simple ? run_aot<TimingMode::SIMPLE>(max_steps - done) : run_aot<TimingMode::FUNCTIONAL>(max_steps - done);
+            else
+                done += simple ? run_jit<TimingMode::SIMPLE>(max_steps - done) : run_jit<TimingMode::FUNCTIONAL>(max_steps - done);
+            continue;
+        }
+
+        switch (timing_mode)
+        {
+        case TimingMode::FUNCTIONAL:
+            done += run_batch<TimingMode::FUNCTIONAL>(max_steps - done);
+            break;
+        case TimingMode::PIPELINE:
+            done += run_batch<TimingMode::PIPELINE>(max_steps - done);
+            break;
+        default:
+            done += run_batch<TimingMode::SIMPLE>(max_steps - done);
+            break;
+        }
+    }
+    return done;
+}
+
+template <TimingMode Mode>
+uint64_t RISCV::run_batch(uint64_t max_steps)
+{
+    uint64_t done = 0;
+    // Observers, coverage and the pipeline model see every instruction
+    bool fuse = Mode != TimingMode::PIPELINE && observers.empty() && !coverage_map;
+    bool idle = fuse && watchpoints.empty();
+    while (running && done < max_steps && timing_mode == Mode)
+    {
+        uint32_t from = pc;
+        uint64_t retired = instret;
+        uint32_t n = fuse && bare && max_steps - done >= 2 ? step_fused<Mode>() : 0;
+        if (n == 0)
+        {
+            step_impl<Mode>();
+            n = 1;
+        }
+        done += n;
+
+        // A backward jump (not a breakpoint stop): maybe an idle loop
+        if (idle && bare && pc <= from && instret != retired && running && done < max_steps)
+            done += idle_back_edge(from + 4 * (n - 1), max_steps - done);
+    }
+    return done;
+}
+
+// Runs the fused pair at pc, if there is one, as step_impl would run its
+// two halves. Returns the number of instructions retired: 0 if there is no
+// pair here, 1 if an interrupt came due between the halves (the second one
+// is then left to step_impl, which takes the interrupt first).
+template <TimingMode Mode>
+uint32_t RISCV::step_fused()
+{
+    const bool simple = Mode == TimingMode::SIMPLE;
+    uint32_t word = pc >> 2;
+    if (word + 1 >= fusion.size())
+    {
+        if (!fusion.empty() || (uint64_t)pc + 8 > mem.size())
+            return 0;
+        fusion.resize(mem.size() / 4);
+    }
+    // Both halves on one page, so its flags cover the second fetch too
+    if ((pc & 3) || (pc & (PAGE_SIZE - 1)) == PAGE_SIZE - 4 ||
+        (page_flags[pc >> PAGE_SHIFT] & (PAGE_BREAKPOINT | PAGE_LAZY)))
+        return 0;
+    uint8_t kind = fusion[word];
+    if (kind == FUSE_UNKNOWN)
+        kind = fuse(pc);
+    if (kind == FUSE_NONE || interrupt_pending())
+        return 0;
+
+    uint32_t first = fetch<simple>(pc);
+    uint32_t rd = (first >> 7) & 0x1F;
+    switch (kind)
+    {
+    case FUSE_LUI_ADDI:
+        reg[rd] = first & 0xFFFFF000;
+        break;
+    case FUSE_SLLI_SRLI:
+        reg[rd] = reg[(first >> 15) & 0x1F] << ((first >> 20) & 0x1F);
+        break;
+    default: // AUIPC
+        reg[rd] = pc + (first & 0xFFFFF000);
+        break;
+    }
+    pc += 4;
+    cycles++; // SIMPLE: base cycle; FUNCTIONAL: the instruction
+    instret++;
+    if (bus)
+        bus->tick(1);
+    if (interrupt_pending())
+        return 1;
+
+    uint32_t second = fetch<simple>(pc);
+    int32_t imm = sign_extend(second >> 20, 12);
+    pc += 4;
+    cycles++;
+    switch (kind)
+    {
+    case FUSE_SLLI_SRLI:
+        reg[rd] >>= (second >> 20) & 0x1F;
+        break;
+    case FUSE_AUIPC_JALR:
+    {
+        uint32_t target = (reg[rd] + imm) & ~1u;
+        reg[(second >> 7) & 0x1F] = pc;
+        pc = target;
+        if (simple)
+            cycles++; // Jump penalty
+        break;
+    }
+    default: // ADDI
+        reg[rd] += imm;
+        break;
+    }
+    instret++;
+    reg[0] = 0;
+    if (bus)
+        bus->tick(1);
+    fused_pairs++;
+    return 2;
+}
+
+// Classifies the pair of instructions at addr and caches the result in
+// fusion[]. The second half must take the first one's rd as its source;
+// only encodings that exec() runs the same way are accepted.
+uint8_t RISCV::fuse(uint32_t addr)
+{
+    uint32_t first = fetch<false>(addr);
+    uint32_t second = fetch<false>(addr + 4);
+    uint32_t rd = (first >> 7) & 0x1F;
+    bool chained = rd != 0 && ((second >> 15) & 0x1F) == rd;
+    bool same_rd = ((second >> 7) & 0x1F) == rd;
+    uint8_t kind = FUSE_NONE;
+
+    if (chained && same_rd && (second & 0x707F) == 0x0013) // ADDI rd, rd, imm
+    {
+        if ((first & 0x7F) == 0x37)
+            kind = FUSE_LUI_ADDI;
+        else if ((first & 0x7F) == 0x17)
+            kind = FUSE_AUIPC_ADDI;
+    }
+    else if (chained && (first & 0x7F) == 0x17 && (second & 0x707F) == 0x0067) // JALR rd2, imm(rd)
+        kind = FUSE_AUIPC_JALR;
+    else if (chained && same_rd && (first & 0xFE00707F) == 0x00001013 && (second & 0xFE00707F) == 0x00005013)
+        kind = FUSE_SLLI_SRLI; // SLLI rd, rs, n; SRLI rd, rd, m
+
+    // A store into a page with entries goes through code_written
+    uint32_t page = addr >> PAGE_SHIFT;
+    if (!(page_flags[page] & PAGE_FUSED))
+    {
+        page_flags[page] |= PAGE_FUSED;
+        acquire_code_page(page);
+        fusion_pages.push_back(page);
+    }
+    fusion[addr >> 2] = kind;
+    return kind;
+}
+
+void RISCV::flush_fusion()
+{
+    for (size_t i = 0; i < fusion_pages.size(); i++)
+    {
+        uint32_t page = fusion_pages[i];
+        size_t start = (size_t)page * (PAGE_SIZE / 4);
+        size_t count = std::min<size_t>(PAGE_SIZE / 4, fusion.size() - start);
+        std::memset(&fusion[start], FUSE_UNKNOWN, count);
+        page_flags[page] &= ~PAGE_FUSED;
+        release_code_page(page);
+    }
+    fusion_pages.clear();
+}
+
+// Called after the jump at `from` went back to pc. Nothing in a pure body
+// writes memory, so an iteration that starts with the registers of the one
+// before repeats it exactly, MMIO reads included, as long as the bus stays
+// quiet. IDLE_CONFIRM equal passes also settle the 2-bit branch counters
+// that FUNCTIONAL timing trains, so skipping leaves those as they would be.
+// Returns the instructions skipped.
+uint64_t RISCV::idle_back_edge(uint32_t from, uint64_t max_steps)
+{
+    uint64_t steps = instret - idle_instret; // Since the last pass
+    uint64_t pass_cycles = cycles - idle_cycles;
+    if (!idle_watching || pc != idle_head || from != idle_tail)
+    {
+        idle_watching = true;
+        idle_head = pc;
+        idle_tail = from;
+        idle_pure = idle_body_pure(pc, from);
+        idle_countable = !(pc & 3) && from >= pc && (from - pc) / 4 < IDLE_MAX_BODY;
+        idle_repeats = 0;
+        idle_counted = 0;
+        idle_steps = 0;
+    }
+    else
+    {
+        // One iteration runs each word at most once; more means the program
+        // left the loop and came back (through a JIT trace, say)
+        bool one_pass = steps <= (idle_tail - idle_head) / 4 + 1 && steps <= idle_quiet;
+        if (idle_pure && one_pass && std::memcmp(reg, idle_regs, sizeof(reg)) == 0)
+            idle_repeats++;
+        else
+            idle_repeats = 0;
+        // The same path each time (the cost would differ otherwise)
+        if (idle_countable && one_pass && steps == idle_steps && pass_cycles == idle_pass_cycles)
+            idle_counted++;
+        else
+            idle_counted = 0;
+    }
+
+    uint64_t skipped = 0;
+    uint64_t quiet = bus ? bus->quiet_ticks() : UINT64_MAX;
+    bool idle = idle_repeats >= IDLE_CONFIRM;
+    if ((idle || idle_counted >= IDLE_CONFIRM) && !interrupt_pending())
+    {
+        // Whole iterations only, each one bus tick per instruction
+        uint64_t n = std::min(max_steps, quiet) / steps;
+        if (!idle)
+            n = count_passes(n, steps);
+        skipped = n * steps;
+        cycles += n * pass_cycles;
+        instret += skipped;
+        for (uint64_t left = skipped; bus && left;)
+        {
+            uint32_t chunk = (uint32_t)std::min<uint64_t>(left, UINT32_MAX);
+            bus->tick(chunk);
+            left -= chunk;
+        }
+        (idle ? idle_skipped : loop_skipped) += skipped;
+        if (skipped && bus)
+            quiet = bus->quiet_ticks();
+    }
+
+    std::memcpy(idle_regs, reg, sizeof(reg));
+    idle_cycles = cycles;
+    idle_instret = instret;
+    idle_steps = steps;
+    idle_pass_cycles = pass_cycles;
+    idle_quiet = quiet;
+    return skipped;
+}
+
+// Moves a counted loop on by up to max_passes passes (ending at the head
+// of one), or returns 0 and stops trying until the next loop
+uint64_t RISCV::count_passes(uint64_t max_passes, uint64_t steps)
+{
+    // Plain RAM only; a breakpoint in the body must still be hit
+    CountedLoop::ReadWord read = [this](uint32_t addr, uint32_t &value)
+    {
+        if ((addr & 3) || (uint64_t)addr + 4 > mem.size() || (addr >= 0x1000 && addr <= 0x1FFF) ||
+            (page_flags[addr >> PAGE_SHIFT] & PAGE_BREAKPOINT))
+            return false;
+        value = read32<false>(addr);
+        return true;
+    };
+    if (!counted.analyse(reg, idle_head, idle_tail, steps, read))
+    {
+        idle_countable = false;
+        return 0;
+    }
+    uint64_t n = std::min(max_passes, counted.get_trips());
+    std::vector<std::pair<uint32_t, uint32_t>> stores;
+    if (n == 0 || !counted.advance(n, reg, stores, read))
+        return 0;
+    for (size_t i = 0; i < stores.size(); i++)
+        write32<false>(stores[i].first, stores[i].second);
+    return n;
+}
+
+// Loads, ALU operations, and branches and JALs that stay within the loop
+// or leave it at the bottom: an iteration changes nothing but registers
+bool RISCV::idle_body_pure(uint32_t head, uint32_t tail) const
+{
+    if ((head & 3) || tail < head || (tail - head) / 4 >= IDLE_MAX_BODY || (uint64_t)tail + 4 > mem.size())
+        return false;
+    for (uint32_t addr = head; addr <= tail; addr += 4)
+    {
+        if (page_flags[addr >> PAGE_SHIFT] & PAGE_BREAKPOINT)
+            return false;
+        uint32_t instr = mem[addr] | (mem[addr + 1] << 8) | (mem[addr + 2] << 16) | ((uint32_t)mem[addr + 3] << 24);
+        int32_t offset;
+        switch (instr & 0x7F)
+        {
+        case 0x03: // LOAD
+        case 0x13: // OP-IMM
+        case 0x17: // AUIPC
+        case 0x33: // OP
+        case 0x37: // LUI
+            continue;
+        case 0x63: // BRANCH
+            offset = sign_extend(((instr >> 8) & 0xF) << 1 | ((instr >> 25) & 0x3F) << 5 | ((instr >> 7) & 0x1) << 11 |
+                                     ((instr >> 31) & 0x1) << 12,
+                                 13);
+            break;
+        case 0x6F: // JAL
+            offset = sign_extend(((instr >> 21) & 0x3FF) << 1 | ((instr >> 20) & 0x1) << 11 | ((instr >> 12) & 0xFF) << 12 |
+                                     ((instr >> 31) & 0x1) << 20,
+                                 21);
+            break;
+        default:
+            return false;
+        }
+        int64_t target = (int64_t)addr + offset;
+        if (target < head || target > (int64_t)tail + 4)
+            return false;
+    }
+    return true;
+}
+
+template <TimingMode Mode>
+uint64_t RISCV::run_aot(uint64_t max_steps)
+{
+    // The first instruction is interpreted: its bus tick picks up anything
+    // the host changed (pins, UART input) since the last call
+    step_impl<Mode>();
+    uint64_t done = 1;
+
+    RvAotContext ctx;
+    ctx.x = reg;
+    ctx.cycles = &cycles;
+    ctx.simple = Mode == TimingMode::SIMPLE;
+    ctx.runtime = this;
+    ctx.load = aot_load;
+    ctx.store = aot_store;
+    ctx.branch = aot_branch;
+
+    while (running && done < max_steps && timing_mode == Mode && aot && bare)
+    {
+        const RvAotBlock *block = aot->lookup(pc);
+        if (!block || block->length > max_steps - done || !aot_can_enter(*block) ||
+            (!aot_stale.empty() && aot_stale.count(pc)))
+        {
+            step_impl<Mode>();
+            done++;
+            continue;
+        }
+
+        aot_entry = instret;
+        aot_start = pc;
+        aot_ticked = 0;
+        ctx.stop = 0;
+        uint32_t n = block->fn(&ctx);
+        instret = aot_entry + n;
+        pc = ctx.next_pc;
+        done += n;
+        aot_steps += n;
+
+        // Bus ticks are batched: nothing in the block could observe them
+        // (MMIO accesses deliver the ticks owed first, see aot_sync)
+        if (bus && n > aot_ticked)
+            bus->tick(n - aot_ticked);
+    }
+    return done;
+}
+
+bool RISCV::aot_can_enter(const RvAotBlock &block) const
+{
+    // Breakpoints and unloaded pages need the interpreter's fetch check
+    uint8_t flags = page_flags[block.pc >> PAGE_SHIFT] | page_flags[(block.pc + 4 * block.length - 4) >> PAGE_SHIFT];
+    if (flags & (PAGE_BREAKPOINT | PAGE_LAZY))
+        return false;
+    return !interrupt_pending();
+}
+
+// An interrupt would be taken before the next instruction: the core looks
+// at the lowest pending vector only (check_interrupts)
+bool RISCV::interrupt_pending() const
+{
+    if (bus && (priv != PRIV_M || (mstatus & MSTATUS_MIE)))
+    {
+        uint32_t pending = bus->get_interrupt_status() & bus->get_interrupt_enable();
+        return pending && interrupt_taken(pending & (0u - pending));
+    }
+    return false;
+}
+
+// Whether the interrupt with this mie bit preempts the current mode.
+// Delegated ones are taken in S mode, so never from M mode; the others
+// always preempt a less privileged mode.
+bool RISCV::interrupt_taken(uint32_t bit) const
+{
+    if (!(mie & bit))
+        return false;
+    if (mideleg & bit)
+        return priv == PRIV_U || (priv == PRIV_S && (mstatus & MSTATUS_SIE));
+    return priv != PRIV_M || (mstatus & MSTATUS_MIE);
+}
+
+void RISCV::set_aot(const AotImage *image)
+{
+    // Words are sorted: one reference per page
+    if (aot)
+    {
+        const RvAotImage &old = aot->get_image();
+        for (uint32_t i = 0; i < old.word_count; i++)
+        {
+            uint32_t page = old.words[i].addr >> PAGE_SHIFT;
+            if (i == 0 || page != old.words[i - 1].addr >> PAGE_SHIFT)
+                release_code_page(page);
+        }
+    }
+    aot = image;
+    aot_stale.clear();
+    if (aot)
+    {
+        const RvAotImage &img = aot->get_image();
+        for (uint32_t i = 0; i < img.word_count; i++)
+        {
+            uint32_t page = img.words[i].addr >> PAGE_SHIFT;
+            if (i == 0 || page != img.words[i - 1].addr >> PAGE_SHIFT)
+                acquire_code_page(page);
+        }
+    }
+}
+
+void RISCV::acquire_code_page(uint32_t page)
+{
+    if (code_pages[page]++ == 0)
+        page_flags[page] |= PAGE_CODE;
+}
+
+void RISCV::release_code_page(uint32_t page)
+{
+    std::unordered_map<uint32_t, uint32_t>::iterator it = code_pages.find(page);
+    if (it == code_pages.end())
+        return;
+    if (--it->second == 0)
+    {
+        code_pages.erase(it);
+        page_flags[page] &= ~PAGE_CODE;
+    }
+}
+
+// Self-modifying code: translations of the written bytes no longer match
+void RISCV::code_written(uint32_t addr, uint32_t size)
+{
+    if (aot && aot->covers(addr, size))
+        aot->blocks_covering(addr, size, aot_stale);
+    if (jit)
+        jit->invalidate(addr, size);
+    if (!fusion.empty())
+    {
+        // The pair starting one word earlier ends in these bytes
+        uint32_t word = addr >> 2 ? (addr >> 2) - 1 : 0;
+        for (; word <= (addr + size - 1) >> 2 && word < fusion.size(); word++)
+            fusion[word] = FUSE_UNKNOWN;
+    }
+}
+
+void RISCV::set_decode_cache(const DecodeCache *cache)
+{
+    decode_cache = cache;
+    decoded = cache ? cache->get_insns() : nullptr;
+    decoded_base = cache ? cache->get_base() : 0;
+    decoded_count = cache ? cache->get_count() : 0;
+}
+
+void RISCV::set_jit(TraceJit *trace_jit)
+{
+    if (jit)
+        jit->bind(nullptr);
+    jit = trace_jit && trace_jit->is_available() ? trace_jit : nullptr;
+    if (jit)
+        jit->bind(this);
+}
+
+template <TimingMode Mode>
+uint64_t RISCV::run_jit(uint64_t max_steps)
+{
+    uint64_t done = 0;
+    while (running && done < max_steps && timing_mode == Mode && jit && bare)
+    {
+        // Everything outside compiled loops is interpreted, including the
+        // first instruction of each call (see run_aot)
+        uint32_t from = pc;
+        uint64_t retired = instret;
+        if (jit->is_recording() && interrupt_pending())
+            jit->abort_recording(); // The trap would not be what gets recorded
+        step_impl<Mode>();
+        done++;
+        if (instret == retired)
+            continue; // Halted at a breakpoint
+
+        if (jit->is_recording())
+            jit->record(from, mem[from] | (mem[from + 1] << 8) | (mem[from + 2] << 16) | (mem[from + 3] << 24), pc);
+
+        // A backward jump: its target may head an idle or a hot loop
+        if (pc <= from && running && timing_mode == Mode)
+        {
+            if (watchpoints.empty() && done < max_steps)
+                done += idle_back_edge(from, max_steps - done);
+            TraceJit::Trace *trace = jit->back_edge(pc);
+            if (trace)
+            {
+                done += jit->execute(*trace, max_steps - done, Mode == TimingMode::SIMPLE);
+                idle_watching = false;
+            }
+        }
+    }
+    return done;
+}
+
+// State as the interpreter has it while executing instruction k of the
+// running block, before a memory access to addr
+void RISCV::aot_sync(RvAotContext *c, uint32_t k, uint32_t addr)
+{
+    instret = aot_entry + k;
+    pc = aot_start + 4 * k + 4;
+    last_mem_addr = addr;
+
+    // A device sees the ticks of every earlier instruction first, and may
+    // raise an interrupt: the block ends after this instruction
+    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+    {
+        if (k > aot_ticked)
+            bus->tick(k - aot_ticked);
+        aot_ticked = k;
+        c->stop = 1;
+    }
+}
+
+uint32_t RISCV::aot_load(RvAotContext *c, uint32_t k, uint32_t addr, uint32_t funct3)
+{
+    RISCV &cpu = *(RISCV *)c->runtime;
+    cpu.aot_sync(c, k, addr);
+    uint32_t value = cpu.mem_read(addr, funct3, c->simple != 0);
+
+    // A watchpoint halted the CPU
+    if (!cpu.running)
+        c->stop = 1;
+    return value;
+}
+
+void RISCV::aot_store(RvAotContext *c, uint32_t k, uint32_t addr, uint32_t value, uint32_t funct3)
+{
+    RISCV &cpu = *(RISCV *)c->runtime;
+    cpu.aot_sync(c, k, addr);
+    cpu.mem_write(addr, funct3, value, c->simple != 0);
+
+    // Watchpoint halt, or the store hit this block's own code (code_written
+    // from flagged_write); either way the interpreter takes over
+    if (!cpu.running || (!cpu.aot_stale.empty() && cpu.aot_stale.count(cpu.aot_start)))
+        c->stop = 1;
+}
+
+uint32_t RISCV::mem_read(uint32_t addr, uint32_t funct3, bool timed)
+{
+    switch (funct3)
+    {
+    case 0x0: // LB
+        return sign_extend(timed ? read8<true>(addr) : read8<false>(addr), 8);
+    case 0x1: // LH
+        return sign_extend(timed ? read16<true>(addr) : read16<false>(addr), 16);
+    case 0x4: // LBU
+        return timed ? read8<true>(addr) : read8<false>(addr);
+    case 0x5: // LHU
+        return timed ? read16<true>(addr) : read16<false>(addr);
+    default: // LW
+        return timed ? read32<true>(addr) : read32<false>(addr);
+    }
+}
+
+void RISCV::mem_write(uint32_t addr, uint32_t funct3, uint32_t value, bool timed)
+{
+    switch (funct3)
+    {
+    case 0x0: // SB
+        timed ? write8<true>(addr, value & 0xFF) : write8<false>(addr, value & 0xFF);
+        break;
+    case 0x1: // SH
+        timed ? write16<true>(addr, value & 0xFFFF) : write16<false>(addr, value & 0xFFFF);
+        break;
+    default: // SW
+        timed ? write32<true>(addr, value) : write32<false>(addr, value);
+        break;
+    }
+}
+
+void RISCV::aot_branch(RvAotContext *c, uint32_t pc, uint32_t next)
+{
+    ((RISCV *)c->runtime)->pipeline.warm(pc, next);
+}
+
+// Block ids are hashed from the pc; shifting the previous one keeps
+// A->B and B->A apart, as in AFL
+inline void RISCV::cover_edge()
+{
+    uint32_t block = ((pc >> 2) * 2654435761u) >> 16;
+    coverage_map[(block ^ coverage_prev) & (COVERAGE_MAP_SIZE - 1)]++;
+    coverage_prev = block >> 1;
+}
+
+template <TimingMode Mode>
+void RISCV::step_impl()
+{
+    uint64_t start_cycles = cycles;
+
     // Check for interrupts before executing next instruction
     check_interrupts();
 
-    uint32_t instr = fetch32(pc);
-    pc += 4;
-    cycles++; // Base cycle for instruction fetch and decode
-    exec(instr);
+    if ((page_flags[pc >> PAGE_SHIFT] & (PAGE_BREAKPOINT | PAGE_LAZY)) && flagged_fetch())
+        return;
+
+    uint32_t fetch_pc = pc;
+    uint32_t instr;
+
+    try
+    {
+        if (Mode == TimingMode::SIMPLE)
+        {
+            instr = fetch<true>(pc);
+            pc += 4;
+            cycles++; // Base cycle for instruction fetch and decode
+            exec_fetched<true>(fetch_pc, instr);
+        }
+        else
+        {
+            instr = fetch<false>(pc);
+            pc += 4;
+            exec_fetched<false>(fetch_pc, instr);
+
+            if (Mode == TimingMode::PIPELINE)
+            {
+                // The pipeline model supplies the whole cost of this step
+                cycles = start_cycles + pipeline.retire(instr, fetch_pc, pc);
+            }
+            else
+            {
+                // One cycle per instruction keeps peripherals moving; branch
+                // outcomes keep the predictor warm for the next detailed window
+                cycles = start_cycles + 1;
+                if ((instr & 0x7F) == 0x63)
+                    pipeline.warm(fetch_pc, pc);
+            }
+        }
+    }
+    catch (const MemFault &fault)
+    {
+        // Translation failed before the instruction changed anything: it
+        // does not retire, the handler runs next
+        pc = fetch_pc;
+        trap(fault.cause, false, fault.addr);
+        if (bus)
+            bus->tick(1);
+        return;
+    }
+    instret++;
+    reg[0] = 0;
+
+    if (coverage_map && (pc != fetch_pc + 4 || (instr & 0x7F) == 0x63))
+        cover_edge();
+
+    if (!observers.empty())
+    {
+        uint32_t cost = (uint32_t)(cycles - start_cycles);
+        for (size_t i = 0; i < observers.size(); i++)
+            observers[i]->on_retire(*this, fetch_pc, instr, cost);
+    }
+
     if (bus)
     {
-        bus->tick(1); // Periodic bus update
+        bus->tick(1); // Periodic bus update
+    }
+}
+
+void RISCV::set_timing_mode(TimingMode mode)
+{
+    if (mode == TimingMode::PIPELINE && timing_mode != TimingMode::PIPELINE)
+        pipeline.reset();
+    timing_mode = mode;
+}
+
+// TLB lookup on the accessors' fast path; anything but a hit on a page
+// that allows this access (and holds all of it) goes to walk()
+template <RISCV::Access A, uint32_t Size>
+inline uint32_t RISCV::translate(uint32_t addr)
+{
+    const TlbEntry &e = tlb[A != ACCESS_FETCH][(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+    if (e.vpn == addr >> PAGE_SHIFT && (e.perm & tlb_need[A]) == tlb_need[A] &&
+        (addr & (PAGE_SIZE - 1)) <= PAGE_SIZE - Size)
+        return e.ppage | (addr & (PAGE_SIZE - 1));
+    return walk(addr, Size, A);
+}
+
+// Exception causes by Access
+static const uint32_t MISALIGNED_CAUSE[3] = {0, 4, 6};
+static const uint32_t ACCESS_FAULT_CAUSE[3] = {1, 5, 7};
+static const uint32_t PAGE_FAULT_CAUSE[3] = {12, 13, 15};
+
+// TLB miss: translates (Sv32 or identity, by the TLB's context), applies
+// PMP, fills the entry and returns the physical address, or throws the
+// fault the access raises. Accesses that cross into another page fault as
+// misaligned rather than being checked part by part.
+uint32_t RISCV::walk(uint32_t addr, uint32_t size, Access access)
+{
+    if ((addr & (PAGE_SIZE - 1)) > PAGE_SIZE - size)
+        throw MemFault{MISALIGNED_CAUSE[access], addr};
+
+    uint8_t context = tlb_context[access != ACCESS_FETCH];
+    uint32_t ppage = addr & ~(PAGE_SIZE - 1);
+    uint8_t perm = TLB_R | TLB_RX | TLB_W | TLB_X | TLB_U | TLB_S;
+    if (context == TLB_CTX_PAGED)
+        perm = walk_sv32(addr, access, ppage);
+
+    // A page split by a region boundary is decided access by access
+    uint32_t paddr = ppage | (addr & (PAGE_SIZE - 1));
+    uint8_t pmp = pmp_page(ppage >> PAGE_SHIFT);
+    if (pmp & PMP_PAGE_SPLIT)
+    {
+        if (!pmp_allows(paddr, size, access, context == TLB_CTX_M))
+            throw MemFault{ACCESS_FAULT_CAUSE[access], addr};
+        return paddr;
+    }
+    if (context == TLB_CTX_M)
+        pmp >>= 3;
+    if (!(pmp & PMP_R))
+        perm &= ~(TLB_R | TLB_RX);
+    if (!(pmp & PMP_W))
+        perm &= ~TLB_W;
+    if (!(pmp & PMP_X))
+        perm &= ~TLB_X;
+    // The page table allowed the access: what is missing, PMP denied
+    if ((perm & tlb_need[access]) != tlb_need[access])
+        throw MemFault{ACCESS_FAULT_CAUSE[access], addr};
+
+    TlbEntry &e = tlb[access != ACCESS_FETCH][(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+    e.vpn = addr >> PAGE_SHIFT;
+    e.ppage = ppage;
+    e.perm = perm;
+    return paddr;
+}
+
+// Sv32 page table walk: sets ppage and returns the leaf's permissions as
+// TLB_* bits, or throws a page fault (or an access fault for page tables
+// outside RAM or denied by PMP)
+uint8_t RISCV::walk_sv32(uint32_t addr, Access access, uint32_t &ppage)
+{
+    const uint32_t V = 1, R = 2, W = 4, X = 8, U = 16, A = 64, D = 128;
+    page_walks++;
+
+    uint32_t vpn = addr >> PAGE_SHIFT;
+    uint64_t table = (uint64_t)(satp & 0x3FFFFF) << PAGE_SHIFT;
+    for (int level = 1; level >= 0; level--)
+    {
+        // Page tables live in RAM; this read is not watched
+        uint64_t pte_addr = table + 4 * ((vpn >> (10 * level)) & 0x3FF);
+        if (pte_addr + 4 > mem.size() || (pte_addr >= 0x1000 && pte_addr <= 0x1FFF) ||
+            !pmp_allows((uint32_t)pte_addr, 4, ACCESS_LOAD, false))
+            throw MemFault{ACCESS_FAULT_CAUSE[access], addr};
+        uint32_t page = (uint32_t)(pte_addr >> PAGE_SHIFT);
+        if (page_flags[page] & PAGE_LAZY)
+            page_in(page);
+        uint8_t *p = &mem[pte_addr];
+        uint32_t pte = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+        if (!(pte & V) || (!(pte & R) && (pte & W)))
+            break;
+        if (!(pte & (R | X)))
+        {
+            table = (uint64_t)(pte >> 10) << PAGE_SHIFT; // Next level
+            continue;
+        }
+
+        // Leaf; a megapage must be aligned to 4 MB
+        uint32_t ppn = pte >> 10;
+        if (level == 1)
+        {
+            if (ppn & 0x3FF)
+                break;
+            ppn |= vpn & 0x3FF;
+        }
+        uint8_t perm = ((pte & R) ? TLB_R : 0) | ((pte & (R | X)) ? TLB_RX : 0) | ((pte & X) ? TLB_X : 0) |
+                       ((pte & U) ? TLB_U : TLB_S);
+        uint8_t need = tlb_need[access] & ~TLB_W;
+        if ((perm & need) != need || (access == ACCESS_STORE && !(pte & W)))
+            break;
+
+        if (ppn >= 1u << (32 - PAGE_SHIFT))
+            throw MemFault{ACCESS_FAULT_CAUSE[access], addr}; // Beyond 32-bit physical addresses
+
+        // Set A, and D for a store, as the page table write they imply
+        uint32_t updated = pte | A | (access == ACCESS_STORE ? D : 0);
+        if (updated != pte)
+        {
+            if (!pmp_allows((uint32_t)pte_addr, 4, ACCESS_STORE, false))
+                throw MemFault{ACCESS_FAULT_CAUSE[access], addr};
+            if (!((page_flags[page] & (PAGE_WATCH_WRITE | PAGE_TRACK_WRITE | PAGE_CODE)) &&
+                  flagged_write((uint32_t)pte_addr, 4, updated)))
+            {
+                for (int i = 0; i < 4; i++)
+                    p[i] = (updated >> (8 * i)) & 0xFF;
+            }
+        }
+        if ((updated & W) && (updated & D))
+            perm |= TLB_W;
+
+        ppage = ppn << PAGE_SHIFT;
+        return perm;
+    }
+    throw MemFault{PAGE_FAULT_CAUSE[access], addr};
+}
+
+// What the accessors check follows from the mode, mstatus, satp and PMP;
+// the mode loads and stores run in is MPP under mstatus.MPRV. S and U mode
+// are always checked: an access matching no PMP entry fails.
+void RISCV::update_vm()
+{
+    bool paging = (satp & SATP_MODE) != 0;
+    Privilege data_priv = priv;
+    if (priv == PRIV_M && (mstatus & MSTATUS_MPRV))
+        data_priv = (Privilege)((mstatus & MSTATUS_MPP) >> 11);
+    vm_fetch = priv != PRIV_M || pmp_locked;
+    vm_data = data_priv != PRIV_M || pmp_locked;
+    bare = !vm_fetch && !vm_data;
+
+    // A TLB only ever holds entries of one context; one that is not used
+    // now keeps its entries for when the context comes back
+    uint8_t context[2];
+    context[0] = priv == PRIV_M ? TLB_CTX_M : paging ? TLB_CTX_PAGED : TLB_CTX_SU;
+    context[1] = data_priv == PRIV_M ? TLB_CTX_M : paging ? TLB_CTX_PAGED : TLB_CTX_SU;
+    bool used[2] = {vm_fetch, vm_data};
+    for (int k = 0; k < 2; k++)
+    {
+        if (used[k] && context[k] != tlb_context[k])
+        {
+            for (uint32_t i = 0; i < TLB_SIZE; i++)
+                tlb[k][i].vpn = TLB_INVALID;
+            tlb_context[k] = context[k];
+        }
+    }
+
+    // S mode never runs user pages, and reads or writes them under SUM
+    tlb_need[ACCESS_FETCH] = TLB_X | (priv == PRIV_U ? TLB_U : TLB_S);
+    uint8_t owner = data_priv == PRIV_U ? TLB_U : (mstatus & MSTATUS_SUM) ? 0 : TLB_S;
+    tlb_need[ACCESS_LOAD] = ((mstatus & MSTATUS_MXR) ? TLB_RX : TLB_R) | owner;
+    tlb_need[ACCESS_STORE] = TLB_W | owner;
+}
+
+void RISCV::flush_tlb()
+{
+    for (uint32_t i = 0; i < TLB_SIZE; i++)
+    {
+        tlb[0][i].vpn = TLB_INVALID;
+        tlb[1][i].vpn = TLB_INVALID;
+    }
+}
+
+uint32_t RISCV::read_pmp(uint32_t addr) const
+{
+    if (addr >= CSR_PMPADDR0)
+        return pmpaddr[addr - CSR_PMPADDR0];
+    uint32_t first = (addr - CSR_PMPCFG0) * 4; // pmpcfg4-15 are not there
+    if (first >= PMP_ENTRIES)
+        return 0;
+    return pmpcfg[first] | (pmpcfg[first + 1] << 8) | (pmpcfg[first + 2] << 16) | ((uint32_t)pmpcfg[first + 3] << 24);
+}
+
+// Locked entries ignore writes until reset, and so does the address a
+// locked TOR entry starts from
+void RISCV::write_pmp(uint32_t addr, uint32_t val)
+{
+    if (addr >= CSR_PMPADDR0)
+    {
+        uint32_t i = addr - CSR_PMPADDR0;
+        bool tor_locked = i + 1 < PMP_ENTRIES && (pmpcfg[i + 1] & PMP_L) && (pmpcfg[i + 1] & PMP_A) == (1 << 3);
+        if ((pmpcfg[i] & PMP_L) || tor_locked)
+            return;
+        pmpaddr[i] = val;
+    }
+    else
+    {
+        uint32_t first = (addr - CSR_PMPCFG0) * 4;
+        for (uint32_t i = first; i < first + 4 && i < PMP_ENTRIES; i++)
+        {
+            if (pmpcfg[i] & PMP_L)
+                continue;
+            uint8_t cfg = (val >> (8 * (i - first))) & (PMP_R | PMP_W | PMP_X | PMP_A | PMP_L);
+            if ((cfg & (PMP_R | PMP_W)) == PMP_W)
+                cfg &= ~PMP_W; // W without R is reserved
+            pmpcfg[i] = cfg;
+        }
+    }
+
+    pmp_locked = false;
+    for (uint32_t i = 0; i < PMP_ENTRIES; i++)
+        pmp_locked |= (pmpcfg[i] & PMP_L) && (pmpcfg[i] & PMP_A);
+    std::fill(pmp_pages.begin(), pmp_pages.end(), 0);
+    flush_tlb();
+    update_vm();
+}
+
+// Byte range [lo, hi) of entry i in the 34-bit physical space; false if
+// the entry is off or empty
+bool RISCV::pmp_range(uint32_t i, uint64_t &lo, uint64_t &hi) const
+{
+    uint64_t a = pmpaddr[i];
+    switch ((pmpcfg[i] & PMP_A) >> 3)
+    {
+    case 1: // TOR: from the previous entry's address
+        lo = i ? (uint64_t)pmpaddr[i - 1] << 2 : 0;
+        hi = a << 2;
+        break;
+    case 2: // NA4
+        lo = a << 2;
+        hi = lo + 4;
+        break;
+    case 3: // NAPOT: trailing ones give the size
+    {
+        uint32_t ones = 0;
+        while (ones < 32 && ((a >> ones) & 1))
+            ones++;
+        lo = (a & ~((1ull << ones) - 1)) << 2;
+        hi = lo + (8ull << ones);
+        break;
+    }
+    default:
+        return false;
+    }
+    return lo < hi;
+}
+
+// Decision for a whole physical page (see PmpBits), cached for RAM pages
+uint8_t RISCV::pmp_page(uint32_t page)
+{
+    if (pmp_pages.empty())
+        pmp_pages.resize((mem.size() + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    if (page < pmp_pages.size() && pmp_pages[page])
+        return pmp_pages[page];
+
+    // The lowest entry touching the page decides it; with none, only M
+    // mode has access
+    uint64_t start = (uint64_t)page << PAGE_SHIFT;
+    uint64_t end = start + PAGE_SIZE;
+    uint8_t decision = PMP_PAGE_KNOWN | (PMP_R | PMP_W | PMP_X) << 3;
+    for (uint32_t i = 0; i < PMP_ENTRIES; i++)
+    {
+        uint64_t lo, hi;
+        if (!pmp_range(i, lo, hi) || hi <= start || lo >= end)
+            continue;
+        uint8_t rwx = pmpcfg[i] & (PMP_R | PMP_W | PMP_X);
+        if (lo > start || hi < end)
+            decision = PMP_PAGE_KNOWN | PMP_PAGE_SPLIT;
+        else
+            decision = PMP_PAGE_KNOWN | rwx | ((pmpcfg[i] & PMP_L) ? rwx : PMP_R | PMP_W | PMP_X) << 3;
+        break;
+    }
+    if (page < pmp_pages.size())
+        pmp_pages[page] = decision;
+    return decision;
+}
+
+// Precise check of one access: the lowest entry matching any of its bytes
+// must match all of them and allow it
+bool RISCV::pmp_allows(uint32_t addr, uint32_t size, Access access, bool machine) const
+{
+    static const uint8_t needs[3] = {PMP_X, PMP_R, PMP_W};
+    for (uint32_t i = 0; i < PMP_ENTRIES; i++)
+    {
+        uint64_t lo, hi;
+        if (!pmp_range(i, lo, hi) || hi <= addr || lo >= (uint64_t)addr + size)
+            continue;
+        if (lo > addr || hi < (uint64_t)addr + size)
+            return false;
+        if (machine && !(pmpcfg[i] & PMP_L))
+            return true;
+        return (pmpcfg[i] & needs[access]) != 0;
+    }
+    return machine;
+}
+
+template <bool Timed>
+uint32_t RISCV::fetch(uint32_t addr)
+{
+    if (vm_fetch)
+    {
+        addr = translate<ACCESS_FETCH, 4>(addr);
+        // step_impl paged in the virtual page
+        if (page_flags[addr >> PAGE_SHIFT] & PAGE_LAZY)
+            page_in(addr >> PAGE_SHIFT);
+    }
+    if (addr + 3 >= mem.size())
+        throw std::runtime_error("Fetch out of bounds");
+
+    // Memory access cycles
+    if (Timed)
+        cycles++; // For memory read
+
+    return mem[addr] | (mem[addr + 1] << 8) | (mem[addr + 2] << 16) | (mem[addr + 3] << 24);
+}
+
+template <bool Timed>
+uint8_t RISCV::read8(uint32_t addr)
+{
+    if (Timed)
+        cycles++; // Memory access cycle
+    if (vm_data)
+        addr = translate<ACCESS_LOAD, 1>(addr);
+    if ((page_flags[addr >> PAGE_SHIFT] & (PAGE_WATCH_READ | PAGE_LAZY)) && flagged_read(addr))
+        return (uint8_t)watched_read(addr, 1);
+
+    // Check if this is MMIO address
+    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+    {
+        return bus->load(addr) & 0xFF;
+    }
+
+    return mem.at(addr);
+}
+
+template <bool Timed>
+uint16_t RISCV::read16(uint32_t addr)
+{
+    if (Timed)
+        cycles++; // Memory access cycle
+    if (vm_data)
+        addr = translate<ACCESS_LOAD, 2>(addr);
+    if ((page_flags[addr >> PAGE_SHIFT] & (PAGE_WATCH_READ | PAGE_LAZY)) && flagged_read(addr))
+        return (uint16_t)watched_read(addr, 2);
+    return mem.at(addr) | (mem.at(addr + 1) << 8);
+}
+
+template <bool Timed>
+uint32_t RISCV::read32(uint32_t addr)
+{
+    if (Timed)
+        cycles++; // Memory access cycle
+    if (vm_data)
+        addr = translate<ACCESS_LOAD, 4>(addr);
+    if ((page_flags[addr >> PAGE_SHIFT] & (PAGE_WATCH_READ | PAGE_LAZY)) && flagged_read(addr))
+        return (uint32_t)watched_read(addr, 4);
+
+    // Check if this is MMIO address (aligned access)
+    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+    {
+        return bus->load(addr);
+    }
+
+    return mem.at(addr) | (mem.at(addr + 1) << 8) | (mem.at(addr + 2) << 16) | (mem.at(addr + 3) << 24);
+}
+
+template <bool Timed>
+void RISCV::write8(uint32_t addr, uint8_t value)
+{
+    if (Timed)
+        cycles++; // Memory access cycle
+    if (vm_data)
+        addr = translate<ACCESS_STORE, 1>(addr);
+    if ((page_flags[addr >> PAGE_SHIFT] & (PAGE_WATCH_WRITE | PAGE_TRACK_WRITE | PAGE_LAZY | PAGE_CODE)) && flagged_write(addr, 1, value))
+        return;
+
+    // Check if this is MMIO address
+    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+    {
+        bus->store(addr, value);
+        return;
+    }
+
+    mem.at(addr) = value;
+}
+
+template <bool Timed>
+void RISCV::write16(uint32_t addr, uint16_t value)
+{
+    if (Timed)
+        cycles++; // Memory access cycle
+    if (vm_data)
+        addr = translate<ACCESS_STORE, 2>(addr);
+    if ((page_flags[addr >> PAGE_SHIFT] & (PAGE_WATCH_WRITE | PAGE_TRACK_WRITE | PAGE_LAZY | PAGE_CODE)) && flagged_write(addr, 2, value))
+        return;
+    mem.at(addr) = value & 0xFF;
+    mem.at(addr + 1) = (value >> 8) & 0xFF;
+}
+
+template <bool Timed>
+void RISCV::write32(uint32_t addr, uint32_t value)
+{
+    if (Timed)
+        cycles++; // Memory access cycle
+    if (vm_data)
+        addr = translate<ACCESS_STORE, 4>(addr);
+    if ((page_flags[addr >> PAGE_SHIFT] & (PAGE_WATCH_WRITE | PAGE_TRACK_WRITE | PAGE_LAZY | PAGE_CODE)) && flagged_write(addr, 4, value))
+        return;
+
+    // Check if this is MMIO address (aligned access)
+    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+    {
+        bus->store(addr, value);
+        return;
     }
 
-    reg[0] = 0;
+    mem.at(addr) = value & 0xFF;
+    mem.at(addr + 1) = (value >> 8) & 0xFF;
+    mem.at(addr + 2) = (value >> 16) & 0xFF;
+    mem.at(addr + 3) = (value >> 24) & 0xFF;
 }
 
-uint32_t RISCV::fetch32(uint32_t addr)
+uint32_t RISCV::fetch32(uint32_t addr) { return fetch<true>(addr); }
+uint8_t RISCV::load8(uint32_t addr) { return read8<true>(addr); }
+uint16_t RISCV::load16(uint32_t addr) { return read16<true>(addr); }
+uint32_t RISCV::load32(uint32_t addr) { return read32<true>(addr); }
+void RISCV::store8(uint32_t addr, uint8_t value) { write8<true>(addr, value); }
+void RISCV::store16(uint32_t addr, uint16_t value) { write16<true>(addr, value); }
+void RISCV::store32(uint32_t addr, uint32_t value) { write32<true>(addr, value); }
+
+void RISCV::add_breakpoint(uint32_t addr)
 {
-    if (addr + 3 >= mem.size())
-        throw std::runtime_error("Fetch out of bounds");
+    breakpoints.insert(addr);
+    page_flags[addr >> PAGE_SHIFT] |= PAGE_BREAKPOINT;
+}
 
-    // Memory access cycles
-    cycles++; // For memory read
+bool RISCV::remove_breakpoint(uint32_t addr)
+{
+    if (!breakpoints.erase(addr))
+        return false;
 
-    return mem[addr] | (mem[addr + 1] << 8) | (mem[addr + 2] << 16) | (mem[addr + 3] << 24);
+    // Keep the page flagged while other breakpoints remain on it
+    uint32_t page = addr >> PAGE_SHIFT;
+    for (auto it = breakpoints.begin(); it != breakpoints.end(); ++it)
+    {
+        if ((*it >> PAGE_SHIFT) == page)
+            return true;
+    }
+    page_flags[page] &= ~PAGE_BREAKPOINT;
+    return true;
 }
 
-uint8_t RISCV::load8(uint32_t addr)
+void RISCV::add_watchpoint(uint32_t addr, uint32_t len, uint8_t kind, bool stop)
 {
-    cycles++; // Memory access cycle
+    if (len == 0)
+        len = 1;
+    Watchpoint w = {addr, len, kind, stop};
+    watchpoints.push_back(w);
+    update_watch_pages();
+}
 
-    // Check if this is MMIO address
-    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+bool RISCV::remove_watchpoint(uint32_t addr, uint32_t len, uint8_t kind)
+{
+    if (len == 0)
+        len = 1;
+    for (size_t i = 0; i < watchpoints.size(); i++)
     {
-        return bus->load(addr) & 0xFF;
+        const Watchpoint &w = watchpoints[i];
+        if (w.addr == addr && w.len == len && w.kind == kind)
+        {
+            watchpoints.erase(watchpoints.begin() + i);
+            update_watch_pages();
+            return true;
+        }
     }
+    return false;
+}
 
-    return mem.at(addr);
+// Rebuild the watch bits of the page table from the watchpoint list
+void RISCV::update_watch_pages()
+{
+    for (size_t i = 0; i < page_flags.size(); i++)
+        page_flags[i] &= ~(PAGE_WATCH_READ | PAGE_WATCH_WRITE);
+
+    for (size_t i = 0; i < watchpoints.size(); i++)
+    {
+        const Watchpoint &w = watchpoints[i];
+        uint8_t bits = ((w.kind & WATCH_READ) ? PAGE_WATCH_READ : 0) |
+                       ((w.kind & WATCH_WRITE) ? PAGE_WATCH_WRITE : 0);
+        // Start 3 bytes early so a word access straddling into the range
+        // from the previous page is caught as well
+        uint32_t first = w.addr >= 3 ? w.addr - 3 : 0;
+        uint32_t last = w.addr + (w.len - 1);
+        for (uint64_t page = first >> PAGE_SHIFT; page <= (last >> PAGE_SHIFT); page++)
+            page_flags[page] |= bits;
+    }
 }
 
-uint16_t RISCV::load16(uint32_t addr)
+void RISCV::track_page_writes(bool enable)
 {
-    cycles++; // Memory access cycle
-    return mem.at(addr) | (mem.at(addr + 1) << 8);
+    uint32_t pages = (uint32_t)((mem.size() + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    for (uint32_t page = 0; page < pages; page++)
+    {
+        if (enable)
+            page_flags[page] |= PAGE_TRACK_WRITE;
+        else
+            page_flags[page] &= ~PAGE_TRACK_WRITE;
+    }
 }
 
-uint32_t RISCV::load32(uint32_t addr)
+void RISCV::track_page_write(uint32_t page)
 {
-    cycles++; // Memory access cycle
+    page_flags[page] |= PAGE_TRACK_WRITE;
+}
 
-    // Check if this is MMIO address (aligned access)
-    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+void RISCV::set_page_loader(PageLoader *loader)
+{
+    page_loader = loader;
+    uint32_t pages = (uint32_t)((mem.size() + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    for (uint32_t page = 0; page < pages; page++)
     {
-        return bus->load(addr);
+        if (loader)
+            page_flags[page] |= PAGE_LAZY | PAGE_UNLOADED;
+        else
+            page_flags[page] &= ~(PAGE_LAZY | PAGE_UNLOADED);
     }
+}
 
-    return mem.at(addr) | (mem.at(addr + 1) << 8) | (mem.at(addr + 2) << 16) | (mem.at(addr + 3) << 24);
+// Loads the page and its successor, which an access at the end of this
+// page can spill into without coming through the slow path again
+void RISCV::page_in(uint32_t page)
+{
+    for (uint32_t p = page; p <= page + 1 && p < page_flags.size(); p++)
+    {
+        if (page_flags[p] & PAGE_UNLOADED)
+        {
+            page_flags[p] &= ~PAGE_UNLOADED;
+            page_loader->load_page(*this, p);
+        }
+    }
+    page_flags[page] &= ~PAGE_LAZY;
 }
 
-void RISCV::store8(uint32_t addr, uint8_t value)
+void RISCV::page_in_all()
 {
-    cycles++; // Memory access cycle
+    if (!page_loader)
+        return;
+    uint32_t pages = (uint32_t)((mem.size() + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    for (uint32_t page = 0; page < pages; page++)
+    {
+        if (page_flags[page] & PAGE_LAZY)
+            page_in(page);
+    }
+}
 
-    // Check if this is MMIO address
-    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+bool RISCV::flagged_fetch()
+{
+    if (page_flags[pc >> PAGE_SHIFT] & PAGE_LAZY)
+        page_in(pc >> PAGE_SHIFT);
+    return (page_flags[pc >> PAGE_SHIFT] & PAGE_BREAKPOINT) && hit_breakpoint();
+}
+
+// Slow path of the load accessors; true if the page has a watchpoint
+bool RISCV::flagged_read(uint32_t addr)
+{
+    if (page_flags[addr >> PAGE_SHIFT] & PAGE_LAZY)
+        page_in(addr >> PAGE_SHIFT);
+    return (page_flags[addr >> PAGE_SHIFT] & PAGE_WATCH_READ) != 0;
+}
+
+void RISCV::first_page_write(uint32_t page)
+{
+    page_flags[page] &= ~PAGE_TRACK_WRITE;
+    if (page_write_observer)
+        page_write_observer->before_page_write(*this, page);
+}
+
+// Slow path of the store accessors for flagged pages. Returns true if the
+// store was done here (watched page), false to let the accessor do it.
+bool RISCV::flagged_write(uint32_t addr, uint32_t size, uint32_t value)
+{
+    uint32_t page = addr >> PAGE_SHIFT;
+    if (page_flags[page] & PAGE_LAZY)
+        page_in(page);
+    if (page_flags[page] & PAGE_TRACK_WRITE)
     {
-        bus->store(addr, value);
-        return;
+        first_page_write(page);
+        // Stores to this page no longer come here, so a later misaligned
+        // one spilling into the next page would go unseen
+        if (page + 1 < page_flags.size() && (page_flags[page + 1] & PAGE_TRACK_WRITE))
+            first_page_write(page + 1);
     }
 
-    mem.at(addr) = value;
+    if (page_flags[page] & PAGE_CODE)
+        code_written(addr, size);
+
+    if (!(page_flags[page] & PAGE_WATCH_WRITE))
+        return false;
+    watched_write(addr, size, value);
+    return true;
 }
 
-void RISCV::store16(uint32_t addr, uint16_t value)
+bool RISCV::hit_breakpoint()
 {
-    cycles++; // Memory access cycle
-    mem.at(addr) = value & 0xFF;
-    mem.at(addr + 1) = (value >> 8) & 0xFF;
+    if (ignore_breakpoint || !breakpoints.count(pc))
+        return false;
+    halt(DebugEvent::BREAKPOINT);
+    return true;
 }
 
-void RISCV::store32(uint32_t addr, uint32_t value)
+// Slow path of the accessors for pages holding a watchpoint: the access
+// is done here (same MMIO/RAM rules as read8/16/32 and write8/16/32) so
+// the old value can be captured before a store lands
+uint32_t RISCV::watched_read(uint32_t addr, uint32_t size)
 {
-    cycles++; // Memory access cycle
+    uint32_t value;
+    if (bus && size != 2 && (addr >= 0x1000 && addr <= 0x1FFF))
+    {
+        value = bus->load(addr);
+        if (size == 1)
+            value &= 0xFF;
+    }
+    else
+    {
+        value = 0;
+        for (uint32_t i = 0; i < size; i++)
+            value |= (uint32_t)mem.at(addr + i) << (8 * i);
+    }
 
-    // Check if this is MMIO address (aligned access)
-    if (bus && (addr >= 0x1000 && addr <= 0x1FFF))
+    notify_watch(addr, size, WATCH_READ, value, value);
+    return value;
+}
+
+void RISCV::watched_write(uint32_t addr, uint32_t size, uint32_t value)
+{
+    uint32_t old_value = 0;
+    if (bus && size != 2 && (addr >= 0x1000 && addr <= 0x1FFF))
     {
         bus->store(addr, value);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < size; i++)
+        {
+            uint8_t &byte = mem.at(addr + i);
+            old_value |= (uint32_t)byte << (8 * i);
+            byte = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    notify_watch(addr, size, WATCH_WRITE, old_value, value);
+}
+
+// Precise range check once the page flag says a watchpoint may be touched.
+// The access itself completes; a stopping watchpoint halts the CPU after
+// the instruction.
+void RISCV::notify_watch(uint32_t addr, uint32_t size, uint8_t kind, uint32_t old_value, uint32_t new_value)
+{
+    for (size_t i = 0; i < watchpoints.size(); i++)
+    {
+        const Watchpoint &w = watchpoints[i];
+        if (!(w.kind & kind) || addr > w.addr + (w.len - 1) || w.addr > addr + (size - 1))
+            continue;
+
+        WatchHit hit;
+        hit.watch = w;
+        hit.pc = pc - 4; // pc already points past the load/store
+        hit.addr = addr;
+        hit.size = size;
+        hit.kind = kind;
+        hit.old_value = old_value;
+        hit.new_value = new_value;
+
+        for (size_t j = 0; j < watch_observers.size(); j++)
+            watch_observers[j]->on_watch(*this, hit);
+
+        if (w.stop)
+        {
+            watch_hit = hit;
+            halt(DebugEvent::WATCHPOINT);
+        }
+    }
+}
+
+void RISCV::halt(DebugEvent event)
+{
+    debug_event = event;
+    running = false;
+}
+
+void RISCV::resume()
+{
+    if (debug_event == DebugEvent::NONE)
         return;
+    debug_event = DebugEvent::NONE;
+    running = true;
+}
+
+void RISCV::step_over()
+{
+    ignore_breakpoint = true;
+    step();
+    ignore_breakpoint = false;
+}
+
+bool RISCV::run_to(uint32_t addr)
+{
+    bool existing = breakpoints.count(addr) != 0;
+    add_breakpoint(addr);
+    while (running)
+        run_for(100000);
+    bool reached = debug_event == DebugEvent::BREAKPOINT && pc == addr;
+    if (!existing)
+        remove_breakpoint(addr);
+    resume();
+    return reached;
+}
+
+bool RISCV::debug_read(uint32_t addr, uint8_t &value)
+{
+    return debug_read(addr, &value, 1) == 1;
+}
+
+uint32_t RISCV::debug_read(uint32_t addr, uint8_t *out, uint32_t len)
+{
+    uint32_t word_addr = 0, word = 0;
+    bool have_word = false;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        uint32_t a = addr + i;
+        if (bus && (a >= 0x1000 && a <= 0x1FFF))
+        {
+            if (!have_word || word_addr != (a & ~0x3u))
+            {
+                word_addr = a & ~0x3u;
+                word = bus->peek(word_addr);
+                have_word = true;
+            }
+            out[i] = (word >> (8 * (a & 0x3))) & 0xFF;
+            continue;
+        }
+        if (a >= mem.size())
+            return i;
+        if (page_flags[a >> PAGE_SHIFT] & PAGE_LAZY)
+            page_in(a >> PAGE_SHIFT);
+        out[i] = mem[a];
     }
+    return len;
+}
 
-    mem.at(addr) = value & 0xFF;
-    mem.at(addr + 1) = (value >> 8) & 0xFF;
-    mem.at(addr + 2) = (value >> 16) & 0xFF;
-    mem.at(addr + 3) = (value >> 24) & 0xFF;
+bool RISCV::debug_write(uint32_t addr, uint8_t value)
+{
+    if (addr >= mem.size() || (addr >= 0x1000 && addr <= 0x1FFF))
+        return false;
+    if (page_flags[addr >> PAGE_SHIFT] & PAGE_LAZY)
+        page_in(addr >> PAGE_SHIFT);
+    if (page_flags[addr >> PAGE_SHIFT] & PAGE_TRACK_WRITE)
+        first_page_write(addr >> PAGE_SHIFT);
+    if (page_flags[addr >> PAGE_SHIFT] & PAGE_CODE)
+        code_written(addr, 1);
+    mem[addr] = value;
+    return true;
+}
+
+void RISCV::save_state(StateWriter &w) const
+{
+    w.put(reg);
+    w.put(pc);
+    w.put(mstatus);
+    w.put(misa);
+    w.put(mie);
+    w.put(mtvec);
+    w.put(mscratch);
+    w.put(mip);
+    w.put(mepc);
+    w.put(mcause);
+    w.put(mtval);
+    w.put(medeleg);
+    w.put(mideleg);
+    w.put(stvec);
+    w.put(sscratch);
+    w.put(sepc);
+    w.put(scause);
+    w.put(stval);
+    w.put(satp);
+    w.put(priv);
+    w.put(pmpcfg);
+    w.put(pmpaddr);
+    w.put(cycles);
+    w.put(instret);
+    w.put(last_mem_addr);
+    w.put(timing_mode);
+    w.put(pipeline);
+    w.put(running);
+}
+
+void RISCV::load_state(StateReader &r)
+{
+    r.get(reg);
+    r.get(pc);
+    r.get(mstatus);
+    r.get(misa);
+    r.get(mie);
+    r.get(mtvec);
+    r.get(mscratch);
+    r.get(mip);
+    r.get(mepc);
+    r.get(mcause);
+    r.get(mtval);
+    r.get(medeleg);
+    r.get(mideleg);
+    r.get(stvec);
+    r.get(sscratch);
+    r.get(sepc);
+    r.get(scause);
+    r.get(stval);
+    r.get(satp);
+    r.get(priv);
+    r.get(pmpcfg);
+    r.get(pmpaddr);
+    r.get(cycles);
+    r.get(instret);
+    r.get(last_mem_addr);
+    r.get(timing_mode);
+    r.get(pipeline);
+    r.get(running);
+    debug_event = DebugEvent::NONE;
+    pmp_locked = false;
+    for (uint32_t i = 0; i < PMP_ENTRIES; i++)
+        pmp_locked |= (pmpcfg[i] & PMP_L) && (pmpcfg[i] & PMP_A);
+    std::fill(pmp_pages.begin(), pmp_pages.end(), 0);
+    flush_tlb(); // And underneath the page tables
+    update_vm();
+    // RAM may have been restored underneath the traces
+    if (jit)
+        jit->flush();
+    flush_fusion();
 }
 
 void RISCV::load_program(const uint8_t *data, uint32_t size, uint32_t start_addr)
@@ -144,11 +1605,36 @@ void RISCV::load_program(const uint8_t *data, uint32_t size, uint32_t start_addr
         throw std::runtime_error("Program too large");
     std::memcpy(&mem[start_addr], data, size);
     pc = start_addr;
+    if (jit)
+        jit->flush();
+    flush_fusion();
 }
 
-void RISCV::trap(uint32_t cause, bool is_interrupt)
+void RISCV::trap(uint32_t cause, bool is_interrupt, uint32_t tval)
 {
     cycles += 4; // Trap handling takes extra cycles
+    idle_watching = false;
+
+    uint32_t deleg = is_interrupt ? mideleg : medeleg;
+    if (priv != PRIV_M && cause < 32 && (deleg & (1u << cause)))
+    {
+        // Delegated to S mode: the same steps on the supervisor CSRs
+        sepc = pc;
+        scause = is_interrupt ? cause | 0x80000000 : cause;
+        stval = tval;
+        uint32_t s = mstatus & ~(MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP);
+        if (mstatus & MSTATUS_SIE)
+            s |= MSTATUS_SPIE;
+        if (priv == PRIV_S)
+            s |= MSTATUS_SPP;
+        priv = PRIV_S;
+        write_csr(0x100, s);
+        pc = (stvec & ~0x3u) + ((stvec & 0x3) && is_interrupt ? 4 * cause : 0);
+
+        for (size_t i = 0; i < observers.size(); i++)
+            observers[i]->on_trap(*this, cause, is_interrupt);
+        return;
+    }
 
     uint32_t mstatus = read_csr(0x300);
 
@@ -168,7 +1654,12 @@ void RISCV::trap(uint32_t cause, bool is_interrupt)
     // disable interrupts
     mstatus &= ~(1 << 3);
 
+    // save the mode into MPP and enter M mode
+    mstatus = (mstatus & ~MSTATUS_MPP) | ((uint32_t)priv << 11);
+    priv = PRIV_M;
+
     write_csr(0x300, mstatus);
+    write_csr(0x343, tval);
 
     uint32_t mtvec = read_csr(0x305);
     uint32_t base = mtvec & ~0x3;
@@ -187,14 +1678,18 @@ void RISCV::trap(uint32_t cause, bool is_interrupt)
         else
             pc = base;
     }
+
+    for (size_t i = 0; i < observers.size(); i++)
+        observers[i]->on_trap(*this, cause, is_interrupt);
 }
 
 // INTERRUPT HANDLING
 
 void RISCV::check_interrupts()
 {
-    // Check if interrupts are globally enabled (MIE bit in mstatus)
-    if (!(mstatus & (1 << 3))) // MIE bit
+    // Check if interrupts are globally enabled (MIE bit in mstatus); less
+    // privileged modes are always open to M-mode interrupts
+    if (!(mstatus & (1 << 3)) && priv == PRIV_M) // MIE bit
         return;
 
     // Check external interrupts from Bus
@@ -233,19 +1728,10 @@ void RISCV::handle_interrupt(uint32_t interrupt_vector)
     }
 }
 
-bool RISCV::is_interrupt_enabled(uint32_t vector)
+bool RISCV::is_interrupt_enabled(uint32_t vector) const
 {
-    // Check global interrupt enable (MIE in mstatus)
-    if (!(mstatus & (1 << 3))) // MIE bit
-        return false;
-
-    // Check specific interrupt enable in MIE register
-    if (vector < 32)
-    {
-        return (mie & (1 << vector)) != 0;
-    }
-
-    return false;
+    // Enabled in MIE, and globally for the mode that would take it
+    return vector < 32 && interrupt_taken(1u << vector);
 }
 
 void RISCV::trigger_external_interrupt(uint32_t vector)
@@ -278,6 +1764,7 @@ void RISCV::clear_external_interrupt(uint32_t vector)
     }
 }
 
+template <bool Timed>
 void RISCV::exec(uint32_t instr)
 {
     uint32_t opcode = instr & 0x7F;
@@ -612,24 +2099,25 @@ void RISCV::exec(uint32_t instr)
     {
         int32_t imm = sign_extend(instr >> 20, 12);
         uint32_t addr = reg[rs1] + imm;
+        last_mem_addr = addr;
         extra_cycles = 2; // Load instructions take extra cycles (memory access)
 
         switch (funct3)
         {
         case 0x0: // LB
-            reg[rd] = sign_extend(load8(addr), 8);
+            reg[rd] = sign_extend(read8<Timed>(addr), 8);
             break;
         case 0x1: // LH
-            reg[rd] = sign_extend(load16(addr), 16);
+            reg[rd] = sign_extend(read16<Timed>(addr), 16);
             break;
         case 0x2: // LW
-            reg[rd] = load32(addr);
+            reg[rd] = read32<Timed>(addr);
             break;
         case 0x4: // LBU
-            reg[rd] = load8(addr);
+            reg[rd] = read8<Timed>(addr);
             break;
         case 0x5: // LHU
-            reg[rd] = load16(addr);
+            reg[rd] = read16<Timed>(addr);
             break;
         default:
             throw std::runtime_error("Unknown LOAD funct3");
@@ -643,18 +2131,19 @@ void RISCV::exec(uint32_t instr)
         uint32_t imm = ((instr >> 7) & 0x1F) | ((instr >> 25) << 5);
         int32_t simm = sign_extend(imm, 12);
         uint32_t addr = reg[rs1] + simm;
+        last_mem_addr = addr;
         extra_cycles = 2; // Store instructions take extra cycles (memory access)
 
         switch (funct3)
         {
         case 0x0: // SB
-            store8(addr, reg[rs2] & 0xFF);
+            write8<Timed>(addr, reg[rs2] & 0xFF);
             break;
         case 0x1: // SH
-            store16(addr, reg[rs2] & 0xFFFF);
+            write16<Timed>(addr, reg[rs2] & 0xFFFF);
             break;
         case 0x2: // SW
-            store32(addr, reg[rs2]);
+            write32<Timed>(addr, reg[rs2]);
             break;
         default:
             throw std::runtime_error("Unknown STORE funct3");
@@ -662,9 +2151,12 @@ void RISCV::exec(uint32_t instr)
         break;
     }
 
-    // MISC-MEM (FENCE)
+    // MISC-MEM (FENCE, FENCE.I)
     case 0x0F:
-        // FENCE instruction - do nothing in emulator
+        // Memory is sequentially consistent here, and stores into code
+        // drop its translations as they happen (code_written), so neither
+        // has anything left to do. The pipeline model charges the refetch
+        // after FENCE.I.
         extra_cycles = 1; // FENCE has small penalty
         break;
 
@@ -679,14 +2171,25 @@ void RISCV::exec(uint32_t instr)
         {
             if (imm12 == 0x0)
             {
-                // ECALL
-                if (env)
+                // ECALL: the environment serves M mode; from S and U mode
+                // it traps to the guest's own handler
+                if (priv != PRIV_M)
+                {
+                    pc -= 4;
+                    trap(8 + priv);
+                }
+                else if (env)
                     env->on_trap(*this, 11);
             }
             else if (imm12 == 0x1)
             {
-                // EBREAK
-                if (env)
+                // EBREAK: report to an attached debugger, else the environment
+                if (halt_on_ebreak)
+                {
+                    pc -= 4;
+                    halt(DebugEvent::EBREAK);
+                }
+                else if (env)
                     env->on_trap(*this, 3);
             }
             else if (imm12 == 0x105) // WFI instruction (0x105)
@@ -715,19 +2218,61 @@ void RISCV::exec(uint32_t instr)
                 }
                 // else: interrupts pending - continue to next instruction
             }
-            else if (imm12 == 0x302) // MRET
+            else if ((imm12 == 0x302 && priv == PRIV_M) || (imm12 == 0x102 && priv != PRIV_U)) // MRET, SRET
             {
+                bool m_ret = imm12 == 0x302;
                 uint32_t m = read_csr(0x300);
-                uint32_t mpie = (m >> 7) & 1;
+                uint32_t pie = m_ret ? (m >> 7) & 1 : (m >> 5) & 1;
 
-                m = (m & ~(1 << 3)) | (mpie << 3);
-                m |= (1 << 7);
+                if (m_ret)
+                {
+                    m = (m & ~(1 << 3)) | (pie << 3);
+                    m |= (1 << 7);
+                    priv = (Privilege)((m & MSTATUS_MPP) >> 11);
+                    m &= ~MSTATUS_MPP; // Back to U
+                }
+                else
+                {
+                    m = (m & ~MSTATUS_SIE) | (pie << 1);
+                    m |= MSTATUS_SPIE;
+                    priv = (m & MSTATUS_SPP) ? PRIV_S : PRIV_U;
+                    m &= ~MSTATUS_SPP;
+                }
+                if (priv == 2)
+                    priv = PRIV_U; // MPP is WARL; 2 is reserved
+                if (priv != PRIV_M)
+                    m &= ~MSTATUS_MPRV;
 
                 write_csr(0x300, m);
 
-                pc = read_csr(0x341) & ~1u;
+                pc = read_csr(m_ret ? 0x341 : 0x141) & ~1u;
                 extra_cycles = 5; // MRET takes longer
             }
+            else if ((instr >> 25) == 0x09 && rd == 0 && priv != PRIV_U) // SFENCE.VMA
+            {
+                // Entries carry no ASID: rs2 is ignored, and a page is
+                // dropped only from the slots it maps to
+                uint32_t vpn = reg[rs1] >> PAGE_SHIFT;
+                if (rs1 == 0)
+                    flush_tlb();
+                for (int k = 0; k < 2 && rs1 != 0; k++)
+                {
+                    if (tlb[k][vpn & (TLB_SIZE - 1)].vpn == vpn)
+                        tlb[k][vpn & (TLB_SIZE - 1)].vpn = TLB_INVALID;
+                }
+            }
+            else if (imm12 == 0x302 || imm12 == 0x102 || (instr >> 25) == 0x09)
+            {
+                // Privileged instruction in a less privileged mode
+                pc -= 4;
+                trap(2, false, instr);
+            }
+        }
+        else if (((instr >> 28) & 3) > priv)
+        {
+            // CSR of a more privileged mode
+            pc -= 4;
+            trap(2, false, instr);
         }
         else
         {
@@ -754,6 +2299,24 @@ void RISCV::exec(uint32_t instr)
                     write_csr(csr_addr, csr_val & ~reg[rs1]);
                 break;
 
+            // Immediate forms: rs1 field is a 5-bit zero-extended immediate
+            case 5:
+                reg[rd] = csr_val;
+                write_csr(csr_addr, rs1);
+                break;
+
+            case 6:
+                reg[rd] = csr_val;
+                if (rs1)
+                    write_csr(csr_addr, csr_val | rs1);
+                break;
+
+            case 7:
+                reg[rd] = csr_val;
+                if (rs1)
+                    write_csr(csr_addr, csr_val & ~rs1);
+                break;
+
             default:
                 trap(2);
                 break;
@@ -768,7 +2331,224 @@ void RISCV::exec(uint32_t instr)
     }
 
     // Add extra cycles for this instruction
-    cycles += extra_cycles;
+    if (Timed)
+        cycles += extra_cycles;
+}
+
+// Entries are matched by word, not just by address, so any entry that
+// equals the fetched word decodes it correctly
+template <bool Timed>
+inline void RISCV::exec_fetched(uint32_t addr, uint32_t instr)
+{
+    uint32_t index = (addr - decoded_base) >> 2;
+    if (index < decoded_count && decoded[index].word == instr)
+        exec_decoded<Timed>(decoded[index]);
+    else
+        exec<Timed>(instr);
+}
+
+// exec() with the decoding done ahead of time (decode_insn)
+template <bool Timed>
+void RISCV::exec_decoded(const DecodedInsn &d)
+{
+    uint32_t a = reg[d.rs1];
+    uint32_t b = reg[d.rs2];
+    uint32_t extra_cycles = d.cost;
+
+    switch (d.op)
+    {
+    case INSN_LUI:
+        reg[d.rd] = d.imm;
+        break;
+    case INSN_AUIPC:
+        reg[d.rd] = pc - 4 + d.imm;
+        break;
+    case INSN_JAL:
+        reg[d.rd] = pc;
+        pc += d.imm - 4;
+        break;
+    case INSN_JALR:
+    {
+        uint32_t target = (a + d.imm) & ~1u;
+        reg[d.rd] = pc;
+        pc = target;
+        break;
+    }
+
+    case INSN_BEQ:
+    case INSN_BNE:
+    case INSN_BLT:
+    case INSN_BGE:
+    case INSN_BLTU:
+    case INSN_BGEU:
+    {
+        bool branch;
+        switch (d.op)
+        {
+        case INSN_BEQ:
+            branch = a == b;
+            break;
+        case INSN_BNE:
+            branch = a != b;
+            break;
+        case INSN_BLT:
+            branch = (int32_t)a < (int32_t)b;
+            break;
+        case INSN_BGE:
+            branch = (int32_t)a >= (int32_t)b;
+            break;
+        case INSN_BLTU:
+            branch = a < b;
+            break;
+        default:
+            branch = a >= b;
+            break;
+        }
+        if (branch)
+        {
+            pc += d.imm - 4;
+            extra_cycles++; // Branch taken penalty
+        }
+        break;
+    }
+
+    case INSN_LB:
+        last_mem_addr = a + d.imm;
+        reg[d.rd] = sign_extend(read8<Timed>(last_mem_addr), 8);
+        break;
+    case INSN_LH:
+        last_mem_addr = a + d.imm;
+        reg[d.rd] = sign_extend(read16<Timed>(last_mem_addr), 16);
+        break;
+    case INSN_LW:
+        last_mem_addr = a + d.imm;
+        reg[d.rd] = read32<Timed>(last_mem_addr);
+        break;
+    case INSN_LBU:
+        last_mem_addr = a + d.imm;
+        reg[d.rd] = read8<Timed>(last_mem_addr);
+        break;
+    case INSN_LHU:
+        last_mem_addr = a + d.imm;
+        reg[d.rd] = read16<Timed>(last_mem_addr);
+        break;
+    case INSN_SB:
+        last_mem_addr = a + d.imm;
+        write8<Timed>(last_mem_addr, b & 0xFF);
+        break;
+    case INSN_SH:
+        last_mem_addr = a + d.imm;
+        write16<Timed>(last_mem_addr, b & 0xFFFF);
+        break;
+    case INSN_SW:
+        last_mem_addr = a + d.imm;
+        write32<Timed>(last_mem_addr, b);
+        break;
+
+    case INSN_ADDI:
+        reg[d.rd] = a + d.imm;
+        break;
+    case INSN_SLTI:
+        reg[d.rd] = (int32_t)a < d.imm ? 1 : 0;
+        break;
+    case INSN_SLTIU:
+        reg[d.rd] = a < (uint32_t)d.imm ? 1 : 0;
+        break;
+    case INSN_XORI:
+        reg[d.rd] = a ^ d.imm;
+        break;
+    case INSN_ORI:
+        reg[d.rd] = a | d.imm;
+        break;
+    case INSN_ANDI:
+        reg[d.rd] = a & d.imm;
+        break;
+    case INSN_SLLI:
+        reg[d.rd] = a << d.imm;
+        break;
+    case INSN_SRLI:
+        reg[d.rd] = a >> d.imm;
+        break;
+    case INSN_SRAI:
+        reg[d.rd] = (int32_t)a >> d.imm;
+        break;
+
+    case INSN_ADD:
+        reg[d.rd] = a + b;
+        break;
+    case INSN_SUB:
+        reg[d.rd] = a - b;
+        break;
+    case INSN_SLL:
+        reg[d.rd] = a << (b & 0x1F);
+        break;
+    case INSN_SLT:
+        reg[d.rd] = (int32_t)a < (int32_t)b ? 1 : 0;
+        break;
+    case INSN_SLTU:
+        reg[d.rd] = a < b ? 1 : 0;
+        break;
+    case INSN_XOR:
+        reg[d.rd] = a ^ b;
+        break;
+    case INSN_SRL:
+        reg[d.rd] = a >> (b & 0x1F);
+        break;
+    case INSN_SRA:
+        reg[d.rd] = (int32_t)a >> (b & 0x1F);
+        break;
+    case INSN_OR:
+        reg[d.rd] = a | b;
+        break;
+    case INSN_AND:
+        reg[d.rd] = a & b;
+        break;
+
+    case INSN_MUL:
+        reg[d.rd] = (uint32_t)((int64_t)(int32_t)a * (int64_t)(int32_t)b);
+        break;
+    case INSN_MULH:
+        reg[d.rd] = (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+        break;
+    case INSN_MULHSU:
+        reg[d.rd] = (uint32_t)(((int64_t)(int32_t)a * (int64_t)b) >> 32);
+        break;
+    case INSN_MULHU:
+        reg[d.rd] = (uint32_t)(((uint64_t)a * (uint64_t)b) >> 32);
+        break;
+    case INSN_DIV:
+        if (b == 0)
+            reg[d.rd] = UINT32_MAX;
+        else if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+            reg[d.rd] = a;
+        else
+            reg[d.rd] = (uint32_t)((int32_t)a / (int32_t)b);
+        break;
+    case INSN_DIVU:
+        reg[d.rd] = b == 0 ? UINT32_MAX : a / b;
+        break;
+    case INSN_REM:
+        if (b == 0)
+            reg[d.rd] = a;
+        else if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+            reg[d.rd] = 0;
+        else
+            reg[d.rd] = (uint32_t)((int32_t)a % (int32_t)b);
+        break;
+    case INSN_REMU:
+        reg[d.rd] = b == 0 ? a : a % b;
+        break;
+
+    case INSN_FENCE:
+        break;
+
+    default:
+        exec<Timed>(d.word); // System instructions, rejected encodings
+        return;
+    }
+
+    if (Timed)
+        cycles += extra_cycles;
 }
 
 uint64_t RISCV::get_cycles() const
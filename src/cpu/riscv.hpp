@@ -1,9 +1,52 @@
 #pragma once
 #include <iostream>
 #include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "../environment/environment.hpp"
 #include "../peripherals/bus.hpp"
+#include "pipeline.hpp"
+#include "observer.hpp"
+#include "watch.hpp"
+#include "counted_loop.hpp"
+#include "../snapshot/state.hpp"
+
+class AotImage;
+class DecodeCache;
+class TraceJit;
+struct DecodedInsn;
+struct RvAotBlock;
+struct RvAotContext;
+
+// How executed instructions are turned into cycles
+enum class TimingMode
+{
+    SIMPLE,    // Fixed per-instruction and per-access penalties
+    PIPELINE,  // In-order 5-stage pipeline model (see pipeline.hpp)
+    FUNCTIONAL // No timing: one cycle per instruction, fastest
+};
+
+// Custom machine-mode CSR: guest code writes a TimingMode value here to
+// switch timing around a region of interest
+constexpr uint32_t CSR_SIM_TIMING = 0x7C0;
+
+// Privilege levels, encoded as in mstatus.MPP
+enum Privilege : uint8_t
+{
+    PRIV_U = 0,
+    PRIV_S = 1,
+    PRIV_M = 3
+};
+
+// Why the CPU halted for a debugger (running is false, see RISCV::resume)
+enum class DebugEvent
+{
+    NONE,
+    BREAKPOINT, // About to execute a breakpoint address
+    WATCHPOINT, // The last instruction accessed a watched range
+    EBREAK      // EBREAK executed with halt_on_ebreak set; pc points at it
+};
 
 class RISCV
 {
@@ -17,6 +60,7 @@ public:
     void reset();
     void run();
     void step();
+    uint64_t run_for(uint64_t max_steps); // Returns the number of steps executed
 
     // Fetch instruction
     uint32_t fetch32(uint32_t addr);
@@ -36,6 +80,13 @@ public:
     void set_environment(Environment *env_ptr) { env = env_ptr; }
     void set_bus(Bus *bus_ptr) { bus = bus_ptr; }
 
+    // Instrumentation (profilers, tracers); not owned
+    void add_observer(ExecObserver *observer) { observers.push_back(observer); }
+    void add_watch_observer(WatchObserver *observer) { watch_observers.push_back(observer); }
+
+    uint32_t get_pc() const { return pc; }
+    void set_pc(uint32_t value) { pc = value; }
+
     // Register access (for environment or testing)
     uint32_t get_reg(uint32_t index) const { return reg[index]; }
     void set_reg(uint32_t index, uint32_t value)
@@ -49,10 +100,32 @@ public:
     {
         switch (addr)
         {
+        case 0x100:
+            return mstatus & SSTATUS_MASK; // Supervisor Status (view of mstatus)
+        case 0x104:
+            return mie & mideleg; // Supervisor Interrupt Enable
+        case 0x105:
+            return stvec; // Supervisor Trap Vector
+        case 0x140:
+            return sscratch; // Supervisor Scratch
+        case 0x141:
+            return sepc; // Supervisor Exception PC
+        case 0x142:
+            return scause; // Supervisor Exception Cause
+        case 0x143:
+            return stval; // Supervisor Trap Value
+        case 0x144:
+            return mip & mideleg; // Supervisor Interrupt Pending
+        case 0x180:
+            return satp; // Supervisor Address Translation
         case 0x300:
             return mstatus; // Machine Status
         case 0x301:
             return misa; // Machine ISA
+        case 0x302:
+            return medeleg; // Machine Exception Delegation
+        case 0x303:
+            return mideleg; // Machine Interrupt Delegation
         case 0x304:
             return mie; // Machine Interrupt Enable
         case 0x305:
@@ -67,7 +140,11 @@ public:
             return mtval; // Machine Trap Value
         case 0x344:
             return mip; // Machine Interrupt Pending
+        case CSR_SIM_TIMING:
+            return (uint32_t)timing_mode; // Simulator timing mode
         default:
+            if (addr >= CSR_PMPCFG0 && addr < CSR_PMPADDR0 + PMP_ENTRIES)
+                return read_pmp(addr); // Physical Memory Protection
             return 0; // or trap later
         }
     }
@@ -76,12 +153,49 @@ public:
     {
         switch (addr)
         {
+        case 0x100:
+            mstatus = (mstatus & ~SSTATUS_MASK) | (val & SSTATUS_MASK);
+            update_vm();
+            break; // Supervisor Status
+        case 0x104:
+            mie = (mie & ~mideleg) | (val & mideleg);
+            break; // Supervisor Interrupt Enable
+        case 0x105:
+            stvec = val;
+            break; // Supervisor Trap Vector
+        case 0x140:
+            sscratch = val;
+            break; // Supervisor Scratch
+        case 0x141:
+            sepc = val;
+            break; // Supervisor Exception PC
+        case 0x142:
+            scause = val;
+            break; // Supervisor Exception Cause
+        case 0x143:
+            stval = val;
+            break; // Supervisor Trap Value
+        case 0x144:
+            mip = (mip & ~mideleg) | (val & mideleg);
+            break; // Supervisor Interrupt Pending
+        case 0x180:
+            satp = val;
+            flush_tlb(); // Entries carry no ASID
+            update_vm();
+            break; // Supervisor Address Translation
         case 0x300:
             mstatus = val;
+            update_vm();
             break; // Machine Status
         case 0x301:
             misa = val;
             break; // Machine ISA
+        case 0x302:
+            medeleg = val & ~(1u << 11); // ECALL from M mode always stays there
+            break; // Machine Exception Delegation
+        case 0x303:
+            mideleg = val;
+            break; // Machine Interrupt Delegation
         case 0x304:
             mie = val;
             break; // Machine Interrupt Enable
@@ -103,22 +217,337 @@ public:
         case 0x344:
             mip = val;
             break; // Machine Interrupt Pending
+        case CSR_SIM_TIMING:
+            if (val <= (uint32_t)TimingMode::FUNCTIONAL)
+                set_timing_mode((TimingMode)val);
+            break; // Simulator timing mode
+        default:
+            if (addr >= CSR_PMPCFG0 && addr < CSR_PMPADDR0 + PMP_ENTRIES)
+                write_pmp(addr, val); // Physical Memory Protection
+            break;
         }
     }
-    void trap(uint32_t cause, bool is_interrupt = false);
+    // Takes a trap in M mode, or in S mode when a less privileged mode
+    // traps and medeleg/mideleg delegate the cause; tval goes to mtval/stval
+    void trap(uint32_t cause, bool is_interrupt = false, uint32_t tval = 0);
+    Privilege get_privilege() const { return priv; }
     uint64_t get_cycles() const;
+    uint64_t get_instret() const { return instret; }
+
+    // Effective address of the most recent load/store (for tracers)
+    uint32_t get_last_mem_addr() const { return last_mem_addr; }
+
+    // Timing mode can be switched at any instruction boundary; the
+    // functional behaviour is identical in every mode
+    void set_timing_mode(TimingMode mode);
+    TimingMode get_timing_mode() const { return timing_mode; }
+    PipelineModel &get_pipeline() { return pipeline; }
     bool is_running() const { return running; }
     void stop() { running = false; }
 
+    // Debugging. Breakpoint and watchpoint addresses are found through a
+    // per-page flag table: execution on pages without any only pays one
+    // byte load per fetch/access, never a compare against every breakpoint
+    void add_breakpoint(uint32_t addr);
+    bool remove_breakpoint(uint32_t addr);
+    // Watchpoints notify watch observers with the old and new value;
+    // stop=true also halts the CPU after the accessing instruction
+    void add_watchpoint(uint32_t addr, uint32_t len, uint8_t kind, bool stop = true);
+    bool remove_watchpoint(uint32_t addr, uint32_t len, uint8_t kind);
+    void set_halt_on_ebreak(bool halt) { halt_on_ebreak = halt; }
+    DebugEvent get_debug_event() const { return debug_event; }
+    const std::vector<Watchpoint> &get_watchpoints() const { return watchpoints; }
+    const WatchHit &get_watch_hit() const { return watch_hit; }
+    void resume();    // Continue after a debug halt
+    void step_over(); // One step, ignoring a breakpoint at the current pc
+    // Runs until the CPU is about to execute `addr` (fork server and
+    // fuzzer boot); false if the program stopped before getting there
+    bool run_to(uint32_t addr);
+
+    // Debugger memory access: no cycles, no watchpoints, no MMIO side
+    // effects; false if unmapped. The ranged read fetches each MMIO word
+    // once and returns how many bytes were readable.
+    bool debug_read(uint32_t addr, uint8_t &value);
+    uint32_t debug_read(uint32_t addr, uint8_t *out, uint32_t len);
+    bool debug_write(uint32_t addr, uint8_t value);
+
+    // Architectural and timing state for snapshots; RAM is not included,
+    // snapshot code reads it through get_ram() and tracks page writes
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r); // Also clears any debug halt
+    uint8_t *get_ram() { return mem.data(); }
+    uint32_t get_ram_size() const { return (uint32_t)mem.size(); }
+    static constexpr uint32_t PAGE_SIZE = 4096;
+
+    // After track_page_writes(true) the first store to each RAM page
+    // notifies the observer once; call again to re-arm every page
+    void set_page_write_observer(PageWriteObserver *observer) { page_write_observer = observer; }
+    void track_page_writes(bool enable);
+    void track_page_write(uint32_t page); // Re-arms a single page
+
+    // AFL-style edge coverage for fuzzing: every block transition (a
+    // taken jump, branch or trap return, or a branch falling through)
+    // bumps map[hash(previous block) ^ hash(next block)]. The map holds
+    // COVERAGE_MAP_SIZE counters; nullptr turns coverage off.
+    static constexpr uint32_t COVERAGE_MAP_SIZE = 1 << 16;
+    void set_coverage_map(uint8_t *map)
+    {
+        coverage_map = map;
+        coverage_prev = 0;
+    }
+    void reset_coverage() { coverage_prev = 0; } // Next edge starts from nowhere
+
+    // Lazy RAM: every page is filled by the loader on first access, so a
+    // large image costs nothing until it is touched. Code that reads
+    // get_ram() directly calls page_in_all() first.
+    void set_page_loader(PageLoader *loader);
+    void page_in_all();
+
+    // Ahead-of-time translated code (rvaot): run_for executes whole blocks
+    // natively in SIMPLE and FUNCTIONAL timing when there are no observers
+    // or coverage map, with exactly the interpreter's results. A store
+    // into a translated instruction retires the blocks holding it, which
+    // the interpreter runs from then on (until the next set_aot).
+    // nullptr detaches; the image must outlive its use here.
+    void set_aot(const AotImage *image);
+    const AotImage *get_aot() const { return aot; }
+    uint64_t get_aot_steps() const { return aot_steps; } // Instructions run translated
+    size_t get_aot_stale_blocks() const { return aot_stale.size(); }
+
+    // Trace JIT for hot loops (jit/trace_jit.hpp), used under the same
+    // conditions as an AOT image (which takes precedence). Attaching
+    // flushes the JIT's traces; nullptr detaches. Not owned.
+    void set_jit(TraceJit *trace_jit);
+    TraceJit *get_jit() const { return jit; }
+
+    // Pre-decoded program (decode_cache.hpp): a fetched word that the
+    // cache holds at its address skips decoding, in every timing mode.
+    // nullptr detaches; not owned.
+    void set_decode_cache(const DecodeCache *cache);
+    const DecodeCache *get_decode_cache() const { return decode_cache; }
+
+    // Macro-op fusion: the interpreter retires common compiler idioms
+    // (LUI+ADDI, AUIPC+ADDI, AUIPC+JALR, SLLI+SRLI) in one dispatch, with
+    // exactly the state and cycles of two steps. Pairs are recognised once
+    // per address. Used in SIMPLE and FUNCTIONAL timing when nothing needs
+    // to see single instructions and no AOT image or JIT is attached.
+    uint64_t get_fused_pairs() const { return fused_pairs; }
+
+    // Idle loops: a short loop that only loads, computes and branches, and
+    // comes back to its head with the registers it left with, will keep
+    // doing so until the bus changes. After a few such iterations the
+    // interpreter (or run_jit) skips whole ones, charging their cycles,
+    // instructions and bus ticks, up to the end of the run_for budget
+    // (external input only arrives between calls) or the next peripheral
+    // event. Used under the same conditions as fusion, and with no
+    // watchpoints set.
+    uint64_t get_idle_skipped() const { return idle_skipped; } // Instructions
+
+    // Counted loops: a loop of the same kind whose passes differ only by
+    // an induction variable stepping towards its bound (delay loops; stores
+    // to fixed addresses allowed) is advanced in closed form to the head of
+    // its last pass, within the same limits (see counted_loop.hpp)
+    uint64_t get_loop_skipped() const { return loop_skipped; } // Instructions
+
+    // Sv32 virtual memory: with satp.MODE set, fetches in S and U mode and
+    // their loads and stores (M mode too under mstatus.MPRV) are translated
+    // through a direct-mapped TLB that the accessors check first; a miss
+    // walks the page table, setting the A and D bits in hardware. Writes to
+    // satp and SFENCE.VMA flush it. Watchpoints, the debugger and the
+    // translated-code fast paths (AOT, JIT, fusion, idle and delay loops,
+    // which run in M mode only) see physical addresses.
+    uint64_t get_page_walks() const { return page_walks; }
+
     // Interrupt handling
     void check_interrupts();
     void handle_interrupt(uint32_t interrupt_vector);
-    bool is_interrupt_enabled(uint32_t vector);
+    bool is_interrupt_enabled(uint32_t vector) const;
     void trigger_external_interrupt(uint32_t vector);
     void clear_external_interrupt(uint32_t vector);
 
 private:
+    friend class LockstepGroup; // Runs several cores off one decode (lockstep.hpp)
+    friend class TraceJit;      // Compiled traces run on the core's state
+
+    template <TimingMode Mode>
+    uint64_t run_batch(uint64_t max_steps);
+    template <TimingMode Mode>
+    void step_impl();
+    template <TimingMode Mode>
+    uint32_t step_fused();
+    uint8_t fuse(uint32_t addr);
+    void flush_fusion();
+    uint64_t idle_back_edge(uint32_t from, uint64_t max_steps);
+    bool idle_body_pure(uint32_t head, uint32_t tail) const;
+    uint64_t count_passes(uint64_t max_passes, uint64_t steps);
+    template <TimingMode Mode>
+    uint64_t run_aot(uint64_t max_steps);
+    bool aot_can_enter(const RvAotBlock &block) const;
+    void aot_sync(RvAotContext *c, uint32_t k, uint32_t addr);
+    static uint32_t aot_load(RvAotContext *c, uint32_t k, uint32_t addr, uint32_t funct3);
+    static void aot_store(RvAotContext *c, uint32_t k, uint32_t addr, uint32_t value, uint32_t funct3);
+    static void aot_branch(RvAotContext *c, uint32_t pc, uint32_t next);
+    template <TimingMode Mode>
+    uint64_t run_jit(uint64_t max_steps);
+    bool interrupt_pending() const;
+    bool interrupt_taken(uint32_t bit) const;
+    // Loads (sign- or zero-extended) and stores by funct3, for translated code
+    uint32_t mem_read(uint32_t addr, uint32_t funct3, bool timed);
+    void mem_write(uint32_t addr, uint32_t funct3, uint32_t value, bool timed);
+    // PAGE_CODE is set while any translation (AOT, JIT) holds a reference
+    void acquire_code_page(uint32_t page);
+    void release_code_page(uint32_t page);
+    void code_written(uint32_t addr, uint32_t size);
+    template <bool Timed>
     void exec(uint32_t instr);
+    template <bool Timed>
+    void exec_fetched(uint32_t addr, uint32_t instr);
+    template <bool Timed>
+    void exec_decoded(const DecodedInsn &d);
+
+    // Memory accessors behind the public ones; Timed=false skips the
+    // per-access cycle accounting
+    template <bool Timed>
+    uint32_t fetch(uint32_t addr);
+    template <bool Timed>
+    uint8_t read8(uint32_t addr);
+    template <bool Timed>
+    uint16_t read16(uint32_t addr);
+    template <bool Timed>
+    uint32_t read32(uint32_t addr);
+    template <bool Timed>
+    void write8(uint32_t addr, uint8_t value);
+    template <bool Timed>
+    void write16(uint32_t addr, uint16_t value);
+    template <bool Timed>
+    void write32(uint32_t addr, uint32_t value);
+
+    // mstatus fields
+    static constexpr uint32_t MSTATUS_SIE = 1u << 1;
+    static constexpr uint32_t MSTATUS_MIE = 1u << 3;
+    static constexpr uint32_t MSTATUS_SPIE = 1u << 5;
+    static constexpr uint32_t MSTATUS_MPIE = 1u << 7;
+    static constexpr uint32_t MSTATUS_SPP = 1u << 8;
+    static constexpr uint32_t MSTATUS_MPP = 3u << 11;
+    static constexpr uint32_t MSTATUS_MPRV = 1u << 17;
+    static constexpr uint32_t MSTATUS_SUM = 1u << 18;
+    static constexpr uint32_t MSTATUS_MXR = 1u << 19;
+    static constexpr uint32_t SSTATUS_MASK =
+        MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR;
+
+    // Address translation. A TLB entry maps one 4 KB virtual page (a slice
+    // of a megapage) and keeps the PTE's permissions, less what PMP denies,
+    // as TLB_* bits, which update_vm() turns into the bits each kind of
+    // access needs in the current mode. Fetches and data accesses have a
+    // TLB each, flushed only when its context (TlbContext) changes, so
+    // S/U transitions and traps to an unchecked M mode need no flush.
+    enum Access : uint8_t
+    {
+        ACCESS_FETCH,
+        ACCESS_LOAD,
+        ACCESS_STORE
+    };
+    enum TlbPerm : uint8_t
+    {
+        TLB_R = 1 << 0,
+        TLB_RX = 1 << 1, // Readable under mstatus.MXR
+        TLB_W = 1 << 2,  // Writable and already dirty
+        TLB_X = 1 << 3,
+        TLB_U = 1 << 4, // User page
+        TLB_S = 1 << 5  // Not a user page
+    };
+    enum TlbContext : uint8_t
+    {
+        TLB_CTX_PAGED, // Sv32, permissions of S/U-mode accesses
+        TLB_CTX_SU,    // Identity, PMP decisions for S and U mode
+        TLB_CTX_M      // Identity, locked PMP entries only
+    };
+    struct TlbEntry
+    {
+        uint32_t vpn; // TLB_INVALID when empty
+        uint32_t ppage;
+        uint8_t perm;
+    };
+    // Aborts the faulting instruction; step_impl takes the trap
+    struct MemFault
+    {
+        uint32_t cause;
+        uint32_t addr;
+    };
+    static constexpr uint32_t TLB_SIZE = 256;
+    static constexpr uint32_t TLB_INVALID = ~0u;
+    static constexpr uint32_t SATP_MODE = 1u << 31;
+
+    template <Access A, uint32_t Size>
+    uint32_t translate(uint32_t addr);
+    uint32_t walk(uint32_t addr, uint32_t size, Access access);
+    uint8_t walk_sv32(uint32_t addr, Access access, uint32_t &ppage);
+    void update_vm();
+    void flush_tlb();
+
+    // Physical memory protection: 16 entries that every S- and U-mode
+    // access must match, and that bind M mode too once locked. Their
+    // decision for each RAM page is computed once and goes into the TLB
+    // entries (identity-mapped without paging), so an access to a page one
+    // region covers whole costs a TLB hit. Pages that a region boundary
+    // splits are checked access by access.
+    static constexpr uint32_t CSR_PMPCFG0 = 0x3A0;
+    static constexpr uint32_t CSR_PMPADDR0 = 0x3B0;
+    static constexpr uint32_t PMP_ENTRIES = 16;
+    enum PmpBits : uint8_t
+    {
+        PMP_R = 1 << 0,
+        PMP_W = 1 << 1,
+        PMP_X = 1 << 2,
+        PMP_A = 3 << 3, // Address matching: OFF, TOR, NA4, NAPOT
+        PMP_L = 1 << 7,
+        // pmp_pages: the R/W/X an S/U access gets, the same for M shifted
+        // left by 3, or SPLIT when a region boundary lies in the page
+        PMP_PAGE_SPLIT = 1 << 6,
+        PMP_PAGE_KNOWN = 1 << 7
+    };
+    uint32_t read_pmp(uint32_t addr) const;
+    void write_pmp(uint32_t addr, uint32_t val);
+    bool pmp_range(uint32_t i, uint64_t &lo, uint64_t &hi) const;
+    uint8_t pmp_page(uint32_t page);
+    bool pmp_allows(uint32_t addr, uint32_t size, Access access, bool machine) const;
+
+    static constexpr uint32_t PAGE_SHIFT = 12;
+    enum PageFlags : uint8_t
+    {
+        PAGE_BREAKPOINT = 1 << 0,
+        PAGE_WATCH_READ = 1 << 1,
+        PAGE_WATCH_WRITE = 1 << 2,
+        PAGE_TRACK_WRITE = 1 << 3, // Not yet written since track_page_writes()
+        PAGE_LAZY = 1 << 4,        // This page or the next is not loaded yet
+        PAGE_UNLOADED = 1 << 5,    // This page is not loaded yet
+        PAGE_CODE = 1 << 6,        // Holds translated instructions (AOT image, JIT traces)
+        PAGE_FUSED = 1 << 7,       // Holds fusion entries (and a PAGE_CODE reference for them)
+    };
+
+    // Pair of instructions starting at a word, see step_fused
+    enum FusedPair : uint8_t
+    {
+        FUSE_UNKNOWN, // Not looked at yet
+        FUSE_NONE,
+        FUSE_LUI_ADDI,   // li rd, imm32
+        FUSE_AUIPC_ADDI, // la rd, symbol
+        FUSE_AUIPC_JALR, // call / tail
+        FUSE_SLLI_SRLI   // Zero extension
+    };
+
+    bool hit_breakpoint();
+    bool flagged_fetch();
+    bool flagged_read(uint32_t addr);
+    bool flagged_write(uint32_t addr, uint32_t size, uint32_t value);
+    void page_in(uint32_t page);
+    void first_page_write(uint32_t page);
+    uint32_t watched_read(uint32_t addr, uint32_t size);
+    void watched_write(uint32_t addr, uint32_t size, uint32_t value);
+    void notify_watch(uint32_t addr, uint32_t size, uint8_t kind, uint32_t old_value, uint32_t new_value);
+    void halt(DebugEvent event);
+    void update_watch_pages();
+    void cover_edge();
 
     uint32_t reg[32]{}; // x0-x31
     uint32_t pc = 0;
@@ -132,10 +561,95 @@ private:
     uint32_t mepc = 0;
     uint32_t mcause = 0;
     uint32_t mtval = 0;
-    uint64_t cycles = 0; // Cycle count for performance measurement
+    uint32_t medeleg = 0;
+    uint32_t mideleg = 0;
+    uint32_t stvec = 0;
+    uint32_t sscratch = 0;
+    uint32_t sepc = 0;
+    uint32_t scause = 0;
+    uint32_t stval = 0;
+    uint32_t satp = 0;
+    Privilege priv = PRIV_M;
+    uint64_t cycles = 0;  // Cycle count for performance measurement
+    uint64_t instret = 0; // Retired instruction count
+    uint32_t last_mem_addr = 0;
+    TimingMode timing_mode = TimingMode::SIMPLE;
+    PipelineModel pipeline;
     bool running = false;
     std::vector<uint8_t> mem; // RAM
 
     Environment *env = nullptr;
     Bus *bus = nullptr;
+    std::vector<ExecObserver *> observers;
+    std::vector<WatchObserver *> watch_observers;
+    PageWriteObserver *page_write_observer = nullptr;
+    PageLoader *page_loader = nullptr;
+    uint8_t *coverage_map = nullptr;
+    uint32_t coverage_prev = 0; // Hash of the previous block, shifted
+
+    // Translated code; the entry state of the running block lets
+    // callbacks reconstruct instret, pc and bus ticks mid-block
+    const AotImage *aot = nullptr;
+    uint64_t aot_steps = 0;
+    uint64_t aot_entry = 0;  // instret at block entry
+    uint32_t aot_start = 0;  // Block pc
+    uint32_t aot_ticked = 0; // Bus ticks already delivered for this block
+    std::unordered_set<uint32_t> aot_stale; // Blocks (by pc) whose code was written
+    TraceJit *jit = nullptr;
+    std::unordered_map<uint32_t, uint32_t> code_pages; // PAGE_CODE references
+
+    const DecodeCache *decode_cache = nullptr;
+    const DecodedInsn *decoded = nullptr; // Entry for decoded_base + 4 * i
+    uint32_t decoded_base = 0;
+    uint32_t decoded_count = 0;
+
+    // One FusedPair per RAM word, allocated on first use; cleared when
+    // either instruction is written and when RAM is replaced wholesale
+    std::vector<uint8_t> fusion;
+    std::vector<uint32_t> fusion_pages; // Pages marked PAGE_FUSED
+    uint64_t fused_pairs = 0;
+
+    // Loop watched by idle_back_edge, and the state of its last pass
+    // through the head. Forgotten on traps and at each run_for.
+    static constexpr uint32_t IDLE_MAX_BODY = 16; // Instructions
+    static constexpr uint32_t IDLE_CONFIRM = 3;   // Equal passes before a skip
+    bool idle_watching = false;
+    bool idle_pure = false; // The body passed idle_body_pure
+    uint32_t idle_head = 0;
+    uint32_t idle_tail = 0; // The jump back to the head
+    uint32_t idle_repeats = 0;
+    bool idle_countable = false; // Not yet ruled out by count_passes
+    uint32_t idle_counted = 0;   // Passes as long as the one before
+    uint32_t idle_regs[32];
+    uint64_t idle_cycles = 0;
+    uint64_t idle_instret = 0;
+    uint64_t idle_steps = 0; // Instructions and cycles of the last pass
+    uint64_t idle_pass_cycles = 0;
+    uint64_t idle_quiet = 0; // Bus ticks without an event from there on
+    uint64_t idle_skipped = 0;
+    CountedLoop counted;
+    uint64_t loop_skipped = 0;
+
+    uint8_t pmpcfg[PMP_ENTRIES] = {};
+    uint32_t pmpaddr[PMP_ENTRIES] = {};
+    bool pmp_locked = false;        // Some active entry binds M mode
+    std::vector<uint8_t> pmp_pages; // Per RAM page, 0 until computed
+
+    // Derived from priv, mstatus, satp and PMP by update_vm()
+    bool vm_fetch = false; // Fetches go through the TLB
+    bool vm_data = false;  // Loads and stores go through the TLB
+    bool bare = true;      // M mode, nothing checked: fast paths allowed
+    uint8_t tlb_need[3] = {}; // TLB_* bits each Access requires
+    uint8_t tlb_context[2] = {}; // TlbContext of the fetch and data TLBs
+    TlbEntry tlb[2][TLB_SIZE];   // Indexed by A != ACCESS_FETCH
+    uint64_t page_walks = 0;
+
+    // Debug state; page_flags covers the whole 32-bit address space
+    std::vector<uint8_t> page_flags;
+    std::unordered_set<uint32_t> breakpoints;
+    std::vector<Watchpoint> watchpoints;
+    WatchHit watch_hit{};
+    DebugEvent debug_event = DebugEvent::NONE;
+    bool ignore_breakpoint = false;
+    bool halt_on_ebreak = false;
 };
\ No newline at end of file
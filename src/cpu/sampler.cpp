@@ -0,0 +1,91 @@
+#include "sampler.hpp"
+#include <cmath>
+
+// Two-sided 95% Student t quantiles for 1..30 degrees of freedom
+static const double T95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+Sampler::Sampler(RISCV &cpu, const SamplerConfig &config) : cpu(cpu), config(config)
+{
+    if (this->config.window == 0)
+        this->config.window = 1;
+    if (this->config.period < this->config.warmup + this->config.window)
+        this->config.period = this->config.warmup + this->config.window;
+    enter(FAST_FORWARD);
+}
+
+void Sampler::enter(Phase next)
+{
+    phase = next;
+    switch (phase)
+    {
+    case FAST_FORWARD:
+        phase_left = config.period - config.warmup - config.window;
+        cpu.set_timing_mode(TimingMode::FUNCTIONAL);
+        break;
+    case WARMUP:
+        phase_left = config.warmup;
+        cpu.set_timing_mode(config.detailed);
+        break;
+    case MEASURE:
+        phase_left = config.window;
+        cpu.set_timing_mode(config.detailed);
+        window_cycles = cpu.get_cycles();
+        window_instret = cpu.get_instret();
+        break;
+    }
+}
+
+uint64_t Sampler::run_for(uint64_t max_steps)
+{
+    uint64_t done = 0;
+
+    while (cpu.is_running() && done < max_steps)
+    {
+        if (phase_left == 0)
+        {
+            if (phase == MEASURE)
+            {
+                uint64_t instructions = cpu.get_instret() - window_instret;
+                double cpi = (double)(cpu.get_cycles() - window_cycles) / instructions;
+
+                windows++;
+                double delta = cpi - cpi_mean;
+                cpi_mean += delta / windows;
+                cpi_m2 += delta * (cpi - cpi_mean);
+            }
+            enter(phase == FAST_FORWARD ? WARMUP : phase == WARMUP ? MEASURE : FAST_FORWARD);
+            continue;
+        }
+
+        uint64_t chunk = max_steps - done;
+        if (chunk > phase_left)
+            chunk = phase_left;
+
+        uint64_t ran = cpu.run_for(chunk);
+        done += ran;
+        phase_left -= ran;
+    }
+    return done;
+}
+
+SampleEstimate Sampler::estimate() const
+{
+    SampleEstimate e;
+    e.windows = windows;
+    e.instructions = cpu.get_instret();
+    if (windows == 0)
+        return e;
+
+    e.mean_cpi = cpi_mean;
+    e.cycles = cpi_mean * e.instructions;
+    if (windows > 1)
+    {
+        e.cpi_stddev = std::sqrt(cpi_m2 / (windows - 1));
+        double t = windows - 1 <= 30 ? T95[windows - 2] : 1.96;
+        e.ci95 = t * e.cpi_stddev / std::sqrt((double)windows) * e.instructions;
+    }
+    return e;
+}
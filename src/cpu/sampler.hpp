@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include "riscv.hpp"
+
+// Systematic sampling: every `period` instructions the core runs
+// `warmup` + `window` instructions with detailed timing and the rest in
+// FUNCTIONAL mode. Only the `window` part is measured; warm-up absorbs the
+// pipeline fill after each switch.
+struct SamplerConfig
+{
+    uint64_t period = 1000000; // Instructions per sampling unit
+    uint64_t warmup = 2000;    // Detailed instructions run and discarded before each window
+    uint64_t window = 10000;   // Detailed instructions measured per window
+    TimingMode detailed = TimingMode::PIPELINE;
+};
+
+// Extrapolated cost of the whole run
+struct SampleEstimate
+{
+    uint64_t windows = 0;      // Completed measurement windows
+    uint64_t instructions = 0; // Instructions retired in total
+    double mean_cpi = 0;
+    double cpi_stddev = 0;
+    double cycles = 0;         // Estimated total cycles
+    double ci95 = 0;           // Half-width of the 95% confidence interval on cycles
+};
+
+class Sampler
+{
+public:
+    Sampler(RISCV &cpu, const SamplerConfig &config = SamplerConfig());
+
+    // Drop-in replacement for RISCV::run_for that switches timing modes
+    // at sampling-unit boundaries
+    uint64_t run_for(uint64_t max_steps);
+
+    SampleEstimate estimate() const;
+
+private:
+    enum Phase
+    {
+        FAST_FORWARD,
+        WARMUP,
+        MEASURE
+    };
+
+    void enter(Phase next);
+
+    RISCV &cpu;
+    SamplerConfig config;
+    Phase phase = FAST_FORWARD;
+    uint64_t phase_left = 0;
+
+    uint64_t window_cycles = 0; // Cycle count at the start of the current window
+    uint64_t window_instret = 0;
+
+    // Running mean/variance of per-window CPI (Welford)
+    uint64_t windows = 0;
+    double cpi_mean = 0;
+    double cpi_m2 = 0;
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+
+enum WatchKind
+{
+    WATCH_READ = 1,
+    WATCH_WRITE = 2,
+    WATCH_ACCESS = WATCH_READ | WATCH_WRITE
+};
+
+// Watched guest address range
+struct Watchpoint
+{
+    uint32_t addr;
+    uint32_t len;
+    uint8_t kind; // WatchKind bits
+    bool stop;    // Halt the CPU on a hit (else only notify observers)
+};
+
+// One access that touched a watchpoint
+struct WatchHit
+{
+    Watchpoint watch;
+    uint32_t pc;        // Accessing instruction
+    uint32_t addr;      // Accessed address
+    uint32_t size;      // Access width in bytes
+    uint8_t kind;       // WATCH_READ or WATCH_WRITE
+    uint32_t old_value; // Memory before the access (0 for MMIO writes)
+    uint32_t new_value; // Memory after the access (the value read for loads)
+};
@@ -0,0 +1,293 @@
+#include "console.hpp"
+#include "timetravel.hpp"
+#include "../cpu/disasm.hpp"
+#include "../cpu/riscv.hpp"
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+DebugConsole::DebugConsole(RISCV &cpu, TimeTravel &history, const SymbolTable &symbols)
+    : cpu(cpu), history(history), symbols(symbols)
+{
+}
+
+static std::string hex32(uint32_t value)
+{
+    std::ostringstream s;
+    s << "0x" << std::hex << std::setw(8) << std::setfill('0') << value;
+    return s.str();
+}
+
+std::string DebugConsole::location(uint32_t addr) const
+{
+    const Symbol *sym = symbols.lookup(addr);
+    if (!sym)
+        return "";
+    std::ostringstream s;
+    s << " <" << sym->name;
+    if (addr != sym->addr)
+        s << "+0x" << std::hex << (addr - sym->addr);
+    s << ">";
+    return s.str();
+}
+
+bool DebugConsole::parse_address(const std::string &text, uint32_t &addr) const
+{
+    if (symbols.find(text, addr))
+        return true;
+    try
+    {
+        size_t used = 0;
+        addr = (uint32_t)std::stoul(text, &used, 0);
+        return used == text.size();
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+void DebugConsole::show_position(std::ostream &out) const
+{
+    uint32_t pc = cpu.get_pc();
+    uint8_t bytes[4];
+    bool mapped = cpu.debug_read(pc, bytes, 4) == 4;
+
+    out << "[" << cpu.get_instret() << " insns, cycle " << cpu.get_cycles() << "] " << hex32(pc) << location(pc);
+    if (mapped)
+    {
+        uint32_t instr = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+        out << ": " << disassemble(instr, pc);
+    }
+    out << std::endl;
+}
+
+void DebugConsole::show_registers(std::ostream &out) const
+{
+    for (uint32_t i = 0; i < 32; i++)
+    {
+        out << std::setw(5) << std::left << reg_name(i) << std::right << hex32(cpu.get_reg(i));
+        out << ((i % 4 == 3) ? "\n" : "   ");
+    }
+    out << "pc   " << hex32(cpu.get_pc()) << location(cpu.get_pc()) << std::endl;
+}
+
+void DebugConsole::show_memory(uint32_t addr, uint32_t words, std::ostream &out) const
+{
+    for (uint32_t i = 0; i < words; i++)
+    {
+        uint32_t a = addr + 4 * i;
+        if (i % 4 == 0)
+            out << hex32(a) << ":";
+        uint8_t bytes[4] = {};
+        bool mapped = cpu.debug_read(a, bytes, 4) == 4;
+        uint32_t value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+        out << " " << (mapped ? hex32(value) : "??????????");
+        if (i % 4 == 3 || i + 1 == words)
+            out << std::endl;
+    }
+}
+
+// Runs forward, stepping off a breakpoint at the current pc first, and
+// reports why execution stopped
+void DebugConsole::forward(uint64_t steps, std::ostream &out)
+{
+    if (!cpu.is_running())
+    {
+        if (cpu.get_debug_event() == DebugEvent::NONE)
+        {
+            out << "The program has ended; reverse-step or reverse-continue to go back" << std::endl;
+            return;
+        }
+        cpu.resume();
+    }
+
+    cpu.step_over();
+    if (steps > 1 && cpu.is_running())
+        history.run_for(steps - 1);
+
+    switch (cpu.get_debug_event())
+    {
+    case DebugEvent::BREAKPOINT:
+        out << "Breakpoint ";
+        break;
+    case DebugEvent::WATCHPOINT:
+    {
+        const WatchHit &hit = cpu.get_watch_hit();
+        out << "Watchpoint " << (hit.kind == WATCH_WRITE ? "write" : "read") << hit.size * 8 << " [" << hex32(hit.addr)
+            << "] " << std::hex << "0x" << hit.old_value << " -> 0x" << hit.new_value << std::dec << " at "
+            << hex32(hit.pc) << location(hit.pc) << std::endl;
+        break;
+    }
+    default:
+        if (!cpu.is_running())
+            out << "Program ended" << std::endl;
+        break;
+    }
+    show_position(out);
+}
+
+bool DebugConsole::execute(const std::string &line, std::ostream &out)
+{
+    std::istringstream words(line);
+    std::string cmd;
+    std::vector<std::string> args;
+    words >> cmd;
+    for (std::string arg; words >> arg;)
+        args.push_back(arg);
+
+    uint64_t count = 1;
+    if (!args.empty() && (cmd == "s" || cmd == "step" || cmd == "rs" || cmd == "reverse-step"))
+    {
+        try
+        {
+            count = std::stoull(args[0], nullptr, 0);
+        }
+        catch (const std::exception &)
+        {
+            out << "Bad count '" << args[0] << "'" << std::endl;
+            return true;
+        }
+    }
+
+    if (cmd.empty())
+    {
+        return true;
+    }
+    else if (cmd == "q" || cmd == "quit")
+    {
+        return false;
+    }
+    else if (cmd == "s" || cmd == "step")
+    {
+        forward(count, out);
+    }
+    else if (cmd == "c" || cmd == "continue")
+    {
+        forward(UINT64_MAX, out);
+    }
+    else if (cmd == "rs" || cmd == "reverse-step")
+    {
+        if (!history.reverse_step(count))
+            out << "At the oldest snapshot" << std::endl;
+        show_position(out);
+    }
+    else if (cmd == "rc" || cmd == "reverse-continue")
+    {
+        ReverseStop stop = history.reverse_continue();
+        if (stop.event == DebugEvent::BREAKPOINT)
+            out << "Breakpoint ";
+        else if (stop.event == DebugEvent::WATCHPOINT)
+            out << "Watchpoint [" << hex32(stop.watch.addr) << "] 0x" << std::hex << stop.watch.old_value << " -> 0x"
+                << stop.watch.new_value << std::dec << " at " << hex32(stop.watch.pc) << location(stop.watch.pc)
+                << std::endl;
+        else
+            out << "No earlier stop; at the oldest snapshot" << std::endl;
+        show_position(out);
+    }
+    else if (cmd == "b" || cmd == "break" || cmd == "d" || cmd == "delete")
+    {
+        uint32_t addr;
+        if (args.empty() || !parse_address(args[0], addr))
+        {
+            out << "Usage: " << cmd << " <addr|symbol>" << std::endl;
+            return true;
+        }
+        if (cmd[0] == 'b')
+        {
+            cpu.add_breakpoint(addr);
+            out << "Breakpoint at " << hex32(addr) << location(addr) << std::endl;
+        }
+        else if (!cpu.remove_breakpoint(addr))
+        {
+            out << "No breakpoint at " << hex32(addr) << std::endl;
+        }
+    }
+    else if (cmd == "w" || cmd == "watch")
+    {
+        uint32_t addr;
+        if (args.empty() || !parse_address(args[0], addr))
+        {
+            out << "Usage: watch <addr|symbol> [len] [r|w|rw]" << std::endl;
+            return true;
+        }
+        uint32_t len = 4;
+        uint8_t kind = WATCH_WRITE;
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            if (args[i] == "r")
+                kind = WATCH_READ;
+            else if (args[i] == "rw")
+                kind = WATCH_ACCESS;
+            else if (args[i] != "w")
+                len = (uint32_t)std::strtoul(args[i].c_str(), nullptr, 0);
+        }
+        cpu.add_watchpoint(addr, len, kind);
+        out << "Watching " << len << " bytes at " << hex32(addr) << location(addr) << std::endl;
+    }
+    else if (cmd == "r" || cmd == "regs")
+    {
+        show_registers(out);
+    }
+    else if (cmd == "x")
+    {
+        uint32_t addr;
+        if (args.empty() || !parse_address(args[0], addr))
+        {
+            out << "Usage: x <addr|symbol> [words]" << std::endl;
+            return true;
+        }
+        uint32_t n = args.size() > 1 ? (uint32_t)std::strtoul(args[1].c_str(), nullptr, 0) : 4;
+        show_memory(addr, n, out);
+    }
+    else if (cmd == "i" || cmd == "info")
+    {
+        show_position(out);
+        out << "History: " << history.get_snapshot_count() << " snapshots from instruction "
+            << history.get_oldest_instret() << ", " << (history.get_memory_used() + 1023) / 1024 << " KB" << std::endl;
+    }
+    else if (cmd == "h" || cmd == "help")
+    {
+        out << "step|s [n]               Execute n instructions\n"
+               "continue|c               Run to a breakpoint, watchpoint or the end\n"
+               "reverse-step|rs [n]      Go back n instructions\n"
+               "reverse-continue|rc      Go back to the previous breakpoint or watchpoint hit\n"
+               "break|b <addr|symbol>    Set a breakpoint\n"
+               "delete|d <addr|symbol>   Remove a breakpoint\n"
+               "watch|w <addr> [len] [r|w|rw]  Stop on accesses to a range\n"
+               "regs|r                   Show registers\n"
+               "x <addr> [words]         Show memory\n"
+               "info|i                   Position and history\n"
+               "quit|q                   Leave the debugger"
+            << std::endl;
+    }
+    else
+    {
+        out << "Unknown command '" << cmd << "' (try help)" << std::endl;
+    }
+    return true;
+}
+
+void DebugConsole::run(std::istream &in, std::ostream &out)
+{
+    show_position(out);
+    std::string line;
+    for (;;)
+    {
+        out << "(rvdb) " << std::flush;
+        if (!std::getline(in, line))
+            break;
+        try
+        {
+            if (!execute(line, out))
+                break;
+        }
+        catch (const std::exception &e)
+        {
+            // Machine faults leave the CPU where it failed; history is intact
+            out << "Error: " << e.what() << std::endl;
+            show_position(out);
+        }
+    }
+}
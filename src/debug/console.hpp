@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include "symbols.hpp"
+
+class RISCV;
+class TimeTravel;
+
+// Line-oriented debugger on the terminal, with reverse execution.
+//
+//   step|s [n]             rs|reverse-step [n]
+//   continue|c             rc|reverse-continue
+//   break|b <addr|symbol>  delete|d <addr|symbol>
+//   watch|w <addr> [len] [r|w|rw]
+//   regs|r   x <addr> [words]   info|i   help|h   quit|q
+//
+// The program's own stdin syscalls read from the same terminal when it
+// asks for input.
+class DebugConsole
+{
+public:
+    DebugConsole(RISCV &cpu, TimeTravel &history, const SymbolTable &symbols);
+
+    // Reads commands until quit or end of input
+    void run(std::istream &in, std::ostream &out);
+
+private:
+    bool execute(const std::string &line, std::ostream &out); // false to quit
+    void forward(uint64_t steps, std::ostream &out);
+    void show_position(std::ostream &out) const;
+    void show_registers(std::ostream &out) const;
+    void show_memory(uint32_t addr, uint32_t words, std::ostream &out) const;
+    bool parse_address(const std::string &text, uint32_t &addr) const;
+    std::string location(uint32_t addr) const;
+
+    RISCV &cpu;
+    TimeTravel &history;
+    const SymbolTable &symbols;
+};
@@ -0,0 +1,666 @@
+#include "gdb_stub.hpp"
+#include "../cpu/riscv.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static const uint32_t REG_PC = 32;
+static const uint32_t REG_CSR_BASE = 65; // GDB's RISC-V numbering for CSRs
+static const uint64_t STEPS_PER_POLL = 10000;
+static const uint32_t MAX_READ = 0x2000; // Bytes whose hex fits PacketSize=4000
+
+static const char TARGET_XML[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<architecture>riscv:rv32</architecture>"
+    "<feature name=\"org.gnu.gdb.riscv.cpu\">"
+    "<reg name=\"zero\" bitsize=\"32\" type=\"int\" regnum=\"0\"/>"
+    "<reg name=\"ra\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"gp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"tp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"t0\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"fp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"s1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a0\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a7\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s7\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s8\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s9\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s10\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s11\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+static const char HEX[] = "0123456789abcdef";
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Registers travel as target-endian (little-endian) hex
+static void append_le32(std::string &out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint8_t b = (value >> (8 * i)) & 0xFF;
+        out += HEX[b >> 4];
+        out += HEX[b & 0xF];
+    }
+}
+
+static bool parse_le32(const std::string &hex, size_t pos, uint32_t &value)
+{
+    if (pos + 8 > hex.size())
+        return false;
+    value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int hi = hex_value(hex[pos + 2 * i]);
+        int lo = hex_value(hex[pos + 2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        value |= (uint32_t)((hi << 4) | lo) << (8 * i);
+    }
+    return true;
+}
+
+GdbStub::GdbStub(RISCV &cpu) : cpu(cpu) {}
+
+#ifdef _WIN32
+
+GdbStub::~GdbStub() {}
+
+bool GdbStub::listen(const std::string &address)
+{
+    (void)address;
+    std::cerr << "Error: The GDB stub is not supported on Windows" << std::endl;
+    return false;
+}
+
+void GdbStub::serve() {}
+
+#else
+
+GdbStub::~GdbStub()
+{
+    if (fd >= 0)
+        close(fd);
+    if (listen_fd >= 0)
+        close(listen_fd);
+    if (!unix_path.empty())
+        unlink(unix_path.c_str());
+}
+
+bool GdbStub::listen(const std::string &address)
+{
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        unix_path = address.substr(5);
+        sockaddr_un sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        if (unix_path.empty() || unix_path.size() >= sizeof(sa.sun_path))
+        {
+            std::cerr << "Error: Invalid socket path '" << unix_path << "'" << std::endl;
+            unix_path.clear();
+            return false;
+        }
+        std::strcpy(sa.sun_path, unix_path.c_str());
+        unlink(unix_path.c_str());
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&sa, sizeof(sa)) < 0 || ::listen(listen_fd, 1) < 0)
+        {
+            std::perror("gdb stub");
+            return false;
+        }
+        std::cerr << "Waiting for GDB on " << unix_path << " (target remote " << unix_path << ")" << std::endl;
+        return true;
+    }
+
+    // [host:]port, loopback unless a host is given
+    std::string host = "127.0.0.1";
+    std::string port = address;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos)
+    {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+        if (host == "localhost" || host.empty())
+            host = "127.0.0.1";
+    }
+
+    sockaddr_in sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons((uint16_t)std::atoi(port.c_str()));
+    if (sa.sin_port == 0 || inet_pton(AF_INET, host.c_str(), &sa.sin_addr) != 1)
+    {
+        std::cerr << "Error: Invalid GDB address '" << address << "'" << std::endl;
+        return false;
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if (listen_fd >= 0)
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&sa, sizeof(sa)) < 0 || ::listen(listen_fd, 1) < 0)
+    {
+        std::perror("gdb stub");
+        return false;
+    }
+    std::cerr << "Waiting for GDB on " << host << ":" << port << " (target remote :" << port << ")" << std::endl;
+    return true;
+}
+
+void GdbStub::serve()
+{
+    fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+    {
+        std::perror("gdb stub");
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Report EBREAK to GDB instead of stopping the program
+    cpu.set_halt_on_ebreak(true);
+
+    std::string packet;
+    while (!done && read_packet(packet))
+        handle(packet);
+
+    if (!done)
+        cpu.stop(); // Connection dropped without detach
+    cpu.set_halt_on_ebreak(false);
+    close(fd);
+    fd = -1;
+}
+
+bool GdbStub::read_packet(std::string &packet)
+{
+    for (;;)
+    {
+        // Parse whatever is buffered: acks, Ctrl-C, or a whole $...#xx.
+        // A '-' before the next packet asks for the last reply again.
+        size_t start = rx.find('$');
+        if (ack && rx.find('-') < start)
+            send_raw(last_frame);
+        if (start == std::string::npos)
+        {
+            rx.clear(); // Only acks/interrupts while halted
+        }
+        else
+        {
+            size_t end = rx.find('#', start);
+            if (end != std::string::npos && end + 2 < rx.size())
+            {
+                std::string body = rx.substr(start + 1, end - start - 1);
+                uint8_t sum = 0;
+                for (size_t i = 0; i < body.size(); i++)
+                    sum += (uint8_t)body[i];
+                int hi = hex_value(rx[end + 1]);
+                int lo = hex_value(rx[end + 2]);
+                rx.erase(0, end + 3);
+
+                if (hi < 0 || lo < 0 || ((hi << 4) | lo) != sum)
+                {
+                    if (ack)
+                        send(fd, "-", 1, 0);
+                    continue;
+                }
+                if (ack)
+                    send(fd, "+", 1, 0);
+                packet = body;
+                return true;
+            }
+            rx.erase(0, start);
+        }
+
+        char buf[4096];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return false;
+        rx.append(buf, n);
+    }
+}
+
+void GdbStub::send_packet(const std::string &payload)
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < payload.size(); i++)
+        sum += (uint8_t)payload[i];
+
+    last_frame = "$" + payload + "#";
+    last_frame += HEX[sum >> 4];
+    last_frame += HEX[sum & 0xF];
+    send_raw(last_frame);
+}
+
+void GdbStub::send_raw(const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (n <= 0)
+            return;
+        sent += n;
+    }
+}
+
+// Ctrl-C from GDB while the target runs
+bool GdbStub::interrupt_pending()
+{
+    pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, 0) <= 0)
+        return false;
+
+    char buf[256];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+    {
+        cpu.stop();
+        return true;
+    }
+    for (ssize_t i = 0; i < n; i++)
+    {
+        if (buf[i] == 0x03)
+            return true;
+    }
+    rx.append(buf, n);
+    return false;
+}
+
+void GdbStub::handle(const std::string &packet)
+{
+    char cmd = packet.empty() ? 0 : packet[0];
+
+    switch (cmd)
+    {
+    case '?':
+        send_packet(stop_reply());
+        return;
+
+    case 'g':
+        send_packet(read_registers());
+        return;
+
+    case 'G':
+        write_registers(packet.substr(1));
+        send_packet("OK");
+        return;
+
+    case 'p':
+    {
+        uint32_t value;
+        if (!read_register((uint32_t)std::strtoul(packet.c_str() + 1, nullptr, 16), value))
+        {
+            send_packet("E01");
+            return;
+        }
+        std::string out;
+        append_le32(out, value);
+        send_packet(out);
+        return;
+    }
+
+    case 'P':
+    {
+        size_t eq = packet.find('=');
+        uint32_t value;
+        if (eq == std::string::npos || !parse_le32(packet, eq + 1, value) ||
+            !write_register((uint32_t)std::strtoul(packet.c_str() + 1, nullptr, 16), value))
+        {
+            send_packet("E01");
+            return;
+        }
+        send_packet("OK");
+        return;
+    }
+
+    case 'm':
+    {
+        char *end;
+        uint32_t addr = (uint32_t)std::strtoul(packet.c_str() + 1, &end, 16);
+        if (*end != ',')
+        {
+            send_packet("E01");
+            return;
+        }
+        uint32_t len = (uint32_t)std::strtoul(end + 1, nullptr, 16);
+        send_packet(read_memory(addr, std::min(len, MAX_READ)));
+        return;
+    }
+
+    case 'M':
+    case 'X':
+    {
+        char *end;
+        uint32_t addr = (uint32_t)std::strtoul(packet.c_str() + 1, &end, 16);
+        size_t colon = packet.find(':');
+        if (colon == std::string::npos)
+        {
+            send_packet("E01");
+            return;
+        }
+        send_packet(write_memory(addr, packet.substr(colon + 1), cmd == 'X') ? "OK" : "E01");
+        return;
+    }
+
+    case 'c':
+    case 's':
+        if (packet.size() > 1)
+            cpu.set_pc((uint32_t)std::strtoul(packet.c_str() + 1, nullptr, 16));
+        send_packet(resume(cmd == 's'));
+        return;
+
+    case 'C':
+    case 'S':
+        send_packet(resume(cmd == 'S'));
+        return;
+
+    case 'Z':
+    case 'z':
+        send_packet(breakpoint(packet, cmd == 'Z'));
+        return;
+
+    case 'H':
+    case 'T':
+        send_packet("OK");
+        return;
+
+    case 'k':
+        cpu.stop();
+        done = true;
+        return;
+
+    case 'D':
+        send_packet("OK");
+        cpu.set_halt_on_ebreak(false);
+        cpu.resume();
+        done = true;
+        return;
+
+    default:
+        break;
+    }
+
+    if (packet.compare(0, 10, "qSupported") == 0)
+        send_packet("PacketSize=4000;qXfer:features:read+;QStartNoAckMode+;swbreak+;vContSupported+");
+    else if (packet == "QStartNoAckMode")
+    {
+        send_packet("OK");
+        ack = false;
+    }
+    else if (packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0)
+        send_packet(qxfer_features(packet));
+    else if (packet == "qAttached")
+        send_packet("1");
+    else if (packet == "qC")
+        send_packet("QC1");
+    else if (packet == "qfThreadInfo")
+        send_packet("m1");
+    else if (packet == "qsThreadInfo")
+        send_packet("l");
+    else if (packet == "qSymbol::")
+        send_packet("OK");
+    else if (packet == "vCont?")
+        send_packet("vCont;c;C;s;S");
+    else if (packet.compare(0, 6, "vCont;") == 0)
+    {
+        // Single thread: the first action decides
+        char action = packet.size() > 6 ? packet[6] : 'c';
+        send_packet(resume(action == 's' || action == 'S'));
+    }
+    else if (packet.compare(0, 5, "vKill") == 0)
+    {
+        send_packet("OK");
+        cpu.stop();
+        done = true;
+    }
+    else
+        send_packet(""); // Unsupported
+}
+
+std::string GdbStub::stop_reply() const
+{
+    char buf[64];
+
+    switch (cpu.get_debug_event())
+    {
+    case DebugEvent::BREAKPOINT:
+        return "T05swbreak:;";
+
+    case DebugEvent::WATCHPOINT:
+    {
+        const WatchHit &hit = cpu.get_watch_hit();
+        uint8_t kind = hit.watch.kind;
+        snprintf(buf, sizeof(buf), "T05%s:%x;",
+                 kind == WATCH_READ ? "rwatch" : kind == WATCH_WRITE ? "watch" : "awatch", hit.addr);
+        return buf;
+    }
+
+    default:
+        if (!cpu.is_running())
+            return "W00"; // Program exited
+        snprintf(buf, sizeof(buf), "S%02x", last_signal);
+        return buf;
+    }
+}
+
+std::string GdbStub::resume(bool single_step)
+{
+    if (!cpu.is_running() && cpu.get_debug_event() == DebugEvent::NONE)
+        return "W00";
+
+    cpu.resume();
+    last_signal = 5;
+
+    // The first step ignores a breakpoint GDB is continuing from
+    cpu.step_over();
+    if (!single_step)
+    {
+        while (cpu.is_running())
+        {
+            cpu.run_for(STEPS_PER_POLL);
+            if (interrupt_pending())
+            {
+                last_signal = 2; // SIGINT
+                break;
+            }
+        }
+    }
+    return stop_reply();
+}
+
+std::string GdbStub::read_registers()
+{
+    std::string out;
+    for (uint32_t i = 0; i <= REG_PC; i++)
+    {
+        uint32_t value = 0;
+        read_register(i, value);
+        append_le32(out, value);
+    }
+    return out;
+}
+
+void GdbStub::write_registers(const std::string &hex)
+{
+    for (uint32_t i = 0; i <= REG_PC; i++)
+    {
+        uint32_t value;
+        if (parse_le32(hex, i * 8, value))
+            write_register(i, value);
+    }
+}
+
+bool GdbStub::read_register(uint32_t regno, uint32_t &value)
+{
+    if (regno < 32)
+        value = cpu.get_reg(regno);
+    else if (regno == REG_PC)
+        value = cpu.get_pc();
+    else if (regno >= REG_CSR_BASE && regno < REG_CSR_BASE + 4096)
+        value = cpu.read_csr(regno - REG_CSR_BASE);
+    else
+        return false;
+    return true;
+}
+
+bool GdbStub::write_register(uint32_t regno, uint32_t value)
+{
+    if (regno < 32)
+        cpu.set_reg(regno, value);
+    else if (regno == REG_PC)
+        cpu.set_pc(value);
+    else if (regno >= REG_CSR_BASE && regno < REG_CSR_BASE + 4096)
+        cpu.write_csr(regno - REG_CSR_BASE, value);
+    else
+        return false;
+    return true;
+}
+
+std::string GdbStub::read_memory(uint32_t addr, uint32_t len)
+{
+    std::vector<uint8_t> bytes(len);
+    uint32_t n = len ? cpu.debug_read(addr, &bytes[0], len) : 0;
+    std::string out;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        out += HEX[bytes[i] >> 4];
+        out += HEX[bytes[i] & 0xF];
+    }
+    // A partial read is fine; nothing readable is an error
+    return out.empty() && len ? "E01" : out;
+}
+
+bool GdbStub::write_memory(uint32_t addr, const std::string &data, bool binary)
+{
+    std::string bytes;
+    if (binary)
+    {
+        // '}' escapes the next byte (xor 0x20)
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            if (data[i] == '}' && i + 1 < data.size())
+                bytes += (char)(data[++i] ^ 0x20);
+            else
+                bytes += data[i];
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i + 1 < data.size(); i += 2)
+        {
+            int hi = hex_value(data[i]);
+            int lo = hex_value(data[i + 1]);
+            if (hi < 0 || lo < 0)
+                return false;
+            bytes += (char)((hi << 4) | lo);
+        }
+    }
+
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        if (!cpu.debug_write(addr + (uint32_t)i, (uint8_t)bytes[i]))
+            return false;
+    }
+    return true;
+}
+
+// Z<type>,<addr>,<kind>: 0/1 breakpoint, 2 write, 3 read, 4 access watchpoint
+std::string GdbStub::breakpoint(const std::string &packet, bool insert)
+{
+    char *end;
+    unsigned long type = std::strtoul(packet.c_str() + 1, &end, 16);
+    if (*end != ',')
+        return "E01";
+    uint32_t addr = (uint32_t)std::strtoul(end + 1, &end, 16);
+    uint32_t len = *end == ',' ? (uint32_t)std::strtoul(end + 1, nullptr, 16) : 1;
+
+    switch (type)
+    {
+    case 0:
+    case 1:
+        if (insert)
+            cpu.add_breakpoint(addr);
+        else
+            cpu.remove_breakpoint(addr);
+        return "OK";
+
+    case 2:
+    case 3:
+    case 4:
+    {
+        uint8_t kind = type == 2 ? WATCH_WRITE : type == 3 ? WATCH_READ : WATCH_ACCESS;
+        if (insert)
+            cpu.add_watchpoint(addr, len, kind);
+        else
+            cpu.remove_watchpoint(addr, len, kind);
+        return "OK";
+    }
+
+    default:
+        return "";
+    }
+}
+
+std::string GdbStub::qxfer_features(const std::string &packet) const
+{
+    // qXfer:features:read:target.xml:offset,length
+    size_t colon = packet.rfind(':');
+    char *end;
+    size_t offset = std::strtoul(packet.c_str() + colon + 1, &end, 16);
+    size_t length = std::strtoul(end + 1, nullptr, 16);
+
+    size_t total = sizeof(TARGET_XML) - 1;
+    if (offset >= total)
+        return "l";
+    std::string chunk(TARGET_XML + offset, std::min(length, total - offset));
+    return (offset + chunk.size() >= total ? "l" : "m") + chunk;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+class RISCV;
+
+// GDB remote serial protocol server.
+//
+// Serves one debugger connection over TCP ("1234", "localhost:1234") or a
+// Unix socket ("unix:/tmp/rvemu.sock"). The CPU only runs while GDB has
+// asked it to (continue/step); breakpoints and watchpoints use the RISCV
+// page-flag machinery, so a continued program runs at normal speed.
+//
+// Supported: registers (g/G/p/P, CSRs as 65+csr), memory (m/M/X), c/s,
+// vCont, Z0-Z4/z0-z4, Ctrl-C, qXfer target description, detach, kill.
+class GdbStub
+{
+public:
+    explicit GdbStub(RISCV &cpu);
+    ~GdbStub();
+
+    // Binds and listens; false (with a message on stderr) on failure
+    bool listen(const std::string &address);
+
+    // Waits for GDB and serves it until it detaches or kills the target.
+    // After a detach the CPU is left running so the caller can continue.
+    void serve();
+
+private:
+    bool read_packet(std::string &packet);
+    void send_packet(const std::string &payload);
+    void send_raw(const std::string &data);
+    void handle(const std::string &packet);
+
+    std::string stop_reply() const;
+    std::string resume(bool single_step);
+    bool interrupt_pending();
+
+    std::string read_registers();
+    void write_registers(const std::string &hex);
+    bool read_register(uint32_t regno, uint32_t &value);
+    bool write_register(uint32_t regno, uint32_t value);
+    std::string read_memory(uint32_t addr, uint32_t len);
+    bool write_memory(uint32_t addr, const std::string &data, bool binary);
+    std::string breakpoint(const std::string &packet, bool insert);
+    std::string qxfer_features(const std::string &packet) const;
+
+    RISCV &cpu;
+    int listen_fd = -1;
+    int fd = -1;
+    std::string unix_path;
+    std::string rx;         // Received bytes not yet parsed
+    std::string last_frame; // Resent when GDB answers '-'
+    bool ack = true;
+    bool done = false;
+    int last_signal = 5;
+};
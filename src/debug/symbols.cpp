@@ -0,0 +1,107 @@
+#include "symbols.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static uint32_t rd32(const std::vector<uint8_t> &d, size_t off)
+{
+    return d[off] | (d[off + 1] << 8) | (d[off + 2] << 16) | ((uint32_t)d[off + 3] << 24);
+}
+
+static uint16_t rd16(const std::vector<uint8_t> &d, size_t off)
+{
+    return d[off] | (d[off + 1] << 8);
+}
+
+bool SymbolTable::load(const std::string &path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+    std::vector<uint8_t> d((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // ELF32, little endian
+    if (d.size() < 52 || std::memcmp(d.data(), "\x7f" "ELF", 4) != 0 || d[4] != 1 || d[5] != 1)
+        return false;
+
+    uint32_t shoff = rd32(d, 0x20);
+    uint16_t shentsize = rd16(d, 0x2E);
+    uint16_t shnum = rd16(d, 0x30);
+    if (shentsize < 40 || shoff + (size_t)shnum * shentsize > d.size())
+        return false;
+
+    symbols.clear();
+    for (uint16_t i = 0; i < shnum; i++)
+    {
+        size_t sh = shoff + (size_t)i * shentsize;
+        if (rd32(d, sh + 4) != 2) // SHT_SYMTAB
+            continue;
+
+        uint32_t sym_off = rd32(d, sh + 16);
+        uint32_t sym_size = rd32(d, sh + 20);
+        uint32_t link = rd32(d, sh + 24);
+        if (link >= shnum || sym_off + (size_t)sym_size > d.size())
+            continue;
+        size_t strtab_sh = shoff + (size_t)link * shentsize;
+        uint32_t str_off = rd32(d, strtab_sh + 16);
+        uint32_t str_size = rd32(d, strtab_sh + 20);
+        if (str_off + (size_t)str_size > d.size())
+            continue;
+
+        for (uint32_t s = 16; s + 16 <= sym_size; s += 16) // Entry 0 is reserved
+        {
+            size_t sym = sym_off + s;
+            uint32_t name = rd32(d, sym);
+            uint8_t info = d[sym + 12];
+            uint16_t shndx = rd16(d, sym + 14);
+            uint8_t type = info & 0xF;
+            uint8_t bind = info >> 4;
+
+            // Functions, and global labels (assembly code has no STT_FUNC)
+            if (type != 2 && !(type == 0 && bind != 0))
+                continue;
+            if (shndx == 0 || shndx >= shnum || name >= str_size)
+                continue;
+
+            // Only symbols in executable sections
+            uint32_t flags = rd32(d, shoff + (size_t)shndx * shentsize + 8);
+            if (!(flags & 0x4)) // SHF_EXECINSTR
+                continue;
+
+            Symbol entry;
+            entry.addr = rd32(d, sym + 4);
+            entry.size = rd32(d, sym + 8);
+            entry.name = std::string((const char *)&d[str_off + name],
+                                     strnlen((const char *)&d[str_off + name], str_size - name));
+            if (!entry.name.empty())
+                symbols.push_back(entry);
+        }
+    }
+
+    std::sort(symbols.begin(), symbols.end(),
+              [](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+    return !symbols.empty();
+}
+
+const Symbol *SymbolTable::lookup(uint32_t addr) const
+{
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), addr,
+                               [](uint32_t a, const Symbol &s) { return a < s.addr; });
+    if (it == symbols.begin())
+        return nullptr;
+    return &*(it - 1);
+}
+
+bool SymbolTable::find(const std::string &name, uint32_t &addr) const
+{
+    for (size_t i = 0; i < symbols.size(); i++)
+    {
+        if (symbols[i].name == name)
+        {
+            addr = symbols[i].addr;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Symbol
+{
+    uint32_t addr;
+    uint32_t size; // 0 for assembly labels without .size
+    std::string name;
+};
+
+// Code symbols of a 32-bit little-endian RISC-V ELF (the build/<name>.elf
+// the Makefile links before objcopy produces the .bin)
+class SymbolTable
+{
+public:
+    // Returns false if the file is missing or not an ELF32 image
+    bool load(const std::string &path);
+
+    // Function containing addr (nearest symbol at or below it), or nullptr
+    const Symbol *lookup(uint32_t addr) const;
+
+    // Address of a named symbol
+    bool find(const std::string &name, uint32_t &addr) const;
+
+    bool empty() const { return symbols.empty(); }
+    size_t size() const { return symbols.size(); }
+    const std::vector<Symbol> &get_symbols() const { return symbols; }
+
+private:
+    std::vector<Symbol> symbols; // Sorted by address
+};
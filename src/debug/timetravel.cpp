@@ -0,0 +1,283 @@
+#include "timetravel.hpp"
+#include "../replay/stimulus.hpp"
+#include <algorithm>
+#include <cstring>
+
+// Snapshots are only taken between chunks of this many instructions
+static const uint64_t CHUNK_STEPS = 1000;
+
+TimeTravel::TimeTravel(RISCV &cpu, Bus &bus, Stimulus &stimulus, uint64_t interval, uint64_t memory_limit)
+    : cpu(cpu), bus(bus), stimulus(stimulus), interval(interval ? interval : 1), memory_limit(memory_limit)
+{
+    // Snapshots read and write RAM directly
+    cpu.page_in_all();
+    cpu.set_page_write_observer(this);
+    take_snapshot();
+}
+
+TimeTravel::~TimeTravel()
+{
+    cpu.track_page_writes(false);
+    cpu.set_page_write_observer(nullptr);
+}
+
+uint64_t TimeTravel::run_for(uint64_t max_steps)
+{
+    uint64_t done = 0;
+    while (cpu.is_running() && done < max_steps)
+    {
+        done += cpu.run_for(std::min(max_steps - done, CHUNK_STEPS));
+        maybe_snapshot();
+    }
+    return done;
+}
+
+uint32_t TimeTravel::page_bytes(uint32_t page) const
+{
+    uint64_t start = (uint64_t)page * RISCV::PAGE_SIZE;
+    uint64_t size = cpu.get_ram_size();
+    return (uint32_t)std::min<uint64_t>(RISCV::PAGE_SIZE, size - start);
+}
+
+static bool all_zero(const uint8_t *data, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        if (data[i])
+            return false;
+    }
+    return true;
+}
+
+void TimeTravel::before_page_write(RISCV &cpu, uint32_t page)
+{
+    Snapshot &snap = snapshots.back();
+    if (snap.pages.count(page))
+        return;
+
+    const uint8_t *data = cpu.get_ram() + (uint64_t)page * RISCV::PAGE_SIZE;
+    uint32_t size = page_bytes(page);
+    std::vector<uint8_t> &saved = snap.pages[page];
+    if (!all_zero(data, size))
+    {
+        saved.assign(data, data + size);
+        memory_used += size;
+    }
+}
+
+// The newest snapshot's undo log is complete once the next snapshot is
+// taken; drop the pages that were written but ended up unchanged
+void TimeTravel::seal(Snapshot &snap)
+{
+    const uint8_t *ram = cpu.get_ram();
+    for (auto it = snap.pages.begin(); it != snap.pages.end();)
+    {
+        const uint8_t *data = ram + (uint64_t)it->first * RISCV::PAGE_SIZE;
+        uint32_t size = page_bytes(it->first);
+        bool same = it->second.empty() ? all_zero(data, size) : std::memcmp(data, it->second.data(), size) == 0;
+        if (same)
+        {
+            memory_used -= it->second.size();
+            it = snap.pages.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void TimeTravel::take_snapshot()
+{
+    if (!snapshots.empty())
+        seal(snapshots.back());
+
+    Snapshot snap;
+    snap.instret = cpu.get_instret();
+    snap.cycles = cpu.get_cycles();
+    StateWriter w(snap.state);
+    cpu.save_state(w);
+    bus.save_state(w);
+    memory_used += snap.state.size();
+    snapshots.push_back(std::move(snap));
+
+    cpu.track_page_writes(true);
+    next_snapshot = cpu.get_cycles() + interval;
+
+    if (memory_used > memory_limit)
+        merge_snapshots();
+}
+
+// Only at a plain instruction boundary: a debug halt is not machine state
+void TimeTravel::maybe_snapshot()
+{
+    if (cpu.is_running() && cpu.get_cycles() >= next_snapshot)
+        take_snapshot();
+}
+
+// Halves the snapshot count, keeping the first and the newest. A page not
+// in the older snapshot's log was not written between the two, so the
+// newer one's copy is also the older one's contents.
+void TimeTravel::merge_snapshots()
+{
+    if (snapshots.size() < 3)
+        return;
+
+    std::vector<Snapshot> kept;
+    kept.push_back(std::move(snapshots[0]));
+    for (size_t i = 1; i < snapshots.size(); i++)
+    {
+        Snapshot &snap = snapshots[i];
+        if (i % 2 == 0 || i + 1 == snapshots.size())
+        {
+            kept.push_back(std::move(snap));
+            continue;
+        }
+
+        Snapshot &older = kept.back();
+        for (auto it = snap.pages.begin(); it != snap.pages.end(); ++it)
+        {
+            if (older.pages.count(it->first))
+                memory_used -= it->second.size();
+            else
+                older.pages[it->first].swap(it->second);
+        }
+        memory_used -= snap.state.size();
+    }
+    snapshots.swap(kept);
+}
+
+size_t TimeTravel::snapshot_before(uint64_t instret) const
+{
+    size_t index = 0;
+    while (index + 1 < snapshots.size() && snapshots[index + 1].instret <= instret)
+        index++;
+    return index;
+}
+
+void TimeTravel::restore(size_t index)
+{
+    // Undo newest first, which leaves RAM as it was at snapshot `index`
+    uint8_t *ram = cpu.get_ram();
+    for (size_t i = snapshots.size(); i-- > index;)
+    {
+        Snapshot &snap = snapshots[i];
+        for (auto it = snap.pages.begin(); it != snap.pages.end(); ++it)
+        {
+            uint8_t *data = ram + (uint64_t)it->first * RISCV::PAGE_SIZE;
+            if (it->second.empty())
+                std::memset(data, 0, page_bytes(it->first));
+            else
+                std::memcpy(data, it->second.data(), it->second.size());
+            memory_used -= it->second.size();
+        }
+        snap.pages.clear();
+        if (i > index)
+            memory_used -= snap.state.size();
+    }
+    snapshots.resize(index + 1);
+
+    uint64_t from = cpu.get_instret();
+    Snapshot &snap = snapshots.back();
+    StateReader r(snap.state);
+    cpu.load_state(r);
+    bus.load_state(r);
+
+    cpu.track_page_writes(true);
+    next_snapshot = snap.cycles + interval;
+    stimulus.rewind(from, snap.instret);
+}
+
+// Re-execution passes over breakpoints and watchpoints without stopping
+void TimeTravel::run_to(uint64_t instret)
+{
+    while (cpu.get_instret() < instret)
+    {
+        if (!cpu.is_running())
+        {
+            DebugEvent event = cpu.get_debug_event();
+            if (event == DebugEvent::NONE)
+                return; // Program ended
+            cpu.resume();
+            if (event == DebugEvent::BREAKPOINT)
+            {
+                cpu.step_over();
+                continue;
+            }
+        }
+        cpu.run_for(std::min(instret - cpu.get_instret(), CHUNK_STEPS));
+        maybe_snapshot();
+    }
+}
+
+// Like run_to, remembering the position of the last stop before `end`
+bool TimeTravel::scan(uint64_t end, uint64_t &last, ReverseStop &stop)
+{
+    bool found = false;
+    while (cpu.get_instret() < end)
+    {
+        if (!cpu.is_running())
+        {
+            DebugEvent event = cpu.get_debug_event();
+            if (event == DebugEvent::NONE)
+                break;
+
+            found = true;
+            last = cpu.get_instret();
+            stop.event = event;
+            stop.watch = cpu.get_watch_hit();
+
+            cpu.resume();
+            if (event == DebugEvent::BREAKPOINT)
+            {
+                cpu.step_over();
+                continue;
+            }
+        }
+        cpu.run_for(std::min(end - cpu.get_instret(), CHUNK_STEPS));
+        maybe_snapshot();
+    }
+    return found;
+}
+
+bool TimeTravel::reverse_step(uint64_t count)
+{
+    uint64_t now = cpu.get_instret();
+    uint64_t oldest = get_oldest_instret();
+    if (now <= oldest)
+        return false;
+
+    uint64_t target = now - std::min(count, now - oldest);
+    restore(snapshot_before(target));
+    run_to(target);
+    return true;
+}
+
+ReverseStop TimeTravel::reverse_continue()
+{
+    ReverseStop stop;
+    stop.event = DebugEvent::NONE;
+    stop.watch = WatchHit();
+
+    uint64_t end = cpu.get_instret();
+    size_t index = snapshot_before(end > 0 ? end - 1 : 0);
+    for (;;)
+    {
+        uint64_t last = 0;
+        restore(index);
+        if (scan(end, last, stop))
+        {
+            restore(index);
+            run_to(last);
+            return stop;
+        }
+        if (index == 0)
+            break;
+        end = snapshots[index].instret;
+        index--;
+    }
+
+    restore(0);
+    stop.event = DebugEvent::NONE;
+    return stop;
+}
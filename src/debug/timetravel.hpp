@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "../cpu/riscv.hpp"
+
+class Stimulus;
+
+// Where a reverse-continue stopped
+struct ReverseStop
+{
+    DebugEvent event; // BREAKPOINT, WATCHPOINT, or NONE at the start of history
+    WatchHit watch;   // The hit, for WATCHPOINT
+};
+
+// Reverse execution by snapshot and deterministic re-execution.
+//
+// A snapshot of the CPU and bus (GPIO, UART, signals) is taken every
+// `interval` cycles while the program runs forward through run_for().
+// RAM is not copied: each snapshot keeps an undo log with the old
+// contents of the pages first written after it (copy-on-write through
+// RISCV::track_page_writes), so memory grows with the pages a program
+// actually touches. Pages that end up unchanged are dropped, zero pages
+// are stored empty, and above the memory limit every other snapshot is
+// merged into its predecessor.
+//
+// Going back restores the nearest snapshot at or before the target and
+// re-executes to it; stdin input taken in between is served again from
+// the Stimulus, so re-execution retraces the original run exactly.
+// Positions are retired-instruction counts (RISCV::get_instret).
+class TimeTravel : public PageWriteObserver
+{
+public:
+    TimeTravel(RISCV &cpu, Bus &bus, Stimulus &stimulus, uint64_t interval, uint64_t memory_limit);
+    ~TimeTravel();
+
+    // Forward execution; same contract as RISCV::run_for
+    uint64_t run_for(uint64_t max_steps);
+
+    // Back by count instructions (stops at the oldest snapshot); false if
+    // already there
+    bool reverse_step(uint64_t count);
+
+    // Back to the most recent breakpoint or stopping watchpoint hit before
+    // the current position, or to the start of history if there is none.
+    // At a breakpoint the CPU is positioned before the instruction, at a
+    // watchpoint after the accessing one.
+    ReverseStop reverse_continue();
+
+    size_t get_snapshot_count() const { return snapshots.size(); }
+    uint64_t get_memory_used() const { return memory_used; }
+    uint64_t get_oldest_instret() const { return snapshots.front().instret; }
+
+    void before_page_write(RISCV &cpu, uint32_t page) override;
+
+private:
+    struct Snapshot
+    {
+        uint64_t instret;
+        uint64_t cycles;
+        std::vector<uint8_t> state; // CPU, then bus
+        // Undo log: page -> contents at this snapshot (empty = all zero)
+        std::unordered_map<uint32_t, std::vector<uint8_t>> pages;
+    };
+
+    void take_snapshot();
+    void maybe_snapshot();
+    void seal(Snapshot &snap);
+    void merge_snapshots();
+    void restore(size_t index);
+    void run_to(uint64_t instret);
+    bool scan(uint64_t end, uint64_t &last, ReverseStop &stop);
+    size_t snapshot_before(uint64_t instret) const;
+    uint32_t page_bytes(uint32_t page) const;
+
+    RISCV &cpu;
+    Bus &bus;
+    Stimulus &stimulus;
+    uint64_t interval;
+    uint64_t memory_limit;
+    uint64_t memory_used = 0;
+    uint64_t next_snapshot = 0; // Cycle of the next snapshot
+    std::vector<Snapshot> snapshots; // Oldest first
+};
@@ -0,0 +1,24 @@
+#include "watch_log.hpp"
+#include "../cpu/riscv.hpp"
+#include <cstdio>
+
+WatchLogger::WatchLogger(std::ostream &out, const SymbolTable &symbols) : out(out), symbols(symbols) {}
+
+void WatchLogger::on_watch(RISCV &cpu, const WatchHit &hit)
+{
+    char line[160];
+    hits++;
+
+    if (hit.kind == WATCH_WRITE)
+        snprintf(line, sizeof(line), "[watch] cycle %llu: write%u [0x%08x] 0x%x -> 0x%x at pc 0x%08x",
+                 (unsigned long long)cpu.get_cycles(), hit.size * 8, hit.addr, hit.old_value, hit.new_value, hit.pc);
+    else
+        snprintf(line, sizeof(line), "[watch] cycle %llu: read%u [0x%08x] = 0x%x at pc 0x%08x",
+                 (unsigned long long)cpu.get_cycles(), hit.size * 8, hit.addr, hit.new_value, hit.pc);
+    out << line;
+
+    const Symbol *sym = symbols.lookup(hit.pc);
+    if (sym)
+        out << " <" << sym->name << "+0x" << std::hex << (hit.pc - sym->addr) << std::dec << ">";
+    out << std::endl;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include "../cpu/observer.hpp"
+#include "symbols.hpp"
+
+// Prints every watchpoint hit with the accessing instruction and the old
+// and new values, for chasing memory corruption without a debugger
+class WatchLogger : public WatchObserver
+{
+public:
+    WatchLogger(std::ostream &out, const SymbolTable &symbols);
+
+    void on_watch(RISCV &cpu, const WatchHit &hit) override;
+
+    uint64_t get_hits() const { return hits; }
+
+private:
+    std::ostream &out;
+    const SymbolTable &symbols;
+    uint64_t hits = 0;
+};
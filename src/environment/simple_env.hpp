@@ -2,9 +2,11 @@
 #pragma once
 #include "../environment/environment.hpp"
 #include "../cpu/riscv.hpp"
+#include "../replay/stimulus.hpp"
 #include <iostream>
 #include <cstdint>
 #include <iomanip>
+#include <string>
 
 #ifndef _WIN32
 #include <fcntl.h>
@@ -15,10 +17,29 @@
 class SimpleEnvironment : public Environment
 {
 private:
+    Stimulus *stimulus = nullptr;
+    std::ostream *out = &std::cout; // Program output
+    std::istream *in = &std::cin;   // Stdin syscalls read from here
+    bool raw_terminal = true; // main loop polls stdin in raw, non-blocking mode
+
+    bool replaying() const { return stimulus && stimulus->replaying_input(); }
+
+    // Re-executed after a rewind: this output has been shown already
+    bool rerun(const RISCV &cpu) const { return stimulus && stimulus->is_rerun(cpu); }
+
+    void record(RISCV &cpu, const std::string &data)
+    {
+        if (stimulus)
+            stimulus->record_input(cpu, data);
+    }
+
     // Helper: Temporarily disable non-blocking mode and enable echo for stdin reads
     void enable_blocking_stdin() const
     {
 #ifndef _WIN32
+        if (!raw_terminal)
+            return;
+
         // Disable non-blocking
         int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
         fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
@@ -35,6 +56,9 @@ private:
     void enable_nonblocking_stdin() const
     {
 #ifndef _WIN32
+        if (!raw_terminal)
+            return;
+
         // Disable echo
         struct termios tty;
         tcgetattr(STDIN_FILENO, &tty);
@@ -48,6 +72,18 @@ private:
     }
 
 public:
+    // Stdin reads are logged to / served from a stimulus log; not owned
+    void set_stimulus(Stimulus *s) { stimulus = s; }
+
+    // Where the print syscalls write (batch jobs capture it); not owned
+    void set_output(std::ostream &stream) { out = &stream; }
+
+    // Where the stdin syscalls read (fuzz input); not owned
+    void set_input(std::istream &stream) { in = &stream; }
+
+    // False when stdin stays a normal line-buffered terminal (debug console)
+    void set_raw_terminal(bool raw) { raw_terminal = raw; }
+
     virtual void on_trap(RISCV &cpu, uint32_t cause)
     {
         if (cause == 11) // ECALL
@@ -65,7 +101,8 @@ public:
         {
 
         case 1: // Print Integer
-            std::cout << (int32_t)a0;
+            if (!rerun(cpu))
+                *out << (int32_t)a0;
             break;
 
         case 4:
@@ -76,21 +113,31 @@ public:
                 char c = cpu.load8(addr++);
                 if (c == 0)
                     break;
-                std::cout << c;
+                if (!rerun(cpu))
+                    *out << c;
             }
             break;
         }
 
         case 11: // Print Character
-            std::cout << (char)(a0 & 0xFF);
+            if (!rerun(cpu))
+                *out << (char)(a0 & 0xFF);
             break;
 
         case 5:
         { // Read Integer
             int32_t value;
-            enable_blocking_stdin();
-            std::cin >> value;
-            enable_nonblocking_stdin();
+            if (replaying())
+            {
+                value = (int32_t)std::stol(stimulus->replay_input(cpu));
+            }
+            else
+            {
+                enable_blocking_stdin();
+                *in >> value;
+                enable_nonblocking_stdin();
+                record(cpu, std::to_string(value));
+            }
             cpu.set_reg(10, (uint32_t)value); // return in a0
             break;
         }
@@ -100,10 +147,18 @@ public:
             uint32_t addr = a0;
             uint32_t max_len = a1;
 
-            enable_blocking_stdin();
             std::string input;
-            std::getline(std::cin >> std::ws, input);
-            enable_nonblocking_stdin();
+            if (replaying())
+            {
+                input = stimulus->replay_input(cpu);
+            }
+            else
+            {
+                enable_blocking_stdin();
+                std::getline(*in >> std::ws, input);
+                enable_nonblocking_stdin();
+                record(cpu, input);
+            }
 
             uint32_t i = 0;
             for (; i < input.size() && i < max_len - 1; i++)
@@ -116,10 +171,19 @@ public:
 
         case 12:
         { // Read Character
-            enable_blocking_stdin();
-            char c;
-            std::cin.get(c);
-            enable_nonblocking_stdin();
+            char c = 0;
+            if (replaying())
+            {
+                std::string input = stimulus->replay_input(cpu);
+                c = input.empty() ? 0 : input[0];
+            }
+            else
+            {
+                enable_blocking_stdin();
+                in->get(c);
+                enable_nonblocking_stdin();
+                record(cpu, std::string(1, c));
+            }
             cpu.set_reg(10, (uint32_t)c); // return in a0
             break;
         }
@@ -0,0 +1,79 @@
+#include "fork_server.hpp"
+#include "../cpu/riscv.hpp"
+#include <cstdio>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+bool ForkServer::boot(RISCV &cpu, uint32_t pc)
+{
+    return cpu.run_to(pc);
+}
+
+#ifdef _WIN32
+
+ForkRole ForkServer::serve()
+{
+    std::cerr << "Error: The fork server is not supported on Windows" << std::endl;
+    return ForkRole::FAILED;
+}
+
+#else
+
+static bool write_word(uint32_t value)
+{
+    return write(ForkServer::STATUS_FD, &value, sizeof(value)) == (ssize_t)sizeof(value);
+}
+
+ForkRole ForkServer::serve()
+{
+    if (fcntl(CONTROL_FD, F_GETFD) == -1 || fcntl(STATUS_FD, F_GETFD) == -1)
+    {
+        std::cerr << "Error: --fork-server needs the control pipe on fd " << CONTROL_FD << " and the status pipe on fd "
+                  << STATUS_FD << std::endl;
+        return ForkRole::FAILED;
+    }
+    if (!write_word(0))
+    {
+        std::cerr << "Error: Fork server cannot write to the status pipe" << std::endl;
+        return ForkRole::FAILED;
+    }
+
+    for (;;)
+    {
+        uint32_t request;
+        if (read(CONTROL_FD, &request, sizeof(request)) != (ssize_t)sizeof(request))
+            return ForkRole::DONE;
+
+        // Buffered output would otherwise be written again by every child
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            std::perror("fork");
+            return ForkRole::FAILED;
+        }
+        if (pid == 0)
+        {
+            close(CONTROL_FD);
+            close(STATUS_FD);
+            return ForkRole::CHILD;
+        }
+
+        int status = 0;
+        if (!write_word((uint32_t)pid) || waitpid(pid, &status, 0) < 0 || !write_word((uint32_t)status))
+        {
+            std::cerr << "Error: Fork server lost its driver" << std::endl;
+            return ForkRole::FAILED;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+
+class RISCV;
+
+// Fork-server startup: the program is booted once (firmware, crt0, static
+// initialisation) up to a chosen pc, then the process forks a child per
+// request. Every child starts from the post-boot state with the guest RAM
+// shared copy-on-write, so a run costs a fork instead of a boot.
+//
+// The pipe protocol is AFL's: the driver passes a control pipe as fd 198
+// and a status pipe as fd 199. The server writes a 4-byte hello, then for
+// every 4-byte request read from fd 198 it forks, writes the child's pid
+// and, once the child has exited, its waitpid() status (4 bytes each).
+// Children inherit stdin/stdout/stderr, so input is supplied the usual way.
+enum class ForkRole
+{
+    CHILD,  // A forked run: continue executing the program
+    DONE,   // The driver closed the control pipe
+    FAILED  // Protocol or fork error, reported on stderr
+};
+
+class ForkServer
+{
+public:
+    static const int CONTROL_FD = 198;
+    static const int STATUS_FD = 199;
+
+    // Runs the program until it is about to execute `pc`; false if it
+    // stopped before getting there
+    bool boot(RISCV &cpu, uint32_t pc);
+
+    // Serves requests; returns only in a child or when the server ends
+    ForkRole serve();
+};
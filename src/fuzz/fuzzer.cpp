@@ -0,0 +1,536 @@
+#include "fuzzer.hpp"
+#include "../environment/simple_env.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// Runs between progress lines on stderr
+static const uint64_t REPORT_CHECK_RUNS = 1024;
+
+// Hit counts are compared in AFL's buckets (1, 2, 3, 4-7, 8-15, 16-31,
+// 32-127, 128+), so a loop running a few more times is not a new path
+static uint8_t bucket(uint8_t count)
+{
+    if (count <= 2)
+        return count;
+    if (count == 3)
+        return 4;
+    if (count < 8)
+        return 8;
+    if (count < 16)
+        return 16;
+    if (count < 32)
+        return 32;
+    if (count < 128)
+        return 64;
+    return 128;
+}
+
+static uint64_t fnv1a(const uint8_t *data, size_t size)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &data)
+{
+    std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+    std::streamsize size = in.tellg();
+    in.seekg(0, std::ios::beg);
+    data.resize((size_t)size);
+    return size == 0 || (bool)in.read((char *)data.data(), size);
+}
+
+// Plain files in a directory; false if it is not one
+static bool list_dir(const std::string &dir, std::vector<std::string> &names)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &entry);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    do
+    {
+        if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            names.push_back(entry.cFileName);
+    } while (FindNextFileA(h, &entry));
+    FindClose(h);
+    return true;
+#else
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return false;
+    while (struct dirent *entry = readdir(d))
+    {
+        struct stat st;
+        std::string path = dir + "/" + entry->d_name;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            names.push_back(entry->d_name);
+    }
+    closedir(d);
+    return true;
+#endif
+}
+
+Fuzzer::Fuzzer(RISCV &cpu, Bus &bus, SimpleEnvironment &env, const FuzzConfig &config)
+    : cpu(cpu), bus(bus), env(env), config(config), trace_bits(RISCV::COVERAGE_MAP_SIZE),
+      virgin_bits(RISCV::COVERAGE_MAP_SIZE, 0xFF), virgin_crash(RISCV::COVERAGE_MAP_SIZE, 0xFF),
+      virgin_hang(RISCV::COVERAGE_MAP_SIZE, 0xFF), discard(nullptr)
+{
+    if (this->config.max_len == 0)
+        this->config.max_len = 1;
+    rng = config.seed ? config.seed : (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    rng |= 1;
+
+    // Timing never changes what a program does, so inputs run untimed;
+    // EBREAK (assert, abort) halts instead of reaching the environment
+    cpu.set_timing_mode(TimingMode::FUNCTIONAL);
+    cpu.set_halt_on_ebreak(true);
+    cpu.set_coverage_map(trace_bits.data());
+    env.set_stimulus(nullptr);
+    env.set_raw_terminal(false);
+    env.set_input(stdin_data);
+
+    StateWriter cw(cpu_state);
+    cpu.save_state(cw);
+    StateWriter bw(bus_state);
+    bus.save_state(bw);
+    cpu.set_page_write_observer(this);
+    cpu.track_page_writes(true);
+}
+
+Fuzzer::~Fuzzer()
+{
+    cpu.track_page_writes(false);
+    cpu.set_page_write_observer(nullptr);
+    cpu.set_coverage_map(nullptr);
+    env.set_input(std::cin);
+}
+
+// The page still holds what it held at the snapshot: every input starts
+// from a restore, and this is the first write since
+void Fuzzer::before_page_write(RISCV &cpu, uint32_t page)
+{
+    if (!saved_pages.count(page))
+    {
+        uint64_t start = (uint64_t)page * RISCV::PAGE_SIZE;
+        uint64_t end = start + RISCV::PAGE_SIZE;
+        if (end > cpu.get_ram_size())
+            end = cpu.get_ram_size();
+        saved_pages[page].assign(cpu.get_ram() + start, cpu.get_ram() + end);
+    }
+    dirty_pages.push_back(page);
+}
+
+void Fuzzer::restore()
+{
+    for (size_t i = 0; i < dirty_pages.size(); i++)
+    {
+        uint32_t page = dirty_pages[i];
+        const std::vector<uint8_t> &saved = saved_pages[page];
+        std::memcpy(cpu.get_ram() + (uint64_t)page * RISCV::PAGE_SIZE, saved.data(), saved.size());
+        cpu.track_page_write(page);
+    }
+    dirty_pages.clear();
+
+    StateReader cr(cpu_state);
+    cpu.load_state(cr);
+    StateReader br(bus_state);
+    bus.load_state(br);
+    cpu.reset_coverage();
+}
+
+// Cuts the input into stdin data and timed UART/GPIO deliveries
+void Fuzzer::split(const std::vector<uint8_t> &input)
+{
+    std::string data;
+    events.clear();
+
+    unsigned enabled[3];
+    unsigned count = 0;
+    for (unsigned c = FUZZ_STDIN; c <= FUZZ_GPIO; c <<= 1)
+    {
+        if (config.channels & c)
+            enabled[count++] = c;
+    }
+
+    uint64_t step = 0;
+    size_t pos = 0;
+    while (pos < input.size() && count)
+    {
+        unsigned channel = enabled[0];
+        size_t end = input.size();
+        if (count > 1)
+        {
+            channel = enabled[input[pos] % count];
+            size_t length = pos + 1 < input.size() ? input[pos + 1] : 0;
+            pos += 2;
+            if (pos > input.size())
+                break;
+            if (length < end - pos)
+                end = pos + length;
+        }
+
+        if (channel == FUZZ_STDIN)
+        {
+            data.append((const char *)input.data() + pos, end - pos);
+        }
+        else if (channel == FUZZ_UART)
+        {
+            Event ev = {step, channel, pos, end};
+            events.push_back(ev);
+            step += FUZZ_EVENT_STEPS;
+        }
+        else
+        {
+            for (size_t i = pos; i < end; i++)
+            {
+                Event ev = {step, channel, i, i + 1};
+                events.push_back(ev);
+                step += FUZZ_EVENT_STEPS;
+            }
+        }
+        pos = end;
+    }
+
+    stdin_data.clear();
+    stdin_data.str(data);
+}
+
+void Fuzzer::deliver(const std::vector<uint8_t> &input, const Event &ev)
+{
+    if (ev.channel == FUZZ_UART)
+    {
+        for (size_t i = ev.begin; i < ev.end; i++)
+            bus.uart_receive(input[i]);
+        return;
+    }
+
+    // Driven like the interactive button: the port's data register
+    uint8_t b = input[ev.begin];
+    uint32_t pin = b & 0x1F;
+    uint32_t addr = 0x1000 + (pin >> 3) * 0x8;
+    uint32_t state = bus.load(addr);
+    uint32_t mask = 1u << (pin & 7);
+    bus.store(addr, (b & 0x80) ? state | mask : state & ~mask);
+}
+
+FuzzOutcome Fuzzer::execute(const std::vector<uint8_t> &input, std::string &reason)
+{
+    restore();
+    split(input);
+    std::memset(trace_bits.data(), 0, trace_bits.size());
+    reason.clear();
+
+    uint64_t steps = 0;
+    size_t next = 0;
+    try
+    {
+        while (cpu.is_running() && steps < config.max_steps)
+        {
+            while (next < events.size() && events[next].step <= steps)
+                deliver(input, events[next++]);
+
+            uint64_t chunk = config.max_steps - steps;
+            if (next < events.size() && events[next].step - steps < chunk)
+                chunk = events[next].step - steps;
+            steps += cpu.run_for(chunk);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        reason = e.what();
+        return FuzzOutcome::CRASH;
+    }
+
+    if (cpu.get_debug_event() == DebugEvent::EBREAK)
+    {
+        char buf[48];
+        std::snprintf(buf, sizeof(buf), "EBREAK at pc 0x%08x", cpu.get_pc());
+        reason = buf;
+        return FuzzOutcome::CRASH;
+    }
+    if (cpu.is_running())
+    {
+        reason = "no exit after " + std::to_string(config.max_steps) + " instructions";
+        return FuzzOutcome::HANG;
+    }
+    return FuzzOutcome::OK;
+}
+
+// A cache line at a time: most of the map is untouched by any one input
+bool Fuzzer::has_new_bits(std::vector<uint8_t> &virgin)
+{
+    bool found = false;
+    for (size_t i = 0; i < trace_bits.size(); i += 64)
+    {
+        uint64_t words[8];
+        std::memcpy(words, &trace_bits[i], sizeof(words));
+        if (!(words[0] | words[1] | words[2] | words[3] | words[4] | words[5] | words[6] | words[7]))
+            continue;
+        for (size_t j = i; j < i + 64; j++)
+        {
+            uint8_t b = bucket(trace_bits[j]);
+            if (b & virgin[j])
+            {
+                virgin[j] &= ~b;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+size_t Fuzzer::count_edges() const
+{
+    size_t edges = 0;
+    for (size_t i = 0; i < virgin_bits.size(); i++)
+    {
+        if (virgin_bits[i] != 0xFF)
+            edges++;
+    }
+    return edges;
+}
+
+// xorshift64*
+uint64_t Fuzzer::next_random()
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ull;
+}
+
+// AFL-style havoc: a stack of 1-8 random edits
+void Fuzzer::mutate(std::vector<uint8_t> &data)
+{
+    static const uint8_t INTERESTING_8[] = {0, 1, 16, 32, 64, 100, 127, 128, 255, '\n', ' ', '0', '9', '-'};
+    static const uint32_t INTERESTING_32[] = {0, 1, 0x7F, 0x80, 0xFF, 0x100, 0x7FFF, 0x8000, 0xFFFF, 0x10000,
+                                              0x7FFFFFFF, 0x80000000, 0xFFFFFFFF};
+    static const char *const NUMBERS[] = {"0", "1", "-1", "127", "128", "255", "256", "32767", "65535",
+                                          "2147483647", "-2147483648", "4294967296"};
+
+    unsigned ops = 1u << random(4);
+    for (unsigned op = 0; op < ops; op++)
+    {
+        if (data.empty())
+            data.push_back((uint8_t)next_random());
+        size_t size = data.size();
+        size_t at = random((uint32_t)size);
+
+        switch (random(10))
+        {
+        case 0: // Flip a bit
+            data[at] ^= (uint8_t)(1u << random(8));
+            break;
+        case 1: // Interesting byte
+            data[at] = INTERESTING_8[random(sizeof(INTERESTING_8))];
+            break;
+        case 2: // Random byte
+            data[at] = (uint8_t)next_random();
+            break;
+        case 3: // Small arithmetic
+            data[at] += (uint8_t)(random(2) ? 1 + random(35) : -(int)(1 + random(35)));
+            break;
+        case 4: // Interesting 16/32-bit value, little-endian
+        {
+            uint32_t value = INTERESTING_32[random(sizeof(INTERESTING_32) / sizeof(INTERESTING_32[0]))];
+            size_t width = random(2) ? 2 : 4;
+            for (size_t i = 0; i < width && at + i < size; i++)
+                data[at + i] = (uint8_t)(value >> (8 * i));
+            break;
+        }
+        case 5: // Delete a block
+            if (size > 1)
+            {
+                size_t len = 1 + random((uint32_t)(size - at < 32 ? size - at : 32));
+                data.erase(data.begin() + at, data.begin() + at + len);
+            }
+            break;
+        case 6: // Duplicate a block, or insert a run of one byte
+        {
+            size_t len = 1 + random((uint32_t)(size - at < 32 ? size - at : 32));
+            size_t to = random((uint32_t)size + 1);
+            if (random(2))
+            {
+                std::vector<uint8_t> block(data.begin() + at, data.begin() + at + len);
+                data.insert(data.begin() + to, block.begin(), block.end());
+            }
+            else
+                data.insert(data.begin() + to, len, (uint8_t)next_random());
+            break;
+        }
+        case 7: // Overwrite a block with another part of the input
+        {
+            size_t len = 1 + random((uint32_t)(size - at < 32 ? size - at : 32));
+            size_t from = random((uint32_t)(size - len + 1));
+            std::memmove(&data[at], &data[from], len);
+            break;
+        }
+        case 8: // Splice: keep the head, take the tail of another input
+        {
+            const std::vector<uint8_t> &other = corpus[random((uint32_t)corpus.size())];
+            if (other.empty())
+                break;
+            size_t split_at = random((uint32_t)other.size());
+            data.resize(at);
+            data.insert(data.end(), other.begin() + split_at, other.end());
+            break;
+        }
+        default: // A decimal number, for programs parsing integers
+        {
+            const char *number = NUMBERS[random(sizeof(NUMBERS) / sizeof(NUMBERS[0]))];
+            size_t to = random((uint32_t)size + 1);
+            data.insert(data.begin() + to, number, number + std::strlen(number));
+            break;
+        }
+        }
+    }
+
+    if (data.size() > config.max_len)
+        data.resize(config.max_len);
+}
+
+void Fuzzer::save(const std::string &dir, const char *prefix, const std::vector<uint8_t> &data)
+{
+    char name[40];
+    std::snprintf(name, sizeof(name), "%s-%016llx", prefix, (unsigned long long)fnv1a(data.data(), data.size()));
+    std::string path = dir + "/" + name;
+    std::ofstream out(path.c_str(), std::ios::binary);
+    out.write((const char *)data.data(), (std::streamsize)data.size());
+    if (!out)
+        std::cerr << "[fuzz] Cannot write '" << path << "'" << std::endl;
+}
+
+int Fuzzer::run(const std::string &path)
+{
+    std::vector<std::string> names;
+    if (list_dir(path, names))
+        return fuzz(path);
+
+    std::vector<uint8_t> input;
+    if (!read_file(path, input))
+    {
+        std::cerr << "Error: Cannot open fuzz input '" << path << "'" << std::endl;
+        return 1;
+    }
+
+    std::string reason;
+    FuzzOutcome outcome = execute(input, reason);
+    std::cout << std::endl;
+    if (outcome == FuzzOutcome::OK)
+    {
+        std::cerr << "[fuzz] " << path << ": exited after " << cpu.get_instret() << " instructions" << std::endl;
+        return 0;
+    }
+    std::cerr << "[fuzz] " << path << ": " << (outcome == FuzzOutcome::CRASH ? "crash" : "hang") << ": " << reason
+              << std::endl;
+    return 1;
+}
+
+int Fuzzer::fuzz(const std::string &dir)
+{
+    env.set_output(discard);
+
+    std::vector<std::string> names;
+    list_dir(dir, names);
+    uint64_t crashes = 0;
+    uint64_t hangs = 0;
+    uint64_t runs = 0;
+    std::string reason;
+
+    // Earlier findings stay out of the corpus
+    std::vector<std::string> seed_names;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (names[i].compare(0, 6, "crash-") == 0 || names[i].compare(0, 5, "hang-") == 0)
+            continue;
+        std::vector<uint8_t> seed;
+        if (!read_file(dir + "/" + names[i], seed))
+            continue;
+        if (seed.size() > config.max_len)
+            seed.resize(config.max_len);
+        corpus.push_back(seed);
+        seed_names.push_back(names[i]);
+    }
+    if (corpus.empty())
+    {
+        corpus.push_back(std::vector<uint8_t>(1, '\n'));
+        seed_names.push_back("(built-in)");
+    }
+
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        FuzzOutcome outcome = execute(corpus[i], reason);
+        runs++;
+        if (outcome == FuzzOutcome::OK)
+            has_new_bits(virgin_bits);
+        else
+            std::cerr << "[fuzz] Seed " << seed_names[i] << " " << (outcome == FuzzOutcome::CRASH ? "crashes" : "hangs")
+                      << ": " << reason << std::endl;
+    }
+    std::cerr << "[fuzz] " << corpus.size() << " seeds, " << count_edges() << " edges" << std::endl;
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    Clock::time_point last_report = start;
+    std::vector<uint8_t> input;
+    while (!config.runs || runs < config.runs)
+    {
+        input = corpus[random((uint32_t)corpus.size())];
+        mutate(input);
+        FuzzOutcome outcome = execute(input, reason);
+        runs++;
+
+        if (outcome == FuzzOutcome::OK)
+        {
+            if (has_new_bits(virgin_bits))
+            {
+                corpus.push_back(input);
+                save(dir, "cov", input);
+            }
+        }
+        else if (has_new_bits(outcome == FuzzOutcome::CRASH ? virgin_crash : virgin_hang))
+        {
+            const char *kind = outcome == FuzzOutcome::CRASH ? "crash" : "hang";
+            (outcome == FuzzOutcome::CRASH ? crashes : hangs)++;
+            save(dir, kind, input);
+            std::cerr << "[fuzz] New " << kind << ": " << reason << std::endl;
+        }
+
+        if (runs % REPORT_CHECK_RUNS == 0)
+        {
+            Clock::time_point now = Clock::now();
+            if (now - last_report >= std::chrono::seconds(1))
+            {
+                std::chrono::duration<double> elapsed = now - start;
+                std::cerr << "[fuzz] " << runs << " runs, " << (uint64_t)(runs / elapsed.count()) << "/s, corpus "
+                          << corpus.size() << ", edges " << count_edges() << ", crashes " << crashes << ", hangs "
+                          << hangs << std::endl;
+                last_report = now;
+            }
+        }
+    }
+
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    std::cerr << "[fuzz] Done: " << runs << " runs in " << elapsed.count() << " s, corpus " << corpus.size()
+              << ", edges " << count_edges() << ", crashes " << crashes << ", hangs " << hangs << std::endl;
+    env.set_output(std::cout);
+    return crashes || hangs ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../cpu/riscv.hpp"
+
+class SimpleEnvironment;
+
+// Ways a fuzz input enters the machine (FuzzConfig::channels bits)
+enum FuzzChannel
+{
+    FUZZ_STDIN = 1, // Data returned by the stdin syscalls (5, 8, 12)
+    FUZZ_UART = 2,  // Bytes received by the UART, read from its data register
+    FUZZ_GPIO = 4   // Pin events, one byte each: bits 0-4 pin, bit 7 level
+};
+
+struct FuzzConfig
+{
+    unsigned channels = FUZZ_STDIN;
+    uint64_t max_steps = 1000000; // Instructions per input before it counts as a hang
+    uint64_t runs = 0;            // Inputs to try; 0 for no limit
+    size_t max_len = 4096;        // Longest input the mutator produces
+    uint64_t seed = 0;            // Mutator seed; 0 picks one from the clock
+};
+
+enum class FuzzOutcome
+{
+    OK,    // The program exited within the budget
+    CRASH, // Emulator exception (illegal instruction, memory fault) or EBREAK
+    HANG   // Instruction budget used up
+};
+
+// Persistent-mode, coverage-guided fuzzing inside the emulator process.
+//
+// The machine state when the fuzzer is created (usually after booting to
+// an entry point) is the snapshot every input starts from: CPU and bus
+// state are reloaded and the RAM pages the previous input wrote are
+// copied back (RISCV::track_page_writes), so an input costs only the
+// instructions it runs plus the pages it dirties. The core records edge
+// coverage into an AFL-style bitmap (RISCV::set_coverage_map); mutated
+// inputs that reach a new edge or hit count join the corpus.
+//
+// With one channel the whole input goes to it. With several, the input
+// is a sequence of records: a byte selecting the channel (modulo the
+// number enabled, in the order stdin, uart, gpio), a length byte and that
+// many payload bytes. Stdin data is available from the start; UART
+// records and each GPIO event are delivered FUZZ_EVENT_STEPS instructions
+// apart, in input order.
+class Fuzzer : public PageWriteObserver
+{
+public:
+    static const uint64_t FUZZ_EVENT_STEPS = 5000;
+
+    Fuzzer(RISCV &cpu, Bus &bus, SimpleEnvironment &env, const FuzzConfig &config);
+    ~Fuzzer();
+
+    // A directory is fuzzed as a corpus: seeds are read from it, inputs
+    // reaching new coverage are written to it (cov-*), and crashing or
+    // hanging ones beside them (crash-*, hang-*). A file is run once with
+    // the program's output shown, to reproduce a finding. Returns the exit
+    // status: 1 if anything crashed or hung.
+    int run(const std::string &path);
+
+    // Runs one input from the snapshot; reason describes a crash or hang
+    FuzzOutcome execute(const std::vector<uint8_t> &input, std::string &reason);
+
+    void before_page_write(RISCV &cpu, uint32_t page) override;
+
+private:
+    struct Event
+    {
+        uint64_t step;
+        unsigned channel;
+        size_t begin, end; // Payload bytes of the input
+    };
+
+    int fuzz(const std::string &dir);
+    void restore();
+    void split(const std::vector<uint8_t> &input);
+    void deliver(const std::vector<uint8_t> &input, const Event &ev);
+    bool has_new_bits(std::vector<uint8_t> &virgin);
+    size_t count_edges() const;
+    void mutate(std::vector<uint8_t> &data);
+    uint64_t next_random();
+    uint32_t random(uint32_t limit) { return (uint32_t)(next_random() % limit); }
+    void save(const std::string &dir, const char *prefix, const std::vector<uint8_t> &data);
+
+    RISCV &cpu;
+    Bus &bus;
+    SimpleEnvironment &env;
+    FuzzConfig config;
+
+    // Snapshot: CPU and bus state, RAM pages as they were before the
+    // first write since, and the pages written by the current input
+    std::vector<uint8_t> cpu_state;
+    std::vector<uint8_t> bus_state;
+    std::unordered_map<uint32_t, std::vector<uint8_t>> saved_pages;
+    std::vector<uint32_t> dirty_pages;
+
+    std::vector<uint8_t> trace_bits;   // Coverage of the current input
+    std::vector<uint8_t> virgin_bits;  // Hit-count buckets not seen yet
+    std::vector<uint8_t> virgin_crash; // Same, over crashing inputs
+    std::vector<uint8_t> virgin_hang;
+
+    std::istringstream stdin_data;
+    std::ostream discard; // Program output while fuzzing
+    std::vector<Event> events;
+    std::vector<std::vector<uint8_t>> corpus;
+    uint64_t rng;
+};
@@ -0,0 +1,448 @@
+#include "trace_ir.hpp"
+#include <climits>
+#include <cstddef>
+
+static int32_t sign_extend(uint32_t value, int bits)
+{
+    int32_t shift = 32 - bits;
+    return (int32_t)(value << shift) >> shift;
+}
+
+// Same results as RISCV::exec
+uint32_t IrTrace::fold(IrOp op, uint32_t a, uint32_t b)
+{
+    switch (op)
+    {
+    case IrOp::ADD:
+        return a + b;
+    case IrOp::SUB:
+        return a - b;
+    case IrOp::AND:
+        return a & b;
+    case IrOp::OR:
+        return a | b;
+    case IrOp::XOR:
+        return a ^ b;
+    case IrOp::SLL:
+        return a << (b & 0x1F);
+    case IrOp::SRL:
+        return a >> (b & 0x1F);
+    case IrOp::SRA:
+        return (uint32_t)((int32_t)a >> (b & 0x1F));
+    case IrOp::SLT:
+        return (int32_t)a < (int32_t)b ? 1 : 0;
+    case IrOp::SLTU:
+        return a < b ? 1 : 0;
+    case IrOp::MUL:
+        return a * b;
+    case IrOp::MULH:
+        return (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+    case IrOp::MULHSU:
+        return (uint32_t)(((int64_t)(int32_t)a * (int64_t)b) >> 32);
+    case IrOp::MULHU:
+        return (uint32_t)(((uint64_t)a * (uint64_t)b) >> 32);
+    case IrOp::DIV:
+        if (b == 0)
+            return UINT32_MAX;
+        if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+            return a;
+        return (uint32_t)((int32_t)a / (int32_t)b);
+    case IrOp::DIVU:
+        return b == 0 ? UINT32_MAX : a / b;
+    case IrOp::REM:
+        if (b == 0)
+            return a;
+        if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+            return 0;
+        return (uint32_t)((int32_t)a % (int32_t)b);
+    case IrOp::REMU:
+        return b == 0 ? a : a % b;
+    default:
+        return 0;
+    }
+}
+
+static bool test(IrCond cond, uint32_t a, uint32_t b)
+{
+    switch (cond)
+    {
+    case IrCond::EQ:
+        return a == b;
+    case IrCond::NE:
+        return a != b;
+    case IrCond::LT:
+        return (int32_t)a < (int32_t)b;
+    case IrCond::GE:
+        return (int32_t)a >= (int32_t)b;
+    case IrCond::LTU:
+        return a < b;
+    default:
+        return a >= b;
+    }
+}
+
+static IrCond negate(IrCond cond)
+{
+    switch (cond)
+    {
+    case IrCond::EQ:
+        return IrCond::NE;
+    case IrCond::NE:
+        return IrCond::EQ;
+    case IrCond::LT:
+        return IrCond::GE;
+    case IrCond::GE:
+        return IrCond::LT;
+    case IrCond::LTU:
+        return IrCond::GEU;
+    default:
+        return IrCond::LTU;
+    }
+}
+
+static bool commutative(IrOp op)
+{
+    return op == IrOp::ADD || op == IrOp::AND || op == IrOp::OR || op == IrOp::XOR ||
+           op == IrOp::MUL || op == IrOp::MULH || op == IrOp::MULHU;
+}
+
+bool IrTrace::has_call(IrOp op)
+{
+    return op == IrOp::LOAD || op == IrOp::STORE || op == IrOp::DIV || op == IrOp::DIVU ||
+           op == IrOp::REM || op == IrOp::REMU;
+}
+
+int32_t IrTrace::emit(IrOp op, int32_t a, int32_t b, uint32_t imm, IrCond cond)
+{
+    IrInsn insn;
+    insn.op = op;
+    insn.cond = cond;
+    insn.a = a;
+    insn.b = b;
+    insn.imm = imm;
+    insn.index = index;
+    insn.exit = -1;
+    insn.live = true;
+    insns.push_back(insn);
+    return (int32_t)insns.size() - 1;
+}
+
+// Pure values are numbered: asking for the same one twice returns the
+// first (common subexpressions, repeated constants, register reads)
+int32_t IrTrace::constant(uint32_t value)
+{
+    for (size_t i = 0; i < insns.size(); i++)
+    {
+        if (insns[i].op == IrOp::CONST && insns[i].imm == value)
+            return (int32_t)i;
+    }
+    return emit(IrOp::CONST, -1, -1, value);
+}
+
+int32_t IrTrace::get(uint32_t r)
+{
+    if (r == 0)
+        return constant(0);
+    if (regs[r] >= 0)
+        return regs[r];
+    if (initial[r] < 0)
+        initial[r] = emit(IrOp::GET, -1, -1, r);
+    return initial[r];
+}
+
+void IrTrace::set(uint32_t rd, int32_t v)
+{
+    if (rd != 0)
+        regs[rd] = v == initial[rd] ? -1 : v;
+}
+
+int32_t IrTrace::binop(IrOp op, int32_t a, int32_t b)
+{
+    if (is_const(a) && is_const(b))
+        return constant(fold(op, insns[a].imm, insns[b].imm));
+    if (commutative(op) && is_const(a))
+    {
+        int32_t t = a;
+        a = b;
+        b = t;
+    }
+
+    // Identities
+    if (is_const(b))
+    {
+        uint32_t c = insns[b].imm;
+        switch (op)
+        {
+        case IrOp::ADD:
+        case IrOp::SUB:
+        case IrOp::OR:
+        case IrOp::XOR:
+            if (c == 0)
+                return a;
+            break;
+        case IrOp::SLL:
+        case IrOp::SRL:
+        case IrOp::SRA:
+            if ((c & 0x1F) == 0)
+                return a;
+            break;
+        case IrOp::AND:
+            if (c == 0)
+                return b;
+            if (c == UINT32_MAX)
+                return a;
+            break;
+        case IrOp::MUL:
+            if (c == 0)
+                return b;
+            if (c == 1)
+                return a;
+            break;
+        default:
+            break;
+        }
+
+        // (x + c1) + c2 => x + (c1 + c2): address arithmetic off one base
+        if (op == IrOp::ADD && insns[a].op == IrOp::ADD && is_const(insns[a].b))
+            return binop(IrOp::ADD, insns[a].a, constant(insns[insns[a].b].imm + c));
+    }
+    if (a == b)
+    {
+        if (op == IrOp::SUB || op == IrOp::XOR || op == IrOp::SLT || op == IrOp::SLTU)
+            return constant(0);
+        if (op == IrOp::AND || op == IrOp::OR)
+            return a;
+    }
+
+    for (size_t i = 0; i < insns.size(); i++)
+    {
+        const IrInsn &insn = insns[i];
+        if (insn.op == op && insn.a == a && insn.b == b)
+            return (int32_t)i;
+    }
+    return emit(op, a, b, 0);
+}
+
+int32_t IrTrace::add_exit(IrExitKind kind, uint32_t next_pc)
+{
+    IrExit exit;
+    exit.kind = kind;
+    exit.index = index;
+    exit.next_pc = next_pc;
+    exit.dynamic_pc = false;
+    for (int r = 0; r < 32; r++)
+        exit.regs[r] = regs[r];
+    exits.push_back(exit);
+    return (int32_t)exits.size() - 1;
+}
+
+void IrTrace::guard(IrCond cond, int32_t a, int32_t b, uint32_t next_pc, bool dynamic_pc)
+{
+    // Provably true on every iteration: nothing to check
+    if ((is_const(a) && is_const(b) && test(cond, insns[a].imm, insns[b].imm)) ||
+        (a == b && (cond == IrCond::EQ || cond == IrCond::GE || cond == IrCond::GEU)))
+        return;
+
+    int32_t g = emit(IrOp::GUARD, a, b, 0, cond);
+    insns[g].exit = add_exit(IrExitKind::GUARD, next_pc);
+    exits.back().dynamic_pc = dynamic_pc;
+}
+
+bool IrTrace::build(const std::vector<TraceStep> &steps)
+{
+    insns.clear();
+    exits.clear();
+    for (int r = 0; r < 32; r++)
+    {
+        regs[r] = -1;
+        initial[r] = -1;
+    }
+    length = (uint32_t)steps.size();
+
+    for (index = 0; index < length; index++)
+    {
+        const TraceStep &s = steps[index];
+        uint32_t instr = s.instr;
+        uint32_t opcode = instr & 0x7F;
+        uint32_t rd = (instr >> 7) & 0x1F;
+        uint32_t funct3 = (instr >> 12) & 0x7;
+        uint32_t rs1 = (instr >> 15) & 0x1F;
+        uint32_t rs2 = (instr >> 20) & 0x1F;
+        uint32_t funct7 = instr >> 25;
+        int32_t imm = sign_extend(instr >> 20, 12);
+
+        switch (opcode)
+        {
+        case 0x37: // LUI
+            set(rd, constant(instr & 0xFFFFF000));
+            break;
+
+        case 0x17: // AUIPC
+            set(rd, constant(s.pc + (instr & 0xFFFFF000)));
+            break;
+
+        case 0x6F: // JAL
+            set(rd, constant(s.pc + 4));
+            break;
+
+        case 0x67: // JALR
+        {
+            int32_t target = binop(IrOp::AND, binop(IrOp::ADD, get(rs1), constant((uint32_t)imm)), constant(~1u));
+            set(rd, constant(s.pc + 4));
+            guard(IrCond::EQ, target, constant(s.next_pc), 0, true);
+            break;
+        }
+
+        case 0x63: // BRANCH
+        {
+            uint32_t bimm = ((instr >> 8) & 0xF) << 1 | ((instr >> 25) & 0x3F) << 5 |
+                            ((instr >> 7) & 0x1) << 11 | ((instr >> 31) & 0x1) << 12;
+            uint32_t target = s.pc + sign_extend(bimm, 13);
+            // Taken and not taken look the same: the cost is unknown
+            if (target == s.pc + 4)
+                return false;
+
+            IrCond cond;
+            switch (funct3)
+            {
+            case 0x0:
+                cond = IrCond::EQ;
+                break;
+            case 0x1:
+                cond = IrCond::NE;
+                break;
+            case 0x4:
+                cond = IrCond::LT;
+                break;
+            case 0x5:
+                cond = IrCond::GE;
+                break;
+            case 0x6:
+                cond = IrCond::LTU;
+                break;
+            case 0x7:
+                cond = IrCond::GEU;
+                break;
+            default:
+                return false;
+            }
+            bool taken = s.next_pc == target;
+            guard(taken ? cond : negate(cond), get(rs1), get(rs2), taken ? s.pc + 4 : target, false);
+            break;
+        }
+
+        case 0x13: // OP-IMM
+        {
+            static const IrOp ops[8] = {IrOp::ADD, IrOp::SLL, IrOp::SLT, IrOp::SLTU,
+                                        IrOp::XOR, IrOp::SRL, IrOp::OR, IrOp::AND};
+            IrOp op = ops[funct3];
+            uint32_t value = (uint32_t)imm;
+            if (funct3 == 0x1 || funct3 == 0x5)
+                value &= 0x1F;
+            if (funct3 == 0x5 && funct7 != 0x00)
+                op = IrOp::SRA;
+            set(rd, binop(op, get(rs1), constant(value)));
+            break;
+        }
+
+        case 0x33: // OP
+        {
+            IrOp op;
+            if (funct7 & 0x1)
+            {
+                static const IrOp ops[8] = {IrOp::MUL, IrOp::MULH, IrOp::MULHSU, IrOp::MULHU,
+                                            IrOp::DIV, IrOp::DIVU, IrOp::REM, IrOp::REMU};
+                op = ops[funct3];
+            }
+            else
+            {
+                static const IrOp ops[8] = {IrOp::ADD, IrOp::SLL, IrOp::SLT, IrOp::SLTU,
+                                            IrOp::XOR, IrOp::SRL, IrOp::OR, IrOp::AND};
+                op = ops[funct3];
+                if (funct3 == 0x0 || funct3 == 0x5)
+                {
+                    if (funct7 != 0x00 && funct7 != 0x20)
+                        return false;
+                    if (funct7 == 0x20)
+                        op = funct3 == 0x0 ? IrOp::SUB : IrOp::SRA;
+                }
+            }
+            set(rd, binop(op, get(rs1), get(rs2)));
+            break;
+        }
+
+        case 0x03: // LOAD
+        {
+            if (funct3 == 0x3 || funct3 > 0x5)
+                return false;
+            int32_t addr = binop(IrOp::ADD, get(rs1), constant((uint32_t)imm));
+            int32_t v = emit(IrOp::LOAD, addr, -1, funct3);
+
+            // A failed load leaves rd alone: the ERROR exit (STOP + 1) has
+            // the registers from before it
+            int32_t before = rd ? regs[rd] : -1;
+            set(rd, v);
+            insns[v].exit = add_exit(IrExitKind::STOP, s.pc + 4);
+            add_exit(IrExitKind::ERROR, s.pc);
+            if (rd)
+                exits.back().regs[rd] = before;
+            break;
+        }
+
+        case 0x23: // STORE
+        {
+            if (funct3 > 0x2)
+                return false;
+            int32_t simm = sign_extend(((instr >> 7) & 0x1F) | ((instr >> 25) << 5), 12);
+            int32_t addr = binop(IrOp::ADD, get(rs1), constant((uint32_t)simm));
+            int32_t st = emit(IrOp::STORE, addr, get(rs2), funct3);
+            insns[st].exit = add_exit(IrExitKind::STOP, s.pc + 4);
+            add_exit(IrExitKind::ERROR, s.pc);
+            break;
+        }
+
+        case 0x0F: // FENCE, FENCE.I
+            break;
+
+        default: // SYSTEM and anything unknown stay in the interpreter
+            return false;
+        }
+    }
+
+    for (int r = 0; r < 32; r++)
+        final_regs[r] = regs[r];
+    return true;
+}
+
+void IrTrace::dead_code()
+{
+    for (size_t i = 0; i < insns.size(); i++)
+    {
+        IrOp op = insns[i].op;
+        insns[i].live = op == IrOp::LOAD || op == IrOp::STORE || op == IrOp::GUARD;
+    }
+    for (size_t e = 0; e < exits.size(); e++)
+    {
+        for (int r = 1; r < 32; r++)
+        {
+            if (exits[e].regs[r] >= 0)
+                insns[exits[e].regs[r]].live = true;
+        }
+    }
+    for (int r = 1; r < 32; r++)
+    {
+        if (final_regs[r] >= 0)
+            insns[final_regs[r]].live = true;
+    }
+
+    // Operands always come first: one backward sweep reaches everything
+    for (size_t i = insns.size(); i-- > 0;)
+    {
+        if (!insns[i].live)
+            continue;
+        if (insns[i].a >= 0)
+            insns[insns[i].a].live = true;
+        if (insns[i].b >= 0)
+            insns[insns[i].b].live = true;
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// SSA form of one iteration of a recorded loop trace (see trace_jit.hpp).
+//
+// Every instruction defines one value, its index in IrTrace::insns. While
+// a trace is lifted each guest register maps to the value it currently
+// holds, so a register read is just a reference to that value: the
+// register file is read once per iteration (GET) and written once, at the
+// back-edge or a side exit, with the final values only. Lifting folds
+// constants (LUI + ADDI pairs become one CONST), simplifies identities and
+// shares repeated computations; dead_code() then drops what nothing uses.
+
+enum class IrOp : uint8_t
+{
+    CONST, // imm
+    GET,   // Guest register imm at the start of the iteration
+    ADD,
+    SUB,
+    AND,
+    OR,
+    XOR,
+    SLL,
+    SRL,
+    SRA,
+    SLT,
+    SLTU,
+    MUL,
+    MULH,
+    MULHSU,
+    MULHU,
+    DIV,
+    DIVU,
+    REM,
+    REMU,
+    LOAD,  // a = address, imm = funct3; value is the loaded word
+    STORE, // a = address, b = value, imm = funct3
+    GUARD  // Side exit unless (a cond b)
+};
+
+// GUARD conditions, one per branch kind; JALR targets use EQ
+enum class IrCond : uint8_t
+{
+    EQ,
+    NE,
+    LT,
+    GE,
+    LTU,
+    GEU
+};
+
+struct IrInsn
+{
+    IrOp op;
+    IrCond cond;
+    int32_t a;     // Operand values, -1 if unused
+    int32_t b;
+    uint32_t imm;
+    uint32_t index; // Guest instruction in the trace
+    int32_t exit;   // GUARD, LOAD, STORE: exit taken (LOAD/STORE: when stopped)
+    bool live;
+};
+
+enum class IrExitKind : uint8_t
+{
+    GUARD, // A branch or JALR went the other way; the instruction retired
+    STOP,  // A memory access asked to stop (MMIO, watchpoint, code store); retired
+    ERROR, // A memory access threw; the instruction did not retire
+    END    // The iteration budget ran out at the loop head
+};
+
+struct IrExit
+{
+    IrExitKind kind;
+    uint32_t index;   // Guest instruction it leaves at
+    uint32_t next_pc; // Where the interpreter resumes (GUARD, STOP)
+    bool dynamic_pc;  // JALR guard: the target is only known at run time
+    int32_t regs[32]; // Value of each guest register, -1 if unchanged
+};
+
+// One recorded guest instruction
+struct TraceStep
+{
+    uint32_t pc;
+    uint32_t instr;
+    uint32_t next_pc; // Where it went when recorded
+};
+
+class IrTrace
+{
+public:
+    std::vector<IrInsn> insns;
+    std::vector<IrExit> exits;
+    int32_t final_regs[32]; // Values at the back-edge, -1 if unchanged
+    uint32_t length = 0;    // Guest instructions per iteration
+
+    // Lifts a recorded loop (steps[0].pc is the head; the last step goes
+    // back to it). False for an instruction the JIT cannot run.
+    bool build(const std::vector<TraceStep> &steps);
+
+    // Clears live on everything no exit, guard, memory access or final
+    // register value depends on
+    void dead_code();
+
+    bool is_const(int32_t v) const { return v >= 0 && insns[v].op == IrOp::CONST; }
+    static bool has_call(IrOp op); // Runs through a helper function
+    static uint32_t fold(IrOp op, uint32_t a, uint32_t b); // Arithmetic ops only
+
+private:
+    int32_t emit(IrOp op, int32_t a, int32_t b, uint32_t imm, IrCond cond = IrCond::EQ);
+    int32_t constant(uint32_t value);
+    int32_t get(uint32_t r);
+    int32_t binop(IrOp op, int32_t a, int32_t b);
+    void guard(IrCond cond, int32_t a, int32_t b, uint32_t next_pc, bool dynamic_pc);
+    int32_t add_exit(IrExitKind kind, uint32_t next_pc);
+    void set(uint32_t rd, int32_t v);
+
+    int32_t regs[32];    // Current value of each guest register
+    int32_t initial[32]; // GET value of each register, -1 until read
+    uint32_t index = 0;  // Guest instruction being lifted
+};
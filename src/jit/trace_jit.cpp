@@ -0,0 +1,1027 @@
+#include "trace_jit.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include "../cpu/riscv.hpp"
+#include "x64_emitter.hpp"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#define RVEMU_JIT_X64 1
+#endif
+
+// State shared by execute(), the generated code and the memory helpers.
+// The generated code only touches iter, max_iter and next_pc.
+struct JitFrame
+{
+    uint64_t iter;     // Completed iterations
+    uint64_t max_iter; // Iterations that fit in the step budget
+    uint32_t next_pc;  // Target of a JALR that left the trace
+    uint32_t ticked;   // Bus ticks already delivered by MMIO accesses
+    uint64_t entry_instret;
+    uint64_t entry_cycles;
+    TraceJit *jit;
+    const void *trace;
+    uint32_t simple;
+};
+
+// Guest registers with a host register for the whole loop, busiest first
+static const x64::Reg HOME_REGS[] = {x64::RBX, x64::RBP, x64::R12, x64::R13, x64::R14};
+// Temporaries that do not have to survive a call
+static const x64::Reg CALL_CLOBBERED[] = {x64::RSI, x64::RDI, x64::R8, x64::R9, x64::R10, x64::R11};
+// RAX, RCX and RDX are scratch; R15 points at the guest register file.
+// [rsp] holds the JitFrame pointer, spill slots start at SLOT_BASE.
+static const int32_t SLOT_BASE = 16;
+static const size_t MAX_CODE = 1 << 20;
+
+static uint32_t simple_cost(const TraceStep &s)
+{
+    switch (s.instr & 0x7F)
+    {
+    case 0x03: // LOAD
+    case 0x23: // STORE
+        return 5;
+    case 0x6F: // JAL
+    case 0x67: // JALR
+    case 0x0F: // FENCE, FENCE.I
+        return 3;
+    case 0x63: // BRANCH, taken costs one more
+        return s.next_pc != s.pc + 4 ? 3 : 2;
+    case 0x33: // OP: MUL* 4, DIV/REM 6
+        if ((s.instr >> 25) & 1)
+            return ((s.instr >> 12) & 0x4) ? 6 : 4;
+        return 2;
+    default:
+        return 2;
+    }
+}
+
+// DIV, DIVU, REM and REMU from generated code
+static uint32_t divide(uint32_t op, uint32_t a, uint32_t b)
+{
+    return IrTrace::fold((IrOp)op, a, b);
+}
+
+TraceJit::TraceJit()
+{
+#ifdef RVEMU_JIT_X64
+    void *p = mmap(nullptr, CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED)
+        cache = (uint8_t *)p;
+#endif
+}
+
+TraceJit::~TraceJit()
+{
+#ifdef RVEMU_JIT_X64
+    if (cache)
+        munmap(cache, CACHE_SIZE);
+#endif
+}
+
+void TraceJit::bind(RISCV *core)
+{
+    flush();
+    cpu = core;
+}
+
+void TraceJit::flush()
+{
+    for (size_t i = 0; i < traces.size(); i++)
+    {
+        if (!traces[i]->dead)
+            kill(*traces[i]);
+    }
+    traces.clear();
+    heads.clear();
+    page_traces.clear();
+    cache_used = 0;
+    recording = false;
+    recorded.clear();
+}
+
+void TraceJit::kill(Trace &trace)
+{
+    trace.dead = true;
+    live_traces--;
+    Head &h = heads[trace.head];
+    h.trace = nullptr;
+    h.count = 0;
+    for (size_t i = 0; i < trace.pages.size(); i++)
+    {
+        uint32_t page = trace.pages[i];
+        cpu->release_code_page(page);
+        std::vector<Trace *> &list = page_traces[page];
+        list.erase(std::remove(list.begin(), list.end(), &trace), list.end());
+        if (list.empty())
+            page_traces.erase(page);
+    }
+}
+
+TraceJit::Trace *TraceJit::back_edge(uint32_t target)
+{
+    Head &h = heads[target];
+    if (h.trace)
+        return h.trace;
+    if (recording || h.attempts >= MAX_ATTEMPTS || !cache)
+        return nullptr;
+    if (++h.count >= HOT_LOOP)
+    {
+        h.count = 0;
+        recording = true;
+        recording_head = target;
+        recorded.clear();
+    }
+    return nullptr;
+}
+
+void TraceJit::abort_recording()
+{
+    if (!recording)
+        return;
+    heads[recording_head].attempts++;
+    recording = false;
+    recorded.clear();
+}
+
+void TraceJit::record(uint32_t pc, uint32_t instr, uint32_t next_pc)
+{
+    // Something other than the recorded instructions ran in between
+    // (an exception ended the last run_for)
+    if (pc != (recorded.empty() ? recording_head : recorded.back().next_pc))
+    {
+        abort_recording();
+        return;
+    }
+
+    TraceStep step;
+    step.pc = pc;
+    step.instr = instr;
+    step.next_pc = next_pc;
+    recorded.push_back(step);
+
+    // Only jumps and branches leave the fall-through path; system
+    // instructions always stay in the interpreter
+    uint32_t opcode = instr & 0x7F;
+    bool jump = opcode == 0x63 || opcode == 0x6F || opcode == 0x67;
+    if (opcode == 0x73 || (!jump && next_pc != pc + 4) || recorded.size() > MAX_TRACE)
+    {
+        abort_recording();
+        return;
+    }
+
+    if (next_pc == recording_head)
+    {
+        uint32_t head = recording_head;
+        recording = false;
+        if (!compile())
+            heads[head].attempts++;
+        recorded.clear();
+    }
+}
+
+bool TraceJit::compile()
+{
+    // A store while recording may have changed an instruction already seen
+    for (size_t i = 0; i < recorded.size(); i++)
+    {
+        uint32_t pc = recorded[i].pc;
+        const uint8_t *p = &cpu->mem[pc];
+        if ((uint32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24)) != recorded[i].instr)
+            return false;
+    }
+
+    IrTrace ir;
+    if (!ir.build(recorded))
+        return false;
+    ir.dead_code();
+
+    std::unique_ptr<Trace> trace(new Trace);
+    trace->head = recorded[0].pc;
+    trace->steps = recorded;
+    trace->prefix.push_back(0);
+    for (size_t i = 0; i < recorded.size(); i++)
+        trace->prefix.push_back(trace->prefix.back() + simple_cost(recorded[i]));
+
+    std::vector<uint8_t> code;
+    if (!generate(ir, *trace, code))
+        return false;
+    if (cache_used + code.size() > CACHE_SIZE)
+        flush(); // Nothing runs from the cache while the interpreter records
+    std::memcpy(cache + cache_used, code.data(), code.size());
+    trace->fn = (uint32_t(*)(uint32_t *, JitFrame *))(void *)(cache + cache_used);
+    cache_used = (cache_used + code.size() + 15) & ~(size_t)15;
+
+    const std::vector<TraceStep> &s = trace->steps; // flush() clears recorded
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        uint32_t pages[2] = {s[i].pc >> RISCV::PAGE_SHIFT, (s[i].pc + 3) >> RISCV::PAGE_SHIFT};
+        for (int j = 0; j < 2; j++)
+        {
+            if (std::find(trace->pages.begin(), trace->pages.end(), pages[j]) == trace->pages.end())
+                trace->pages.push_back(pages[j]);
+        }
+    }
+    for (size_t i = 0; i < trace->pages.size(); i++)
+    {
+        cpu->acquire_code_page(trace->pages[i]);
+        page_traces[trace->pages[i]].push_back(trace.get());
+    }
+
+    heads[trace->head].trace = trace.get();
+    traces.push_back(std::move(trace));
+    live_traces++;
+    return true;
+}
+
+void TraceJit::invalidate(uint32_t addr, uint32_t size)
+{
+    uint32_t first = addr >> RISCV::PAGE_SHIFT;
+    uint32_t last = (addr + size - 1) >> RISCV::PAGE_SHIFT;
+    for (uint32_t page = first; page <= last; page++)
+    {
+        std::unordered_map<uint32_t, std::vector<Trace *>>::iterator it = page_traces.find(page);
+        if (it == page_traces.end())
+            continue;
+
+        std::vector<Trace *> hit;
+        for (size_t i = 0; i < it->second.size(); i++)
+        {
+            const std::vector<TraceStep> &s = it->second[i]->steps;
+            for (size_t j = 0; j < s.size(); j++)
+            {
+                if (s[j].pc < addr + size && addr < s[j].pc + 4)
+                {
+                    hit.push_back(it->second[i]);
+                    break;
+                }
+            }
+        }
+        // The code itself stays in the cache: the store may come from
+        // inside the trace being killed
+        for (size_t i = 0; i < hit.size(); i++)
+            kill(*hit[i]);
+    }
+}
+
+uint64_t TraceJit::execute(Trace &trace, uint64_t max_steps, bool simple)
+{
+    RISCV &core = *cpu;
+    uint32_t length = (uint32_t)trace.steps.size();
+    if (trace.dead || max_steps / length == 0)
+        return 0;
+
+    // Breakpoints and unloaded pages need the interpreter's fetch check
+    for (size_t i = 0; i < trace.pages.size(); i++)
+    {
+        if (core.page_flags[trace.pages[i]] & (RISCV::PAGE_BREAKPOINT | RISCV::PAGE_LAZY))
+            return 0;
+    }
+    if (core.interrupt_pending())
+        return 0;
+
+    JitFrame f;
+    f.iter = 0;
+    f.max_iter = max_steps / length;
+    f.next_pc = 0;
+    f.ticked = 0;
+    f.entry_instret = core.instret;
+    f.entry_cycles = core.cycles;
+    f.jit = this;
+    f.trace = &trace;
+    f.simple = simple;
+
+    const Exit &exit = trace.exits[trace.fn(core.reg, &f)];
+    uint64_t n = f.iter * length + exit.retired;
+    steps += n;
+    if (exit.kind != IrExitKind::END)
+        exits++;
+
+    // A failed access has already left instret, pc and cycles where the
+    // interpreter would have them (sync)
+    if (exit.kind != IrExitKind::ERROR)
+    {
+        core.instret = f.entry_instret + n;
+        core.pc = exit.kind == IrExitKind::END ? trace.head : exit.dynamic_pc ? f.next_pc : exit.next_pc;
+        if (simple)
+            core.cycles = f.entry_cycles + f.iter * trace.prefix.back() + exit.cost;
+        else
+            core.cycles = f.entry_cycles + n;
+    }
+
+    // Bus ticks are batched as in run_aot
+    if (core.bus && n > f.ticked)
+        core.bus->tick(n - f.ticked);
+    if (!simple)
+        warm(trace, f.iter, exit);
+
+    if (exit.kind == IrExitKind::ERROR)
+    {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+    return n;
+}
+
+// FUNCTIONAL timing trains the branch predictor with every branch. Each
+// BHT entry is a saturating 2-bit counter and every iteration applies the
+// same outcomes in the same order, which is a monotone map on the counter:
+// after three iterations more of them change nothing. So three replays of
+// the loop's branches plus the last partial iteration give exactly the
+// interpreter's predictor state.
+void TraceJit::warm(const Trace &trace, uint64_t iterations, const Exit &exit)
+{
+    PipelineModel &pipeline = cpu->pipeline;
+    const std::vector<TraceStep> &s = trace.steps;
+    uint64_t replays = iterations < 3 ? iterations : 3;
+    for (uint64_t r = 0; r < replays; r++)
+    {
+        for (size_t i = 0; i < s.size(); i++)
+        {
+            if ((s[i].instr & 0x7F) == 0x63)
+                pipeline.warm(s[i].pc, s[i].next_pc);
+        }
+    }
+
+    uint32_t partial = exit.kind == IrExitKind::GUARD ? exit.retired - 1 : exit.retired;
+    for (uint32_t i = 0; i < partial; i++)
+    {
+        if ((s[i].instr & 0x7F) == 0x63)
+            pipeline.warm(s[i].pc, s[i].next_pc);
+    }
+    if (exit.kind == IrExitKind::GUARD && (s[partial].instr & 0x7F) == 0x63)
+        pipeline.warm(s[partial].pc, exit.next_pc);
+}
+
+// Puts the core where the interpreter would be while executing trace
+// instruction k, before its access to addr. True for MMIO: the device
+// sees the ticks of every earlier instruction first, and may raise an
+// interrupt, so the trace stops after this instruction.
+bool TraceJit::sync(JitFrame *f, uint32_t k, uint32_t addr)
+{
+    const Trace &trace = *(const Trace *)f->trace;
+    RISCV &core = *cpu;
+    uint64_t done = f->iter * trace.steps.size() + k;
+    core.instret = f->entry_instret + done;
+    core.pc = trace.steps[k].pc + 4;
+    core.last_mem_addr = addr;
+    if (f->simple)
+        core.cycles = f->entry_cycles + f->iter * trace.prefix.back() + trace.prefix[k] + 2;
+    else
+        core.cycles = f->entry_cycles + done;
+
+    if (core.bus && (addr >= 0x1000 && addr <= 0x1FFF))
+    {
+        if (done > f->ticked)
+            core.bus->tick(done - f->ticked);
+        f->ticked = (uint32_t)done;
+        return true;
+    }
+    return false;
+}
+
+// Helpers return the loaded value in the low half and flags above it:
+// bit 32 stops the trace after this instruction, bit 33 reports an
+// exception (kept in error, rethrown by execute)
+uint64_t TraceJit::load(JitFrame *f, uint32_t addr, uint32_t, uint32_t k)
+{
+    TraceJit &jit = *f->jit;
+    try
+    {
+        const Trace &trace = *(const Trace *)f->trace;
+        bool stop = jit.sync(f, k, addr);
+        uint32_t value = jit.cpu->mem_read(addr, (trace.steps[k].instr >> 12) & 0x7, f->simple != 0);
+        if (!jit.cpu->running)
+            stop = true; // Watchpoint halt
+        return value | (stop ? 1ull << 32 : 0);
+    }
+    catch (...)
+    {
+        jit.error = std::current_exception();
+        return 2ull << 32;
+    }
+}
+
+uint64_t TraceJit::store(JitFrame *f, uint32_t addr, uint32_t value, uint32_t k)
+{
+    TraceJit &jit = *f->jit;
+    try
+    {
+        const Trace &trace = *(const Trace *)f->trace;
+        bool stop = jit.sync(f, k, addr);
+        jit.cpu->mem_write(addr, (trace.steps[k].instr >> 12) & 0x7, value, f->simple != 0);
+        // Watchpoint halt, or the store hit this very trace
+        if (!jit.cpu->running || trace.dead)
+            stop = true;
+        return stop ? 1ull << 32 : 0;
+    }
+    catch (...)
+    {
+        jit.error = std::current_exception();
+        return 2ull << 32;
+    }
+}
+
+namespace
+{
+
+using namespace x64;
+
+// Where a value lives while the trace runs
+struct Loc
+{
+    enum Kind : uint8_t
+    {
+        NONE, // Never read
+        IMM,
+        REG,
+        MEM
+    } kind;
+    uint32_t imm;
+    Reg reg;
+    Mem mem;
+};
+
+Loc imm_loc(uint32_t imm)
+{
+    Loc l;
+    l.kind = Loc::IMM;
+    l.imm = imm;
+    return l;
+}
+
+Loc reg_loc(Reg reg)
+{
+    Loc l;
+    l.kind = Loc::REG;
+    l.reg = reg;
+    return l;
+}
+
+Loc mem_loc(Reg base, int32_t disp)
+{
+    Loc l;
+    l.kind = Loc::MEM;
+    l.mem.base = base;
+    l.mem.disp = disp;
+    return l;
+}
+
+// Lowers one optimised trace to x86-64
+class Codegen
+{
+public:
+    Codegen(const IrTrace &ir, const void *load_fn, const void *store_fn)
+        : ir(ir), load_fn(load_fn), store_fn(store_fn) {}
+    std::vector<uint8_t> &run();
+
+private:
+    struct Stub
+    {
+        size_t field; // Jump to patch
+        size_t insn;
+    };
+
+    void allocate();
+    void load(Reg dst, int32_t v);
+    void store(int32_t v, Reg src);
+    void alu(Alu op, int32_t b); // EAX op= b
+    void body(size_t i);
+    void back_edge();
+    void writeback(const int32_t *regs);
+    void leave(uint32_t exit);
+    void stub(const Stub &s);
+    void mem_call(size_t i, const void *fn);
+
+    const IrTrace &ir;
+    const void *load_fn;
+    const void *store_fn;
+    Emitter e;
+    std::vector<Loc> locs;
+    Loc home[32];
+    int32_t slots = 0; // Spill slots
+    int32_t stack = 0; // Bytes below the pushed registers
+    size_t top = 0;
+    size_t epilogue = 0;
+    std::vector<Stub> stubs;
+};
+
+void Codegen::allocate()
+{
+    const std::vector<IrInsn> &insns = ir.insns;
+    size_t n = insns.size();
+
+    // Guest registers read or written most get a host register
+    uint32_t uses[32] = {};
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!insns[i].live)
+            continue;
+        if (insns[i].a >= 0 && insns[insns[i].a].op == IrOp::GET)
+            uses[insns[insns[i].a].imm]++;
+        if (insns[i].b >= 0 && insns[insns[i].b].op == IrOp::GET)
+            uses[insns[insns[i].b].imm]++;
+    }
+    for (int r = 1; r < 32; r++)
+    {
+        if (ir.final_regs[r] >= 0)
+            uses[r]++;
+    }
+    std::vector<int> order;
+    for (int r = 1; r < 32; r++)
+    {
+        if (uses[r])
+            order.push_back(r);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return uses[a] > uses[b]; });
+
+    std::vector<Reg> spare; // Callee-saved registers no guest register took
+    for (int r = 0; r < 32; r++)
+        home[r] = mem_loc(R15, 4 * r);
+    for (size_t i = 0; i < 5; i++)
+    {
+        if (i < order.size())
+            home[order[i]] = reg_loc(HOME_REGS[i]);
+        else
+            spare.push_back(HOME_REGS[i]);
+    }
+
+    // Live ranges in half steps: insn i reads its operands at 2i and
+    // defines its value at 2i + 1; its exits read at 2i + 1, the
+    // back-edge at 2n. A call at i clobbers between the two.
+    std::vector<uint32_t> end(n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        const IrInsn &insn = insns[i];
+        if (!insn.live)
+            continue;
+        if (insn.a >= 0)
+            end[insn.a] = std::max(end[insn.a], (uint32_t)(2 * i));
+        if (insn.b >= 0)
+            end[insn.b] = std::max(end[insn.b], (uint32_t)(2 * i));
+        if (insn.exit < 0)
+            continue;
+        int count = insn.op == IrOp::GUARD ? 1 : 2; // LOAD/STORE: STOP and ERROR
+        for (int x = 0; x < count; x++)
+        {
+            const IrExit &exit = ir.exits[insn.exit + x];
+            for (int r = 1; r < 32; r++)
+            {
+                if (exit.regs[r] >= 0)
+                    end[exit.regs[r]] = std::max(end[exit.regs[r]], (uint32_t)(2 * i + 1));
+            }
+        }
+    }
+    for (int r = 1; r < 32; r++)
+    {
+        if (ir.final_regs[r] >= 0)
+            end[ir.final_regs[r]] = (uint32_t)(2 * n);
+    }
+
+    std::vector<size_t> calls;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (insns[i].live && IrTrace::has_call(insns[i].op))
+            calls.push_back(i);
+    }
+
+    // Linear scan in definition order
+    struct Active
+    {
+        uint32_t end;
+        Loc loc;
+    };
+    std::vector<Active> active;
+    std::vector<Reg> clobbered(CALL_CLOBBERED, CALL_CLOBBERED + 6);
+    std::vector<int32_t> free_slots;
+    locs.assign(n, Loc());
+    for (size_t i = 0; i < n; i++)
+    {
+        const IrInsn &insn = insns[i];
+        locs[i].kind = Loc::NONE;
+        if (insn.op == IrOp::CONST)
+        {
+            locs[i] = imm_loc(insn.imm);
+            continue;
+        }
+        if (insn.op == IrOp::GET)
+        {
+            locs[i] = home[insn.imm];
+            continue;
+        }
+        uint32_t def = (uint32_t)(2 * i + 1);
+        if (!insn.live || insn.op == IrOp::STORE || insn.op == IrOp::GUARD || end[i] < def)
+            continue;
+
+        for (size_t a = 0; a < active.size();)
+        {
+            if (active[a].end >= def)
+            {
+                a++;
+                continue;
+            }
+            const Loc &l = active[a].loc;
+            if (l.kind == Loc::MEM)
+                free_slots.push_back(l.mem.disp);
+            else if (std::find(CALL_CLOBBERED, CALL_CLOBBERED + 6, l.reg) != CALL_CLOBBERED + 6)
+                clobbered.push_back(l.reg);
+            else
+                spare.push_back(l.reg);
+            active.erase(active.begin() + a);
+        }
+
+        bool crosses = false;
+        for (size_t c = 0; c < calls.size(); c++)
+        {
+            if (calls[c] > i && end[i] >= 2 * calls[c] + 1)
+                crosses = true;
+        }
+
+        Loc l;
+        if (!crosses && !clobbered.empty())
+        {
+            l = reg_loc(clobbered.back());
+            clobbered.pop_back();
+        }
+        else if (!spare.empty())
+        {
+            l = reg_loc(spare.back());
+            spare.pop_back();
+        }
+        else if (!free_slots.empty())
+        {
+            l = mem_loc(RSP, free_slots.back());
+            free_slots.pop_back();
+        }
+        else
+            l = mem_loc(RSP, SLOT_BASE + 4 * slots++);
+        locs[i] = l;
+        Active a;
+        a.end = end[i];
+        a.loc = l;
+        active.push_back(a);
+    }
+
+    // Spill slots, then one per guest register for the back-edge moves;
+    // rsp stays 16-byte aligned at calls (six pushes after the return
+    // address)
+    stack = SLOT_BASE + 4 * (slots + 32);
+    stack = ((stack + 15) & ~15) + 8;
+}
+
+void Codegen::load(Reg dst, int32_t v)
+{
+    const Loc &l = locs[v];
+    if (l.kind == Loc::IMM)
+        e.mov(dst, l.imm);
+    else if (l.kind == Loc::REG)
+    {
+        if (l.reg != dst)
+            e.mov(dst, l.reg);
+    }
+    else
+        e.mov(dst, l.mem);
+}
+
+void Codegen::store(int32_t v, Reg src)
+{
+    const Loc &l = locs[v];
+    if (l.kind == Loc::REG)
+        e.mov(l.reg, src);
+    else if (l.kind == Loc::MEM)
+        e.mov(l.mem, src);
+}
+
+void Codegen::alu(Alu op, int32_t b)
+{
+    const Loc &l = locs[b];
+    if (l.kind == Loc::IMM)
+        e.alu(op, RAX, l.imm);
+    else if (l.kind == Loc::REG)
+        e.alu(op, RAX, l.reg);
+    else
+        e.alu(op, RAX, l.mem);
+}
+
+// Stores every guest register whose current value is not in the
+// register file yet
+void Codegen::writeback(const int32_t *regs)
+{
+    for (int r = 1; r < 32; r++)
+    {
+        Mem dst = {R15, 4 * r};
+        if (regs[r] >= 0)
+        {
+            load(RAX, regs[r]);
+            e.mov(dst, RAX);
+        }
+        else if (home[r].kind == Loc::REG)
+            e.mov(dst, home[r].reg);
+    }
+}
+
+void Codegen::leave(uint32_t exit)
+{
+    e.mov(RAX, exit);
+    e.jmp_to(epilogue);
+}
+
+void Codegen::mem_call(size_t i, const void *fn)
+{
+    const IrInsn &insn = ir.insns[i];
+    load(RAX, insn.a);
+    if (insn.op == IrOp::STORE)
+        load(RDX, insn.b);
+    // Operands are in scratch registers before any argument register
+    // (which may hold one of them) is overwritten
+    e.mov(RSI, RAX);
+    e.mov(RCX, insn.index);
+    e.mov64(RDI, Mem{RSP, 0});
+    e.call(fn);
+    e.mov64(RCX, RAX);
+    e.shift64(SHR, RCX, 32);
+    Stub s;
+    s.field = e.jcc(NE);
+    s.insn = i;
+    stubs.push_back(s);
+    if (insn.op == IrOp::LOAD)
+        store((int32_t)i, RAX);
+}
+
+void Codegen::body(size_t i)
+{
+    const IrInsn &insn = ir.insns[i];
+    int32_t v = (int32_t)i;
+    switch (insn.op)
+    {
+    case IrOp::CONST:
+    case IrOp::GET:
+        break;
+
+    case IrOp::ADD:
+    case IrOp::SUB:
+    case IrOp::AND:
+    case IrOp::OR:
+    case IrOp::XOR:
+    {
+        static const Alu ops[] = {ADD, SUB, AND, OR, XOR};
+        load(RAX, insn.a);
+        alu(ops[(int)insn.op - (int)IrOp::ADD], insn.b);
+        store(v, RAX);
+        break;
+    }
+
+    case IrOp::SLL:
+    case IrOp::SRL:
+    case IrOp::SRA:
+    {
+        Shift op = insn.op == IrOp::SLL ? SHL : insn.op == IrOp::SRL ? SHR : SAR;
+        if (ir.is_const(insn.b))
+        {
+            load(RAX, insn.a);
+            e.shift(op, RAX, ir.insns[insn.b].imm & 0x1F);
+        }
+        else
+        {
+            load(RCX, insn.b);
+            load(RAX, insn.a);
+            e.shift_cl(op, RAX); // x86 masks the count to 5 bits as well
+        }
+        store(v, RAX);
+        break;
+    }
+
+    case IrOp::SLT:
+    case IrOp::SLTU:
+        load(RAX, insn.a);
+        alu(CMP, insn.b);
+        e.setcc(insn.op == IrOp::SLT ? L : B, RAX);
+        store(v, RAX);
+        break;
+
+    case IrOp::MUL:
+    {
+        const Loc &b = locs[insn.b];
+        load(RAX, insn.a);
+        if (b.kind == Loc::IMM)
+            e.imul(RAX, RAX, b.imm);
+        else if (b.kind == Loc::REG)
+            e.imul(RAX, b.reg);
+        else
+            e.imul(RAX, b.mem);
+        store(v, RAX);
+        break;
+    }
+
+    case IrOp::MULH:
+    case IrOp::MULHSU:
+    case IrOp::MULHU:
+        load(RAX, insn.a);
+        load(RCX, insn.b);
+        if (insn.op != IrOp::MULHU)
+            e.movsxd(RAX, RAX);
+        if (insn.op == IrOp::MULH)
+            e.movsxd(RCX, RCX);
+        e.imul64(RAX, RCX);
+        e.shift64(SHR, RAX, 32);
+        store(v, RAX);
+        break;
+
+    case IrOp::DIV:
+    case IrOp::DIVU:
+    case IrOp::REM:
+    case IrOp::REMU:
+        load(RAX, insn.a);
+        load(RCX, insn.b);
+        e.mov(RSI, RAX);
+        e.mov(RDX, RCX);
+        e.mov(RDI, (uint32_t)insn.op);
+        e.call((const void *)divide);
+        store(v, RAX);
+        break;
+
+    case IrOp::LOAD:
+        mem_call(i, load_fn);
+        break;
+
+    case IrOp::STORE:
+        mem_call(i, store_fn);
+        break;
+
+    case IrOp::GUARD:
+    {
+        // Jump to the exit when the recorded condition fails
+        static const Cond fail[] = {NE, E, GE, L, AE, B};
+        load(RAX, insn.a);
+        alu(CMP, insn.b);
+        Stub s;
+        s.field = e.jcc(fail[(int)insn.cond]);
+        s.insn = i;
+        stubs.push_back(s);
+        break;
+    }
+    }
+}
+
+// Final values into the homes. A value that is another register's entry
+// value (x5 = x6 with x6 also written) goes through a slot first, so no
+// home is read after being overwritten.
+void Codegen::back_edge()
+{
+    const int32_t *final = ir.final_regs;
+    bool staged[32] = {};
+    int32_t temp = SLOT_BASE + 4 * slots;
+    for (int r = 1; r < 32; r++)
+    {
+        int32_t v = final[r];
+        if (v < 0 || ir.insns[v].op != IrOp::GET)
+            continue;
+        uint32_t s = ir.insns[v].imm;
+        if (s != (uint32_t)r && final[s] >= 0)
+        {
+            staged[r] = true;
+            load(RAX, v);
+            e.mov(Mem{RSP, temp + 4 * r}, RAX);
+        }
+    }
+    for (int r = 1; r < 32; r++)
+    {
+        int32_t v = final[r];
+        if (v < 0)
+            continue;
+        Reg dst = home[r].kind == Loc::REG ? home[r].reg : RAX;
+        if (staged[r])
+            e.mov(dst, Mem{RSP, temp + 4 * r});
+        else
+            load(dst, v);
+        if (home[r].kind == Loc::MEM)
+            e.mov(home[r].mem, RAX);
+    }
+
+    e.mov64(RCX, Mem{RSP, 0});
+    e.inc64(Mem{RCX, (int32_t)offsetof(JitFrame, iter)});
+    e.mov64(RAX, Mem{RCX, (int32_t)offsetof(JitFrame, iter)});
+    e.alu64(CMP, RAX, Mem{RCX, (int32_t)offsetof(JitFrame, max_iter)});
+    e.jcc_to(B, top);
+}
+
+void Codegen::stub(const Stub &s)
+{
+    const IrInsn &insn = ir.insns[s.insn];
+    e.patch(s.field, e.size());
+    if (insn.op == IrOp::GUARD)
+    {
+        const IrExit &exit = ir.exits[insn.exit];
+        if (exit.dynamic_pc)
+        {
+            // EAX still holds the JALR target
+            e.mov64(RCX, Mem{RSP, 0});
+            e.mov(Mem{RCX, (int32_t)offsetof(JitFrame, next_pc)}, RAX);
+        }
+        writeback(exit.regs);
+        leave(insn.exit);
+        return;
+    }
+
+    // Memory access: ECX has the helper's flags, EAX a loaded value
+    e.test(RCX, 2);
+    size_t error = e.jcc(NE);
+    if (insn.op == IrOp::LOAD)
+        store((int32_t)s.insn, RAX);
+    writeback(ir.exits[insn.exit].regs);
+    leave(insn.exit);
+    e.patch(error, e.size());
+    writeback(ir.exits[insn.exit + 1].regs);
+    leave(insn.exit + 1);
+}
+
+std::vector<uint8_t> &Codegen::run()
+{
+    allocate();
+
+    static const Reg saved[] = {RBX, RBP, R12, R13, R14, R15};
+    for (int i = 0; i < 6; i++)
+        e.push(saved[i]);
+    e.alu64(SUB, RSP, (uint32_t)stack);
+    e.mov64(Mem{RSP, 0}, RSI);
+    e.mov64(R15, RDI);
+    for (int r = 1; r < 32; r++)
+    {
+        if (home[r].kind == Loc::REG)
+            e.mov(home[r].reg, Mem{R15, 4 * r});
+    }
+
+    top = e.size();
+    for (size_t i = 0; i < ir.insns.size(); i++)
+    {
+        if (ir.insns[i].live)
+            body(i);
+    }
+    back_edge();
+
+    // Out of iterations: the loop head is the exit
+    int32_t unchanged[32];
+    for (int r = 0; r < 32; r++)
+        unchanged[r] = -1;
+    writeback(unchanged);
+    e.mov(RAX, (uint32_t)ir.exits.size());
+
+    epilogue = e.size();
+    e.alu64(ADD, RSP, (uint32_t)stack);
+    for (int i = 5; i >= 0; i--)
+        e.pop(saved[i]);
+    e.ret();
+
+    for (size_t i = 0; i < stubs.size(); i++)
+        stub(stubs[i]);
+    return e.code;
+}
+
+} // namespace
+
+bool TraceJit::generate(const IrTrace &ir, Trace &trace, std::vector<uint8_t> &code) const
+{
+#ifdef RVEMU_JIT_X64
+    Codegen gen(ir, (const void *)&TraceJit::load, (const void *)&TraceJit::store);
+    code = gen.run();
+    if (code.size() > MAX_CODE)
+        return false;
+
+    for (size_t i = 0; i < ir.exits.size(); i++)
+    {
+        const IrExit &x = ir.exits[i];
+        const TraceStep &s = trace.steps[x.index];
+        Exit exit;
+        exit.kind = x.kind;
+        exit.retired = x.kind == IrExitKind::ERROR ? x.index : x.index + 1;
+        exit.next_pc = x.next_pc;
+        exit.dynamic_pc = x.dynamic_pc;
+        exit.cost = trace.prefix[x.index];
+        if (x.kind == IrExitKind::STOP)
+            exit.cost += 5;
+        else if (x.kind == IrExitKind::GUARD)
+        {
+            // The branch went the other way from when it was recorded
+            if ((s.instr & 0x7F) == 0x63)
+                exit.cost += s.next_pc != s.pc + 4 ? 2 : 3;
+            else
+                exit.cost += 3;
+        }
+        trace.exits.push_back(exit);
+    }
+    Exit end;
+    end.kind = IrExitKind::END;
+    end.retired = 0;
+    end.next_pc = trace.head;
+    end.dynamic_pc = false;
+    end.cost = 0;
+    trace.exits.push_back(end);
+    return true;
+#else
+    (void)ir;
+    (void)trace;
+    (void)code;
+    return false;
+#endif
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "trace_ir.hpp"
+
+class RISCV;
+struct JitFrame;
+
+// Trace-compiling JIT for hot loops (--jit).
+//
+// RISCV::run_jit interprets as usual and counts backward jumps per target.
+// Once a target has been jumped to HOT_LOOP times, the next pass through
+// the loop is recorded instruction by instruction until execution comes
+// back to its head. The recording is lifted to SSA (trace_ir.hpp),
+// optimised, and compiled to x86-64: the five busiest guest registers live
+// in callee-saved host registers for the whole loop, temporaries in the
+// remaining ones, and the register file is only written at the back-edge
+// and at side exits. Branches that go the other way, a changed JALR
+// target, and memory accesses that must stop (MMIO, watchpoints, stores to
+// traced code) leave through a side exit back to the interpreter.
+//
+// Loads and stores call back into the core, so watchpoints, lazy pages,
+// MMIO and exceptions behave exactly as interpreted, and so do instret,
+// cycles (SIMPLE and FUNCTIONAL), bus ticks and predictor training.
+// Traces die when a store hits one of their instructions.
+class TraceJit
+{
+public:
+    static const uint32_t HOT_LOOP = 50;     // Backward jumps before a loop is recorded
+    static const uint32_t MAX_TRACE = 128;   // Guest instructions per trace
+    static const uint32_t MAX_ATTEMPTS = 4;  // Failed recordings before a head is left alone
+    static const size_t CACHE_SIZE = 8 << 20; // Bytes of generated code before a flush
+
+    TraceJit();
+    ~TraceJit();
+    TraceJit(const TraceJit &) = delete;
+    TraceJit &operator=(const TraceJit &) = delete;
+
+    // False on hosts other than x86-64 or if no executable memory could be
+    // mapped; RISCV::set_jit ignores an unavailable JIT
+    bool is_available() const { return cache != nullptr; }
+
+    // Drops every trace and loop counter (a new program was loaded)
+    void flush();
+
+    size_t get_trace_count() const { return live_traces; }
+    uint64_t get_steps() const { return steps; } // Instructions run in traces
+    uint64_t get_exits() const { return exits; } // Side exits taken
+
+private:
+    friend class RISCV;
+
+    struct Exit
+    {
+        IrExitKind kind;
+        uint32_t retired; // Instructions of the last iteration that retired
+        uint32_t next_pc;
+        bool dynamic_pc;
+        uint32_t cost; // SIMPLE cycles of the last iteration up to the exit
+    };
+
+    struct Trace
+    {
+        uint32_t head;
+        uint32_t (*fn)(uint32_t *x, JitFrame *frame);
+        std::vector<TraceStep> steps;
+        std::vector<uint32_t> prefix; // SIMPLE cycles before each instruction
+        std::vector<Exit> exits;
+        std::vector<uint32_t> pages;
+        bool dead = false;
+    };
+
+    struct Head
+    {
+        uint32_t count = 0;
+        uint32_t attempts = 0;
+        Trace *trace = nullptr;
+    };
+
+    // RISCV::run_jit
+    void bind(RISCV *core);
+    Trace *back_edge(uint32_t target);
+    bool is_recording() const { return recording; }
+    void record(uint32_t pc, uint32_t instr, uint32_t next_pc);
+    void abort_recording();
+    uint64_t execute(Trace &trace, uint64_t max_steps, bool simple);
+    void invalidate(uint32_t addr, uint32_t size); // A store hit traced code
+
+    bool compile();
+    bool generate(const IrTrace &ir, Trace &trace, std::vector<uint8_t> &code) const;
+    void kill(Trace &trace);
+    void warm(const Trace &trace, uint64_t iterations, const Exit &exit);
+
+    // Called from generated code; never let an exception through it
+    static uint64_t load(JitFrame *f, uint32_t addr, uint32_t unused, uint32_t k);
+    static uint64_t store(JitFrame *f, uint32_t addr, uint32_t value, uint32_t k);
+    bool sync(JitFrame *f, uint32_t k, uint32_t addr);
+
+    RISCV *cpu = nullptr;
+    uint8_t *cache = nullptr;
+    size_t cache_used = 0;
+
+    std::unordered_map<uint32_t, Head> heads;
+    std::vector<std::unique_ptr<Trace>> traces; // Dead ones too, until flush
+    std::unordered_map<uint32_t, std::vector<Trace *>> page_traces;
+    size_t live_traces = 0;
+
+    bool recording = false;
+    uint32_t recording_head = 0;
+    std::vector<TraceStep> recorded;
+
+    std::exception_ptr error; // Thrown by a memory access inside a trace
+
+    uint64_t steps = 0;
+    uint64_t exits = 0;
+};
@@ -0,0 +1,283 @@
+#include "x64_emitter.hpp"
+#include <cstring>
+
+namespace x64
+{
+
+void Emitter::rex(bool w, uint8_t reg, uint8_t rm, bool force)
+{
+    uint8_t r = (uint8_t)(0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0));
+    if (r != 0x40 || force)
+        code.push_back(r);
+}
+
+void Emitter::modrm_reg(uint8_t reg, uint8_t rm)
+{
+    code.push_back((uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+// Always [base + disp32]; RSP and R12 as base need a SIB byte
+void Emitter::modrm_mem(uint8_t reg, Mem m)
+{
+    code.push_back((uint8_t)(0x80 | ((reg & 7) << 3) | (m.base & 7)));
+    if ((m.base & 7) == RSP)
+        code.push_back(0x24);
+    imm32((uint32_t)m.disp);
+}
+
+void Emitter::imm32(uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        code.push_back((uint8_t)(v >> (8 * i)));
+}
+
+void Emitter::mov(Reg dst, Reg src)
+{
+    rex(false, src, dst);
+    code.push_back(0x89);
+    modrm_reg(src, dst);
+}
+
+void Emitter::mov(Reg dst, uint32_t imm)
+{
+    if (imm == 0)
+    {
+        alu(XOR, dst, dst);
+        return;
+    }
+    rex(false, 0, dst);
+    code.push_back((uint8_t)(0xB8 + (dst & 7)));
+    imm32(imm);
+}
+
+void Emitter::mov(Reg dst, Mem src)
+{
+    rex(false, dst, src.base);
+    code.push_back(0x8B);
+    modrm_mem(dst, src);
+}
+
+void Emitter::mov(Mem dst, Reg src)
+{
+    rex(false, src, dst.base);
+    code.push_back(0x89);
+    modrm_mem(src, dst);
+}
+
+void Emitter::mov64(Reg dst, Reg src)
+{
+    rex(true, src, dst);
+    code.push_back(0x89);
+    modrm_reg(src, dst);
+}
+
+void Emitter::mov64(Reg dst, Mem src)
+{
+    rex(true, dst, src.base);
+    code.push_back(0x8B);
+    modrm_mem(dst, src);
+}
+
+void Emitter::mov64(Mem dst, Reg src)
+{
+    rex(true, src, dst.base);
+    code.push_back(0x89);
+    modrm_mem(src, dst);
+}
+
+void Emitter::mov64(Reg dst, uint64_t imm)
+{
+    rex(true, 0, dst);
+    code.push_back((uint8_t)(0xB8 + (dst & 7)));
+    imm32((uint32_t)imm);
+    imm32((uint32_t)(imm >> 32));
+}
+
+void Emitter::alu(Alu op, Reg dst, Reg src)
+{
+    rex(false, src, dst);
+    code.push_back((uint8_t)((op << 3) | 1));
+    modrm_reg(src, dst);
+}
+
+void Emitter::alu(Alu op, Reg dst, Mem src)
+{
+    rex(false, dst, src.base);
+    code.push_back((uint8_t)((op << 3) | 3));
+    modrm_mem(dst, src);
+}
+
+void Emitter::alu(Alu op, Reg dst, uint32_t imm)
+{
+    rex(false, 0, dst);
+    code.push_back(0x81);
+    modrm_reg(op, dst);
+    imm32(imm);
+}
+
+void Emitter::alu64(Alu op, Reg dst, Mem src)
+{
+    rex(true, dst, src.base);
+    code.push_back((uint8_t)((op << 3) | 3));
+    modrm_mem(dst, src);
+}
+
+void Emitter::alu64(Alu op, Reg dst, uint32_t imm)
+{
+    rex(true, 0, dst);
+    code.push_back(0x81);
+    modrm_reg(op, dst);
+    imm32(imm);
+}
+
+void Emitter::inc64(Mem dst)
+{
+    rex(true, 0, dst.base);
+    code.push_back(0xFF);
+    modrm_mem(0, dst);
+}
+
+void Emitter::test(Reg a, uint32_t imm)
+{
+    rex(false, 0, a);
+    code.push_back(0xF7);
+    modrm_reg(0, a);
+    imm32(imm);
+}
+
+void Emitter::shift(Shift op, Reg dst, uint8_t amount)
+{
+    rex(false, 0, dst);
+    code.push_back(0xC1);
+    modrm_reg(op, dst);
+    code.push_back(amount);
+}
+
+void Emitter::shift_cl(Shift op, Reg dst)
+{
+    rex(false, 0, dst);
+    code.push_back(0xD3);
+    modrm_reg(op, dst);
+}
+
+void Emitter::shift64(Shift op, Reg dst, uint8_t amount)
+{
+    rex(true, 0, dst);
+    code.push_back(0xC1);
+    modrm_reg(op, dst);
+    code.push_back(amount);
+}
+
+void Emitter::imul(Reg dst, Reg src)
+{
+    rex(false, dst, src);
+    code.push_back(0x0F);
+    code.push_back(0xAF);
+    modrm_reg(dst, src);
+}
+
+void Emitter::imul(Reg dst, Mem src)
+{
+    rex(false, dst, src.base);
+    code.push_back(0x0F);
+    code.push_back(0xAF);
+    modrm_mem(dst, src);
+}
+
+void Emitter::imul(Reg dst, Reg src, uint32_t imm)
+{
+    rex(false, dst, src);
+    code.push_back(0x69);
+    modrm_reg(dst, src);
+    imm32(imm);
+}
+
+void Emitter::imul64(Reg dst, Reg src)
+{
+    rex(true, dst, src);
+    code.push_back(0x0F);
+    code.push_back(0xAF);
+    modrm_reg(dst, src);
+}
+
+void Emitter::movsxd(Reg dst, Reg src)
+{
+    rex(true, dst, src);
+    code.push_back(0x63);
+    modrm_reg(dst, src);
+}
+
+void Emitter::setcc(Cond cond, Reg dst)
+{
+    // SETcc writes a byte register: a REX prefix selects SIL/DIL and the
+    // like instead of AH..BH
+    rex(false, 0, dst, dst >= RSP);
+    code.push_back(0x0F);
+    code.push_back((uint8_t)(0x90 | cond));
+    modrm_reg(0, dst);
+    // MOVZX dst, dst8
+    rex(false, dst, dst, dst >= RSP);
+    code.push_back(0x0F);
+    code.push_back(0xB6);
+    modrm_reg(dst, dst);
+}
+
+void Emitter::push(Reg r)
+{
+    rex(false, 0, r);
+    code.push_back((uint8_t)(0x50 + (r & 7)));
+}
+
+void Emitter::pop(Reg r)
+{
+    rex(false, 0, r);
+    code.push_back((uint8_t)(0x58 + (r & 7)));
+}
+
+void Emitter::call(const void *target)
+{
+    uint64_t addr;
+    std::memcpy(&addr, &target, sizeof(addr));
+    mov64(RAX, addr);
+    code.push_back(0xFF);
+    code.push_back(0xD0);
+}
+
+void Emitter::ret()
+{
+    code.push_back(0xC3);
+}
+
+size_t Emitter::jcc(Cond cond)
+{
+    code.push_back(0x0F);
+    code.push_back((uint8_t)(0x80 | cond));
+    imm32(0);
+    return code.size() - 4;
+}
+
+size_t Emitter::jmp()
+{
+    code.push_back(0xE9);
+    imm32(0);
+    return code.size() - 4;
+}
+
+void Emitter::jcc_to(Cond cond, size_t target)
+{
+    patch(jcc(cond), target);
+}
+
+void Emitter::jmp_to(size_t target)
+{
+    patch(jmp(), target);
+}
+
+void Emitter::patch(size_t field, size_t target)
+{
+    uint32_t rel = (uint32_t)((int64_t)target - (int64_t)(field + 4));
+    for (int i = 0; i < 4; i++)
+        code[field + i] = (uint8_t)(rel >> (8 * i));
+}
+
+} // namespace x64
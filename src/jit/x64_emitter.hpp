@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Minimal x86-64 machine-code assembler for the trace JIT: 32-bit ALU
+// operations on registers, [base + disp32] memory operands, forward and
+// backward jumps and absolute calls. Only what trace_jit.cpp emits.
+namespace x64
+{
+
+enum Reg : uint8_t
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// ALU operations with their /digit in the 0x81 immediate group; the
+// register forms are (digit << 3) | 1 (r/m, reg) and | 3 (reg, r/m)
+enum Alu : uint8_t
+{
+    ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7
+};
+
+enum Shift : uint8_t
+{
+    SHL = 4, SHR = 5, SAR = 7
+};
+
+// Condition codes (low nibble of Jcc / SETcc)
+enum Cond : uint8_t
+{
+    B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, L = 0xC, GE = 0xD
+};
+
+struct Mem
+{
+    Reg base;
+    int32_t disp;
+};
+
+class Emitter
+{
+public:
+    std::vector<uint8_t> code;
+
+    size_t size() const { return code.size(); }
+
+    void mov(Reg dst, Reg src);                // 32-bit, zero-extends
+    void mov(Reg dst, uint32_t imm);
+    void mov(Reg dst, Mem src);
+    void mov(Mem dst, Reg src);
+    void mov64(Reg dst, Reg src);
+    void mov64(Reg dst, Mem src);
+    void mov64(Mem dst, Reg src);
+    void mov64(Reg dst, uint64_t imm);
+
+    void alu(Alu op, Reg dst, Reg src);
+    void alu(Alu op, Reg dst, Mem src);
+    void alu(Alu op, Reg dst, uint32_t imm);
+    void alu64(Alu op, Reg dst, Mem src);
+    void alu64(Alu op, Reg dst, uint32_t imm);
+    void inc64(Mem dst);
+    void test(Reg a, uint32_t imm);
+
+    void shift(Shift op, Reg dst, uint8_t amount);
+    void shift_cl(Shift op, Reg dst);
+    void shift64(Shift op, Reg dst, uint8_t amount);
+
+    void imul(Reg dst, Reg src);
+    void imul(Reg dst, Mem src);
+    void imul(Reg dst, Reg src, uint32_t imm);
+    void imul64(Reg dst, Reg src);
+    void movsxd(Reg dst, Reg src);
+
+    void setcc(Cond cond, Reg dst); // dst = cond ? 1 : 0 (32-bit)
+
+    void push(Reg r);
+    void pop(Reg r);
+    void call(const void *target); // Through RAX
+    void ret();
+
+    // Jumps return the offset of their rel32 field for patch()
+    size_t jcc(Cond cond);
+    size_t jmp();
+    void jcc_to(Cond cond, size_t target);
+    void jmp_to(size_t target);
+    void patch(size_t field, size_t target);
+
+private:
+    void rex(bool w, uint8_t reg, uint8_t rm, bool force = false);
+    void modrm_reg(uint8_t reg, uint8_t rm);
+    void modrm_mem(uint8_t reg, Mem m);
+    void imm32(uint32_t v);
+};
+
+} // namespace x64
@@ -1,11 +1,35 @@
 #include "cpu/riscv.hpp"
+#include "cpu/sampler.hpp"
+#include "cpu/interval.hpp"
+#include "cpu/lockstep.hpp"
+#include "aot/aot_image.hpp"
+#include "cpu/decode_cache.hpp"
+#include "jit/trace_jit.hpp"
+#include "debug/symbols.hpp"
+#include "profiler/profiler.hpp"
+#include "profiler/callgraph.hpp"
+#include "profiler/instmix.hpp"
+#include "trace/tracer.hpp"
+#include "debug/gdb_stub.hpp"
+#include "debug/watch_log.hpp"
+#include "debug/timetravel.hpp"
+#include "debug/console.hpp"
+#include "replay/stimulus.hpp"
+#include "snapshot/checkpoint.hpp"
+#include "batch/batch.hpp"
+#include "batch/report.hpp"
+#include "forkserver/fork_server.hpp"
+#include "fuzz/fuzzer.hpp"
 #include "environment/simple_env.hpp"
 #include "peripherals/bus.hpp"
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <chrono>
 #include <vector>
 #include <cstdint>
 #include <cstring>
+#include <string>
 
 #ifdef _WIN32
 #include <conio.h>
@@ -52,51 +76,27 @@ void restore_terminal()
 
 // Simulate a button press by toggling GPIO pin 0
 // Simulate a button press - keep pressed until acknowledged
-void simulate_button_press(Bus &bus, RISCV &cpu)
+// Both edges go through the stimulus so a recording sees them
+void simulate_button_press(Bus &bus, RISCV &cpu, Stimulus &stimulus)
 {
     // Read current GPIO port 0 state
     uint32_t current_state = bus.load(0x1000);
 
     // Press button (set bit 0 to 1) and KEEP it pressed
-    bus.store(0x1000, current_state | 1);
+    stimulus.bus_store(cpu, bus, 0x1000, current_state | 1);
     
     // Run cycles to let the program detect the button press
     // and potentially clear the interrupt
-    for (int i = 0; i < 5000 && cpu.is_running(); i++)
-    {
-        cpu.step();
-    }
+    cpu.run_for(5000);
 
     // Release button after the program has had time to process it
-    bus.store(0x1000, current_state & ~1);
+    stimulus.bus_store(cpu, bus, 0x1000, current_state & ~1);
 }
 
-int main(int argc, char *argv[])
+// Firmware at FIRMWARE_BASE (if present) and the user program at USER_BASE,
+// which is also left in user_program
+static bool load_images(RISCV &cpu, const char *user_filename, std::vector<uint8_t> &user_program)
 {
-    if (argc < 2)
-    {
-        std::cout << "RISC-V Emulator" << std::endl;
-        std::cout << "Usage: " << argv[0] << " <user_program.bin>" << std::endl;
-        std::cout << std::endl;
-        std::cout << "Interactive input:" << std::endl;
-        std::cout << "  p - Press button (GPIO pin 0)" << std::endl;
-        std::cout << "  q - Quit emulator" << std::endl;
-        std::cout << std::endl;
-        std::cout << "Example:" << std::endl;
-        std::cout << "  " << argv[0] << " bin/button_led_interrupt.bin" << std::endl;
-        return 1;
-    }
-
-    const char *user_filename = argv[1];
-
-    // Allocate 64MB of RAM
-    RISCV cpu(64 * 1024 * 1024);
-    SimpleEnvironment env;
-    Bus bus;
-
-    cpu.set_environment(&env);
-    cpu.set_bus(&bus);
-
     // Load firmware binary (silently skip if not found)
     std::ifstream firmware_file(FIRMWARE_PATH, std::ios::binary | std::ios::ate);
     std::streamsize firmware_size = 0;
@@ -110,7 +110,7 @@ int main(int argc, char *argv[])
         if (!firmware_file.read((char *)firmware.data(), firmware_size))
         {
             std::cerr << "Error: Failed to read firmware file" << std::endl;
-            return 1;
+            return false;
         }
         cpu.load_program(firmware.data(), firmware.size(), FIRMWARE_BASE);
     }
@@ -120,75 +120,1083 @@ int main(int argc, char *argv[])
     if (!user_file)
     {
         std::cerr << "Error: Cannot open user program file '" << user_filename << "'" << std::endl;
-        return 1;
+        return false;
     }
 
     std::streamsize user_size = user_file.tellg();
     user_file.seekg(0, std::ios::beg);
-    std::vector<uint8_t> user_program(user_size);
+    user_program.resize(user_size);
     if (!user_file.read((char *)user_program.data(), user_size))
     {
         std::cerr << "Error: Failed to read user program file" << std::endl;
-        return 1;
+        return false;
     }
 
     std::cout << "Loading user program: " << user_filename << " (" << user_size << " bytes)" << std::endl;
     cpu.load_program(user_program.data(), user_program.size(), USER_BASE);
+    return true;
+}
+
+// Writes a checkpoint and says so on stderr
+static void write_checkpoint(const std::string &path, RISCV &cpu, Bus &bus)
+{
+    CheckpointInfo info;
+    if (!save_checkpoint(path, cpu, bus, info))
+    {
+        std::cerr << "\nError: Cannot write checkpoint '" << path << "'" << std::endl;
+        return;
+    }
+    std::cerr << "\n[checkpoint] " << path << ": cycle " << info.cycles << ", " << info.pages << " pages ("
+              << info.unique_pages << " unique), " << (info.file_size + 1023) / 1024 << " KB" << std::endl;
+}
+
+// Runs every job of a manifest in this process; 0 if all passed
+static int run_batch(const std::string &manifest, const BatchConfig &config, const std::string &junit_out,
+                     const std::string &json_out)
+{
+    std::vector<BatchJob> jobs;
+    try
+    {
+        jobs = load_manifest(manifest);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    BatchRunner runner(config);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<BatchResult> results = runner.run(jobs);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t passed = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results[i].status == BatchStatus::PASS)
+            passed++;
+        else
+            std::cout << batch_status_name(results[i].status) << ": " << jobs[i].name << ": " << results[i].message
+                      << std::endl;
+    }
+    std::cout << "Batch: " << passed << "/" << results.size() << " passed in " << elapsed.count() << " s on "
+              << runner.get_threads() << " threads" << std::endl;
+    if (config.lockstep && runner.get_total_steps())
+        std::cout << "Lockstep: " << 100.0 * runner.get_lockstep_steps() / runner.get_total_steps()
+                  << "% of instructions decoded once for the group ("
+                  << (LockstepGroup::has_avx2() ? "AVX2" : "portable") << " ALU)" << std::endl;
+
+    if (!junit_out.empty())
+    {
+        std::ofstream out(junit_out.c_str());
+        write_junit(out, jobs, results, elapsed.count());
+    }
+    if (!json_out.empty())
+    {
+        std::ofstream out(json_out.c_str());
+        write_json(out, jobs, results, elapsed.count());
+    }
+    return passed == results.size() ? 0 : 1;
+}
+
+// Print cycle and hazard counters after the run
+void print_stats(RISCV &cpu, const Sampler *sampler, const IntervalSimulator *intervals)
+{
+    uint64_t cycles = cpu.get_cycles();
+    uint64_t instret = cpu.get_instret();
+    PipelineStats ps = cpu.get_pipeline().get_stats();
+
+    // The CPU only ran the functional pass; timing comes from the intervals
+    if (intervals)
+    {
+        IntervalResult total = intervals->total();
+        cycles = total.cycles;
+        ps = total.pipeline;
+    }
+
+    std::cerr << "\n--- Statistics ---" << std::endl;
+    std::cerr << "Cycles:       " << cycles << std::endl;
+    std::cerr << "Instructions: " << instret << std::endl;
+    if (instret)
+        std::cerr << "CPI:          " << (double)cycles / instret << std::endl;
+    if (cpu.get_aot_steps())
+        std::cerr << "Translated:   " << cpu.get_aot_steps() << " (" << 100.0 * cpu.get_aot_steps() / instret << "%)"
+                  << std::endl;
+    if (cpu.get_decode_cache())
+    {
+        const DecodeCache &cache = *cpu.get_decode_cache();
+        std::cerr << "Decode cache: " << cache.get_path()
+                  << (cache.is_mapped() ? " (mapped)" : cache.is_saved() ? " (written)" : " (could not be written)")
+                  << std::endl;
+    }
+    if (cpu.get_fused_pairs())
+        std::cerr << "Fused pairs:  " << cpu.get_fused_pairs() << " (" << 200.0 * cpu.get_fused_pairs() / instret
+                  << "% of instructions)" << std::endl;
+    if (cpu.get_idle_skipped())
+        std::cerr << "Idle skipped: " << cpu.get_idle_skipped() << " instructions ("
+                  << 100.0 * cpu.get_idle_skipped() / instret << "%)" << std::endl;
+    if (cpu.get_loop_skipped())
+        std::cerr << "Delay loops:  " << cpu.get_loop_skipped() << " instructions skipped ("
+                  << 100.0 * cpu.get_loop_skipped() / instret << "%)" << std::endl;
+    if (cpu.get_page_walks())
+        std::cerr << "Page walks:   " << cpu.get_page_walks() << std::endl;
+    if (cpu.get_jit() && cpu.get_jit()->get_steps())
+    {
+        const TraceJit &jit = *cpu.get_jit();
+        std::cerr << "JIT traces:   " << jit.get_trace_count() << ", " << jit.get_steps() << " instructions ("
+                  << 100.0 * jit.get_steps() / instret << "%), " << jit.get_exits() << " side exits" << std::endl;
+    }
+
+    if (ps.instructions)
+    {
+        std::cerr << "Pipeline instructions: " << ps.instructions << std::endl;
+        std::cerr << "  Load-use stalls:     " << ps.load_use_stalls << std::endl;
+        std::cerr << "  Data stalls:         " << ps.data_stalls << std::endl;
+        std::cerr << "  Structural stalls:   " << ps.structural_stalls << std::endl;
+        std::cerr << "  Branch mispredicts:  " << ps.branch_mispredicts << std::endl;
+        std::cerr << "  Jumps:               " << ps.jumps << std::endl;
+        std::cerr << "  Flushes:             " << ps.flushes << std::endl;
+    }
+
+    if (intervals)
+    {
+        const std::vector<IntervalResult> &results = intervals->get_results();
+        const IntervalConfig &config = intervals->get_config();
+        std::cerr << "Intervals:            " << results.size() << " on " << config.threads << " threads ("
+                  << config.length << " instructions, " << config.warmup << " warm-up)" << std::endl;
+
+        double min_cpi = 0, max_cpi = 0;
+        bool first = true;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const IntervalResult &r = results[i];
+            if (!r.error.empty())
+            {
+                std::cerr << "  Interval " << i << " at instret " << r.start << " failed: " << r.error << std::endl;
+                continue;
+            }
+            double cpi = (double)r.cycles / r.instructions;
+            if (first || cpi < min_cpi)
+                min_cpi = cpi;
+            if (first || cpi > max_cpi)
+                max_cpi = cpi;
+            first = false;
+        }
+        if (!first)
+            std::cerr << "  Interval CPI:       " << min_cpi << " .. " << max_cpi << std::endl;
+    }
+
+    if (sampler)
+    {
+        SampleEstimate e = sampler->estimate();
+        std::cerr << "Sampled windows:      " << e.windows << std::endl;
+        if (e.windows == 0)
+        {
+            std::cerr << "  No complete window; lower --sample-period" << std::endl;
+            return;
+        }
+        std::cerr << "  Mean CPI:           " << e.mean_cpi << " (stddev " << e.cpi_stddev << ")" << std::endl;
+        std::cerr << "  Estimated cycles:   " << (uint64_t)e.cycles;
+        if (e.windows > 1)
+            std::cerr << " +/- " << (uint64_t)e.ci95 << " (95% CI)";
+        std::cerr << std::endl;
+    }
+}
+
+// bin/<name>.bin -> build/<name>.elf, as produced by the Makefile
+std::string default_symbols_path(const std::string &program)
+{
+    std::string name = program;
+    size_t slash = name.find_last_of('/');
+    if (slash != std::string::npos)
+        name = name.substr(slash + 1);
+    size_t dot = name.rfind(".bin");
+    if (dot != std::string::npos)
+        name = name.substr(0, dot);
+    return "build/" + name + ".elf";
+}
+
+// A symbol from the program's ELF or a numeric address, for the fork
+// server and fuzzer entry points
+static bool resolve_pc(const std::string &spec, std::string symbols_path, const char *user_filename, uint32_t &pc)
+{
+    SymbolTable symbols;
+    if (symbols_path.empty() && user_filename)
+        symbols_path = default_symbols_path(user_filename);
+    symbols.load(symbols_path);
+    if (symbols.find(spec, pc))
+        return true;
+
+    try
+    {
+        pc = (uint32_t)std::stoul(spec, nullptr, 0);
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        std::cerr << "Error: No symbol '" << spec << "' in '" << symbols_path << "'" << std::endl;
+        return false;
+    }
+}
+
+// stdin,uart,gpio -> FuzzChannel bits; 0 if a name is unknown
+static unsigned parse_fuzz_channels(const std::string &list)
+{
+    unsigned channels = 0;
+    size_t start = 0;
+    for (;;)
+    {
+        size_t comma = list.find(',', start);
+        std::string name = list.substr(start, comma - start);
+        if (name == "stdin")
+            channels |= FUZZ_STDIN;
+        else if (name == "uart")
+            channels |= FUZZ_UART;
+        else if (name == "gpio")
+            channels |= FUZZ_GPIO;
+        else
+            return 0;
+        if (comma == std::string::npos)
+            return channels;
+        start = comma + 1;
+    }
+}
+
+// addr[:len][:r|w|rw], numbers in any C base
+static bool parse_watch(const std::string &spec, Watchpoint &w)
+{
+    w.addr = 0;
+    w.len = 4;
+    w.kind = WATCH_WRITE;
+    w.stop = false;
+
+    std::vector<std::string> parts;
+    size_t start = 0;
+    for (;;)
+    {
+        size_t colon = spec.find(':', start);
+        parts.push_back(spec.substr(start, colon - start));
+        if (colon == std::string::npos)
+            break;
+        start = colon + 1;
+    }
+
+    try
+    {
+        w.addr = (uint32_t)std::stoul(parts[0], nullptr, 0);
+        for (size_t i = 1; i < parts.size(); i++)
+        {
+            if (parts[i] == "r")
+                w.kind = WATCH_READ;
+            else if (parts[i] == "w")
+                w.kind = WATCH_WRITE;
+            else if (parts[i] == "rw")
+                w.kind = WATCH_ACCESS;
+            else
+                w.len = (uint32_t)std::stoul(parts[i], nullptr, 0);
+        }
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+    return w.len != 0;
+}
+
+void print_usage(const char *prog)
+{
+    std::cout << "RISC-V Emulator" << std::endl;
+    std::cout << "Usage: " << prog << " [options] <user_program.bin>" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --timing <mode>             Initial timing mode: simple, pipeline, functional" << std::endl;
+    std::cout << "  --no-forwarding             Pipeline timing without bypass paths" << std::endl;
+    std::cout << "  --aot <file.so>             Run code translated ahead of time by rvaot" << std::endl;
+    std::cout << "  --jit                       Compile hot loops to native code while running" << std::endl;
+    std::cout << "  --decode-cache <dir>        Keep pre-decoded programs in dir for later runs" << std::endl;
+    std::cout << "  --stats                     Print cycle statistics on exit" << std::endl;
+    std::cout << "  --sample                    Sampled simulation (functional fast-forward," << std::endl;
+    std::cout << "                              detailed windows, extrapolated cycles)" << std::endl;
+    std::cout << "  --sample-period <n>         Instructions per sampling unit (default 1000000)" << std::endl;
+    std::cout << "  --sample-warmup <n>         Detailed warm-up instructions per unit (default 2000)" << std::endl;
+    std::cout << "  --sample-window <n>         Measured instructions per unit (default 10000)" << std::endl;
+    std::cout << "  --parallel <threads>        Detailed timing in intervals simulated on n threads" << std::endl;
+    std::cout << "                              (0: one per core) after a functional pass" << std::endl;
+    std::cout << "  --interval <n>              Instructions per parallel interval (default 10000000)" << std::endl;
+    std::cout << "  --interval-warmup <n>       Detailed warm-up instructions per interval (default 10000)" << std::endl;
+    std::cout << "  --profile <n>               Sample the PC every n cycles, flat profile on exit" << std::endl;
+    std::cout << "  --profile-exact             Profile by counting every instruction" << std::endl;
+    std::cout << "  --profile-out <file>        Write the profile to a file (default: stderr)" << std::endl;
+    std::cout << "  --callgraph <file>          Write call-path cycles as folded stacks (flame graphs)" << std::endl;
+    std::cout << "  --instmix <file>            Write instruction mix and basic-block counts" << std::endl;
+    std::cout << "                              (.csv for CSV, JSON otherwise)" << std::endl;
+    std::cout << "  --trace <file>              Write a binary execution trace (decode with rvtrace)" << std::endl;
+    std::cout << "  --gdb <[host:]port|unix:path> Wait for a GDB remote connection before running" << std::endl;
+    std::cout << "  --watch <addr>[:len][:r|w|rw] Log accesses to a range with old/new values" << std::endl;
+    std::cout << "                              (repeatable, default 4 bytes, writes)" << std::endl;
+    std::cout << "  --watch-stop                Stop the program at the first watch hit" << std::endl;
+    std::cout << "  --record <file>             Log external input (button, stdin, quit) with cycle stamps" << std::endl;
+    std::cout << "  --replay <file>             Re-run a recording without the terminal, as fast as possible" << std::endl;
+    std::cout << "  --debug-console             Interactive debugger with reverse-step/reverse-continue" << std::endl;
+    std::cout << "  --snapshot-interval <n>     Cycles between reverse-execution snapshots (default 1000000)" << std::endl;
+    std::cout << "  --snapshot-memory <MB>      Memory for reverse-execution history (default 256)" << std::endl;
+    std::cout << "  --checkpoint <file>         Save the machine state there on quit (q)" << std::endl;
+    std::cout << "  --checkpoint-every <n>      ...and every n cycles" << std::endl;
+    std::cout << "  --resume <file>             Continue from a checkpoint instead of loading a program" << std::endl;
+    std::cout << "  --fork-server <pc|symbol>   Boot to pc, then fork a run per request (AFL protocol," << std::endl;
+    std::cout << "                              fds 198/199)" << std::endl;
+    std::cout << "  --fuzz <dir|file>           Coverage-guided fuzzing of a corpus directory, or run one" << std::endl;
+    std::cout << "                              input file to reproduce a crash" << std::endl;
+    std::cout << "  --fuzz-entry <pc|symbol>    Boot to pc first; every input starts from there" << std::endl;
+    std::cout << "  --fuzz-input <channels>     Where input goes: stdin,uart,gpio (default stdin)" << std::endl;
+    std::cout << "  --fuzz-runs <n>             Stop after n inputs (default: never)" << std::endl;
+    std::cout << "  --fuzz-steps <n>            Instructions per input before it hangs (default 1000000)" << std::endl;
+    std::cout << "  --fuzz-max-len <n>          Longest generated input (default 4096)" << std::endl;
+    std::cout << "  --fuzz-seed <n>             Mutator random seed" << std::endl;
+    std::cout << "  --batch <manifest>          Run every job of a manifest in this process and exit" << std::endl;
+    std::cout << "  --jobs <n>                  Batch worker threads (default: one per core)" << std::endl;
+    std::cout << "  --lockstep                  Batch: run jobs of the same program side by side, sharing decode" << std::endl;
+    std::cout << "  --junit <file>              Write batch results as JUnit XML" << std::endl;
+    std::cout << "  --json <file>               Write batch results as JSON" << std::endl;
+    std::cout << "  --symbols <file.elf>        Symbol table (default: build/<name>.elf)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Interactive input:" << std::endl;
+    std::cout << "  p - Press button (GPIO pin 0)" << std::endl;
+    std::cout << "  q - Quit emulator" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Example:" << std::endl;
+    std::cout << "  " << prog << " bin/button_led_interrupt.bin" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *user_filename = nullptr;
+    TimingMode timing_mode = TimingMode::SIMPLE;
+    PipelineConfig pipeline_config;
+    bool show_stats = false;
+    bool sample = false;
+    SamplerConfig sampler_config;
+    bool parallel = false;
+    IntervalConfig interval_config;
+    bool profile = false;
+    uint64_t profile_interval = 0;
+    std::string profile_out;
+    std::string symbols_path;
+    std::string callgraph_out;
+    std::string instmix_out;
+    std::string trace_out;
+    std::string gdb_address;
+    std::vector<Watchpoint> watches;
+    bool watch_stop = false;
+    std::string record_out;
+    std::string replay_in;
+    bool debug_console = false;
+    uint64_t snapshot_interval = 1000000;
+    uint64_t snapshot_memory = 256;
+    std::string checkpoint_out;
+    uint64_t checkpoint_every = 0;
+    std::string resume_in;
+    bool timing_given = false;
+    std::string fork_target;
+    std::string fuzz_path;
+    std::string fuzz_entry;
+    FuzzConfig fuzz_config;
+    std::string batch_manifest;
+    BatchConfig batch_config;
+    std::string aot_path;
+    bool use_jit = false;
+    std::string decode_cache_dir;
+    std::string junit_out;
+    std::string json_out;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--timing" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            timing_given = true;
+            if (mode == "simple")
+                timing_mode = TimingMode::SIMPLE;
+            else if (mode == "pipeline")
+                timing_mode = TimingMode::PIPELINE;
+            else if (mode == "functional")
+                timing_mode = TimingMode::FUNCTIONAL;
+            else
+            {
+                std::cerr << "Error: Unknown timing mode '" << mode << "'" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--no-forwarding")
+        {
+            pipeline_config.forwarding = false;
+        }
+        else if (arg == "--stats")
+        {
+            show_stats = true;
+        }
+        else if (arg == "--sample")
+        {
+            sample = true;
+        }
+        else if (arg == "--sample-period" && i + 1 < argc)
+        {
+            sampler_config.period = std::stoull(argv[++i]);
+        }
+        else if (arg == "--sample-warmup" && i + 1 < argc)
+        {
+            sampler_config.warmup = std::stoull(argv[++i]);
+        }
+        else if (arg == "--sample-window" && i + 1 < argc)
+        {
+            sampler_config.window = std::stoull(argv[++i]);
+        }
+        else if (arg == "--parallel" && i + 1 < argc)
+        {
+            parallel = true;
+            interval_config.threads = (unsigned)std::stoul(argv[++i]);
+        }
+        else if (arg == "--interval" && i + 1 < argc)
+        {
+            interval_config.length = std::stoull(argv[++i]);
+        }
+        else if (arg == "--interval-warmup" && i + 1 < argc)
+        {
+            interval_config.warmup = std::stoull(argv[++i]);
+        }
+        else if (arg == "--profile" && i + 1 < argc)
+        {
+            profile = true;
+            profile_interval = std::stoull(argv[++i]);
+        }
+        else if (arg == "--profile-exact")
+        {
+            profile = true;
+            profile_interval = 0;
+        }
+        else if (arg == "--profile-out" && i + 1 < argc)
+        {
+            profile_out = argv[++i];
+        }
+        else if (arg == "--callgraph" && i + 1 < argc)
+        {
+            callgraph_out = argv[++i];
+        }
+        else if (arg == "--instmix" && i + 1 < argc)
+        {
+            instmix_out = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            trace_out = argv[++i];
+        }
+        else if (arg == "--gdb" && i + 1 < argc)
+        {
+            gdb_address = argv[++i];
+        }
+        else if (arg == "--watch" && i + 1 < argc)
+        {
+            Watchpoint w;
+            if (!parse_watch(argv[++i], w))
+            {
+                std::cerr << "Error: Invalid watch '" << argv[i] << "' (expected addr[:len][:r|w|rw])" << std::endl;
+                return 1;
+            }
+            watches.push_back(w);
+        }
+        else if (arg == "--watch-stop")
+        {
+            watch_stop = true;
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            record_out = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replay_in = argv[++i];
+        }
+        else if (arg == "--debug-console")
+        {
+            debug_console = true;
+        }
+        else if (arg == "--snapshot-interval" && i + 1 < argc)
+        {
+            snapshot_interval = std::stoull(argv[++i]);
+        }
+        else if (arg == "--snapshot-memory" && i + 1 < argc)
+        {
+            snapshot_memory = std::stoull(argv[++i]);
+        }
+        else if (arg == "--checkpoint" && i + 1 < argc)
+        {
+            checkpoint_out = argv[++i];
+        }
+        else if (arg == "--checkpoint-every" && i + 1 < argc)
+        {
+            checkpoint_every = std::stoull(argv[++i]);
+        }
+        else if (arg == "--resume" && i + 1 < argc)
+        {
+            resume_in = argv[++i];
+        }
+        else if (arg == "--fork-server" && i + 1 < argc)
+        {
+            fork_target = argv[++i];
+        }
+        else if (arg == "--fuzz" && i + 1 < argc)
+        {
+            fuzz_path = argv[++i];
+        }
+        else if (arg == "--fuzz-entry" && i + 1 < argc)
+        {
+            fuzz_entry = argv[++i];
+        }
+        else if (arg == "--fuzz-input" && i + 1 < argc)
+        {
+            fuzz_config.channels = parse_fuzz_channels(argv[++i]);
+            if (!fuzz_config.channels)
+            {
+                std::cerr << "Error: Invalid fuzz input '" << argv[i] << "' (expected stdin, uart, gpio)" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--fuzz-runs" && i + 1 < argc)
+        {
+            fuzz_config.runs = std::stoull(argv[++i]);
+        }
+        else if (arg == "--fuzz-steps" && i + 1 < argc)
+        {
+            fuzz_config.max_steps = std::stoull(argv[++i]);
+        }
+        else if (arg == "--fuzz-max-len" && i + 1 < argc)
+        {
+            fuzz_config.max_len = (size_t)std::stoull(argv[++i]);
+        }
+        else if (arg == "--fuzz-seed" && i + 1 < argc)
+        {
+            fuzz_config.seed = std::stoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--batch" && i + 1 < argc)
+        {
+            batch_manifest = argv[++i];
+        }
+        else if (arg == "--jobs" && i + 1 < argc)
+        {
+            batch_config.threads = (unsigned)std::stoul(argv[++i]);
+        }
+        else if (arg == "--lockstep")
+        {
+            batch_config.lockstep = true;
+        }
+        else if (arg == "--aot" && i + 1 < argc)
+        {
+            aot_path = argv[++i];
+        }
+        else if (arg == "--jit")
+        {
+            use_jit = true;
+            batch_config.jit = true;
+        }
+        else if (arg == "--decode-cache" && i + 1 < argc)
+        {
+            decode_cache_dir = argv[++i];
+            batch_config.decode_cache = decode_cache_dir;
+        }
+        else if (arg == "--junit" && i + 1 < argc)
+        {
+            junit_out = argv[++i];
+        }
+        else if (arg == "--json" && i + 1 < argc)
+        {
+            json_out = argv[++i];
+        }
+        else if (arg == "--symbols" && i + 1 < argc)
+        {
+            symbols_path = argv[++i];
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            std::cerr << "Error: Unknown option '" << arg << "'" << std::endl;
+            return 1;
+        }
+        else
+        {
+            user_filename = argv[i];
+        }
+    }
+
+    // Loaded up front: a batch shares it between its jobs
+    std::unique_ptr<AotImage> aot_image;
+    if (!aot_path.empty())
+    {
+        try
+        {
+            aot_image.reset(new AotImage(aot_path));
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        batch_config.aot = aot_image.get();
+    }
+
+    if (!batch_manifest.empty())
+    {
+        if (user_filename || !resume_in.empty() || !record_out.empty() || !replay_in.empty() || !gdb_address.empty() ||
+            debug_console || sample || parallel || !fork_target.empty() || !fuzz_path.empty())
+        {
+            std::cerr << "Error: --batch takes its programs from the manifest and runs them without debuggers,"
+                      << " recording or sampling" << std::endl;
+            return 1;
+        }
+        batch_config.firmware_path = FIRMWARE_PATH;
+        batch_config.firmware_base = FIRMWARE_BASE;
+        batch_config.user_base = USER_BASE;
+        batch_config.timing = timing_mode;
+        batch_config.pipeline = pipeline_config;
+        return run_batch(batch_manifest, batch_config, junit_out, json_out);
+    }
+    if (batch_config.lockstep)
+    {
+        std::cerr << "Error: --lockstep only applies to --batch" << std::endl;
+        return 1;
+    }
+    if (!user_filename && resume_in.empty())
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (checkpoint_every && checkpoint_out.empty())
+    {
+        std::cerr << "Error: --checkpoint-every needs --checkpoint <file>" << std::endl;
+        return 1;
+    }
+    if (!record_out.empty() && !replay_in.empty())
+    {
+        std::cerr << "Error: --record and --replay are exclusive" << std::endl;
+        return 1;
+    }
+    if (!replay_in.empty() && !gdb_address.empty())
+    {
+        std::cerr << "Error: --replay cannot be combined with --gdb" << std::endl;
+        return 1;
+    }
+    if (debug_console && (!record_out.empty() || !replay_in.empty() || !gdb_address.empty() || sample))
+    {
+        std::cerr << "Error: --debug-console cannot be combined with --record, --replay, --gdb or --sample" << std::endl;
+        return 1;
+    }
+    if (parallel && (sample || debug_console || !gdb_address.empty() || !record_out.empty() || !replay_in.empty()))
+    {
+        std::cerr << "Error: --parallel cannot be combined with --sample, --debug-console, --gdb, --record or --replay"
+                  << std::endl;
+        return 1;
+    }
+    if (parallel && timing_mode == TimingMode::FUNCTIONAL)
+    {
+        std::cerr << "Error: --parallel needs --timing simple or pipeline" << std::endl;
+        return 1;
+    }
+    if (!fork_target.empty() &&
+        (!record_out.empty() || !replay_in.empty() || !gdb_address.empty() || debug_console || parallel || !trace_out.empty()))
+    {
+        std::cerr << "Error: --fork-server cannot be combined with --record, --replay, --gdb, --debug-console,"
+                  << " --parallel or --trace" << std::endl;
+        return 1;
+    }
+    if (!fuzz_path.empty() &&
+        (!record_out.empty() || !replay_in.empty() || !gdb_address.empty() || debug_console || sample || parallel ||
+         !fork_target.empty() || !trace_out.empty() || profile || !callgraph_out.empty() || !instmix_out.empty() ||
+         !watches.empty() || checkpoint_every))
+    {
+        std::cerr << "Error: --fuzz cannot be combined with recording, debugging, sampling, --parallel,"
+                  << " --fork-server, tracing, profiling or periodic checkpoints" << std::endl;
+        return 1;
+    }
+    // Allocate 64MB of RAM
+    RISCV cpu(64 * 1024 * 1024);
+    SimpleEnvironment env;
+    Bus bus;
+
+    cpu.set_environment(&env);
+    cpu.set_bus(&bus);
+    cpu.get_pipeline().set_config(pipeline_config);
+    cpu.set_timing_mode(timing_mode);
+
+    std::vector<uint8_t> user_program;
+    std::unique_ptr<CheckpointImage> checkpoint_image;
+    if (!resume_in.empty())
+    {
+        checkpoint_image.reset(new CheckpointImage());
+        try
+        {
+            if (!checkpoint_image->open(resume_in))
+            {
+                std::cerr << "Error: Cannot open checkpoint '" << resume_in << "'" << std::endl;
+                return 1;
+            }
+            checkpoint_image->restore(cpu, bus);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        if (timing_given)
+            cpu.set_timing_mode(timing_mode);
+
+        const CheckpointInfo &info = checkpoint_image->get_info();
+        std::cout << "Resuming from checkpoint: " << resume_in << " (cycle " << info.cycles << ", " << info.pages
+                  << " pages)" << std::endl;
+    }
+    else if (!load_images(cpu, user_filename, user_program))
+    {
+        return 1;
+    }
+
+    // Without --record/--replay the stimulus just applies inputs
+    Stimulus stimulus;
+    try
+    {
+        if (!record_out.empty() && !stimulus.open_record(record_out))
+        {
+            std::cerr << "Error: Cannot write recording '" << record_out << "'" << std::endl;
+            return 1;
+        }
+        if (!replay_in.empty() && !stimulus.open_replay(replay_in))
+        {
+            std::cerr << "Error: Cannot open recording '" << replay_in << "'" << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    env.set_stimulus(&stimulus);
+
+    // Translated code only runs against the program it was made from
+    if (aot_image)
+    {
+        uint32_t bad_addr;
+        if (aot_image->matches(cpu, bad_addr))
+            cpu.set_aot(aot_image.get());
+        else
+            std::cerr << "Warning: '" << aot_path << "' was translated from another program (differs at 0x" << std::hex
+                      << bad_addr << std::dec << "), running interpreted" << std::endl;
+    }
+    // Checkpoints bring their own RAM and have no program file to key on
+    DecodeCache decode_cache;
+    if (!decode_cache_dir.empty() && resume_in.empty())
+    {
+        decode_cache.open(decode_cache_dir, user_program.data(), (uint32_t)user_program.size(), USER_BASE);
+        cpu.set_decode_cache(&decode_cache);
+    }
+    std::unique_ptr<TraceJit> trace_jit;
+    if (use_jit)
+    {
+        trace_jit.reset(new TraceJit);
+        if (trace_jit->is_available())
+            cpu.set_jit(trace_jit.get());
+        else
+            std::cerr << "Warning: --jit needs an x86-64 host, running interpreted" << std::endl;
+    }
+
+    // Every fuzz input starts from the state after booting to the entry
+    if (!fuzz_path.empty())
+    {
+        uint32_t entry_pc = 0;
+        bool booted = fuzz_entry.empty();
+        if (!booted && resolve_pc(fuzz_entry, symbols_path, user_filename, entry_pc))
+        {
+            try
+            {
+                booted = cpu.run_to(entry_pc);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Error during boot: " << e.what() << std::endl;
+            }
+            if (!booted)
+                std::cerr << "Error: Program did not reach " << fuzz_entry << std::endl;
+        }
+        if (!booted)
+        {
+            return 1;
+        }
+
+        Fuzzer fuzzer(cpu, bus, env, fuzz_config);
+        int status = fuzzer.run(fuzz_path);
+        return status;
+    }
+
+    // Boot once; only the forked children get past this point, each
+    // starting from the post-boot state
+    if (!fork_target.empty())
+    {
+        uint32_t boot_pc;
+        if (!resolve_pc(fork_target, symbols_path, user_filename, boot_pc))
+        {
+            return 1;
+        }
+
+        ForkServer server;
+        bool booted = false;
+        try
+        {
+            booted = server.boot(cpu, boot_pc);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error during boot: " << e.what() << std::endl;
+        }
+        if (!booted)
+        {
+            std::cerr << "Error: Program did not reach " << fork_target << std::endl;
+            return 1;
+        }
+
+        ForkRole role = server.serve();
+        if (role != ForkRole::CHILD)
+        {
+            return role == ForkRole::DONE ? 0 : 1;
+        }
+        env.set_raw_terminal(false);
+    }
+
+    std::unique_ptr<Tracer> tracer;
+    if (!trace_out.empty())
+    {
+        tracer.reset(new Tracer());
+        if (!tracer->open(trace_out))
+        {
+            std::cerr << "Error: Cannot write trace '" << trace_out << "'" << std::endl;
+            return 1;
+        }
+        cpu.add_observer(tracer.get());
+    }
+
+    std::unique_ptr<GdbStub> gdb;
+    if (!gdb_address.empty())
+    {
+        gdb.reset(new GdbStub(cpu));
+        if (!gdb->listen(gdb_address))
+        {
+            return 1;
+        }
+    }
 
     std::cout << "Starting execution..." << std::endl;
     std::cout << "\n--- Program output ---\n"
               << std::endl;
 
-    enable_raw_input();
+    // The sampler owns the timing mode from here on
+    std::unique_ptr<Sampler> sampler;
+    if (sample)
+        sampler.reset(new Sampler(cpu, sampler_config));
+
+    // Symbols come from the ELF the Makefile links next to the .bin
+    SymbolTable symbols;
+    if (symbols_path.empty() && user_filename)
+        symbols_path = default_symbols_path(user_filename);
+    if ((profile || !callgraph_out.empty() || !instmix_out.empty() || !watches.empty() || debug_console) &&
+        !symbols.load(symbols_path))
+        std::cerr << "Warning: No symbols from '" << symbols_path << "', profile shows raw addresses" << std::endl;
+
+    // Sampling is driven from the run loop below, so the fast paths stay
+    // on; exact profiles, and runs the debugger or intervals drive, see
+    // every instruction instead
+    std::unique_ptr<Profiler> profiler;
+    bool profile_by_run = false;
+    if (profile)
+    {
+        profiler.reset(new Profiler(profile_interval));
+        profile_by_run = profile_interval && !gdb && !debug_console && !parallel;
+        if (!profile_by_run)
+            cpu.add_observer(profiler.get());
+    }
+
+    std::unique_ptr<CallGraphProfiler> callgraph;
+    if (!callgraph_out.empty())
+    {
+        callgraph.reset(new CallGraphProfiler(symbols));
+        cpu.add_observer(callgraph.get());
+    }
+
+    std::unique_ptr<InstructionMixProfiler> instmix;
+    if (!instmix_out.empty())
+    {
+        instmix.reset(new InstructionMixProfiler(symbols));
+        cpu.add_observer(instmix.get());
+    }
+
+    std::unique_ptr<WatchLogger> watch_log;
+    if (!watches.empty())
+    {
+        watch_log.reset(new WatchLogger(std::cerr, symbols));
+        cpu.add_watch_observer(watch_log.get());
+        for (size_t i = 0; i < watches.size(); i++)
+            cpu.add_watchpoint(watches[i].addr, watches[i].len, watches[i].kind, watch_stop);
+    }
+
+    // The debug console keeps stdin a normal terminal for its commands
+    std::unique_ptr<TimeTravel> history;
+    std::unique_ptr<DebugConsole> console;
+    if (debug_console)
+    {
+        env.set_raw_terminal(false);
+        history.reset(new TimeTravel(cpu, bus, stimulus, snapshot_interval, snapshot_memory << 20));
+        console.reset(new DebugConsole(cpu, *history, symbols));
+    }
+
+    // Parallel intervals run the program through without interactive input
+    std::unique_ptr<IntervalSimulator> intervals;
+    if (parallel)
+    {
+        env.set_raw_terminal(false);
+        interval_config.detailed = timing_mode;
+        intervals.reset(new IntervalSimulator(cpu, bus, stimulus, interval_config));
+        show_stats = true;
+    }
+
+    bool replaying = stimulus.get_mode() == Stimulus::REPLAY;
+    bool raw_input = !replaying && !console && !intervals && fork_target.empty();
+    if (raw_input)
+        enable_raw_input();
 
+    int status = 0;
     try
     {
         // Run CPU with interactive input support
         const int CYCLES_PER_CHECK = 1000;
+        uint64_t next_checkpoint = cpu.get_cycles() + checkpoint_every;
+
+        // The debugger drives execution until it detaches or kills
+        if (gdb)
+            gdb->serve();
+
+        Profiler::Runner run = [&](uint64_t n) { return sampler ? sampler->run_for(n) : cpu.run_for(n); };
+        if (profile_by_run)
+        {
+            Profiler::Runner unprofiled = run;
+            run = [&, unprofiled](uint64_t n) { return profiler->run_for(cpu, n, unprofiled); };
+        }
+
+        // Replay injects the recorded inputs itself and never polls stdin
+        if (replaying)
+        {
+            stimulus.replay(cpu, bus, run);
+        }
+
+        if (intervals)
+        {
+            intervals->run_for(UINT64_MAX);
+            intervals->finish();
+        }
+
+        if (console)
+        {
+            console->run(std::cin, std::cout);
+            cpu.stop();
+        }
 
         while (cpu.is_running())
         {
             // Run CPU for a bit
-            for (int i = 0; i < CYCLES_PER_CHECK && cpu.is_running(); i++)
+            run(CYCLES_PER_CHECK);
+
+            if (checkpoint_every && cpu.is_running() && cpu.get_cycles() >= next_checkpoint)
             {
-                cpu.step();
+                write_checkpoint(checkpoint_out, cpu, bus);
+                next_checkpoint = cpu.get_cycles() + checkpoint_every;
             }
 
             // Check for user input
             char input;
 #ifdef _WIN32
-            if (_kbhit())
+            if (raw_input && _kbhit())
             {
                 input = _getch();
 #else
-            if (read(STDIN_FILENO, &input, 1) > 0)
+            if (raw_input && read(STDIN_FILENO, &input, 1) > 0)
             {
 #endif
                 if (input == 'p' || input == 'P')
                 {
                     // Inject button press signal
-                    simulate_button_press(bus, cpu);
+                    simulate_button_press(bus, cpu, stimulus);
                 }
                 else if (input == 'q' || input == 'Q')
                 {
-                    // Stop execution
-                    cpu.stop();
+                    // Stop execution, suspending to a checkpoint if asked
+                    if (!checkpoint_out.empty())
+                        write_checkpoint(checkpoint_out, cpu, bus);
+                    stimulus.quit(cpu);
                     break;
                 }
             }
         }
 
         std::cout << "\n--- End of program ---" << std::endl;
-        std::cout << "Program exited successfully." << std::endl;
+        if (cpu.get_debug_event() == DebugEvent::WATCHPOINT)
+            std::cout << "Stopped at watchpoint, pc = 0x" << std::hex << cpu.get_watch_hit().pc << std::dec << std::endl;
+        else
+            std::cout << "Program exited successfully." << std::endl;
     }
     catch (const std::exception &e)
     {
         std::cerr << std::endl
                   << "Error during execution: " << e.what() << std::endl;
+        status = 1;
+    }
+
+    stimulus.finish(cpu);
+    if (raw_input)
         restore_terminal();
-        return 1;
+
+    if (tracer)
+        tracer->close();
+
+    if (show_stats)
+        print_stats(cpu, sampler.get(), intervals.get());
+    if (aot_image && cpu.get_aot_stale_blocks())
+        std::cerr << "Note: the program wrote to translated code; " << cpu.get_aot_stale_blocks()
+                  << " block(s) were interpreted from then on" << std::endl;
+    if (profiler)
+    {
+        if (profile_out.empty())
+        {
+            profiler->report(std::cerr, symbols);
+        }
+        else
+        {
+            std::ofstream out(profile_out.c_str());
+            profiler->report(out, symbols);
+        }
+    }
+
+    if (callgraph)
+    {
+        std::ofstream out(callgraph_out.c_str());
+        callgraph->write_folded(out);
+        if (show_stats)
+            callgraph->report(std::cerr);
+    }
+
+    if (instmix)
+    {
+        instmix->flush();
+        std::ofstream out(instmix_out.c_str());
+        size_t dot = instmix_out.rfind('.');
+        if (dot != std::string::npos && instmix_out.compare(dot, std::string::npos, ".csv") == 0)
+            instmix->write_csv(out);
+        else
+            instmix->write_json(out);
     }
 
-    restore_terminal();
-    return 0;
+    return status;
 }
\ No newline at end of file
@@ -128,3 +128,33 @@ Signal *GPIO::get_interrupt_line(uint32_t vector)
         return &interrupt_lines[vector];
     return nullptr;
 }
+
+void GPIO::save_state(StateWriter &w) const
+{
+    w.put(ctrl);
+    for (int i = 0; i < 4; i++)
+        pin_blocks[i].save_state(w);
+    w.put(interrupt_status);
+    w.put(interrupt_enable);
+    w.put(pin_interrupt_modes);
+    w.put(last_pin_state);
+    for (int i = 0; i < 32; i++)
+        interrupt_lines[i].save_state(w);
+    for (int i = 0; i < 4; i++)
+        port_interrupt_lines[i].save_state(w);
+}
+
+void GPIO::load_state(StateReader &r)
+{
+    r.get(ctrl);
+    for (int i = 0; i < 4; i++)
+        pin_blocks[i].load_state(r);
+    r.get(interrupt_status);
+    r.get(interrupt_enable);
+    r.get(pin_interrupt_modes);
+    r.get(last_pin_state);
+    for (int i = 0; i < 32; i++)
+        interrupt_lines[i].load_state(r);
+    for (int i = 0; i < 4; i++)
+        port_interrupt_lines[i].load_state(r);
+}
@@ -112,6 +112,10 @@ public:
     void connect_interrupt_line(uint32_t vector, Signal *signal);
     Signal *get_interrupt_line(uint32_t vector);
 
+    // Snapshot support
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
+
 private:
     uint32_t ctrl = 0x1;
     PinBlock pin_blocks[4];
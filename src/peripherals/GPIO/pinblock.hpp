@@ -60,4 +60,22 @@ public:
     {
         return mode;
     }
+
+    void save_state(StateWriter &w) const
+    {
+        w.put(mode);
+        w.put(external_in);
+        w.put(output_state);
+        for (int i = 0; i < 8; i++)
+            pins[i].save_state(w);
+    }
+
+    void load_state(StateReader &r)
+    {
+        r.get(mode);
+        r.get(external_in);
+        r.get(output_state);
+        for (int i = 0; i < 8; i++)
+            pins[i].load_state(r);
+    }
 };
\ No newline at end of file
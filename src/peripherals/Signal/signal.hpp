@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include "../../snapshot/state.hpp"
 
 class Signal
 {
@@ -34,6 +35,10 @@ public:
         bound_signal = s;
     } // simple wire connection
 
+    // Only the level is state; bindings are wiring set up by the Bus
+    void save_state(StateWriter &w) const { w.put(value); }
+    void load_state(StateReader &r) { r.get(value); }
+
 private:
     uint8_t value = 0;
     Signal *bound_signal = nullptr;
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <deque>
 #include "../Signal/signal.hpp"
 
 class UART
@@ -28,13 +29,45 @@ public:
         interrupt_status &= ~UART_INT_TX_EMPTY;
     }
 
+    // Received bytes are read from the data register in order, ahead of
+    // the RX line level
     uint8_t read()
     {
+        if (!rx_fifo.empty())
+        {
+            uint8_t data = rx_fifo.front();
+            rx_fifo.pop_front();
+            if (rx_fifo.empty())
+                interrupt_status &= ~UART_INT_RX_READY;
+            return data;
+        }
         if (!rx)
             return 0;
         return rx->read();
     }
 
+    // What read() would return, without consuming it (debugger)
+    uint8_t peek() const
+    {
+        if (!rx_fifo.empty())
+            return rx_fifo.front();
+        if (!rx)
+            return 0;
+        return rx->read();
+    }
+
+    // Host side of the RX path (fuzz input): queue a byte for the CPU
+    void receive(uint8_t data)
+    {
+        rx_fifo.push_back(data);
+        interrupt_status |= UART_INT_RX_READY;
+        if (interrupt_enable & UART_INT_RX_READY)
+        {
+            interrupt_lines[1].write(1);
+            interrupt_lines[1].write(0); // Pulse interrupt
+        }
+    }
+
     // CPU cycles-based simulation
     void tick(uint32_t cpu_cycles)
     {
@@ -94,11 +127,56 @@ public:
         }
     }
 
+    // Ticks that pass without anything the CPU could observe: up to the
+    // next TX bit, or none while received bytes wait (reading one pops it)
+    uint64_t quiet_ticks() const
+    {
+        if (!rx_fifo.empty())
+            return 0;
+        if (!tx || !tx_busy)
+            return UINT64_MAX;
+        uint32_t cycles_per_bit = cpu_clock_hz / baud_rate;
+        return cycles_accum + 1 < cycles_per_bit ? cycles_per_bit - cycles_accum - 1 : 0;
+    }
+
     uint32_t get_baud() const { return baud_rate; }
     void set_baud(uint32_t b) { baud_rate = b; }
 
     void set_cpu_clock(uint32_t hz) { cpu_clock_hz = hz; }
 
+    // Snapshot support; includes a transmission in flight. Queued RX
+    // bytes are host input, not state: loading a state drops them.
+    void save_state(StateWriter &w) const
+    {
+        w.put(baud_rate);
+        w.put(cpu_clock_hz);
+        w.put(cycles_accum);
+        w.put(tx_phase);
+        w.put(tx_busy);
+        w.put(tx_shift);
+        w.put(tx_bit_index);
+        w.put(interrupt_status);
+        w.put(interrupt_enable);
+        for (int i = 0; i < 2; i++)
+            interrupt_lines[i].save_state(w);
+    }
+
+    void load_state(StateReader &r)
+    {
+        r.get(baud_rate);
+        r.get(cpu_clock_hz);
+        r.get(cycles_accum);
+        r.get(tx_phase);
+        r.get(tx_busy);
+        r.get(tx_shift);
+        r.get(tx_bit_index);
+        r.get(interrupt_status);
+        r.get(interrupt_enable);
+        for (int i = 0; i < 2; i++)
+            interrupt_lines[i].load_state(r);
+        rx_fifo.clear();
+    }
+
     // INTERRUPT SUPPORT
     uint32_t get_interrupt_status() const { return interrupt_status; }
     uint32_t get_interrupt_enable() const { return interrupt_enable; }
@@ -129,6 +207,8 @@ private:
     uint8_t tx_shift = 0;
     uint8_t tx_bit_index = 0;
 
+    std::deque<uint8_t> rx_fifo; // Received, not yet read
+
     // Interrupt support
     uint32_t interrupt_status = 0; // Active UART interrupts
     uint32_t interrupt_enable = 0; // Enabled UART interrupts
@@ -76,6 +76,14 @@ uint32_t Bus::load(uint32_t addr)
     return 0;
 }
 
+// Only the UART data register changes state when read
+uint32_t Bus::peek(uint32_t addr)
+{
+    if (is_uart(addr) && uart && decode_uart(addr).second == 0x0)
+        return uart->peek();
+    return load(addr);
+}
+
 // MMIO WRITE
 void Bus::store(uint32_t addr, uint32_t val)
 {
@@ -147,6 +155,11 @@ uint8_t Bus::uart_read()
     return uart->read();
 }
 
+void Bus::uart_receive(uint8_t data)
+{
+    uart->receive(data);
+}
+
 void Bus::uart_tick(uint32_t cpu_cycles)
 {
     uart->tick(cpu_cycles);
@@ -185,6 +198,12 @@ void Bus::tick(uint32_t cpu_cycles)
     }
 }
 
+uint64_t Bus::quiet_ticks() const
+{
+    // GPIO interrupts only follow pin changes; only the UART moves by itself
+    return uart ? uart->quiet_ticks() : UINT64_MAX;
+}
+
 // PIN ACCESS (for external / debug)
 Pin *Bus::get_pin(int index)
 {
@@ -351,4 +370,40 @@ Signal *Bus::get_interrupt_line(uint32_t vector)
     if (vector < BUS_INT_MAX)
         return &interrupt_lines[vector];
     return nullptr;
-}
\ No newline at end of file
+}
+// SNAPSHOT SUPPORT
+void Bus::save_state(StateWriter &w) const
+{
+    w.put(current_route_mode);
+    for (int i = 0; i < 32; i++)
+    {
+        pins[i].save_state(w);
+        signals[i].save_state(w);
+    }
+    w.put(interrupt_status);
+    w.put(interrupt_enable);
+    for (int i = 0; i < BUS_INT_MAX; i++)
+        interrupt_lines[i].save_state(w);
+    gpio->save_state(w);
+    uart->save_state(w);
+}
+
+void Bus::load_state(StateReader &r)
+{
+    // Routing is wiring, so rebuild it before the signal levels land
+    RouteMode mode;
+    r.get(mode);
+    set_route_mode(mode);
+
+    for (int i = 0; i < 32; i++)
+    {
+        pins[i].load_state(r);
+        signals[i].load_state(r);
+    }
+    r.get(interrupt_status);
+    r.get(interrupt_enable);
+    for (int i = 0; i < BUS_INT_MAX; i++)
+        interrupt_lines[i].load_state(r);
+    gpio->load_state(r);
+    uart->load_state(r);
+}
@@ -50,6 +50,7 @@ public:
 
     // MMIO READ/WRITE
     uint32_t load(uint32_t addr);
+    uint32_t peek(uint32_t addr); // load() without side effects (debugger)
     void store(uint32_t addr, uint32_t val);
 
     // ROUTING CONTROL
@@ -59,11 +60,17 @@ public:
     // UART ACCESS
     void uart_write(uint8_t data);
     uint8_t uart_read();
+    void uart_receive(uint8_t data); // Byte arriving on RX, from the host
     void uart_tick(uint32_t cpu_cycles);
 
     // TICK (periodic update)
     void tick(uint32_t cpu_cycles); // Check GPIO/UART and aggregate interrupts
 
+    // Ticks the bus can take with no change visible to the CPU (MMIO
+    // values, interrupts), UINT64_MAX if nothing is scheduled. Pins only
+    // change from outside, between run_for calls.
+    uint64_t quiet_ticks() const;
+
     // PIN ACCESS (for external / debug)
     Pin *get_pin(int index);
 
@@ -80,6 +87,10 @@ public:
     void connect_interrupt_line(uint32_t vector, Signal *signal);
     Signal *get_interrupt_line(uint32_t vector);
 
+    // SNAPSHOT SUPPORT (GPIO and UART included)
+    void save_state(StateWriter &w) const;
+    void load_state(StateReader &r);
+
 private:
     GPIO *gpio;
     UART *uart;
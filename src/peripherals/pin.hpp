@@ -30,6 +30,9 @@ public:
         return mode;
     }
 
+    void save_state(StateWriter &w) const { w.put(mode); }
+    void load_state(StateReader &r) { r.get(mode); }
+
     // Drive signal (only if OUTPUT)
     void write(uint8_t value)
     {
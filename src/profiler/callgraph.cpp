@@ -0,0 +1,195 @@
+#include "callgraph.hpp"
+#include "../cpu/riscv.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+CallGraphProfiler::CallGraphProfiler(const SymbolTable &symbols) : symbols(symbols)
+{
+    Node root;
+    root.func = 0;
+    root.marker = FUNCTION;
+    root.parent = 0;
+    nodes.push_back(root);
+}
+
+uint32_t CallGraphProfiler::child(uint32_t parent, uint32_t func, int32_t marker)
+{
+    const std::vector<uint32_t> &children = nodes[parent].children;
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        const Node &n = nodes[children[i]];
+        if (n.func == func && n.marker == marker)
+            return children[i];
+    }
+
+    Node n;
+    n.func = func;
+    n.marker = marker;
+    n.parent = parent;
+    nodes.push_back(n);
+    uint32_t index = (uint32_t)(nodes.size() - 1);
+    nodes[parent].children.push_back(index);
+    return index;
+}
+
+uint32_t CallGraphProfiler::function_of(uint32_t addr) const
+{
+    const Symbol *sym = symbols.lookup(addr);
+    return sym ? sym->addr : addr;
+}
+
+void CallGraphProfiler::on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost)
+{
+    if (stack.empty())
+    {
+        Frame base = {child(0, function_of(pc), FUNCTION), NO_RETURN};
+        stack.push_back(base);
+    }
+
+    nodes[stack.back().node].self += cost;
+
+    // Whether this instruction trapped: a trap since the last retire that
+    // did not go to this instruction (an interrupt before a handler's first
+    // instruction does)
+    bool trapped = trap_taken && pc != trap_target;
+    trap_taken = false;
+
+    uint32_t opcode = instr & 0x7F;
+    if (opcode == 0x6F || opcode == 0x67)
+    {
+        uint32_t rd = (instr >> 7) & 0x1F;
+        uint32_t rs1 = (instr >> 15) & 0x1F;
+        uint32_t target = cpu.get_pc();
+
+        if (rd == 1)
+        {
+            // Call
+            Frame f = {child(stack.back().node, function_of(target), FUNCTION), pc + 4};
+            stack.push_back(f);
+        }
+        else if (rd == 0 && opcode == 0x67 && rs1 == 1)
+        {
+            // Return: unwind to the frame expecting this address, never
+            // below the current trap context; unmatched returns are ignored
+            size_t floor = contexts.empty() ? 1 : contexts.back() + 1;
+            for (size_t i = stack.size(); i-- > floor;)
+            {
+                if (stack[i].return_addr == target)
+                {
+                    stack.resize(i);
+                    break;
+                }
+            }
+        }
+        else if (rd == 0 && !symbols.empty())
+        {
+            // Tail call (or the jump out of a vector table)
+            Frame &top = stack.back();
+            uint32_t func = function_of(target);
+            if (func != nodes[top.node].func)
+                top.node = child(nodes[top.node].parent, func, FUNCTION);
+        }
+    }
+    else if (instr == 0x30200073 || instr == 0x10200073) // MRET, SRET
+    {
+        // One that trapped as illegal still retires; the context its trap
+        // opened stays
+        if (!trapped && !contexts.empty())
+        {
+            stack.resize(contexts.back());
+            contexts.pop_back();
+        }
+    }
+}
+
+void CallGraphProfiler::on_trap(RISCV &cpu, uint32_t cause, bool is_interrupt)
+{
+    contexts.push_back(stack.size());
+    trap_taken = true;
+    trap_target = cpu.get_pc();
+
+    int32_t marker = (int32_t)(cause & 0x7FFFFFFF);
+    if (is_interrupt)
+        marker |= INT32_MIN;
+
+    uint32_t root = child(0, cause, marker);
+    Frame context = {root, NO_RETURN};
+    stack.push_back(context);
+    Frame handler = {child(root, function_of(cpu.get_pc()), FUNCTION), NO_RETURN};
+    stack.push_back(handler);
+}
+
+std::string CallGraphProfiler::name_of(const Node &node) const
+{
+    std::ostringstream name;
+    if (node.marker != FUNCTION)
+    {
+        name << (node.marker < 0 ? "[interrupt " : "[exception ") << (node.marker & 0x7FFFFFFF) << "]";
+        return name.str();
+    }
+
+    const Symbol *sym = symbols.lookup(node.func);
+    if (sym && sym->addr == node.func)
+        return sym->name;
+    name << "0x" << std::hex << std::setw(8) << std::setfill('0') << node.func;
+    return name.str();
+}
+
+uint64_t CallGraphProfiler::inclusive(uint32_t node, std::vector<uint64_t> &totals) const
+{
+    uint64_t total = nodes[node].self;
+    for (size_t i = 0; i < nodes[node].children.size(); i++)
+        total += inclusive(nodes[node].children[i], totals);
+    totals[node] = total;
+    return total;
+}
+
+void CallGraphProfiler::write_folded(std::ostream &out) const
+{
+    // Iterative DFS carrying the path string
+    std::vector<std::pair<uint32_t, std::string> > work;
+    for (size_t i = 0; i < nodes[0].children.size(); i++)
+        work.push_back(std::make_pair(nodes[0].children[i], name_of(nodes[nodes[0].children[i]])));
+
+    while (!work.empty())
+    {
+        std::pair<uint32_t, std::string> item = work.back();
+        work.pop_back();
+
+        const Node &n = nodes[item.first];
+        if (n.self)
+            out << item.second << " " << n.self << "\n";
+        for (size_t i = 0; i < n.children.size(); i++)
+            work.push_back(std::make_pair(n.children[i], item.second + ";" + name_of(nodes[n.children[i]])));
+    }
+}
+
+void CallGraphProfiler::report(std::ostream &out, size_t max_rows) const
+{
+    std::vector<uint64_t> totals(nodes.size());
+    uint64_t total = inclusive(0, totals);
+
+    std::vector<uint32_t> order;
+    for (uint32_t i = 1; i < nodes.size(); i++)
+        order.push_back(i);
+    std::sort(order.begin(), order.end(), [&totals](uint32_t a, uint32_t b) { return totals[a] > totals[b]; });
+    if (order.size() > max_rows)
+        order.resize(max_rows);
+
+    std::ios::fmtflags flags = out.flags();
+    out << "\n--- Call paths by inclusive cycles ---" << std::endl;
+    out << std::setw(8) << "%" << std::setw(16) << "inclusive" << std::setw(16) << "exclusive" << "  path" << std::endl;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        std::string path;
+        for (uint32_t n = order[i]; n != 0; n = nodes[n].parent)
+            path = name_of(nodes[n]) + (path.empty() ? "" : ";" + path);
+
+        double percent = total ? 100.0 * totals[order[i]] / total : 0.0;
+        out << std::fixed << std::setprecision(2) << std::setw(8) << percent
+            << std::setw(16) << totals[order[i]] << std::setw(16) << nodes[order[i]].self
+            << "  " << path << std::endl;
+    }
+    out.flags(flags);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "../cpu/observer.hpp"
+#include "../debug/symbols.hpp"
+
+// Call-graph profiler.
+//
+// Keeps a shadow call stack from the instruction stream: JAL/JALR writing
+// ra are calls, `jalr x0, 0(ra)` returns, other jumps into a different
+// function are tail calls. Every trap opens a new context that shows up as
+// its own root ("[interrupt N]", "[exception N]") and MRET or SRET closes
+// it, so handlers never appear under whatever code they interrupted.
+//
+// Cycles are charged to a calling-context tree; each node holds the
+// exclusive cycles of one call path, inclusive cycles are summed on output.
+class CallGraphProfiler : public ExecObserver
+{
+public:
+    // symbols may be empty; functions are then named by entry address
+    explicit CallGraphProfiler(const SymbolTable &symbols);
+
+    void on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost) override;
+    void on_trap(RISCV &cpu, uint32_t cause, bool is_interrupt) override;
+
+    // One "root;caller;callee exclusive_cycles" line per call path, as
+    // consumed by flamegraph.pl, speedscope and inferno
+    void write_folded(std::ostream &out) const;
+
+    // Hottest call paths by inclusive cycles
+    void report(std::ostream &out, size_t max_rows = 20) const;
+
+private:
+    static constexpr uint32_t NO_RETURN = 0xFFFFFFFF;
+    static constexpr int32_t FUNCTION = -1;
+
+    struct Node
+    {
+        uint32_t func;   // Entry address (or trap cause for context markers)
+        int32_t marker;  // FUNCTION, or cause with bit 31 set for interrupts
+        uint32_t parent;
+        std::vector<uint32_t> children;
+        uint64_t self = 0;
+    };
+
+    struct Frame
+    {
+        uint32_t node;
+        uint32_t return_addr;
+    };
+
+    uint32_t child(uint32_t parent, uint32_t func, int32_t marker);
+    uint32_t function_of(uint32_t addr) const;
+    std::string name_of(const Node &node) const;
+    uint64_t inclusive(uint32_t node, std::vector<uint64_t> &totals) const;
+
+    const SymbolTable &symbols;
+    std::vector<Node> nodes; // nodes[0] is the synthetic root
+    std::vector<Frame> stack;
+    std::vector<size_t> contexts; // Stack depth at each open trap context
+    bool trap_taken = false;      // Since the last retire
+    uint32_t trap_target = 0;     // Handler it went to
+};
@@ -0,0 +1,193 @@
+#include "instmix.hpp"
+#include "../cpu/riscv.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+InstructionMixProfiler::InstructionMixProfiler(const SymbolTable &symbols) : symbols(symbols) {}
+
+void InstructionMixProfiler::on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost)
+{
+    // A trap that retired nothing (a faulting fetch, load or store) moved
+    // the pc without ending the block: close it at its last instruction
+    if (cur_len > 0 && pc != cur_start + cur_len * 4)
+        end_block(cur_start + (cur_len - 1) * 4, pc);
+    if (cur_len == 0)
+        cur_start = pc;
+    cur_instrs[cur_len++] = instr;
+    cur_cycles += cost;
+
+    // ECALL in M mode is served in place and falls through; it still
+    // ends the block, as do the other privileged SYSTEM instructions
+    uint32_t next_pc = cpu.get_pc();
+    if ((instr & 0x7F) == 0x63 || (instr & 0x707F) == 0x73 || next_pc != pc + 4 || cur_len == MAX_BLOCK)
+        end_block(pc, next_pc);
+}
+
+void InstructionMixProfiler::on_trap(RISCV &cpu, uint32_t cause, bool is_interrupt)
+{
+    (void)cause;
+
+    // Exceptions raised by a retiring instruction (ECALL, illegal
+    // instructions) end the block in its on_retire; faulting accesses
+    // retire nothing and are cut at the handler's first instruction. An
+    // interrupt arrives between instructions, so cut the block here
+    if (is_interrupt && cur_len > 0)
+        end_block(cur_start + (cur_len - 1) * 4, cpu.get_pc());
+}
+
+void InstructionMixProfiler::flush()
+{
+    if (cur_len > 0)
+        end_block(cur_start + (cur_len - 1) * 4, 0);
+}
+
+void InstructionMixProfiler::end_block(uint32_t last_pc, uint32_t next_pc)
+{
+    uint64_t key = (static_cast<uint64_t>(cur_start) << 32) | last_pc;
+    auto it = ids.find(key);
+    uint32_t id;
+    if (it == ids.end())
+    {
+        // First execution: assign the next dense id and classify the block
+        id = static_cast<uint32_t>(blocks.size());
+        ids.emplace(key, id);
+
+        Block b;
+        b.start = cur_start;
+        b.end = last_pc;
+        b.length = cur_len;
+        b.first_class = static_cast<uint32_t>(classes.size());
+        b.branch = (cur_instrs[cur_len - 1] & 0x7F) == 0x63;
+        blocks.push_back(b);
+        for (uint32_t i = 0; i < cur_len; i++)
+            classes.push_back(static_cast<uint8_t>(classify(cur_instrs[i])));
+
+        counts.push_back(0);
+        cycles.push_back(0);
+        taken.push_back(0);
+        not_taken.push_back(0);
+    }
+    else
+    {
+        id = it->second;
+    }
+
+    counts[id]++;
+    cycles[id] += cur_cycles;
+    if (blocks[id].branch)
+    {
+        if (next_pc == last_pc + 4)
+            not_taken[id]++;
+        else
+            taken[id]++;
+    }
+
+    cur_len = 0;
+    cur_cycles = 0;
+}
+
+void InstructionMixProfiler::mix(std::vector<uint64_t> &totals) const
+{
+    totals.assign(INSN_CLASS_COUNT, 0);
+    for (size_t id = 0; id < blocks.size(); id++)
+    {
+        const Block &b = blocks[id];
+        for (uint32_t i = 0; i < b.length; i++)
+            totals[classes[b.first_class + i]] += counts[id];
+    }
+}
+
+// Block ids ordered by execution count, hottest first
+static std::vector<uint32_t> by_count(const std::vector<uint64_t> &counts)
+{
+    std::vector<uint32_t> order(counts.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = static_cast<uint32_t>(i);
+    std::stable_sort(order.begin(), order.end(), [&counts](uint32_t a, uint32_t b)
+                     { return counts[a] > counts[b]; });
+    return order;
+}
+
+static std::string hex32(uint32_t value)
+{
+    std::ostringstream s;
+    s << "0x" << std::hex << std::setw(8) << std::setfill('0') << value;
+    return s.str();
+}
+
+std::string InstructionMixProfiler::location(uint32_t addr) const
+{
+    const Symbol *sym = symbols.lookup(addr);
+    if (!sym)
+        return "";
+    std::ostringstream s;
+    s << sym->name << "+0x" << std::hex << (addr - sym->addr);
+    return s.str();
+}
+
+void InstructionMixProfiler::write_json(std::ostream &out) const
+{
+    std::vector<uint64_t> totals;
+    mix(totals);
+    uint64_t instructions = 0;
+    for (size_t c = 0; c < totals.size(); c++)
+        instructions += totals[c];
+
+    out << "{\n  \"instructions\": " << instructions << ",\n";
+    out << "  \"mix\": {";
+    bool first = true;
+    for (size_t c = 0; c < totals.size(); c++)
+    {
+        if (totals[c] == 0)
+            continue;
+        out << (first ? "\n" : ",\n") << "    \"" << insn_name(static_cast<InsnClass>(c)) << "\": " << totals[c];
+        first = false;
+    }
+    out << "\n  },\n  \"blocks\": [";
+
+    std::vector<uint32_t> order = by_count(counts);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        uint32_t id = order[i];
+        const Block &b = blocks[id];
+        out << (i ? ",\n" : "\n") << "    {\"id\": " << id
+            << ", \"start\": \"" << hex32(b.start) << "\", \"end\": \"" << hex32(b.end) << "\"";
+        std::string loc = location(b.start);
+        if (!loc.empty())
+            out << ", \"function\": \"" << loc << "\"";
+        out << ", \"length\": " << b.length << ", \"count\": " << counts[id] << ", \"cycles\": " << cycles[id];
+        if (b.branch)
+            out << ", \"taken\": " << taken[id] << ", \"not_taken\": " << not_taken[id];
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void InstructionMixProfiler::write_csv(std::ostream &out) const
+{
+    std::vector<uint64_t> totals;
+    mix(totals);
+
+    out << "kind,name,start,end,function,length,count,cycles,taken,not_taken\n";
+    for (size_t c = 0; c < totals.size(); c++)
+    {
+        if (totals[c] != 0)
+            out << "mix," << insn_name(static_cast<InsnClass>(c)) << ",,,,," << totals[c] << ",,,\n";
+    }
+
+    std::vector<uint32_t> order = by_count(counts);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        uint32_t id = order[i];
+        const Block &b = blocks[id];
+        out << "block," << id << ',' << hex32(b.start) << ',' << hex32(b.end) << ',' << location(b.start) << ','
+            << b.length << ',' << counts[id] << ',' << cycles[id] << ',';
+        if (b.branch)
+            out << taken[id] << ',' << not_taken[id];
+        else
+            out << ',';
+        out << '\n';
+    }
+}
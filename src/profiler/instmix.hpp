@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../cpu/observer.hpp"
+#include "../cpu/disasm.hpp"
+#include "../debug/symbols.hpp"
+
+// Instruction-mix and basic-block profiler.
+//
+// Blocks are discovered from the executed stream: a block ends at any
+// control transfer (branch, jump), at ECALL/EBREAK/MRET/SRET and the other
+// privileged SYSTEM instructions, before a trap, or after MAX_BLOCK
+// instructions. The first execution of a block assigns it a dense id and
+// classifies its instructions once; after that the only per-instruction
+// work is appending to the current block, and one hash lookup per block
+// entry bumps flat counter arrays. Conditional branches
+// ending a block also count their taken and fall-through edges.
+//
+// The per-class mix is derived on output as block count x block contents,
+// so code modified after its first execution is reported as first seen.
+class InstructionMixProfiler : public ExecObserver
+{
+public:
+    // symbols may be empty; blocks are then reported by address only
+    explicit InstructionMixProfiler(const SymbolTable &symbols);
+
+    void on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost) override;
+    void on_trap(RISCV &cpu, uint32_t cause, bool is_interrupt) override;
+
+    // Close the block in progress (call before writing results)
+    void flush();
+
+    void write_json(std::ostream &out) const;
+    void write_csv(std::ostream &out) const;
+
+private:
+    static constexpr uint32_t MAX_BLOCK = 64;
+
+    struct Block
+    {
+        uint32_t start;
+        uint32_t end;         // Address of the last instruction
+        uint32_t length;      // Instructions
+        uint32_t first_class; // Index of the block's classes in `classes`
+        bool branch;          // Ends with a conditional branch
+    };
+
+    void end_block(uint32_t last_pc, uint32_t next_pc);
+    void mix(std::vector<uint64_t> &totals) const;
+    std::string location(uint32_t addr) const;
+
+    const SymbolTable &symbols;
+
+    // Block being executed
+    uint32_t cur_start = 0;
+    uint32_t cur_len = 0;
+    uint64_t cur_cycles = 0;
+    uint32_t cur_instrs[MAX_BLOCK];
+
+    // (start << 32 | end) -> dense block id
+    std::unordered_map<uint64_t, uint32_t> ids;
+    std::vector<Block> blocks;
+    std::vector<uint8_t> classes; // InsnClass of every instruction of every block
+
+    // Counters indexed by block id
+    std::vector<uint64_t> counts;
+    std::vector<uint64_t> cycles;
+    std::vector<uint64_t> taken;
+    std::vector<uint64_t> not_taken;
+};
@@ -0,0 +1,129 @@
+#include "profiler.hpp"
+#include "../cpu/riscv.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <vector>
+
+Profiler::Profiler(uint64_t interval) : interval(interval) {}
+
+// Samples are counted from where profiling began (after --resume or a
+// fork-server boot the counter is well past 0)
+void Profiler::start(const RISCV &cpu)
+{
+    next_sample = cpu.get_cycles() + interval;
+    started = true;
+}
+
+void Profiler::on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost)
+{
+    (void)instr;
+
+    if (interval == 0)
+    {
+        Bucket &b = histogram[pc];
+        b.cycles += cost;
+        b.hits++;
+        return;
+    }
+
+    if (!started)
+        start(cpu);
+    uint64_t now = cpu.get_cycles();
+    if (now >= next_sample)
+        sample(pc, now);
+}
+
+uint64_t Profiler::run_for(RISCV &cpu, uint64_t max_steps, const Runner &run)
+{
+    if (!started)
+        start(cpu);
+
+    uint64_t done = 0;
+    while (done < max_steps && cpu.is_running())
+    {
+        // Steps are not cycles: aim at the sample point with the CPI so far
+        // and close in on it, rather than overshoot it
+        uint64_t now = cpu.get_cycles();
+        uint64_t steps = next_sample - now;
+        if (cpu.get_instret() && now > cpu.get_instret())
+            steps = steps * cpu.get_instret() / now;
+        steps = std::max<uint64_t>(1, std::min(steps, max_steps - done));
+
+        uint64_t ran = run(steps);
+        done += ran;
+        now = cpu.get_cycles();
+        if (now >= next_sample)
+            sample(cpu.get_pc(), now);
+        if (ran == 0)
+            break;
+    }
+    return done;
+}
+
+void Profiler::sample(uint32_t pc, uint64_t now)
+{
+    // A long instruction (or skipped loop) can cover several sample points
+    uint64_t samples = (now - next_sample) / interval + 1;
+    next_sample += samples * interval;
+
+    Bucket &b = histogram[pc];
+    b.cycles += samples * interval;
+    b.hits += samples;
+}
+
+void Profiler::report(std::ostream &out, const SymbolTable &symbols) const
+{
+    struct Row
+    {
+        std::string name;
+        uint64_t cycles;
+        uint64_t hits;
+    };
+
+    // Fold PCs into their functions
+    std::map<std::string, Row> by_function;
+    uint64_t total = 0;
+    for (auto it = histogram.begin(); it != histogram.end(); ++it)
+    {
+        const Symbol *sym = symbols.lookup(it->first);
+        std::string name;
+        if (sym)
+        {
+            name = sym->name;
+        }
+        else
+        {
+            std::ostringstream addr;
+            addr << "0x" << std::hex << std::setw(8) << std::setfill('0') << it->first;
+            name = addr.str();
+        }
+
+        Row &row = by_function[name];
+        row.name = name;
+        row.cycles += it->second.cycles;
+        row.hits += it->second.hits;
+        total += it->second.cycles;
+    }
+
+    std::vector<Row> rows;
+    for (auto it = by_function.begin(); it != by_function.end(); ++it)
+        rows.push_back(it->second);
+    std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.cycles > b.cycles; });
+
+    std::ios::fmtflags flags = out.flags();
+    out << "\n--- Flat profile (" << (interval ? "sampled every " + std::to_string(interval) + " cycles" : "exact")
+        << ") ---" << std::endl;
+    out << std::setw(8) << "%" << std::setw(16) << "self cycles" << std::setw(14)
+        << (interval ? "samples" : "instructions") << "  function" << std::endl;
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        double percent = total ? 100.0 * rows[i].cycles / total : 0.0;
+        out << std::fixed << std::setprecision(2) << std::setw(8) << percent
+            << std::setw(16) << rows[i].cycles << std::setw(14) << rows[i].hits
+            << "  " << rows[i].name << std::endl;
+    }
+    out << std::setw(8) << "" << std::setw(16) << total << "  total" << std::endl;
+    out.flags(flags);
+}
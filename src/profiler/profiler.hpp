@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <unordered_map>
+#include "../cpu/observer.hpp"
+#include "../debug/symbols.hpp"
+
+// Flat guest profiler.
+//
+// Sampled mode records the PC when the cycle counter crosses each multiple
+// of `interval` past the cycle it started at; every sample stands for
+// `interval` cycles. It is driven through run_for(), which keeps the
+// fast paths on, or as an observer where something else runs the CPU.
+// Exact mode (interval 0) is an observer that charges every instruction
+// its real cost.
+class Profiler : public ExecObserver
+{
+public:
+    typedef std::function<uint64_t(uint64_t)> Runner;
+
+    explicit Profiler(uint64_t interval);
+
+    void on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost) override;
+
+    // Sampled mode: runs up to max_steps through `run` (the CPU's or the
+    // sampler's run_for) in chunks that end where a sample is due, and
+    // samples the PC about to execute there
+    uint64_t run_for(RISCV &cpu, uint64_t max_steps, const Runner &run);
+
+    // Sorted flat profile: function, self cycles, percent
+    void report(std::ostream &out, const SymbolTable &symbols) const;
+
+private:
+    struct Bucket
+    {
+        uint64_t cycles = 0;
+        uint64_t hits = 0; // Samples, or instructions in exact mode
+    };
+
+    void start(const RISCV &cpu);
+    void sample(uint32_t pc, uint64_t now);
+
+    uint64_t interval;
+    uint64_t next_sample = 0; // Set by start() on first use
+    bool started = false;
+    std::unordered_map<uint32_t, Bucket> histogram; // Keyed by PC
+};
@@ -0,0 +1,315 @@
+#include "stimulus.hpp"
+#include "../cpu/riscv.hpp"
+#include "../peripherals/bus.hpp"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+static const char STIMULUS_MAGIC[8] = {'R', 'V', 'S', 'T', 'I', 'M', '1', 0};
+
+// Events carry no cycle budget: once no input is pending, replay runs in
+// chunks of this many instructions until the program ends
+static const uint64_t FREE_RUN_STEPS = 1000000;
+
+static void put_varint(std::string &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+static uint64_t get_varint(const std::string &in, size_t &pos)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (pos >= in.size())
+            throw std::runtime_error("Truncated stimulus log");
+        uint8_t byte = in[pos++];
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return v;
+    }
+    throw std::runtime_error("Corrupt stimulus log");
+}
+
+Stimulus::~Stimulus()
+{
+    if (file)
+        std::fclose(file);
+}
+
+bool Stimulus::open_record(const std::string &path)
+{
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    std::fwrite(STIMULUS_MAGIC, 1, sizeof(STIMULUS_MAGIC), file);
+    mode = RECORD;
+    return true;
+}
+
+bool Stimulus::open_replay(const std::string &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in)
+        return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string log = ss.str();
+
+    if (log.size() < sizeof(STIMULUS_MAGIC) || std::memcmp(log.data(), STIMULUS_MAGIC, sizeof(STIMULUS_MAGIC)) != 0)
+        throw std::runtime_error("'" + path + "' is not a stimulus log");
+
+    size_t pos = sizeof(STIMULUS_MAGIC);
+    uint64_t instret = 0, cycles = 0;
+    while (pos < log.size())
+    {
+        Event ev;
+        ev.type = (EventType)(uint8_t)log[pos++];
+        instret += get_varint(log, pos);
+        cycles += get_varint(log, pos);
+        ev.instret = instret;
+        ev.cycles = cycles;
+        ev.addr = 0;
+        ev.value = 0;
+
+        switch (ev.type)
+        {
+        case EV_BUS_STORE:
+        case EV_SIGNAL:
+            ev.addr = (uint32_t)get_varint(log, pos);
+            ev.value = (uint32_t)get_varint(log, pos);
+            break;
+        case EV_INPUT:
+        {
+            size_t len = (size_t)get_varint(log, pos);
+            if (pos + len > log.size())
+                throw std::runtime_error("Truncated stimulus log");
+            ev.data = log.substr(pos, len);
+            pos += len;
+            break;
+        }
+        case EV_QUIT:
+        case EV_END:
+            break;
+        default:
+            throw std::runtime_error("Corrupt stimulus log");
+        }
+        events.push_back(ev);
+    }
+
+    mode = REPLAY;
+    return true;
+}
+
+void Stimulus::open_replay_empty()
+{
+    events.clear();
+    next = 0;
+    mode = REPLAY;
+}
+
+void Stimulus::write_event(RISCV &cpu, EventType type, uint32_t addr, uint32_t value, const std::string &data)
+{
+    if (mode == REPLAY)
+        return;
+
+    uint64_t instret = cpu.get_instret();
+    uint64_t cycles = cpu.get_cycles();
+
+    // Kept in memory for rewinds; stdin data is all a rerun needs
+    if (type == EV_INPUT)
+    {
+        Event ev = {type, instret, cycles, addr, value, data};
+        events.push_back(ev);
+        next = events.size();
+    }
+    if (mode != RECORD)
+        return;
+
+    std::string rec;
+    rec += (char)type;
+    put_varint(rec, instret - last_instret);
+    put_varint(rec, cycles - last_cycles);
+    if (type == EV_BUS_STORE || type == EV_SIGNAL)
+    {
+        put_varint(rec, addr);
+        put_varint(rec, value);
+    }
+    else if (type == EV_INPUT)
+    {
+        put_varint(rec, data.size());
+        rec += data;
+    }
+    std::fwrite(rec.data(), 1, rec.size(), file);
+
+    last_instret = instret;
+    last_cycles = cycles;
+}
+
+void Stimulus::bus_store(RISCV &cpu, Bus &bus, uint32_t addr, uint32_t value)
+{
+    write_event(cpu, EV_BUS_STORE, addr, value, std::string());
+    bus.store(addr, value);
+}
+
+void Stimulus::drive_signal(RISCV &cpu, Bus &bus, int index, uint8_t level)
+{
+    write_event(cpu, EV_SIGNAL, (uint32_t)index, level, std::string());
+    if (Signal *s = bus.get_signal(index))
+        s->set(level);
+}
+
+void Stimulus::quit(RISCV &cpu)
+{
+    write_event(cpu, EV_QUIT, 0, 0, std::string());
+    cpu.stop();
+}
+
+void Stimulus::record_input(RISCV &cpu, const std::string &data)
+{
+    write_event(cpu, EV_INPUT, 0, 0, data);
+}
+
+void Stimulus::rewind(uint64_t from, uint64_t to)
+{
+    if (from > frontier)
+        frontier = from;
+    if (mode == REPLAY)
+        return;
+
+    next = 0;
+    while (next < events.size() && events[next].instret < to)
+        next++;
+}
+
+bool Stimulus::is_rerun(const RISCV &cpu) const
+{
+    return cpu.get_instret() < frontier;
+}
+
+void Stimulus::rerun_inputs(const Stimulus &source, uint64_t from, uint64_t to)
+{
+    mode = REPLAY;
+    events.clear();
+    for (size_t i = 0; i < source.events.size(); i++)
+    {
+        const Event &ev = source.events[i];
+        if (ev.type == EV_INPUT && ev.instret >= from && ev.instret < to)
+            events.push_back(ev);
+    }
+    next = 0;
+    frontier = UINT64_MAX;
+    stamp_cycles = false;
+}
+
+std::string Stimulus::replay_input(RISCV &cpu)
+{
+    if (next >= events.size() || events[next].type != EV_INPUT)
+        throw std::runtime_error("Replay diverged: program reads input the recording does not have");
+    const Event &ev = events[next++];
+    check_stamp(cpu, ev);
+    return ev.data;
+}
+
+void Stimulus::finish(RISCV &cpu)
+{
+    if (mode != RECORD || !file)
+        return;
+    write_event(cpu, EV_END, 0, 0, std::string());
+    std::fclose(file);
+    file = nullptr;
+}
+
+void Stimulus::check_stamp(RISCV &cpu, const Event &ev) const
+{
+    if (cpu.get_instret() != ev.instret || (stamp_cycles && cpu.get_cycles() != ev.cycles))
+    {
+        std::ostringstream msg;
+        msg << "Replay diverged: event recorded at instret " << ev.instret << ", cycle " << ev.cycles
+            << " but reached at instret " << cpu.get_instret() << ", cycle " << cpu.get_cycles();
+        throw std::runtime_error(msg.str());
+    }
+}
+
+// Every step retires exactly one instruction, so a stamp is reached by
+// running the difference in instret
+void Stimulus::run_to(RISCV &cpu, const Runner &run, uint64_t instret)
+{
+    while (cpu.is_running() && cpu.get_instret() < instret)
+        run(instret - cpu.get_instret());
+}
+
+void Stimulus::replay(RISCV &cpu, Bus &bus, const Runner &run)
+{
+    while (cpu.is_running())
+    {
+        uint64_t until = replay_advance(cpu, bus);
+        if (!cpu.is_running())
+            break;
+        if (until == UINT64_MAX)
+            run(FREE_RUN_STEPS);
+        else
+            run_to(cpu, run, until);
+    }
+    replay_finish(cpu);
+}
+
+uint64_t Stimulus::replay_advance(RISCV &cpu, Bus &bus)
+{
+    if (input_pending != SIZE_MAX)
+    {
+        // The instruction at the stamp was the syscall that takes it (replay_input)
+        if (next == input_pending)
+            throw std::runtime_error("Replay diverged: recorded input was not read at its stamp");
+        input_pending = SIZE_MAX;
+    }
+
+    while (next < events.size())
+    {
+        const Event &ev = events[next];
+        if (cpu.get_instret() < ev.instret)
+            return ev.instret;
+
+        if (ev.type == EV_INPUT)
+        {
+            input_pending = next;
+            return ev.instret + 1;
+        }
+
+        check_stamp(cpu, ev);
+        next++;
+
+        switch (ev.type)
+        {
+        case EV_BUS_STORE:
+            bus.store(ev.addr, ev.value);
+            break;
+        case EV_SIGNAL:
+            if (Signal *s = bus.get_signal((int)ev.addr))
+                s->set((uint8_t)ev.value);
+            break;
+        case EV_QUIT:
+            cpu.stop();
+            return UINT64_MAX;
+        default: // EV_END: the recorded program stopped here too
+            cpu.stop();
+            return UINT64_MAX;
+        }
+    }
+    return UINT64_MAX;
+}
+
+void Stimulus::replay_finish(RISCV &cpu)
+{
+    // The recording ends with the stamp at which the program stopped
+    if (next < events.size() && events[next].type == EV_END)
+        check_stamp(cpu, events[next++]);
+    else if (next < events.size())
+        throw std::runtime_error("Replay diverged: program stopped before all recorded inputs were applied");
+}
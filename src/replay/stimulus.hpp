@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+class RISCV;
+class Bus;
+
+// Record/replay of everything that enters the machine from outside.
+//
+// External inputs are host writes to peripheral registers (the button),
+// levels driven onto bus signals (UART RX and other wires), data returned
+// by the stdin syscalls, and the user quitting. Each is stamped with the
+// retired-instruction count and cycle count at which it took effect.
+// Replaying runs the core exactly to each stamp and applies the input
+// there, so a replay is bit-exact and needs no terminal; any difference in
+// the stamps means the run diverged and is reported as an error.
+//
+// Log layout: STIMULUS_MAGIC, then per event a type byte, varint deltas of
+// instret and cycles, and a type-specific payload (see stimulus.cpp).
+class Stimulus
+{
+public:
+    enum Mode
+    {
+        OFF,
+        RECORD,
+        REPLAY
+    };
+
+    // Advances the program by up to n instructions (RISCV::run_for or the
+    // sampler's), returning how many ran
+    typedef std::function<uint64_t(uint64_t)> Runner;
+
+    Stimulus() = default;
+    ~Stimulus();
+
+    bool open_record(const std::string &path);
+    bool open_replay(const std::string &path); // Reads the whole log
+    void open_replay_empty();                  // No inputs at all; reading stdin diverges
+
+    Mode get_mode() const { return mode; }
+
+    // Host-side inputs while recording (also applied directly when OFF)
+    void bus_store(RISCV &cpu, Bus &bus, uint32_t addr, uint32_t value);
+    void drive_signal(RISCV &cpu, Bus &bus, int index, uint8_t level);
+    void quit(RISCV &cpu);
+
+    // Stdin syscalls: while recording, log what the terminal delivered;
+    // while replaying, return the recorded data instead of reading stdin
+    void record_input(RISCV &cpu, const std::string &data);
+    std::string replay_input(RISCV &cpu);
+
+    // Replay driver: runs the CPU, applying recorded inputs at their
+    // stamps, until the program stops. Throws std::runtime_error on
+    // divergence.
+    void replay(RISCV &cpu, Bus &bus, const Runner &run);
+
+    // The same replay one stretch at a time, for drivers that run several
+    // machines side by side (LockstepGroup): applies the inputs due at the
+    // CPU's instret and returns the instret to run it to before calling
+    // again (UINT64_MAX: none pending). Once the CPU has stopped,
+    // replay_finish checks that the recording ended there too.
+    uint64_t replay_advance(RISCV &cpu, Bus &bus);
+    void replay_finish(RISCV &cpu);
+
+    // Closes the log with the final instret/cycles of the run
+    void finish(RISCV &cpu);
+
+    // Time travel (see TimeTravel): the machine was restored from instret
+    // `from` back to `to`. Inputs already taken after `to` are served
+    // again from memory instead of the terminal, and output up to the
+    // furthest point reached is not repeated.
+    void rewind(uint64_t from, uint64_t to);
+    bool replaying_input() const { return mode == REPLAY || next < events.size(); }
+    bool is_rerun(const RISCV &cpu) const;
+
+    // Interval simulation (see IntervalSimulator): serve the inputs
+    // `source` took between instret `from` and `to` again, matched by
+    // instret only since the timing differs, and show no output
+    void rerun_inputs(const Stimulus &source, uint64_t from, uint64_t to);
+
+private:
+    enum EventType : uint8_t
+    {
+        EV_BUS_STORE = 1,
+        EV_SIGNAL = 2,
+        EV_INPUT = 3,
+        EV_QUIT = 4,
+        EV_END = 5,
+    };
+
+    struct Event
+    {
+        EventType type;
+        uint64_t instret;
+        uint64_t cycles;
+        uint32_t addr;  // Bus address or signal index
+        uint32_t value; // Stored value or signal level
+        std::string data;
+    };
+
+    void write_event(RISCV &cpu, EventType type, uint32_t addr, uint32_t value, const std::string &data);
+    void run_to(RISCV &cpu, const Runner &run, uint64_t instret);
+    void check_stamp(RISCV &cpu, const Event &ev) const;
+
+    Mode mode = OFF;
+    std::FILE *file = nullptr;
+    uint64_t last_instret = 0;
+    uint64_t last_cycles = 0;
+
+    std::vector<Event> events; // Replay log, or inputs taken so far
+    size_t next = 0;
+    size_t input_pending = SIZE_MAX; // Input event whose syscall replay_advance let run
+    uint64_t frontier = 0; // Furthest instret reached before a rewind
+    bool stamp_cycles = true; // Cycle stamps must match too
+};
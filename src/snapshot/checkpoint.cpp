@@ -0,0 +1,285 @@
+#include "checkpoint.hpp"
+#include "compress.hpp"
+#include "state.hpp"
+#include "../cpu/riscv.hpp"
+#include "../peripherals/bus.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Layout: magic, ram size, page count, blob count, state size, cycles,
+// instret, CPU/bus state, page table {page, blob}, blob table {offset,
+// size}, blob data
+static const char CHECKPOINT_MAGIC[8] = {'R', 'V', 'C', 'K', 'P', 'T', '1', 0};
+static const uint32_t NO_BLOB = 0xFFFFFFFF;
+
+static uint64_t fnv1a(const uint8_t *data, size_t size)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Eight bytes at a time: most of a large RAM is zero and every
+// checkpoint scans all of it
+static bool all_zero(const uint8_t *data, size_t size)
+{
+    size_t i = 0;
+    uint64_t acc = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        acc |= word;
+        if ((i & 511) == 504 && acc)
+            return false;
+    }
+    for (; i < size; i++)
+        acc |= data[i];
+    return acc == 0;
+}
+
+static uint32_t page_bytes(uint32_t ram_size, uint32_t page)
+{
+    uint64_t start = (uint64_t)page * RISCV::PAGE_SIZE;
+    return (uint32_t)(ram_size - start < RISCV::PAGE_SIZE ? ram_size - start : RISCV::PAGE_SIZE);
+}
+
+void encode_checkpoint(RISCV &cpu, Bus &bus, std::vector<uint8_t> &out, CheckpointInfo &info)
+{
+    cpu.page_in_all();
+    const uint8_t *ram = cpu.get_ram();
+    uint32_t ram_size = cpu.get_ram_size();
+    uint32_t page_count = (ram_size + RISCV::PAGE_SIZE - 1) / RISCV::PAGE_SIZE;
+
+    std::vector<uint8_t> state;
+    StateWriter sw(state);
+    cpu.save_state(sw);
+    bus.save_state(sw);
+
+    // Unique non-zero pages, each compressed once
+    std::vector<uint32_t> table;                // page, blob pairs
+    std::vector<uint32_t> blob_page;            // Page each blob was taken from
+    std::vector<std::vector<uint8_t>> payloads; // Compressed (or raw) blob data
+    std::unordered_map<uint64_t, std::vector<uint32_t>> by_hash;
+    for (uint32_t page = 0; page < page_count; page++)
+    {
+        const uint8_t *p = ram + (uint64_t)page * RISCV::PAGE_SIZE;
+        uint32_t bytes = page_bytes(ram_size, page);
+        if (all_zero(p, bytes))
+            continue;
+
+        std::vector<uint32_t> &same = by_hash[fnv1a(p, bytes)];
+        uint32_t blob = NO_BLOB;
+        for (size_t i = 0; i < same.size() && blob == NO_BLOB; i++)
+        {
+            uint32_t other = blob_page[same[i]];
+            if (page_bytes(ram_size, other) == bytes && std::memcmp(ram + (uint64_t)other * RISCV::PAGE_SIZE, p, bytes) == 0)
+                blob = same[i];
+        }
+        if (blob == NO_BLOB)
+        {
+            blob = (uint32_t)payloads.size();
+            same.push_back(blob);
+            blob_page.push_back(page);
+            std::vector<uint8_t> packed = lz_compress(p, bytes);
+            if (packed.size() >= bytes)
+                packed.assign(p, p + bytes);
+            payloads.push_back(std::move(packed));
+        }
+        table.push_back(page);
+        table.push_back(blob);
+    }
+
+    out.clear();
+    StateWriter w(out);
+    w.put_bytes(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    w.put(ram_size);
+    w.put((uint32_t)(table.size() / 2));
+    w.put((uint32_t)payloads.size());
+    w.put((uint32_t)state.size());
+    w.put(cpu.get_cycles());
+    w.put(cpu.get_instret());
+    w.put_bytes(state.data(), state.size());
+    w.put_bytes(table.data(), table.size() * sizeof(uint32_t));
+
+    uint64_t offset = out.size() + payloads.size() * (sizeof(uint64_t) + sizeof(uint32_t));
+    for (size_t i = 0; i < payloads.size(); i++)
+    {
+        w.put(offset);
+        w.put((uint32_t)payloads[i].size());
+        offset += payloads[i].size();
+    }
+    for (size_t i = 0; i < payloads.size(); i++)
+        w.put_bytes(payloads[i].data(), payloads[i].size());
+
+    info.cycles = cpu.get_cycles();
+    info.instret = cpu.get_instret();
+    info.pages = (uint32_t)(table.size() / 2);
+    info.unique_pages = (uint32_t)payloads.size();
+    info.file_size = out.size();
+}
+
+bool save_checkpoint(const std::string &path, RISCV &cpu, Bus &bus, CheckpointInfo &info)
+{
+    std::vector<uint8_t> image;
+    encode_checkpoint(cpu, bus, image, info);
+
+    std::string tmp = path + ".tmp";
+    std::FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = std::fwrite(image.data(), 1, image.size(), f) == image.size();
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+CheckpointImage::~CheckpointImage()
+{
+#ifndef _WIN32
+    if (data && buffer.empty())
+        munmap((void *)data, size);
+#endif
+}
+
+bool CheckpointImage::open(const std::string &path)
+{
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    data = (const uint8_t *)map;
+    size = (size_t)st.st_size;
+#else
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in)
+        return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string contents = ss.str();
+    buffer.assign(contents.begin(), contents.end());
+    data = buffer.data();
+    size = buffer.size();
+#endif
+
+    parse("'" + path + "'");
+    return true;
+}
+
+void CheckpointImage::open_buffer(std::vector<uint8_t> contents)
+{
+    buffer = std::move(contents);
+    data = buffer.data();
+    size = buffer.size();
+    parse("Image");
+}
+
+void CheckpointImage::parse(const std::string &name)
+{
+    StateReader r(data, size);
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    r.get_bytes(magic, sizeof(magic));
+    if (std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+        throw std::runtime_error(name + " is not a checkpoint");
+
+    uint32_t page_count, blob_count;
+    r.get(ram_size);
+    r.get(page_count);
+    r.get(blob_count);
+    r.get(state_size);
+    r.get(info.cycles);
+    r.get(info.instret);
+
+    state = data + r.position();
+    r.skip(state_size);
+
+    uint32_t ram_pages = (ram_size + RISCV::PAGE_SIZE - 1) / RISCV::PAGE_SIZE;
+    page_blob.assign(ram_pages, NO_BLOB);
+    for (uint32_t i = 0; i < page_count; i++)
+    {
+        uint32_t page, blob;
+        r.get(page);
+        r.get(blob);
+        if (page >= ram_pages || blob >= blob_count)
+            throw std::runtime_error("Corrupt checkpoint page table");
+        page_blob[page] = blob;
+    }
+
+    blobs.resize(blob_count);
+    for (uint32_t i = 0; i < blob_count; i++)
+    {
+        r.get(blobs[i].offset);
+        r.get(blobs[i].size);
+        if (blobs[i].offset > size || blobs[i].size > size - blobs[i].offset)
+            throw std::runtime_error("Corrupt checkpoint blob table");
+    }
+
+    info.pages = page_count;
+    info.unique_pages = blob_count;
+    info.file_size = size;
+}
+
+void CheckpointImage::restore(RISCV &cpu, Bus &bus)
+{
+    if (cpu.get_ram_size() != ram_size)
+    {
+        std::ostringstream msg;
+        msg << "Checkpoint has " << ram_size << " bytes of RAM, the machine " << cpu.get_ram_size();
+        throw std::runtime_error(msg.str());
+    }
+
+    StateReader r(state, state_size);
+    cpu.load_state(r);
+    bus.load_state(r);
+    if (!r.at_end())
+        throw std::runtime_error("Checkpoint was written by a different emulator build");
+
+    cpu.set_page_loader(this);
+}
+
+void CheckpointImage::load_page(RISCV &cpu, uint32_t page)
+{
+    uint8_t *dst = cpu.get_ram() + (uint64_t)page * RISCV::PAGE_SIZE;
+    uint32_t bytes = page_bytes(ram_size, page);
+    uint32_t blob = page < page_blob.size() ? page_blob[page] : NO_BLOB;
+    if (blob == NO_BLOB)
+    {
+        std::memset(dst, 0, bytes);
+        return;
+    }
+
+    const Blob &b = blobs[blob];
+    if (b.size == bytes)
+        std::memcpy(dst, data + b.offset, bytes);
+    else if (!lz_decompress(data + b.offset, b.size, dst, bytes))
+        throw std::runtime_error("Corrupt checkpoint page");
+}
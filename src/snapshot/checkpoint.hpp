@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../cpu/observer.hpp"
+
+class RISCV;
+class Bus;
+
+// What a checkpoint holds, for messages
+struct CheckpointInfo
+{
+    uint64_t cycles = 0;
+    uint64_t instret = 0;
+    uint32_t pages = 0;        // Non-zero RAM pages
+    uint32_t unique_pages = 0; // After deduplication
+    uint64_t file_size = 0;
+};
+
+// Full machine state on disk: registers and CSRs, timing state, the bus
+// with GPIO pin blocks and the UART transmit shift state, and RAM. Only
+// non-zero pages are stored, identical pages once (by hash), each
+// LZ-compressed (compress.hpp). The file is written next to `path` and
+// renamed over it, so an interrupted save keeps the previous checkpoint.
+//
+// A checkpoint resumes in any process running the same emulator build.
+// False if the file cannot be written.
+bool save_checkpoint(const std::string &path, RISCV &cpu, Bus &bus, CheckpointInfo &info);
+
+// The same image in memory (file_size is its size)
+void encode_checkpoint(RISCV &cpu, Bus &bus, std::vector<uint8_t> &out, CheckpointInfo &info);
+
+// A checkpoint file mapped into memory. restore() sets the CPU and bus
+// state right away; RAM pages are decompressed from the mapping on first
+// access (RISCV::set_page_loader), so the image must outlive the run.
+class CheckpointImage : public PageLoader
+{
+public:
+    CheckpointImage() = default;
+    ~CheckpointImage();
+
+    // False if the file cannot be read; throws std::runtime_error if it
+    // is not a valid checkpoint
+    bool open(const std::string &path);
+    void open_buffer(std::vector<uint8_t> contents); // From encode_checkpoint()
+    void restore(RISCV &cpu, Bus &bus);
+    const CheckpointInfo &get_info() const { return info; }
+
+    void load_page(RISCV &cpu, uint32_t page) override;
+
+private:
+    void parse(const std::string &name);
+
+    struct Blob
+    {
+        uint64_t offset;
+        uint32_t size; // Equal to the page size when stored uncompressed
+    };
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    std::vector<uint8_t> buffer; // In-memory image, or file contents where mmap is unavailable
+
+    CheckpointInfo info;
+    uint32_t ram_size = 0;
+    const uint8_t *state = nullptr;
+    uint32_t state_size = 0;
+    std::vector<Blob> blobs;
+    std::vector<uint32_t> page_blob; // Per RAM page; NO_BLOB for zero pages
+};
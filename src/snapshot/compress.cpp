@@ -0,0 +1,114 @@
+#include "compress.hpp"
+#include <cstring>
+
+static const size_t MIN_MATCH = 4;
+static const uint32_t HASH_BITS = 12;
+
+static void put_length(std::vector<uint8_t> &out, size_t extra)
+{
+    while (extra >= 255)
+    {
+        out.push_back(255);
+        extra -= 255;
+    }
+    out.push_back((uint8_t)extra);
+}
+
+static void put_sequence(std::vector<uint8_t> &out, const uint8_t *literals, size_t count, size_t offset, size_t match)
+{
+    size_t len = match ? match - MIN_MATCH : 0;
+    out.push_back((uint8_t)(((count < 15 ? count : 15) << 4) | (len < 15 ? len : 15)));
+    if (count >= 15)
+        put_length(out, count - 15);
+    out.insert(out.end(), literals, literals + count);
+    if (!match)
+        return;
+    out.push_back(offset & 0xFF);
+    out.push_back((offset >> 8) & 0xFF);
+    if (len >= 15)
+        put_length(out, len - 15);
+}
+
+std::vector<uint8_t> lz_compress(const uint8_t *data, size_t size)
+{
+    std::vector<uint8_t> out;
+    std::vector<uint32_t> table(1u << HASH_BITS, 0); // position + 1
+    size_t anchor = 0;
+    size_t i = 0;
+
+    while (i + MIN_MATCH <= size)
+    {
+        uint32_t seq;
+        std::memcpy(&seq, data + i, sizeof(seq));
+        uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)(i + 1);
+
+        if (candidate && i - (candidate - 1) <= 0xFFFF && std::memcmp(data + candidate - 1, data + i, MIN_MATCH) == 0)
+        {
+            size_t from = candidate - 1;
+            size_t len = MIN_MATCH;
+            while (i + len < size && data[from + len] == data[i + len])
+                len++;
+            put_sequence(out, data + anchor, i - anchor, i - from, len);
+            i += len;
+            anchor = i;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    put_sequence(out, data + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+static bool get_length(const uint8_t *in, size_t in_size, size_t &pos, size_t &value)
+{
+    uint8_t byte;
+    do
+    {
+        if (pos >= in_size)
+            return false;
+        byte = in[pos++];
+        value += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lz_decompress(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < in_size)
+    {
+        uint8_t token = in[ip++];
+        size_t count = token >> 4;
+        if (count == 15 && !get_length(in, in_size, ip, count))
+            return false;
+        if (count > in_size - ip || count > out_size - op)
+            return false;
+        if (count)
+            std::memcpy(out + op, in + ip, count);
+        ip += count;
+        op += count;
+        if (ip == in_size)
+            break; // Final literal-only sequence
+
+        if (in_size - ip < 2)
+            return false;
+        size_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        size_t len = token & 0x0F;
+        if (len == 15 && !get_length(in, in_size, ip, len))
+            return false;
+        len += MIN_MATCH;
+        if (offset == 0 || offset > op || len > out_size - op)
+            return false;
+
+        // Byte by byte: a match may overlap the bytes it produces
+        for (size_t k = 0; k < len; k++, op++)
+            out[op] = out[op - offset];
+    }
+    return op == out_size;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Small LZ77 codec for checkpoint pages, LZ4-style sequences: a token
+// byte (literal count << 4 | match length - 4), extra length bytes for
+// counts of 15 and more, the literals, then a 16-bit match offset. The
+// stream ends with a literal-only sequence.
+std::vector<uint8_t> lz_compress(const uint8_t *data, size_t size);
+
+// False if the input is malformed or does not expand to exactly out_size
+bool lz_decompress(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size);
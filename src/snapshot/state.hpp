@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Flat byte stream for machine state (snapshots, checkpoints). Each
+// component writes its fields with save_state() and reads them back in
+// the same order with load_state(); the stream carries no field names, so
+// both sides must come from the same build.
+class StateWriter
+{
+public:
+    explicit StateWriter(std::vector<uint8_t> &out) : out(out) {}
+
+    void put_bytes(const void *data, size_t size)
+    {
+        const uint8_t *p = (const uint8_t *)data;
+        out.insert(out.end(), p, p + size);
+    }
+
+    // Plain values and trivially copyable structs
+    template <typename T>
+    void put(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "state fields must be trivially copyable");
+        put_bytes(&value, sizeof(T));
+    }
+
+private:
+    std::vector<uint8_t> &out;
+};
+
+class StateReader
+{
+public:
+    StateReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+    explicit StateReader(const std::vector<uint8_t> &in) : data(in.data()), size(in.size()) {}
+
+    void get_bytes(void *dst, size_t n)
+    {
+        if (n > size - pos)
+            throw std::runtime_error("Truncated machine state");
+        std::memcpy(dst, data + pos, n);
+        pos += n;
+    }
+
+    template <typename T>
+    void get(T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "state fields must be trivially copyable");
+        get_bytes(&value, sizeof(T));
+    }
+
+    void skip(size_t n)
+    {
+        if (n > size - pos)
+            throw std::runtime_error("Truncated machine state");
+        pos += n;
+    }
+
+    size_t position() const { return pos; }
+    bool at_end() const { return pos == size; }
+
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t pos = 0;
+};
@@ -0,0 +1,651 @@
+// rvaot - translate a RISC-V program ahead of time into C++ for rvemu --aot
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "aot/aot_abi.hpp"
+#include "cpu/disasm.hpp"
+#include "debug/symbols.hpp"
+
+static const uint32_t MAX_BLOCK = 64; // Instructions per translated block
+
+struct Segment
+{
+    uint32_t addr;
+    std::vector<uint8_t> bytes;
+};
+
+// Code to translate: loaded bytes, and where an ELF says code may be
+struct Program
+{
+    std::vector<Segment> segments;
+    std::vector<std::pair<uint32_t, uint32_t>> code; // Executable [begin, end); empty for anywhere
+
+    bool fetch(uint32_t addr, uint32_t &instr) const
+    {
+        if (addr & 3)
+            return false;
+        if (!code.empty())
+        {
+            bool inside = false;
+            for (size_t i = 0; i < code.size() && !inside; i++)
+                inside = addr >= code[i].first && addr + 4 <= code[i].second;
+            if (!inside)
+                return false;
+        }
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            const Segment &seg = segments[i];
+            if (addr >= seg.addr && addr - seg.addr + 4 <= seg.bytes.size())
+            {
+                const uint8_t *p = &seg.bytes[addr - seg.addr];
+                instr = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Static cycle cost not yet added to the counter: SIMPLE and FUNCTIONAL
+struct Cost
+{
+    uint32_t simple = 0;
+    uint32_t functional = 0;
+};
+
+static void print_usage(const char *prog)
+{
+    std::cout << "Usage: " << prog << " <program.bin|program.elf> [options]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  -o <file.cpp>          Output (default: <program>.aot.cpp)" << std::endl;
+    std::cout << "  --base <addr>          Load address of a .bin (default: 0x2000)" << std::endl;
+    std::cout << "  --entry <addr>         Entry point (default: ELF entry or the base)" << std::endl;
+    std::cout << "  --symbols <file.elf>   Start blocks at every function and keep to its code" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Build the output with: g++ -O2 -shared -fPIC -Isrc/aot <file.cpp> -o <file.so>" << std::endl;
+}
+
+static std::vector<uint8_t> read_file(const std::string &path, bool &ok)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    ok = (bool)file;
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static uint32_t rd32(const std::vector<uint8_t> &d, size_t off)
+{
+    return d[off] | (d[off + 1] << 8) | (d[off + 2] << 16) | ((uint32_t)d[off + 3] << 24);
+}
+
+static uint16_t rd16(const std::vector<uint8_t> &d, size_t off)
+{
+    return d[off] | (d[off + 1] << 8);
+}
+
+static bool is_elf(const std::vector<uint8_t> &d)
+{
+    return d.size() >= 52 && std::memcmp(d.data(), "\x7f" "ELF", 4) == 0 && d[4] == 1 && d[5] == 1;
+}
+
+// Allocated executable sections of an ELF32 image; their contents go to
+// segments if given
+static bool elf_code(const std::vector<uint8_t> &d, Program &program, std::vector<Segment> *segments)
+{
+    uint32_t shoff = rd32(d, 0x20);
+    uint16_t shentsize = rd16(d, 0x2E);
+    uint16_t shnum = rd16(d, 0x30);
+    if (shentsize < 40 || shoff + (size_t)shnum * shentsize > d.size())
+        return false;
+
+    for (uint16_t i = 0; i < shnum; i++)
+    {
+        size_t sh = shoff + (size_t)i * shentsize;
+        uint32_t type = rd32(d, sh + 4);
+        uint32_t flags = rd32(d, sh + 8);
+        uint32_t addr = rd32(d, sh + 12);
+        uint32_t offset = rd32(d, sh + 16);
+        uint32_t size = rd32(d, sh + 20);
+        if (type != 1 || (flags & 0x6) != 0x6) // SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR
+            continue;
+        program.code.push_back(std::make_pair(addr, addr + size));
+        if (segments && offset + (size_t)size <= d.size())
+        {
+            Segment seg;
+            seg.addr = addr;
+            seg.bytes.assign(d.begin() + offset, d.begin() + offset + size);
+            segments->push_back(seg);
+        }
+    }
+    return !program.code.empty();
+}
+
+static bool translatable(uint32_t instr, InsnClass c)
+{
+    uint32_t funct7 = instr >> 25;
+    switch (c)
+    {
+    case INSN_ADD:
+    case INSN_SRL:
+        // classify() accepts any funct7 here, the core only 0x00
+        return funct7 == 0x00;
+    case INSN_UNKNOWN:
+    case INSN_ECALL:
+    case INSN_EBREAK:
+    case INSN_MRET:
+    case INSN_SRET:
+    case INSN_SFENCE_VMA:
+    case INSN_WFI:
+    case INSN_CSRRW:
+    case INSN_CSRRS:
+    case INSN_CSRRC:
+    case INSN_CSRRWI:
+    case INSN_CSRRSI:
+    case INSN_CSRRCI:
+        return false; // Left to the interpreter
+    default:
+        return true;
+    }
+}
+
+static bool is_branch(InsnClass c)
+{
+    return c >= INSN_BEQ && c <= INSN_BGEU;
+}
+
+static bool is_system(InsnClass c)
+{
+    return c >= INSN_ECALL && c <= INSN_CSRRCI;
+}
+
+static int32_t sext(uint32_t value, int bits)
+{
+    return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+static uint32_t branch_target(uint32_t pc, uint32_t instr)
+{
+    uint32_t imm = ((instr >> 8) & 0xF) << 1 | ((instr >> 25) & 0x3F) << 5 |
+                   ((instr >> 7) & 0x1) << 11 | ((instr >> 31) & 0x1) << 12;
+    return pc + sext(imm, 13);
+}
+
+static uint32_t jal_target(uint32_t pc, uint32_t instr)
+{
+    uint32_t imm = ((instr >> 21) & 0x3FF) << 1 | ((instr >> 20) & 0x1) << 11 |
+                   ((instr >> 12) & 0xFF) << 12 | ((instr >> 31) & 0x1) << 20;
+    return pc + sext(imm, 21);
+}
+
+// Recursive traversal from the roots: blocks end at branches and jumps,
+// before anything left to the interpreter, or after MAX_BLOCK instructions.
+// Fall-through and return addresses become roots of their own, and so do
+// the targets of JALRs whose base the instruction before set (call, tail).
+static std::map<uint32_t, std::vector<uint32_t>> discover(const Program &program, const std::set<uint32_t> &roots)
+{
+    std::map<uint32_t, std::vector<uint32_t>> blocks;
+    std::set<uint32_t> seen(roots.begin(), roots.end());
+    std::vector<uint32_t> work(roots.begin(), roots.end());
+
+    while (!work.empty())
+    {
+        uint32_t start = work.back();
+        work.pop_back();
+
+        std::vector<uint32_t> instrs;
+        std::vector<uint32_t> next;
+        uint32_t pc = start;
+        uint32_t instr;
+        uint32_t upper_reg = 0, upper_value = 0; // AUIPC/LUI just before: call and tail targets
+        while (program.fetch(pc, instr))
+        {
+            InsnClass c = classify(instr);
+            uint32_t rd = (instr >> 7) & 0x1F;
+            uint32_t rs1 = (instr >> 15) & 0x1F;
+            if (!translatable(instr, c))
+            {
+                // ECALL, CSR accesses and the like come back to pc + 4
+                if (is_system(c) && c != INSN_MRET && c != INSN_SRET)
+                    next.push_back(pc + 4);
+                break;
+            }
+            instrs.push_back(instr);
+            if (is_branch(c))
+            {
+                next.push_back(branch_target(pc, instr));
+                next.push_back(pc + 4);
+                break;
+            }
+            if (c == INSN_JAL || c == INSN_JALR)
+            {
+                if (c == INSN_JAL)
+                    next.push_back(jal_target(pc, instr));
+                else if (upper_reg && rs1 == upper_reg)
+                    next.push_back((upper_value + sext(instr >> 20, 12)) & ~1u);
+                if (rd != 0)
+                    next.push_back(pc + 4); // Return address of a call
+                break;
+            }
+            upper_reg = 0;
+            if (c == INSN_AUIPC || c == INSN_LUI)
+            {
+                upper_reg = rd;
+                upper_value = (c == INSN_AUIPC ? pc : 0) + (instr & 0xFFFFF000);
+            }
+            pc += 4;
+            if (instrs.size() == MAX_BLOCK)
+            {
+                next.push_back(pc);
+                break;
+            }
+        }
+
+        if (!instrs.empty())
+            blocks[start] = instrs;
+        for (size_t i = 0; i < next.size(); i++)
+        {
+            if (seen.insert(next[i]).second)
+                work.push_back(next[i]);
+        }
+    }
+    return blocks;
+}
+
+static std::string hex(uint32_t value)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "0x%xu", value);
+    return buf;
+}
+
+static std::string src(uint32_t r)
+{
+    return r ? "x[" + std::to_string(r) + "]" : std::string("0u");
+}
+
+static void flush(std::ostream &out, Cost &cost)
+{
+    if (cost.simple == cost.functional && cost.simple)
+        out << "    *cy += " << cost.simple << ";\n";
+    else if (cost.simple || cost.functional)
+        out << "    *cy += s ? " << cost.simple << " : " << cost.functional << ";\n";
+    cost = Cost();
+}
+
+static void end_block(std::ostream &out, Cost &cost, const std::string &next_pc, uint32_t retired)
+{
+    flush(out, cost);
+    out << "    c->next_pc = " << next_pc << ";\n";
+    out << "    return " << retired << ";\n";
+}
+
+// Value computed by an ALU or M-extension instruction, or empty
+static std::string alu_expr(InsnClass c, uint32_t instr, uint32_t pc)
+{
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+    std::string a = src(rs1), b = src(rs2);
+    std::string imm = hex((uint32_t)sext(instr >> 20, 12));
+    std::string shamt = std::to_string((instr >> 20) & 0x1F);
+
+    switch (c)
+    {
+    case INSN_LUI:
+        return hex(instr & 0xFFFFF000);
+    case INSN_AUIPC:
+        return hex(pc + (instr & 0xFFFFF000));
+    case INSN_ADDI:
+        return a + " + " + imm;
+    case INSN_SLTI:
+        return "((int32_t)" + a + " < (int32_t)" + imm + " ? 1u : 0u)";
+    case INSN_SLTIU:
+        return "(" + a + " < " + imm + " ? 1u : 0u)";
+    case INSN_XORI:
+        return a + " ^ " + imm;
+    case INSN_ORI:
+        return a + " | " + imm;
+    case INSN_ANDI:
+        return a + " & " + imm;
+    case INSN_SLLI:
+        return a + " << " + shamt;
+    case INSN_SRLI:
+        return a + " >> " + shamt;
+    case INSN_SRAI:
+        return "(uint32_t)((int32_t)" + a + " >> " + shamt + ")";
+    case INSN_ADD:
+        return a + " + " + b;
+    case INSN_SUB:
+        return a + " - " + b;
+    case INSN_SLL:
+        return a + " << (" + b + " & 31)";
+    case INSN_SLT:
+        return "((int32_t)" + a + " < (int32_t)" + b + " ? 1u : 0u)";
+    case INSN_SLTU:
+        return "(" + a + " < " + b + " ? 1u : 0u)";
+    case INSN_XOR:
+        return a + " ^ " + b;
+    case INSN_SRL:
+        return a + " >> (" + b + " & 31)";
+    case INSN_SRA:
+        return "(uint32_t)((int32_t)" + a + " >> (" + b + " & 31))";
+    case INSN_OR:
+        return a + " | " + b;
+    case INSN_AND:
+        return a + " & " + b;
+    case INSN_MUL:
+        return a + " * " + b;
+    case INSN_MULH:
+        return "(uint32_t)((uint64_t)((int64_t)(int32_t)" + a + " * (int64_t)(int32_t)" + b + ") >> 32)";
+    case INSN_MULHSU:
+        return "(uint32_t)((uint64_t)((int64_t)(int32_t)" + a + " * (int64_t)" + b + ") >> 32)";
+    case INSN_MULHU:
+        return "(uint32_t)(((uint64_t)" + a + " * " + b + ") >> 32)";
+    case INSN_DIV:
+        return "rv_div(" + a + ", " + b + ")";
+    case INSN_DIVU:
+        return "rv_divu(" + a + ", " + b + ")";
+    case INSN_REM:
+        return "rv_rem(" + a + ", " + b + ")";
+    case INSN_REMU:
+        return "rv_remu(" + a + ", " + b + ")";
+    default:
+        return "";
+    }
+}
+
+// Cycles of an instruction without a memory access, as the core's
+// SIMPLE timing charges them (fetch, base cycle and extra penalty)
+static uint32_t simple_cost(InsnClass c)
+{
+    if (c >= INSN_DIV && c <= INSN_REMU)
+        return 6;
+    if (c >= INSN_MUL && c <= INSN_MULHU)
+        return 4;
+    if (c == INSN_JAL || c == INSN_JALR || c == INSN_FENCE || c == INSN_FENCE_I)
+        return 3;
+    return 2;
+}
+
+static void emit_block(std::ostream &out, uint32_t start, const std::vector<uint32_t> &instrs,
+                       const SymbolTable &symbols)
+{
+    const Symbol *sym = symbols.lookup(start);
+    char name[32];
+    snprintf(name, sizeof(name), "b_%08x", start);
+    out << "\n";
+    if (sym && sym->addr == start)
+        out << "// <" << sym->name << ">\n";
+    out << "static uint32_t " << name << "(RvAotContext *c)\n{\n";
+    out << "    uint32_t *x = c->x;\n";
+    out << "    uint64_t *cy = c->cycles;\n";
+    out << "    const uint32_t s = c->simple;\n";
+    out << "    (void)x;\n";
+    out << "    (void)s;\n";
+
+    Cost cost;
+    uint32_t n = (uint32_t)instrs.size();
+    for (uint32_t k = 0; k < n; k++)
+    {
+        uint32_t pc = start + 4 * k;
+        uint32_t instr = instrs[k];
+        InsnClass c = classify(instr);
+        uint32_t rd = (instr >> 7) & 0x1F;
+        uint32_t rs1 = (instr >> 15) & 0x1F;
+        uint32_t rs2 = (instr >> 20) & 0x1F;
+        uint32_t funct3 = (instr >> 12) & 0x7;
+        char line[96];
+        snprintf(line, sizeof(line), "    // %08x: %s\n", pc, disassemble(instr, pc).c_str());
+        out << line;
+
+        if (c >= INSN_LB && c <= INSN_SW)
+        {
+            // The callback's timed access adds the memory cycle itself
+            bool load = c <= INSN_LHU;
+            std::string addr = src(rs1) + " + " + hex((uint32_t)sext(load ? instr >> 20 : ((instr >> 7) & 0x1F) | ((instr >> 25) << 5), 12));
+            cost.simple += 2;
+            flush(out, cost);
+            if (!load)
+                out << "    c->store(c, " << k << ", " << addr << ", " << src(rs2) << ", " << funct3 << ");\n";
+            else if (rd)
+                out << "    x[" << rd << "] = c->load(c, " << k << ", " << addr << ", " << funct3 << ");\n";
+            else
+                out << "    c->load(c, " << k << ", " << addr << ", " << funct3 << ");\n";
+            cost.simple += 2;
+            cost.functional += 1;
+            flush(out, cost);
+            if (k + 1 < n)
+                out << "    if (c->stop)\n    {\n        c->next_pc = " << hex(pc + 4) << ";\n        return " << k + 1
+                    << ";\n    }\n";
+            else
+                end_block(out, cost, hex(pc + 4), n);
+            continue;
+        }
+
+        cost.simple += simple_cost(c);
+        cost.functional += 1;
+
+        if (is_branch(c))
+        {
+            static const char *const ops[] = {"==", "!=", "<", ">=", "<", ">="};
+            int op = c - INSN_BEQ;
+            bool is_signed = c == INSN_BLT || c == INSN_BGE;
+            std::string cond = is_signed ? "(int32_t)" + src(rs1) + " " + ops[op] + " (int32_t)" + src(rs2)
+                                         : src(rs1) + " " + ops[op] + " " + src(rs2);
+            std::string target = hex(branch_target(pc, instr));
+            flush(out, cost);
+            out << "    if (" << cond << ")\n    {\n";
+            out << "        if (s)\n            *cy += 1;\n";
+            out << "        else\n            c->branch(c, " << hex(pc) << ", " << target << ");\n";
+            out << "        c->next_pc = " << target << ";\n        return " << n << ";\n    }\n";
+            out << "    if (!s)\n        c->branch(c, " << hex(pc) << ", " << hex(pc + 4) << ");\n";
+            end_block(out, cost, hex(pc + 4), n);
+        }
+        else if (c == INSN_JAL)
+        {
+            if (rd)
+                out << "    x[" << rd << "] = " << hex(pc + 4) << ";\n";
+            end_block(out, cost, hex(jal_target(pc, instr)), n);
+        }
+        else if (c == INSN_JALR)
+        {
+            out << "    const uint32_t target = (" << src(rs1) << " + " << hex((uint32_t)sext(instr >> 20, 12))
+                << ") & ~1u;\n";
+            if (rd)
+                out << "    x[" << rd << "] = " << hex(pc + 4) << ";\n";
+            end_block(out, cost, "target", n);
+        }
+        else
+        {
+            std::string expr = alu_expr(c, instr, pc);
+            if (rd && !expr.empty())
+                out << "    x[" << rd << "] = " << expr << ";\n";
+            if (k + 1 == n)
+                end_block(out, cost, hex(pc + 4), n);
+        }
+    }
+    out << "}\n";
+}
+
+static const char *const PRELUDE =
+    "#include <stdint.h>\n"
+    "#include \"aot_abi.hpp\"\n"
+    "\n"
+    "// Division as the core does it: no traps, RISC-V results for x/0 and overflow\n"
+    "static inline uint32_t rv_div(uint32_t a, uint32_t b)\n"
+    "{\n"
+    "    if (b == 0)\n"
+    "        return 0xFFFFFFFFu;\n"
+    "    if (a == 0x80000000u && b == 0xFFFFFFFFu)\n"
+    "        return a;\n"
+    "    return (uint32_t)((int32_t)a / (int32_t)b);\n"
+    "}\n"
+    "\n"
+    "static inline uint32_t rv_divu(uint32_t a, uint32_t b)\n"
+    "{\n"
+    "    return b ? a / b : 0xFFFFFFFFu;\n"
+    "}\n"
+    "\n"
+    "static inline uint32_t rv_rem(uint32_t a, uint32_t b)\n"
+    "{\n"
+    "    if (b == 0)\n"
+    "        return a;\n"
+    "    if (a == 0x80000000u && b == 0xFFFFFFFFu)\n"
+    "        return 0;\n"
+    "    return (uint32_t)((int32_t)a % (int32_t)b);\n"
+    "}\n"
+    "\n"
+    "static inline uint32_t rv_remu(uint32_t a, uint32_t b)\n"
+    "{\n"
+    "    return b ? a % b : a;\n"
+    "}\n";
+
+int main(int argc, char *argv[])
+{
+    std::string path, out_path, symbols_path;
+    uint32_t base = 0x2000;
+    uint32_t entry = 0;
+    bool has_entry = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            out_path = argv[++i];
+        else if (arg == "--base" && i + 1 < argc)
+            base = (uint32_t)std::stoul(argv[++i], nullptr, 0);
+        else if (arg == "--entry" && i + 1 < argc)
+        {
+            entry = (uint32_t)std::stoul(argv[++i], nullptr, 0);
+            has_entry = true;
+        }
+        else if (arg == "--symbols" && i + 1 < argc)
+            symbols_path = argv[++i];
+        else if (arg == "-h" || arg == "--help")
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+        else if (path.empty())
+            path = arg;
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (path.empty())
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    bool ok;
+    std::vector<uint8_t> data = read_file(path, ok);
+    if (!ok || data.empty())
+    {
+        std::cerr << "Error: Cannot read '" << path << "'" << std::endl;
+        return 1;
+    }
+
+    // An ELF brings its code sections, entry point and symbols; a .bin is
+    // code from base, limited to the --symbols ELF's code if there is one
+    Program program;
+    SymbolTable symbols;
+    if (is_elf(data))
+    {
+        if (!elf_code(data, program, &program.segments))
+        {
+            std::cerr << "Error: '" << path << "' has no code sections" << std::endl;
+            return 1;
+        }
+        if (!has_entry)
+            entry = rd32(data, 0x18);
+        if (symbols_path.empty())
+            symbols_path = path;
+    }
+    else
+    {
+        Segment seg;
+        seg.addr = base;
+        seg.bytes = data;
+        program.segments.push_back(seg);
+        if (!has_entry)
+            entry = base;
+        if (!symbols_path.empty())
+        {
+            std::vector<uint8_t> elf = read_file(symbols_path, ok);
+            if (!ok || !is_elf(elf) || !elf_code(elf, program, nullptr))
+                program.code.clear();
+        }
+    }
+    if (!symbols_path.empty() && !symbols.load(symbols_path))
+        std::cerr << "Warning: No symbols from '" << symbols_path << "'" << std::endl;
+
+    std::set<uint32_t> roots;
+    roots.insert(entry);
+    for (size_t i = 0; i < symbols.get_symbols().size(); i++)
+        roots.insert(symbols.get_symbols()[i].addr);
+
+    std::map<uint32_t, std::vector<uint32_t>> blocks = discover(program, roots);
+    if (blocks.empty())
+    {
+        std::cerr << "Error: No code found at entry point 0x" << std::hex << entry << std::endl;
+        return 1;
+    }
+
+    if (out_path.empty())
+    {
+        size_t slash = path.find_last_of('/');
+        size_t dot = path.find_last_of('.');
+        out_path = (dot != std::string::npos && (slash == std::string::npos || dot > slash) ? path.substr(0, dot) : path) +
+                   ".aot.cpp";
+    }
+    std::ofstream out(out_path.c_str());
+    if (!out)
+    {
+        std::cerr << "Error: Cannot write '" << out_path << "'" << std::endl;
+        return 1;
+    }
+
+    out << "// Translated by rvaot from " << path << "; load with rvemu --aot\n";
+    out << "// Build: g++ -O2 -shared -fPIC -I<rvemu>/src/aot " << out_path << " -o <name>.so\n";
+    out << PRELUDE;
+
+    std::map<uint32_t, uint32_t> words; // Every translated instruction, checked at load
+    size_t instructions = 0;
+    for (std::map<uint32_t, std::vector<uint32_t>>::const_iterator it = blocks.begin(); it != blocks.end(); ++it)
+    {
+        emit_block(out, it->first, it->second, symbols);
+        for (size_t k = 0; k < it->second.size(); k++)
+            words[it->first + 4 * (uint32_t)k] = it->second[k];
+        instructions += it->second.size();
+    }
+
+    char line[96];
+    out << "\nstatic const RvAotBlock blocks[] = {\n";
+    for (std::map<uint32_t, std::vector<uint32_t>>::const_iterator it = blocks.begin(); it != blocks.end(); ++it)
+    {
+        snprintf(line, sizeof(line), "    {0x%xu, %uu, b_%08x},\n", it->first, (unsigned)it->second.size(), it->first);
+        out << line;
+    }
+    out << "};\n\nstatic const RvAotWord words[] = {\n";
+    for (std::map<uint32_t, uint32_t>::const_iterator it = words.begin(); it != words.end(); ++it)
+    {
+        snprintf(line, sizeof(line), "    {0x%xu, 0x%08xu},\n", it->first, it->second);
+        out << line;
+    }
+    out << "};\n\n";
+    out << "extern \"C\" const RvAotImage " RVEMU_AOT_SYMBOL " = {RVEMU_AOT_VERSION, " << blocks.size() << ", blocks, "
+        << words.size() << ", words};\n";
+
+    std::cout << out_path << ": " << blocks.size() << " blocks, " << instructions << " instructions ("
+              << words.size() << " distinct)" << std::endl;
+    return 0;
+}
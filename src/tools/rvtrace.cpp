@@ -0,0 +1,153 @@
+// rvtrace - pretty-print a binary execution trace written by rvemu --trace
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "cpu/disasm.hpp"
+#include "debug/symbols.hpp"
+#include "trace/trace_format.hpp"
+
+static void print_usage(const char *prog)
+{
+    std::cout << "Usage: " << prog << " <trace file> [options]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --symbols <file.elf>   Label addresses with function names" << std::endl;
+    std::cout << "  --limit <n>            Stop after n records" << std::endl;
+}
+
+static void print_record(const TraceRecord &rec, const SymbolTable &symbols, uint32_t &last_func)
+{
+    char line[256];
+
+    if (rec.flags & TRACE_TRAP)
+    {
+        snprintf(line, sizeof(line), "%12llu  -- %s %u -> 0x%08x",
+                 (unsigned long long)rec.cycle, (rec.flags & TRACE_INTERRUPT) ? "interrupt" : "exception",
+                 rec.instr, rec.pc);
+        std::cout << line << std::endl;
+        last_func = 0xFFFFFFFF;
+        return;
+    }
+
+    // Function label whenever execution moves into another function
+    const Symbol *sym = symbols.lookup(rec.pc);
+    uint32_t func = sym ? sym->addr : 0xFFFFFFFF;
+    if (sym && func != last_func)
+        std::cout << "<" << sym->name << ">:" << std::endl;
+    last_func = func;
+
+    bool extra = rec.rd || (rec.flags & (TRACE_LOAD | TRACE_STORE));
+    int n = snprintf(line, sizeof(line), extra ? "%12llu  %08x  %08x  %-28s" : "%12llu  %08x  %08x  %s",
+                     (unsigned long long)rec.cycle, rec.pc, rec.instr, disassemble(rec.instr, rec.pc).c_str());
+    if (rec.rd)
+        n += snprintf(line + n, sizeof(line) - n, "  %s=0x%08x", reg_name(rec.rd), rec.rd_value);
+    if (rec.flags & (TRACE_LOAD | TRACE_STORE))
+    {
+        snprintf(line + n, sizeof(line) - n, "  %s%u [0x%08x] %s 0x%x",
+                 (rec.flags & TRACE_MMIO) ? "mmio " : "", (unsigned)rec.mem_size * 8, rec.mem_addr,
+                 (rec.flags & TRACE_LOAD) ? "->" : "<-", rec.mem_value);
+    }
+    std::cout << line << '\n';
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = nullptr;
+    std::string symbols_path;
+    uint64_t limit = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--symbols" && i + 1 < argc)
+            symbols_path = argv[++i];
+        else if (arg == "--limit" && i + 1 < argc)
+            limit = std::stoull(argv[++i]);
+        else if (arg == "-h" || arg == "--help")
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+        else if (!path)
+            path = argv[i];
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!path)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    SymbolTable symbols;
+    if (!symbols_path.empty() && !symbols.load(symbols_path))
+        std::cerr << "Warning: No symbols from '" << symbols_path << "'" << std::endl;
+
+    std::FILE *file = std::fopen(path, "rb");
+    if (!file)
+    {
+        std::cerr << "Error: Cannot open '" << path << "'" << std::endl;
+        return 1;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        std::cerr << "Error: '" << path << "' is not an rvemu trace" << std::endl;
+        std::fclose(file);
+        return 1;
+    }
+
+    // Stream the file in chunks; a record never exceeds MAX_ENCODED bytes,
+    // so decoding stops short of the chunk end until the file is exhausted
+    std::vector<uint8_t> buf(1 << 20);
+    size_t have = 0;
+    bool eof = false;
+    uint64_t count = 0;
+    uint32_t last_func = 0xFFFFFFFF;
+    TraceDecoder decoder;
+    TraceRecord rec;
+
+    try
+    {
+        while (!limit || count < limit)
+        {
+            if (!eof)
+            {
+                size_t got = std::fread(&buf[have], 1, buf.size() - have, file);
+                have += got;
+                eof = have < buf.size();
+            }
+
+            size_t pos = 0;
+            while (pos < have && (eof || have - pos >= TraceEncoder::MAX_ENCODED) && (!limit || count < limit))
+            {
+                pos += decoder.decode(&buf[pos], &buf[have], rec);
+                print_record(rec, symbols, last_func);
+                count++;
+            }
+
+            std::memmove(&buf[0], &buf[pos], have - pos);
+            have -= pos;
+            if (eof && have == 0)
+                break;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << " after " << count << " records" << std::endl;
+        std::fclose(file);
+        return 1;
+    }
+
+    std::fclose(file);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Lock-free single-producer/single-consumer ring of fixed-size records.
+//
+// Each side owns one index and only reads the other's; acquire/release
+// ordering on those two atomics is the only synchronisation. Both sides
+// also cache the other index so the shared cache line is only touched when
+// the ring looks full (producer) or empty (consumer).
+template <typename T>
+class SpscRing
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    // Producer side; false if the ring is full
+    bool push(const T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - cached_tail > mask)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h - cached_tail > mask)
+                return false;
+        }
+        slots[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; copies up to max items, returns how many
+    size_t pop(T *out, size_t max)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (cached_head == t)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (cached_head == t)
+                return 0;
+        }
+        size_t n = cached_head - t;
+        if (n > max)
+            n = max;
+        for (size_t i = 0; i < n; i++)
+            out[i] = slots[(t + i) & mask];
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    // Padding keeps producer and consumer state on separate cache lines
+    // (without alignas, which would need C++17 aligned new on the heap)
+    char pad0[64];
+    std::atomic<size_t> head{0};
+    size_t cached_tail = 0; // Producer's view of tail
+    char pad1[64];
+    std::atomic<size_t> tail{0};
+    size_t cached_head = 0; // Consumer's view of head
+    char pad2[64];
+};
@@ -0,0 +1,132 @@
+#include "trace_format.hpp"
+#include <stdexcept>
+
+// Header bits (low byte mirrors TraceRecord::flags)
+enum
+{
+    H_FLAGS = 0x1F,
+    H_RD = 1 << 5,
+    H_JUMP = 1 << 6,   // PC delta follows (else pc = previous + 4)
+    H_INSTR = 1 << 7,  // Instruction word follows (cache miss)
+    H_SIZE_SHIFT = 8,  // 2 bits: access width 1/2/4
+};
+
+static size_t put_varint(uint8_t *out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static uint64_t get_varint(const uint8_t *&in, const uint8_t *end)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (in >= end)
+            throw std::runtime_error("Truncated trace record");
+        uint8_t byte = *in++;
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return v;
+    }
+    throw std::runtime_error("Corrupt trace varint");
+}
+
+static uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+static uint32_t size_code(uint8_t size) { return size == 4 ? 2 : size == 2 ? 1 : 0; }
+
+size_t TraceEncoder::encode(const TraceRecord &rec, uint8_t *out)
+{
+    uint32_t slot = (rec.pc >> 2) & (CACHE_SLOTS - 1);
+    bool mem = rec.flags & (TRACE_LOAD | TRACE_STORE);
+
+    uint32_t header = rec.flags & H_FLAGS;
+    if (rec.rd)
+        header |= H_RD;
+    if (rec.pc != prev_pc + 4)
+        header |= H_JUMP;
+    if (cache[slot] != rec.instr)
+        header |= H_INSTR;
+    if (mem)
+        header |= size_code(rec.mem_size) << H_SIZE_SHIFT;
+
+    size_t n = put_varint(out, header);
+    if (header & H_JUMP)
+        n += put_varint(out + n, zigzag((int32_t)(rec.pc - prev_pc)));
+    n += put_varint(out + n, rec.cycle - prev_cycle);
+    if (header & H_INSTR)
+    {
+        for (int i = 0; i < 4; i++)
+            out[n++] = (uint8_t)(rec.instr >> (8 * i));
+        cache[slot] = rec.instr;
+    }
+    if (rec.rd)
+    {
+        out[n++] = rec.rd;
+        n += put_varint(out + n, rec.rd_value);
+    }
+    if (mem)
+    {
+        n += put_varint(out + n, zigzag((int32_t)(rec.mem_addr - prev_mem_addr)));
+        n += put_varint(out + n, rec.mem_value);
+        prev_mem_addr = rec.mem_addr;
+    }
+
+    prev_pc = rec.pc;
+    prev_cycle = rec.cycle;
+    return n;
+}
+
+size_t TraceDecoder::decode(const uint8_t *in, const uint8_t *end, TraceRecord &rec)
+{
+    if (in >= end)
+        return 0;
+
+    const uint8_t *start = in;
+    uint32_t header = (uint32_t)get_varint(in, end);
+
+    rec = TraceRecord();
+    rec.flags = header & H_FLAGS;
+    rec.pc = prev_pc + 4;
+    if (header & H_JUMP)
+        rec.pc = prev_pc + (uint32_t)unzigzag((uint32_t)get_varint(in, end));
+    rec.cycle = prev_cycle + get_varint(in, end);
+
+    uint32_t slot = (rec.pc >> 2) & (CACHE_SLOTS - 1);
+    if (header & H_INSTR)
+    {
+        if (end - in < 4)
+            throw std::runtime_error("Truncated trace record");
+        cache[slot] = in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+        in += 4;
+    }
+    rec.instr = cache[slot];
+
+    if (header & H_RD)
+    {
+        if (in >= end)
+            throw std::runtime_error("Truncated trace record");
+        rec.rd = *in++;
+        rec.rd_value = (uint32_t)get_varint(in, end);
+    }
+    if (rec.flags & (TRACE_LOAD | TRACE_STORE))
+    {
+        static const uint8_t sizes[4] = {1, 2, 4, 4};
+        rec.mem_size = sizes[(header >> H_SIZE_SHIFT) & 3];
+        rec.mem_addr = prev_mem_addr + (uint32_t)unzigzag((uint32_t)get_varint(in, end));
+        rec.mem_value = (uint32_t)get_varint(in, end);
+        prev_mem_addr = rec.mem_addr;
+    }
+
+    prev_pc = rec.pc;
+    prev_cycle = rec.cycle;
+    return in - start;
+}
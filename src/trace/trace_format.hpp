@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// One retired instruction (or trap) as captured on the simulation thread
+struct TraceRecord
+{
+    uint64_t cycle;     // Cycle count after the instruction
+    uint32_t pc;        // Fetch address (handler address for traps)
+    uint32_t instr;     // Instruction word (trap cause for traps)
+    uint32_t rd_value;  // Value written to rd
+    uint32_t mem_addr;  // Effective address of a load/store
+    uint32_t mem_value; // Value loaded or stored
+    uint8_t rd;         // Destination register, 0 if none
+    uint8_t flags;      // TRACE_* bits
+    uint8_t mem_size;   // Access width in bytes
+    uint8_t reserved;
+};
+
+enum TraceFlags
+{
+    TRACE_LOAD = 1 << 0,
+    TRACE_STORE = 1 << 1,
+    TRACE_MMIO = 1 << 2,      // Access went to the peripheral bus
+    TRACE_TRAP = 1 << 3,      // Not an instruction: trap taken
+    TRACE_INTERRUPT = 1 << 4, // Trap was an interrupt
+};
+
+// File layout: TRACE_MAGIC followed by a stream of encoded records.
+//
+// Records are delta-compressed against the previous one: a varint header
+// of presence bits, the PC only when it is not sequential, the cycle delta,
+// and the instruction word only when it differs from the last one seen at
+// the same slot of a small direct-mapped cache. Typical records take 3-6
+// bytes instead of 32.
+static const char TRACE_MAGIC[8] = {'R', 'V', 'T', 'R', 'A', 'C', 'E', '1'};
+
+class TraceEncoder
+{
+public:
+    // Appends the encoding of rec to out (at most MAX_ENCODED bytes)
+    size_t encode(const TraceRecord &rec, uint8_t *out);
+
+    static constexpr size_t MAX_ENCODED = 48;
+
+private:
+    static constexpr uint32_t CACHE_SLOTS = 1024;
+
+    uint32_t prev_pc = 0;
+    uint64_t prev_cycle = 0;
+    uint32_t prev_mem_addr = 0;
+    uint32_t cache[CACHE_SLOTS]{};
+};
+
+class TraceDecoder
+{
+public:
+    // Decodes one record from [in, end); returns bytes consumed, 0 at end
+    // of data, throws std::runtime_error on a truncated record
+    size_t decode(const uint8_t *in, const uint8_t *end, TraceRecord &rec);
+
+private:
+    static constexpr uint32_t CACHE_SLOTS = 1024;
+
+    uint32_t prev_pc = 0;
+    uint64_t prev_cycle = 0;
+    uint32_t prev_mem_addr = 0;
+    uint32_t cache[CACHE_SLOTS]{};
+};
@@ -0,0 +1,137 @@
+#include "tracer.hpp"
+#include "../cpu/riscv.hpp"
+#include <chrono>
+#include <vector>
+
+Tracer::Tracer() : ring(RING_RECORDS) {}
+
+Tracer::~Tracer()
+{
+    close();
+}
+
+bool Tracer::open(const std::string &path)
+{
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    std::fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file);
+    done = false;
+    writer = std::thread(&Tracer::writer_loop, this);
+    return true;
+}
+
+void Tracer::close()
+{
+    if (!file)
+        return;
+
+    done = true;
+    writer.join();
+    std::fclose(file);
+    file = nullptr;
+}
+
+void Tracer::on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost)
+{
+    (void)cost;
+
+    TraceRecord rec = TraceRecord();
+    rec.cycle = cpu.get_cycles();
+    rec.pc = pc;
+    rec.instr = instr;
+
+    uint32_t opcode = instr & 0x7F;
+    uint32_t rd = (instr >> 7) & 0x1F;
+
+    // Every format that writes rd (U, J, I, R, CSR) except branches/stores
+    if (rd != 0 && opcode != 0x63 && opcode != 0x23 && opcode != 0x0F &&
+        !(opcode == 0x73 && ((instr >> 12) & 0x7) == 0))
+    {
+        rec.rd = (uint8_t)rd;
+        rec.rd_value = cpu.get_reg(rd);
+    }
+
+    if (opcode == 0x03 || opcode == 0x23)
+    {
+        uint32_t funct3 = (instr >> 12) & 0x7;
+        uint32_t addr = cpu.get_last_mem_addr();
+        rec.mem_addr = addr;
+        rec.mem_size = (uint8_t)(1 << (funct3 & 0x3));
+        if (addr >= 0x1000 && addr <= 0x1FFF)
+            rec.flags |= TRACE_MMIO;
+
+        if (opcode == 0x03)
+        {
+            rec.flags |= TRACE_LOAD;
+            rec.mem_value = cpu.get_reg(rd);
+        }
+        else
+        {
+            // The source register is unchanged by the store
+            uint32_t value = cpu.get_reg((instr >> 20) & 0x1F);
+            rec.flags |= TRACE_STORE;
+            rec.mem_value = rec.mem_size == 4 ? value : value & ((1u << (8 * rec.mem_size)) - 1);
+        }
+    }
+
+    push(rec);
+}
+
+void Tracer::on_trap(RISCV &cpu, uint32_t cause, bool is_interrupt)
+{
+    TraceRecord rec = TraceRecord();
+    rec.cycle = cpu.get_cycles();
+    rec.pc = cpu.get_pc();
+    rec.instr = cause;
+    rec.flags = TRACE_TRAP | (is_interrupt ? TRACE_INTERRUPT : 0);
+    push(rec);
+}
+
+void Tracer::push(const TraceRecord &rec)
+{
+    // Back-pressure instead of dropping records
+    while (!ring.push(rec))
+        std::this_thread::yield();
+    records++;
+}
+
+void Tracer::writer_loop()
+{
+    const size_t BATCH = 4096;
+    const size_t FLUSH_BYTES = 256 * 1024;
+
+    std::vector<TraceRecord> batch(BATCH);
+    std::vector<uint8_t> out;
+    out.reserve(FLUSH_BYTES + BATCH * TraceEncoder::MAX_ENCODED);
+    TraceEncoder encoder;
+
+    for (;;)
+    {
+        // Read the flag before draining so nothing pushed before close()
+        // is left behind
+        bool finishing = done.load(std::memory_order_acquire);
+        size_t n = ring.pop(batch.data(), BATCH);
+
+        uint8_t encoded[TraceEncoder::MAX_ENCODED];
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t len = encoder.encode(batch[i], encoded);
+            out.insert(out.end(), encoded, encoded + len);
+        }
+
+        if (out.size() >= FLUSH_BYTES || (n == 0 && !out.empty()))
+        {
+            std::fwrite(out.data(), 1, out.size(), file);
+            out.clear();
+        }
+
+        if (n == 0)
+        {
+            if (finishing)
+                break;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include "../cpu/observer.hpp"
+#include "ring_buffer.hpp"
+#include "trace_format.hpp"
+
+// Binary execution tracer.
+//
+// The simulation thread only fills a fixed-size TraceRecord per retired
+// instruction and pushes it into a lock-free SPSC ring; a background thread
+// drains the ring, delta-compresses the records and streams them to disk.
+// When the writer falls behind, the simulation waits for ring space, so the
+// trace is never lossy. Decode with bin/rvtrace.
+class Tracer : public ExecObserver
+{
+public:
+    Tracer();
+    ~Tracer();
+
+    // Opens the file and starts the writer thread
+    bool open(const std::string &path);
+
+    // Drains the ring, stops the writer and closes the file
+    void close();
+
+    void on_retire(RISCV &cpu, uint32_t pc, uint32_t instr, uint32_t cost) override;
+    void on_trap(RISCV &cpu, uint32_t cause, bool is_interrupt) override;
+
+    uint64_t get_records() const { return records; }
+
+private:
+    static constexpr size_t RING_RECORDS = 1 << 16;
+
+    void push(const TraceRecord &rec);
+    void writer_loop();
+
+    SpscRing<TraceRecord> ring;
+    std::FILE *file = nullptr;
+    std::thread writer;
+    std::atomic<bool> done{false};
+    uint64_t records = 0;
+};